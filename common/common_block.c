@@ -97,6 +97,8 @@ int super_table[8][20] = {
 const uint16_t gquant_table[6] = {26214,23302,20560,18396,16384,14564};
 const uint16_t gdequant_table[6] = {40,45,51,57,64,72};
 
+/* Block availability. ypos and xpos are relative to the top-left corner of
+   the tile, and width and height are the size of the tile. */
 int get_left_available(int ypos, int xpos, int size, int width){
   int left_available = xpos > 0;
   return left_available;
@@ -155,9 +157,24 @@ void reconstruct_block(int16_t *block, uint8_t *pblock, uint8_t *rec, int size,
   }
 }
 
-void find_block_contexts(int ypos, int xpos, int height, int width, int size, deblock_data_t *deblock_data, block_context_t *block_context, int enable){
+void get_tile(tile_t *tile, int width, int height, int tile_rows, int tile_cols, int row, int col){
+
+  /* Tile boundaries are evenly spaced in units of superblocks */
+  int num_sb_hor = (width + MAX_BLOCK_SIZE - 1)/MAX_BLOCK_SIZE;
+  int num_sb_ver = (height + MAX_BLOCK_SIZE - 1)/MAX_BLOCK_SIZE;
+  int x0 = (col*num_sb_hor/tile_cols)*MAX_BLOCK_SIZE;
+  int x1 = ((col+1)*num_sb_hor/tile_cols)*MAX_BLOCK_SIZE;
+  int y0 = (row*num_sb_ver/tile_rows)*MAX_BLOCK_SIZE;
+  int y1 = ((row+1)*num_sb_ver/tile_rows)*MAX_BLOCK_SIZE;
+  tile->xpos = x0;
+  tile->ypos = y0;
+  tile->width = min(x1,width) - x0;
+  tile->height = min(y1,height) - y0;
+}
+
+void find_block_contexts(int ypos, int xpos, int height, int width, int size, deblock_data_t *deblock_data, const tile_t *tile, block_context_t *block_context, int enable){
 
-  if (ypos >= MIN_BLOCK_SIZE && xpos >= MIN_BLOCK_SIZE && ypos + size < height && xpos + size < width && enable && size <= MAX_TR_SIZE) {
+  if (ypos - tile->ypos >= MIN_BLOCK_SIZE && xpos - tile->xpos >= MIN_BLOCK_SIZE && ypos + size < height && xpos + size < width && enable && size <= MAX_TR_SIZE) {
     int by = ypos/MIN_PB_SIZE;
     int bx = xpos/MIN_PB_SIZE;
     int bs = width/MIN_PB_SIZE;
@@ -38,7 +38,8 @@ int get_downleft_available(int ypos, int xpos, int size, int height);
 void dequantize (int16_t *coeff,int16_t *rcoeff,int quant,int size);
 void reconstruct_block(int16_t *block, uint8_t *pblock, uint8_t *rec, int size, int stride);
 
-void find_block_contexts(int ypos, int xpos, int height, int width, int size, deblock_data_t *deblock_data, block_context_t *block_context, int enable);
+void get_tile(tile_t *tile, int width, int height, int tile_rows, int tile_cols, int row, int col);
+void find_block_contexts(int ypos, int xpos, int height, int width, int size, deblock_data_t *deblock_data, const tile_t *tile, block_context_t *block_context, int enable);
 
 void clpf_block(const uint8_t *src, uint8_t *dst, int sstride, int dstride, int x0, int y0, int size, int width, int height);
 
@@ -43,9 +43,103 @@ static const int tc_table[56] =
     0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,1,1,1,1,1,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,5,5,6,6,7,8,9,9,10,10,11,11,12,12,13,13,14,14
 };
 
-void deblock_frame_y(yuv_frame_t  *rec, deblock_data_t *deblock_data, int width, int height, uint8_t qp)
+/* Luma vertical edge, p at q0 of the first row.  Bit 0 of filter
+   selects rows 0-3, bit 1 rows 4-7. */
+void deblock_ver_y_non_simd(uint8_t *p, int stride, int tc, int filter)
+{
+  for (int k=0;k<MIN_BLOCK_SIZE;k++){
+    if (!(filter & (1 << (k/MIN_PB_SIZE))))
+      continue;
+    int p2 = p[k*stride - 3];
+    int p1 = p[k*stride - 2];
+    int p0 = p[k*stride - 1];
+    int q0 = p[k*stride + 0];
+    int q1 = p[k*stride + 1];
+    int q2 = p[k*stride + 2];
+#if NEW_DEBLOCK_FILTER
+    int delta = (18*(q0-p0) - 6*(q1-p1) + 0*(q2-p2) + 16)>>5;
+#else
+    int delta = (13*(q0-p0) + 4*(q1-p1) - 5*(q2-p2) + 16)>>5;
+#endif
+    delta = clip(delta,-tc,tc);
+
+    p[k*stride - 2] = (uint8_t)clip255(p1 + delta/2);
+    p[k*stride - 1] = (uint8_t)clip255(p0 + delta);
+    p[k*stride + 0] = (uint8_t)clip255(q0 - delta);
+    p[k*stride + 1] = (uint8_t)clip255(q1 - delta/2);
+  }
+}
+
+/* Luma horizontal edge, p at q0 of the first column.  Bit 0 of filter
+   selects columns 0-3, bit 1 columns 4-7. */
+void deblock_hor_y_non_simd(uint8_t *p, int stride, int tc, int filter)
 {
-  int i,j,k,l,d;
+  for (int l=0;l<MIN_BLOCK_SIZE;l++){
+    if (!(filter & (1 << (l/MIN_PB_SIZE))))
+      continue;
+    int p2 = p[-3*stride + l];
+    int p1 = p[-2*stride + l];
+    int p0 = p[-1*stride + l];
+    int q0 = p[ 0*stride + l];
+    int q1 = p[ 1*stride + l];
+    int q2 = p[ 2*stride + l];
+#if NEW_DEBLOCK_FILTER
+    int delta = (18*(q0-p0) - 6*(q1-p1) + 0*(q2-p2) + 16)>>5;
+#else
+    int delta = (13*(q0-p0) + 4*(q1-p1) - 5*(q2-p2) + 16)>>5;
+#endif
+    delta = clip(delta,-tc,tc);
+
+    p[-2*stride + l] = (uint8_t)clip255(p1 + delta/2);
+    p[-1*stride + l] = (uint8_t)clip255(p0 + delta);
+    p[ 0*stride + l] = (uint8_t)clip255(q0 - delta);
+    p[ 1*stride + l] = (uint8_t)clip255(q1 - delta/2);
+  }
+}
+
+/* Chroma vertical edge in both planes, u and v at q0 of the first row */
+void deblock_ver_uv_non_simd(uint8_t *u, uint8_t *v, int stride, int tc)
+{
+  for (int uv=0;uv<2;uv++){
+    uint8_t *recC = (uv ? v : u);
+    for (int k=0;k<MIN_BLOCK_SIZE/2;k++){
+      int p1 = recC[k*stride - 2];
+      int p0 = recC[k*stride - 1];
+      int q0 = recC[k*stride + 0];
+      int q1 = recC[k*stride + 1];
+      int delta = (4*(q0-p0) + (p1-q1) + 4)>>3;
+      delta = clip(delta,-tc,tc);
+      recC[k*stride - 1] = (uint8_t)clip255(p0 + delta);
+      recC[k*stride + 0] = (uint8_t)clip255(q0 - delta);
+    }
+  }
+}
+
+/* Chroma horizontal edge in both planes, u and v at q0 of the first column */
+void deblock_hor_uv_non_simd(uint8_t *u, uint8_t *v, int stride, int tc)
+{
+  for (int uv=0;uv<2;uv++){
+    uint8_t *recC = (uv ? v : u);
+    for (int l=0;l<MIN_BLOCK_SIZE/2;l++){
+      int p1 = recC[-2*stride + l];
+      int p0 = recC[-1*stride + l];
+      int q0 = recC[ 0*stride + l];
+      int q1 = recC[ 1*stride + l];
+      int delta = (4*(q0-p0) + (p1-q1) + 4)>>3;
+      delta = clip(delta,-tc,tc);
+      recC[-1*stride + l] = (uint8_t)clip255(p0 + delta);
+      recC[ 0*stride + l] = (uint8_t)clip255(q0 - delta);
+    }
+  }
+}
+
+/* Deblock the luma rows [y0,y1), which must be aligned to MIN_BLOCK_SIZE. The
+   horizontal edge at y0 is included, so it modifies the two rows above y0.
+   Deblocking consecutive row ranges in order gives the same result as
+   deblocking the whole frame at once. */
+void deblock_rows_y(yuv_frame_t  *rec, deblock_data_t *deblock_data, int width, int height, uint8_t qp, int y0, int y1)
+{
+  int i,j,d;
   int stride = rec->stride_y;
 #if NEW_DEBLOCK_TEST
   int p12,p02,q02,q12;
@@ -54,7 +148,6 @@ void deblock_frame_y(yuv_frame_t  *rec, deblock_data_t *deblock_data, int width,
   int p22,p12,p02,q02,q12,q22;
   int p25,p15,p05,q05,q15,q25;
 #endif
-  int p2,p1,p0,q0,q1,q2;
   uint8_t *recY = rec->y;
   uint8_t do_filter;
   uint8_t beta = beta_table[qp];
@@ -67,10 +160,9 @@ void deblock_frame_y(yuv_frame_t  *rec, deblock_data_t *deblock_data, int width,
   int p_cbp,q_cbp;
   int q_size;
   int mv,mode,cbp,interior;
-  int delta;
 
   /* Vertical filtering */
-  for (i=0;i<height;i+=MIN_BLOCK_SIZE){
+  for (i=y0;i<y1;i+=MIN_BLOCK_SIZE){
     for (j=MIN_BLOCK_SIZE;j<width;j+=MIN_BLOCK_SIZE){
 
 #if NEW_DEBLOCK_TEST
@@ -101,6 +193,7 @@ void deblock_frame_y(yuv_frame_t  *rec, deblock_data_t *deblock_data, int width,
       d = abs(p22-2*p12+p02) + abs(q22-2*q12+q02) + abs(p25-2*p15+p05) + abs(q25-2*q15+q05);
 #endif
       int m;
+      int filter = 0;
       for (m=0;m<MIN_BLOCK_SIZE;m+=MIN_PB_SIZE){
         q_index = ((i+m)/MIN_PB_SIZE)*(width/MIN_PB_SIZE) + (j/MIN_PB_SIZE);
         p_index = q_index - 1;
@@ -126,34 +219,17 @@ void deblock_frame_y(yuv_frame_t  *rec, deblock_data_t *deblock_data, int width,
         mode = p_mode == MODE_INTRA || q_mode == MODE_INTRA;
         interior = j%q_size > 0 ? 1 : 0;
         do_filter = (d < beta) && !interior && (mv || cbp || mode); //TODO: This logic needs to support 4x4TUs
-        if (do_filter){
-          for (k=m;k<m+MIN_PB_SIZE;k++){
-            p2 = (int)recY[(i+k)*stride + j - 3];
-            p1 = (int)recY[(i+k)*stride + j - 2];
-            p0 = (int)recY[(i+k)*stride + j - 1];
-            q0 = (int)recY[(i+k)*stride + j + 0];
-            q1 = (int)recY[(i+k)*stride + j + 1];
-            q2 = (int)recY[(i+k)*stride + j + 2];
-#if NEW_DEBLOCK_FILTER
-            delta = (18*(q0-p0) - 6*(q1-p1) + 0*(q2-p2) + 16)>>5;
-#else
-            delta = (13*(q0-p0) + 4*(q1-p1) - 5*(q2-p2) + 16)>>5;
-#endif
-            delta = clip(delta,-tc,tc);
-
-            recY[(i+k)*stride + j - 2] = (uint8_t)clip255(p1 + delta/2);
-            recY[(i+k)*stride + j - 1] = (uint8_t)clip255(p0 + delta);
-            recY[(i+k)*stride + j + 0] = (uint8_t)clip255(q0 - delta);
-            recY[(i+k)*stride + j + 1] = (uint8_t)clip255(q1 - delta/2);
-          }
-        }
+        if (do_filter)
+          filter |= 1 << (m/MIN_PB_SIZE);
       }
+      if (filter)
+        common_kernels->deblock_ver_y(recY + i*stride + j, stride, tc, filter);
 
     }
   }
 
   /* Horizontal filtering */
-  for (i=MIN_BLOCK_SIZE;i<height;i+=MIN_BLOCK_SIZE){
+  for (i=max(y0,MIN_BLOCK_SIZE);i<y1;i+=MIN_BLOCK_SIZE){
     for (j=0;j<width;j+=MIN_BLOCK_SIZE){
 
 #if NEW_DEBLOCK_TEST
@@ -185,6 +261,7 @@ void deblock_frame_y(yuv_frame_t  *rec, deblock_data_t *deblock_data, int width,
 #endif
 
       int n;
+      int filter = 0;
       for (n=0;n<MIN_BLOCK_SIZE;n+=MIN_PB_SIZE){
         q_index = (i/MIN_PB_SIZE)*(width/MIN_PB_SIZE) + ((j+n)/MIN_PB_SIZE);
         p_index = q_index - (width/MIN_PB_SIZE);
@@ -212,39 +289,26 @@ void deblock_frame_y(yuv_frame_t  *rec, deblock_data_t *deblock_data, int width,
         mode = p_mode == MODE_INTRA || q_mode == MODE_INTRA;
         interior = i%q_size > 0 ? 1 : 0;
         do_filter = (d < beta) && !interior && (mv || cbp || mode); //TODO: This logic needs to support 4x4TUs
-        if (do_filter){
-          for (l=n;l<n+MIN_PB_SIZE;l++){
-            p2 = (int)recY[(i-3)*stride + j + l];
-            p1 = (int)recY[(i-2)*stride + j + l];
-            p0 = (int)recY[(i-1)*stride + j + l];
-            q0 = (int)recY[(i+0)*stride + j + l];
-            q1 = (int)recY[(i+1)*stride + j + l];
-            q2 = (int)recY[(i+2)*stride + j + l];
-
-#if NEW_DEBLOCK_FILTER
-            delta = (18*(q0-p0) - 6*(q1-p1) + 0*(q2-p2) + 16)>>5;
-#else
-            delta = (13*(q0-p0) + 4*(q1-p1) - 5*(q2-p2) + 16)>>5;
-#endif
-            delta = clip(delta,-tc,tc);
-
-            recY[(i-2)*stride + j + l] = (uint8_t)clip255(p1 + delta/2);
-            recY[(i-1)*stride + j + l] = (uint8_t)clip255(p0 + delta);
-            recY[(i+0)*stride + j + l] = (uint8_t)clip255(q0 - delta);
-            recY[(i+1)*stride + j + l] = (uint8_t)clip255(q1 - delta/2);
-          }
-        }
+        if (do_filter)
+          filter |= 1 << (n/MIN_PB_SIZE);
       }
+      if (filter)
+        common_kernels->deblock_hor_y(recY + i*stride + j, stride, tc, filter);
 
     }
   }
 }
 
-void deblock_frame_uv(yuv_frame_t  *rec, deblock_data_t *deblock_data, int width, int height, uint8_t qp)
+void deblock_frame_y(yuv_frame_t  *rec, deblock_data_t *deblock_data, int width, int height, uint8_t qp)
+{
+  deblock_rows_y(rec, deblock_data, width, height, qp, 0, height);
+}
+
+/* Deblock the chroma rows corresponding to the luma rows [y0,y1) */
+void deblock_rows_uv(yuv_frame_t  *rec, deblock_data_t *deblock_data, int width, int height, uint8_t qp, int y0, int y1)
 {
-  int i,j,k,l;
+  int i,j;
   int stride = rec->stride_c;
-  int p1,p0,q0,q1;
 
   uint8_t do_filter;
   uint8_t tc = tc_table[qp];
@@ -253,73 +317,54 @@ void deblock_frame_uv(yuv_frame_t  *rec, deblock_data_t *deblock_data, int width
   block_mode_t p_mode,q_mode;
   int q_size;
   int mode,interior;
-  int delta;
-
-  for (int uv=0;uv<2;uv++){
-
-    uint8_t *recC = (uv ? rec->v : rec->u);
 
-    /* Vertical filtering */
-    for (i=0;i<height;i+=MIN_BLOCK_SIZE){
-      for (j=MIN_BLOCK_SIZE;j<width;j+=MIN_BLOCK_SIZE){
-        int i2 = i/2;
-        int j2 = j/2;
-        q_index = (i/MIN_PB_SIZE)*(width/MIN_PB_SIZE) + (j/MIN_PB_SIZE);
-        p_index = q_index - 1;
+  /* The u and v planes share the filter decisions and are independent,
+     so an edge is filtered in both planes at once */
 
-        p_mode = deblock_data[p_index].mode;
-        q_mode = deblock_data[q_index].mode;
-        q_size = deblock_data[q_index].size;
-
-        mode = p_mode == MODE_INTRA || q_mode == MODE_INTRA;
-        interior = j%q_size > 0 ? 1 : 0;
-        do_filter = !interior && mode;
-        if (do_filter){
-          for (k=0;k<MIN_BLOCK_SIZE/2;k++){
-            p1 = (int)recC[(i2+k)*stride + j2 - 2];
-            p0 = (int)recC[(i2+k)*stride + j2 - 1];
-            q0 = (int)recC[(i2+k)*stride + j2 + 0];
-            q1 = (int)recC[(i2+k)*stride + j2 + 1];
-            delta = (4*(q0-p0) + (p1-q1) + 4)>>3;
-            delta = clip(delta,-tc,tc);
-            recC[(i2+k)*stride + j2 - 1] = (uint8_t)clip255(p0 + delta);
-            recC[(i2+k)*stride + j2 + 0] = (uint8_t)clip255(q0 - delta);
-          }
-        }
-      }
+  /* Vertical filtering */
+  for (i=y0;i<y1;i+=MIN_BLOCK_SIZE){
+    for (j=MIN_BLOCK_SIZE;j<width;j+=MIN_BLOCK_SIZE){
+      int i2 = i/2;
+      int j2 = j/2;
+      q_index = (i/MIN_PB_SIZE)*(width/MIN_PB_SIZE) + (j/MIN_PB_SIZE);
+      p_index = q_index - 1;
+
+      p_mode = deblock_data[p_index].mode;
+      q_mode = deblock_data[q_index].mode;
+      q_size = deblock_data[q_index].size;
+
+      mode = p_mode == MODE_INTRA || q_mode == MODE_INTRA;
+      interior = j%q_size > 0 ? 1 : 0;
+      do_filter = !interior && mode;
+      if (do_filter)
+        common_kernels->deblock_ver_uv(rec->u + i2*stride + j2, rec->v + i2*stride + j2, stride, tc);
     }
+  }
 
-    /* Horizontal filtering */
-    for (i=MIN_BLOCK_SIZE;i<height;i+=MIN_BLOCK_SIZE){
-      for (j=0;j<width;j+=MIN_BLOCK_SIZE){
-        int i2 = i/2;
-        int j2 = j/2;
-        q_index = (i/MIN_PB_SIZE)*(width/MIN_PB_SIZE) + (j/MIN_PB_SIZE);
-        p_index = q_index - (width/MIN_PB_SIZE);
-        p_mode = deblock_data[p_index].mode;
-        q_mode = deblock_data[q_index].mode;
-        q_size = deblock_data[q_index].size;
-
-        mode = p_mode == MODE_INTRA || q_mode == MODE_INTRA;
-        interior = i%q_size > 0 ? 1 : 0;
-        do_filter = !interior && mode;
-        if (do_filter){
-          for (l=0;l<MIN_BLOCK_SIZE/2;l++){
-            p1 = (int)recC[(i2-2)*stride + j2 + l];
-            p0 = (int)recC[(i2-1)*stride + j2 + l];
-            q0 = (int)recC[(i2+0)*stride + j2 + l];
-            q1 = (int)recC[(i2+1)*stride + j2 + l];
-            delta = (4*(q0-p0) + (p1-q1) + 4)>>3;
-            delta = clip(delta,-tc,tc);
-            recC[(i2-1)*stride + j2 + l] = (uint8_t)clip255(p0 + delta);
-            recC[(i2+0)*stride + j2 + l] = (uint8_t)clip255(q0 - delta);
-          }
-        }
-      }
+  /* Horizontal filtering */
+  for (i=max(y0,MIN_BLOCK_SIZE);i<y1;i+=MIN_BLOCK_SIZE){
+    for (j=0;j<width;j+=MIN_BLOCK_SIZE){
+      int i2 = i/2;
+      int j2 = j/2;
+      q_index = (i/MIN_PB_SIZE)*(width/MIN_PB_SIZE) + (j/MIN_PB_SIZE);
+      p_index = q_index - (width/MIN_PB_SIZE);
+      p_mode = deblock_data[p_index].mode;
+      q_mode = deblock_data[q_index].mode;
+      q_size = deblock_data[q_index].size;
+
+      mode = p_mode == MODE_INTRA || q_mode == MODE_INTRA;
+      interior = i%q_size > 0 ? 1 : 0;
+      do_filter = !interior && mode;
+      if (do_filter)
+        common_kernels->deblock_hor_uv(rec->u + i2*stride + j2, rec->v + i2*stride + j2, stride, tc);
     }
   }
 }
 
+void deblock_frame_uv(yuv_frame_t  *rec, deblock_data_t *deblock_data, int width, int height, uint8_t qp)
+{
+  deblock_rows_uv(rec, deblock_data, width, height, qp, 0, height);
+}
 
 void create_yuv_frame(yuv_frame_t  *frame, int width, int height, int pad_ver_y, int pad_hor_y, int pad_ver_uv, int pad_hor_uv)
 {
@@ -402,7 +447,10 @@ void write_yuv_frame(yuv_frame_t  *frame, int width, int height, FILE *outfile)
 }
 
 
-void pad_yuv_frame(yuv_frame_t * f)
+/* Pad the luma rows [y0,y1) and the corresponding chroma rows to the left and
+   right. The top padding is made with the first rows and the bottom padding
+   with the last rows, so a frame can be padded in consecutive row ranges. */
+void pad_yuv_rows(yuv_frame_t * f, int y0, int y1)
 {
   int sy = f->stride_y;
   int sc = f->stride_c;
@@ -412,7 +460,7 @@ void pad_yuv_frame(yuv_frame_t * f)
   uint8_t val;
   /* Y */
   /* Left and right */
-  for (i=0;i<h;i++)
+  for (i=y0;i<y1;i++)
   {
     val=f->y[i*sy];
     memset(&f->y[i*sy-f->pad_hor_y],val,f->pad_hor_y*sizeof(uint8_t));
@@ -420,13 +468,17 @@ void pad_yuv_frame(yuv_frame_t * f)
     memset(&f->y[i*sy+w],val,f->pad_hor_y*sizeof(uint8_t));
   }
   /* Top and bottom */
-  for (i=-f->pad_ver_y;i<0;i++)
-  {
-    memcpy(&f->y[i*sy-f->pad_hor_y], &f->y[-f->pad_hor_y], w+2*f->pad_hor_y);
+  if (y0 == 0){
+    for (i=-f->pad_ver_y;i<0;i++)
+    {
+      memcpy(&f->y[i*sy-f->pad_hor_y], &f->y[-f->pad_hor_y], w+2*f->pad_hor_y);
+    }
   }
-  for (i=h;i<h+f->pad_ver_y;i++)
-  {
-    memcpy(&f->y[i*sy-f->pad_hor_y], &f->y[(h-1)*sy-f->pad_hor_y], w+2*f->pad_hor_y);
+  if (y1 == h){
+    for (i=h;i<h+f->pad_ver_y;i++)
+    {
+      memcpy(&f->y[i*sy-f->pad_hor_y], &f->y[(h-1)*sy-f->pad_hor_y], w+2*f->pad_hor_y);
+    }
   }
 
   /* UV */
@@ -434,7 +486,7 @@ void pad_yuv_frame(yuv_frame_t * f)
  /* Left and right */
   w /= 2;
   h /= 2;
-  for (i=0;i<h;i++)
+  for (i=y0/2;i<y1/2;i++)
   {
     val=f->u[i*sc];
     memset(&f->u[i*sc-f->pad_hor_c],val,f->pad_hor_c*sizeof(uint8_t));
@@ -448,110 +500,125 @@ void pad_yuv_frame(yuv_frame_t * f)
   }
 
   /* Top and bottom */
-  for (i=-f->pad_ver_c;i<0;i++)
-  {
-    memcpy(&f->u[i*sc-f->pad_hor_c], &f->u[-f->pad_hor_c], w+2*f->pad_hor_c);
-    memcpy(&f->v[i*sc-f->pad_hor_c], &f->v[-f->pad_hor_c], w+2*f->pad_hor_c);
+  if (y0 == 0){
+    for (i=-f->pad_ver_c;i<0;i++)
+    {
+      memcpy(&f->u[i*sc-f->pad_hor_c], &f->u[-f->pad_hor_c], w+2*f->pad_hor_c);
+      memcpy(&f->v[i*sc-f->pad_hor_c], &f->v[-f->pad_hor_c], w+2*f->pad_hor_c);
+    }
   }
-  for (i=h;i<h+f->pad_ver_c;i++)
-  {
-    memcpy(&f->u[i*sc-f->pad_hor_c], &f->u[(h-1)*sc-f->pad_hor_c], w+2*f->pad_hor_c);
-    memcpy(&f->v[i*sc-f->pad_hor_c], &f->v[(h-1)*sc-f->pad_hor_c], w+2*f->pad_hor_c);
+  if (y1 == 2*h){
+    for (i=h;i<h+f->pad_ver_c;i++)
+    {
+      memcpy(&f->u[i*sc-f->pad_hor_c], &f->u[(h-1)*sc-f->pad_hor_c], w+2*f->pad_hor_c);
+      memcpy(&f->v[i*sc-f->pad_hor_c], &f->v[(h-1)*sc-f->pad_hor_c], w+2*f->pad_hor_c);
+    }
   }
 
 }
 
-void create_reference_frame(yuv_frame_t  *ref,yuv_frame_t  *rec)
+void pad_yuv_frame(yuv_frame_t * f)
 {
-  ref->frame_num = rec->frame_num;
-  int height = rec->height;
-  int width = rec->width;  
+  pad_yuv_rows(f, 0, f->height);
+}
+
+/* Copy the luma rows [y0,y1) and the corresponding chroma rows of rec into
+   ref and pad them */
+void create_reference_rows(yuv_frame_t  *ref,yuv_frame_t  *rec, int y0, int y1)
+{
+  int width = rec->width;
   int i;
   uint8_t *ref_y = ref->y;
   uint8_t *ref_u = ref->u;
   uint8_t *ref_v = ref->v;
-  for (i=0;i<height;i++){
+  for (i=y0;i<y1;i++){
     memcpy(&ref_y[i*ref->stride_y],&rec->y[i*rec->stride_y],width*sizeof(uint8_t)); 
   }
-  for (i=0;i<height/2;i++){
+  for (i=y0/2;i<y1/2;i++){
     memcpy(&ref_u[i*ref->stride_c],&rec->u[i*rec->stride_c],width/2*sizeof(uint8_t));
     memcpy(&ref_v[i*ref->stride_c],&rec->v[i*rec->stride_c],width/2*sizeof(uint8_t));
   }
 
-  pad_yuv_frame(ref);
-
+  pad_yuv_rows(ref, y0, y1);
 }
 
-void clpf_frame(yuv_frame_t *rec, yuv_frame_t *org, const deblock_data_t *deblock_data, void *stream,
-                int (*decision)(int, int, yuv_frame_t *, yuv_frame_t *, const deblock_data_t *, int, void *)) {
+/* Constrained low-pass filter (CLPF) of superblock row k */
+void clpf_sb_row(yuv_frame_t *rec, yuv_frame_t *org, const deblock_data_t *deblock_data, void *stream,
+                 int (*decision)(int, int, yuv_frame_t *, yuv_frame_t *, const deblock_data_t *, int, void *), int k) {
 
-  /* Constrained low-pass filter (CLPF) */
   int width = rec->width;
   int height = rec->height;
   int xpos,ypos,index;
-  int k,l,m,n;
+  int l,m,n;
   int stride_y = rec->stride_y;
   int stride_c = rec->stride_c;
   const int block_size = 8;
   int num_sb_hor = width/MAX_BLOCK_SIZE;
-  int num_sb_ver = height/MAX_BLOCK_SIZE;
 
-  for (k=0;k<num_sb_ver;k++){
-    for (l=0;l<num_sb_hor;l++){
-      int cand = 0;
+  for (l=0;l<num_sb_hor;l++){
+    int cand = 0;
+
+    for (m=0;m<MAX_BLOCK_SIZE/block_size;m++){
+      for (n=0;n<MAX_BLOCK_SIZE/block_size;n++){
+        xpos = l*MAX_BLOCK_SIZE + n*block_size;
+        ypos = k*MAX_BLOCK_SIZE + m*block_size;
+        index = (ypos/MIN_PB_SIZE)*(width/MIN_PB_SIZE) + (xpos/MIN_PB_SIZE);
+        cand |= deblock_data[index].mode != MODE_BIPRED &&
+          (deblock_data[index].cbp.y || deblock_data[index].cbp.u || deblock_data[index].cbp.v);
+      }
+    }
+
+    if (cand && decision(k, l, rec, org, deblock_data, block_size, stream)) {
+      uint8_t tmp[MAX_BLOCK_SIZE*MAX_BLOCK_SIZE*3/2];
+      for (m=0; m<MAX_BLOCK_SIZE; m++)
+        memcpy(tmp + m*MAX_BLOCK_SIZE, rec->y + (k*MAX_BLOCK_SIZE+m)*stride_y + l*MAX_BLOCK_SIZE, MAX_BLOCK_SIZE);
+
+      for (m=0; m<MAX_BLOCK_SIZE/2; m++) {
+        memcpy(tmp+MAX_BLOCK_SIZE*MAX_BLOCK_SIZE + m*MAX_BLOCK_SIZE/2,
+               rec->u + (k*MAX_BLOCK_SIZE/2+m)*stride_c + l*MAX_BLOCK_SIZE/2, MAX_BLOCK_SIZE/2);
+        memcpy(tmp+MAX_BLOCK_SIZE*MAX_BLOCK_SIZE*5/4 + m*MAX_BLOCK_SIZE/2,
+               rec->v + (k*MAX_BLOCK_SIZE/2+m)*stride_c + l*MAX_BLOCK_SIZE/2, MAX_BLOCK_SIZE/2);
+      }
 
       for (m=0;m<MAX_BLOCK_SIZE/block_size;m++){
         for (n=0;n<MAX_BLOCK_SIZE/block_size;n++){
           xpos = l*MAX_BLOCK_SIZE + n*block_size;
           ypos = k*MAX_BLOCK_SIZE + m*block_size;
           index = (ypos/MIN_PB_SIZE)*(width/MIN_PB_SIZE) + (xpos/MIN_PB_SIZE);
-          cand |= deblock_data[index].mode != MODE_BIPRED &&
-            (deblock_data[index].cbp.y || deblock_data[index].cbp.u || deblock_data[index].cbp.v);
-        }
-      }
-
-      if (cand && decision(k, l, rec, org, deblock_data, block_size, stream)) {
-        uint8_t tmp[MAX_BLOCK_SIZE*MAX_BLOCK_SIZE*3/2];
-        for (m=0; m<MAX_BLOCK_SIZE; m++)
-          memcpy(tmp + m*MAX_BLOCK_SIZE, rec->y + (k*MAX_BLOCK_SIZE+m)*stride_y + l*MAX_BLOCK_SIZE, MAX_BLOCK_SIZE);
-
-        for (m=0; m<MAX_BLOCK_SIZE/2; m++) {
-          memcpy(tmp+MAX_BLOCK_SIZE*MAX_BLOCK_SIZE + m*MAX_BLOCK_SIZE/2,
-                 rec->u + (k*MAX_BLOCK_SIZE/2+m)*stride_c + l*MAX_BLOCK_SIZE/2, MAX_BLOCK_SIZE/2);
-          memcpy(tmp+MAX_BLOCK_SIZE*MAX_BLOCK_SIZE*5/4 + m*MAX_BLOCK_SIZE/2,
-                 rec->v + (k*MAX_BLOCK_SIZE/2+m)*stride_c + l*MAX_BLOCK_SIZE/2, MAX_BLOCK_SIZE/2);
-        }
-
-        for (m=0;m<MAX_BLOCK_SIZE/block_size;m++){
-          for (n=0;n<MAX_BLOCK_SIZE/block_size;n++){
-            xpos = l*MAX_BLOCK_SIZE + n*block_size;
-            ypos = k*MAX_BLOCK_SIZE + m*block_size;
-            index = (ypos/MIN_PB_SIZE)*(width/MIN_PB_SIZE) + (xpos/MIN_PB_SIZE);
-            int filter = deblock_data[index].mode != MODE_BIPRED;
-
-            if (filter) {
-              /* Y */
-              if (deblock_data[index].cbp.y)
-                (use_simd ? clpf_block_simd : clpf_block)(rec->y,tmp,stride_y,MAX_BLOCK_SIZE, xpos,ypos,block_size,width, height);
-
-              /* C */
-              if (deblock_data[index].cbp.u)
-                (use_simd ? clpf_block_simd : clpf_block)(rec->u,tmp+MAX_BLOCK_SIZE*MAX_BLOCK_SIZE,stride_c,MAX_BLOCK_SIZE/2,xpos/2,ypos/2,block_size/2,width/2,height/2);
-              if (deblock_data[index].cbp.v)
-                (use_simd ? clpf_block_simd : clpf_block)(rec->v,tmp+MAX_BLOCK_SIZE*MAX_BLOCK_SIZE*5/4,stride_c,MAX_BLOCK_SIZE/2,xpos/2,ypos/2,block_size/2,width/2,height/2);
-            }
+          int filter = deblock_data[index].mode != MODE_BIPRED;
+
+          if (filter) {
+            /* Y */
+            if (deblock_data[index].cbp.y)
+              common_kernels->clpf_block(rec->y,tmp,stride_y,MAX_BLOCK_SIZE, xpos,ypos,block_size,width, height);
+
+            /* C */
+            if (deblock_data[index].cbp.u)
+              common_kernels->clpf_block(rec->u,tmp+MAX_BLOCK_SIZE*MAX_BLOCK_SIZE,stride_c,MAX_BLOCK_SIZE/2,xpos/2,ypos/2,block_size/2,width/2,height/2);
+            if (deblock_data[index].cbp.v)
+              common_kernels->clpf_block(rec->v,tmp+MAX_BLOCK_SIZE*MAX_BLOCK_SIZE*5/4,stride_c,MAX_BLOCK_SIZE/2,xpos/2,ypos/2,block_size/2,width/2,height/2);
           }
         }
-        for (m=0; m<MAX_BLOCK_SIZE; m++)
-          memcpy(rec->y + (k*MAX_BLOCK_SIZE+m)*stride_y + l*MAX_BLOCK_SIZE, tmp + m*MAX_BLOCK_SIZE, MAX_BLOCK_SIZE);
-
-        for (m=0; m<MAX_BLOCK_SIZE/2; m++) {
-          memcpy(rec->u + (k*MAX_BLOCK_SIZE/2+m)*stride_c + l*MAX_BLOCK_SIZE/2,
-                 tmp+MAX_BLOCK_SIZE*MAX_BLOCK_SIZE + m*MAX_BLOCK_SIZE/2, MAX_BLOCK_SIZE/2);
-          memcpy(rec->v + (k*MAX_BLOCK_SIZE/2+m)*stride_c + l*MAX_BLOCK_SIZE/2,
-                 tmp+MAX_BLOCK_SIZE*MAX_BLOCK_SIZE*5/4 + m*MAX_BLOCK_SIZE/2, MAX_BLOCK_SIZE/2);
-        }
+      }
+      for (m=0; m<MAX_BLOCK_SIZE; m++)
+        memcpy(rec->y + (k*MAX_BLOCK_SIZE+m)*stride_y + l*MAX_BLOCK_SIZE, tmp + m*MAX_BLOCK_SIZE, MAX_BLOCK_SIZE);
+
+      for (m=0; m<MAX_BLOCK_SIZE/2; m++) {
+        memcpy(rec->u + (k*MAX_BLOCK_SIZE/2+m)*stride_c + l*MAX_BLOCK_SIZE/2,
+               tmp+MAX_BLOCK_SIZE*MAX_BLOCK_SIZE + m*MAX_BLOCK_SIZE/2, MAX_BLOCK_SIZE/2);
+        memcpy(rec->v + (k*MAX_BLOCK_SIZE/2+m)*stride_c + l*MAX_BLOCK_SIZE/2,
+               tmp+MAX_BLOCK_SIZE*MAX_BLOCK_SIZE*5/4 + m*MAX_BLOCK_SIZE/2, MAX_BLOCK_SIZE/2);
       }
     }
   }
 }
+
+void clpf_frame(yuv_frame_t *rec, yuv_frame_t *org, const deblock_data_t *deblock_data, void *stream,
+                int (*decision)(int, int, yuv_frame_t *, yuv_frame_t *, const deblock_data_t *, int, void *)) {
+
+  /* Constrained low-pass filter (CLPF) */
+  int num_sb_ver = rec->height/MAX_BLOCK_SIZE;
+
+  for (int k=0;k<num_sb_ver;k++)
+    clpf_sb_row(rec, org, deblock_data, stream, decision, k);
+}
@@ -29,12 +29,17 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 void deblock_frame_y(yuv_frame_t  *rec, deblock_data_t *deblock_data, int width, int height, uint8_t qp);
 void deblock_frame_uv(yuv_frame_t  *rec, deblock_data_t *deblock_data, int width, int height, uint8_t qp);
+void deblock_rows_y(yuv_frame_t  *rec, deblock_data_t *deblock_data, int width, int height, uint8_t qp, int y0, int y1);
+void deblock_rows_uv(yuv_frame_t  *rec, deblock_data_t *deblock_data, int width, int height, uint8_t qp, int y0, int y1);
 void create_yuv_frame(yuv_frame_t  *frame, int width, int height, int pad_ver_y, int pad_hor_y, int pad_ver_uv, int pad_hor_uv);
 void close_yuv_frame(yuv_frame_t  *frame);
 void read_yuv_frame(yuv_frame_t  *frame, int width, int height, FILE *infile);
 void write_yuv_frame(yuv_frame_t  *frame, int width, int height, FILE *outfile);
 void pad_yuv_frame(yuv_frame_t* f);
-void create_reference_frame(yuv_frame_t  *ref,yuv_frame_t  *rec);
+void pad_yuv_rows(yuv_frame_t * f, int y0, int y1);
+void create_reference_rows(yuv_frame_t  *ref,yuv_frame_t  *rec, int y0, int y1);
+void clpf_sb_row(yuv_frame_t *rec, yuv_frame_t *org, const deblock_data_t *deblock_data, void *stream,
+                 int (*decision)(int, int, yuv_frame_t *, yuv_frame_t *, const deblock_data_t *, int, void *), int k);
 void clpf_frame(yuv_frame_t *rec, yuv_frame_t *org, const deblock_data_t *deblock_data, void *stream,
                 int (*decision)(int, int, yuv_frame_t *, yuv_frame_t *, const deblock_data_t *, int, void *));
 
@@ -30,10 +30,23 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "simd.h"
 #include "global.h"
+#include "types.h"
+#include "common_kernels.h"
 
-void block_avg_simd(uint8_t *p,uint8_t *r0, uint8_t *r1, int sp, int s0, int s1, int width, int height)
+/* This file is also compiled into per instruction set variants, which
+   define SIMD_KERNEL to give the exported kernels distinct names. */
+#ifndef SIMD_KERNEL
+#define SIMD_KERNEL(name) name
+#define COMMON_KERNELS_DISPATCH
+#endif
+
+void SIMD_KERNEL(block_avg_simd)(uint8_t *p,uint8_t *r0, uint8_t *r1, int sp, int s0, int s1, int width, int height)
 {
   int i,j;
+  if (width < 4) {
+    block_avg_non_simd(p, r0, r1, sp, s0, s1, width, height);
+    return;
+  }
   if (width == 4) {
     v64 a, b;
     // Assume height is divisible by 4
@@ -73,9 +86,11 @@ void block_avg_simd(uint8_t *p,uint8_t *r0, uint8_t *r1, int sp, int s0, int s1,
 
 }
 
-int sad_calc_simd_unaligned(uint8_t *a, uint8_t *b, int astride, int bstride, int width, int height)
+int SIMD_KERNEL(sad_calc_simd_unaligned)(uint8_t *a, uint8_t *b, int astride, int bstride, int width, int height)
 {
   int i, j;
+  if (width < 4)
+    return sad_calc_unaligned_non_simd(a, b, astride, bstride, width, height);
 
   switch (width) {
     case 8 :
@@ -122,6 +137,64 @@ int sad_calc_simd_unaligned(uint8_t *a, uint8_t *b, int astride, int bstride, in
   };
 }
 
+/* Halve a frame in each direction, averaging 2x2 blocks.  Padding is
+   left to the caller. */
+void SIMD_KERNEL(scale_frame_down2x2_simd)(yuv_frame_t* sin, yuv_frame_t* sout)
+{
+  int wo=sout->width;
+  int ho=sout->height;
+  int so=sout->stride_y;
+  int si=sin->stride_y;
+  int i, j;
+  v128 ones = v128_dup_8(1);
+  v128 z = v128_dup_8(0);
+  for (i=0; i<ho; ++i) {
+
+    for (j=0; j<=wo-8; j+=8) {
+      v128 a = v128_load_aligned(&sin->y[(2*i+0)*si+2*j]);
+      v128 b = v128_load_aligned(&sin->y[(2*i+1)*si+2*j]);
+      v128 c = v128_avg_u8(a,b);
+      v128 d = v128_shr_s16(v128_madd_us8(c,ones),1);
+      v64_store_aligned(&sout->y[i*so+j], v128_low_v64(v128_pack_s16_u8(z,d)));
+    }
+    for (; j<wo; ++j) {
+      sout->y[i*so+j]=( ((sin->y[(2*i+0)*si+(2*j+0)] + sin->y[(2*i+1)*si+(2*j+0)]+1)>>1)+
+                      + ((sin->y[(2*i+0)*si+(2*j+1)] + sin->y[(2*i+1)*si+(2*j+1)]+1)>>1) )>>1;
+    }
+
+  }
+  int soc=sout->stride_c;
+  int sic=sin->stride_c;
+  ho /= 2;
+  wo /= 2;
+  for (int i=0; i<ho; ++i) {
+
+    for (j=0; j<=wo-8; j+=8) {
+      v128 a = v128_load_aligned(&sin->u[(2*i+0)*sic+2*j]);
+      v128 b = v128_load_aligned(&sin->u[(2*i+1)*sic+2*j]);
+      v128 c = v128_avg_u8(a,b);
+      v128 d = v128_shr_s16(v128_madd_us8(c,ones),1);
+      v64_store_aligned(&sout->u[i*soc+j], v128_low_v64(v128_pack_s16_u8(z,d)));
+    }
+    for (; j<wo; ++j) {
+      sout->u[i*soc+j]=( ((sin->u[(2*i+0)*sic+(2*j+0)] + sin->u[(2*i+1)*sic+(2*j+0)]+1)>>1)+
+                       + ((sin->u[(2*i+0)*sic+(2*j+1)] + sin->u[(2*i+1)*sic+(2*j+1)]+1)>>1) )>>1;
+    }
+
+    for (j=0; j<=wo-8; j+=8) {
+      v128 a = v128_load_aligned(&sin->v[(2*i+0)*sic+2*j]);
+      v128 b = v128_load_aligned(&sin->v[(2*i+1)*sic+2*j]);
+      v128 c = v128_avg_u8(a,b);
+      v128 d = v128_shr_s16(v128_madd_us8(c,ones),1);
+      v64_store_aligned(&sout->v[i*soc+j], v128_low_v64(v128_pack_s16_u8(z,d)));
+    }
+    for (; j<wo; ++j) {
+      sout->v[i*soc+j]=( ((sin->v[(2*i+0)*sic+(2*j+0)] + sin->v[(2*i+1)*sic+(2*j+0)]+1)>>1)+
+                       + ((sin->v[(2*i+0)*sic+(2*j+1)] + sin->v[(2*i+1)*sic+(2*j+1)]+1)>>1) )>>1;
+    }
+
+  }
+}
 
 static void transpose8x8(const int16_t *src, int sstride, int16_t *dst, int dstride)
 {
@@ -321,6 +394,11 @@ static void get_inter_prediction_luma_edge(int width, int height, int xoff, int
   v64 c4 = v64_load_aligned(coeffs[cf][4]);
   //v64 c5 = v64_load_aligned(coeffs[cf][5]);
   v64 cr = v64_dup_16(32);
+  v256 d1 = v256_dup_16(coeffs[cf][1][0]);
+  v256 d2 = v256_dup_16(coeffs[cf][2][0]);
+  v256 d3 = v256_dup_16(coeffs[cf][3][0]);
+  v256 d4 = v256_dup_16(coeffs[cf][4][0]);
+  v256 dr = v256_dup_16(32);
   int st1 = s1 + sx;
   for (int y = 0; y < height; y++) {
 
@@ -354,6 +432,27 @@ static void get_inter_prediction_luma_edge(int width, int height, int xoff, int
       ip += 4;
       rs = v64_shr_n_s16(rs, 6);
       u32_store_aligned(qp, v64_low_u32(v64_pack_s16_u8(rs, rs)));
+    } else if (width >= 16) {
+      for (int x = 0; x < width; x += 16) {
+        v256 r0, r1, r2, r3, r4, r5;
+        v256 rs;
+        const unsigned char *r = ip - 2 * s1 - 2 * sx;
+        r0 = v256_unpack_u8_s16(v128_load_unaligned(r));
+        r += st1;
+        r1 = v256_mullo_s16(d1, v256_unpack_u8_s16(v128_load_unaligned(r)));
+        r += st1;
+        r2 = v256_mullo_s16(d2, v256_unpack_u8_s16(v128_load_unaligned(r)));
+        r += st1;
+        r3 = v256_mullo_s16(d3, v256_unpack_u8_s16(v128_load_unaligned(r)));
+        r += st1;
+        r4 = v256_mullo_s16(d4, v256_unpack_u8_s16(v128_load_unaligned(r)));
+        r += st1;
+        r5 = v256_unpack_u8_s16(v128_load_unaligned(r));
+        rs = v256_add_16(v256_add_16(v256_add_16(v256_add_16(v256_add_16(v256_add_16(dr, r0), r1), r2), r3), r4), r5);
+        ip += 16;
+        rs = v256_shr_n_s16(rs, 6);
+        v128_store_unaligned(qp + x, v256_low_v128(v256_pack_s16_u8(rs, rs)));
+      }
     } else {
       for (int x = 0; x < width; x += 8) {
         v64 l0, l1, l2, l3, l4, l5;
@@ -759,7 +858,7 @@ static void get_inter_prediction_luma_centre(int width, int height,
   }
 }
 
-void get_inter_prediction_luma_simd(int width, int height, int xoff, int yoff,
+void SIMD_KERNEL(get_inter_prediction_luma_simd)(int width, int height, int xoff, int yoff,
                                     uint8_t *restrict qp, int qstride,
                                     const uint8_t *restrict ip, int istride, int bipred)
 {
@@ -783,9 +882,13 @@ void get_inter_prediction_luma_simd(int width, int height, int xoff, int yoff,
   }
 }
 
-void get_inter_prediction_chroma_simd(int width, int height, int xoff, int yoff,
+void SIMD_KERNEL(get_inter_prediction_chroma_simd)(int width, int height, int xoff, int yoff,
                                       unsigned char *restrict qp, int qstride,
                                       const unsigned char *restrict ip, int istride) {
+  if (width <= 2) {
+    get_inter_prediction_chroma_non_simd(width, height, xoff, yoff, qp, qstride, ip, istride);
+    return;
+  }
   static const ALIGN(16) int16_t coeffs[8][4] = {
     { 0, 64,  0,  0},
     {-2, 58, 10, -2},
@@ -885,7 +988,7 @@ enum {
 };
 
 /* Check whether coeffs are DC only, 4x4, 8x8 or larger. */
-int check_nz_area(const int16_t *coeff, int size)
+static int check_nz_area(const int16_t *coeff, int size)
 {
   uint64_t *c64 = (uint64_t *)coeff;
   int other3, rest;
@@ -1390,220 +1493,52 @@ static void inverse_transform8(const int16_t *coeff, int16_t *block) {
   v128_store_aligned(block + 56, v128_ziphi_64(t3, t5));
 }
 
-static void inverse_transform16(const int16_t *src, int16_t *dst, int shift) {
-  int j;
-  v64 c9 = v64_dup_16(9);
-  v64 c25 = v64_dup_16(25);
-  v64 c43 = v64_dup_16(43);
-  v64 c57 = v64_dup_16(57);
-  v64 c70 = v64_dup_16(70);
-  v64 c80 = v64_dup_16(80);
-  v64 c87 = v64_dup_16(87);
-  v64 c90 = v64_dup_16(90);
-
-  v64 c50 = v64_dup_16(50);
-  v64 c18 = v64_dup_16(18);
-  v64 c64 = v64_dup_16(64);
-  v64 c36 = v64_dup_16(36);
-  v64 c83 = v64_dup_16(83);
-  v64 c89 = v64_dup_16(89);
-  v64 c75 = v64_dup_16(75);
-
-  for (j = 0; j < 16; j += 4) {
-    v128 E0, E1, E2, E3, E4, E5, E6, E7;
-    v128 O0, O1, O2, O3, O4, O5, O6, O7;
-    v128 d0, d1, d2, d3, d4, d5, d6, d7;
-    v128 o0, o1, o2, o3, o4, o5, o6, o7;
-    v128 EO0, EO1, EO2, EO3, EEO0, EEO1, EEE0, EEE1;
-    v128 EE0, EE1, EE2, EE3;
-    v128 round, tmp, tmp1, tmp2;
-    v64 s0 =  v64_load_aligned(src +   0);
-    v64 s1 =  v64_load_aligned(src +  16);
-    v64 s2 =  v64_load_aligned(src +  32);
-    v64 s3 =  v64_load_aligned(src +  48);
-    v64 s4 =  v64_load_aligned(src +  64);
-    v64 s5 =  v64_load_aligned(src +  80);
-    v64 s6 =  v64_load_aligned(src +  96);
-    v64 s7 =  v64_load_aligned(src + 112);
-    v64 s8 =  v64_load_aligned(src + 128);
-    v64 s9 =  v64_load_aligned(src + 144);
-    v64 s10 = v64_load_aligned(src + 160);
-    v64 s11 = v64_load_aligned(src + 176);
-    v64 s12 = v64_load_aligned(src + 192);
-    v64 s13 = v64_load_aligned(src + 208);
-    v64 s14 = v64_load_aligned(src + 224);
-    v64 s15 = v64_load_aligned(src + 240);
-
-    /* O0 = 90*src[16] + 87*src[3*16] + 80*src[5*16] + 70*src[7*16]
-      + 57*src[9*16] + 43*src[11*16] + 25*src[13*16] + 9*src[15*16];*/
-    O0   = v128_add_32(v128_mul_s16(s1, c90),v128_mul_s16(s3, c87));
-    tmp  = v128_add_32(v128_mul_s16(s5, c80),v128_mul_s16(s7, c70));
-    tmp1 = v128_add_32(v128_mul_s16(s9, c57),v128_mul_s16(s11, c43));
-    tmp2 = v128_add_32(v128_mul_s16(s13, c25),v128_mul_s16(s15, c9));
-    O0   = v128_add_32(O0, v128_add_32(tmp, v128_add_32(tmp1, tmp2)));
-
-    /* O1 = 87*src[16] + 57*src[3*16] + 9*src[5*16] - 43*src[7*16]
-      - 80*src[9*16] -  90*src[11*16] -  70*src[13*16] - 25*src[15*16];*/
-
-    O1   = v128_add_32(v128_mul_s16(s1, c87),  v128_mul_s16(s3, c57));
-    tmp  = v128_sub_32(v128_mul_s16(s5, c9),   v128_mul_s16(s7, c43));
-    tmp1 = v128_add_32(v128_mul_s16(s9, c80),  v128_mul_s16(s11, c90));
-    tmp2 = v128_add_32(v128_mul_s16(s13 ,c70), v128_mul_s16(s15, c25));
-    O1   = v128_add_32(O1, tmp);
-    tmp1 = v128_add_32(tmp1, tmp2);
-    O1   = v128_sub_32(O1, tmp1);
-
-    /* O2 = 80*src[16] + 9*src[3*16] - 70*src[5*16] - 87*src[7*16]
-      + (-25)*src[9 * 16] + 57*src[11 * 16] + 90*src[13 * 16] + 43*src[15 * 16] */
-    O2   = v128_add_32(v128_mul_s16(s1, c80), v128_mul_s16(s3, c9));
-    tmp  =     v128_add_32(v128_mul_s16(s5, c70), v128_mul_s16(s7, c87));
-    tmp1 =    v128_sub_32(v128_mul_s16(s11, c57) ,v128_mul_s16(s9, c25));
-    tmp2 = v128_add_32(v128_mul_s16(s13, c90), v128_mul_s16(s15, c43));
-    O2   = v128_sub_32(O2, tmp);
-    O2   = v128_add_32(O2, v128_add_32(tmp1, tmp2));
-
-    /* O3 = 70*src[16] - 43*src[3*16] - 87*src[5*16] + 9*src[7*16]
-      + 90 * src[9 * 16] + 25 *src[11 * 16] - 80 * src[13 * 16] - 57* src[15 * 16]*/
-    O3   = v128_sub_32(v128_mul_s16(s1, c70), v128_mul_s16(s3, c43));
-    tmp  = v128_sub_32(v128_mul_s16(s5, c87), v128_mul_s16(s7, c9));
-    O3   = v128_sub_32(O3, tmp);
-    tmp1 = v128_add_32(v128_mul_s16(s9, c90), v128_mul_s16(s11, c25));
-    tmp2 = v128_add_32(v128_mul_s16(s13, c80), v128_mul_s16(s15, c57));
-    O3   = v128_add_32(O3, v128_sub_32(tmp1, tmp2));
-
-    /* O4 = 57*src[16] - 80*src[3*16] - 25*src[5*16] + 90*src[7*16]
-      = - 9 * src[9 * 16] -87 * src[11 * 16] + 43 * src[13 * 16] + 70 * src[15 * 16]*/
-    O4   = v128_sub_32(v128_mul_s16(s1, c57), v128_mul_s16(s3, c80));
-    tmp  = v128_sub_32(v128_mul_s16(s5, c25), v128_mul_s16(s7, c90));
-    O4   = v128_sub_32(O4, tmp);
-    tmp1 = v128_add_32(v128_mul_s16(s9, c9),v128_mul_s16(s11, c87));
-    tmp2 = v128_add_32(v128_mul_s16(s13, c43),v128_mul_s16(s15, c70));
-    O4   = v128_add_32(O4, tmp2);
-    O4   = v128_sub_32(O4, tmp1);
-
-    /* O5 = 43*src[16] - 90*src[3*16] + 57*src[5*16] + 25*src[7*16]
-      - 87 * src[9 * 16] + 70 * src[11 * 16] + 9 * src[13 * 16] - 80 * src[15 * 16]*/
-    O5   = v128_sub_32(v128_mul_s16(s1, c43), v128_mul_s16(s3, c90));
-    tmp  = v128_add_32(v128_mul_s16(s5, c57), v128_mul_s16(s7, c25));
-    O5   = v128_add_32(O5, tmp);
-    tmp1 = v128_sub_32(v128_mul_s16(s11, c70), v128_mul_s16(s9, c87));
-    tmp2 = v128_sub_32(v128_mul_s16(s13, c9), v128_mul_s16(s15, c80));
-    O5   = v128_add_32(O5, v128_add_32(tmp1, tmp2));
-
-    /* O6 = 25*src[16] - 70*src[3*16] + 90*src[5*16] - 80*src[7*16]
-      + 43* src[9 * 16] + 9 * src[11 * 16] -57 * src[13 * 16] + 87 * src[15 * 16]*/
-    O6   = v128_sub_32(v128_mul_s16(s1, c25), v128_mul_s16(s3, c70));
-    tmp  = v128_sub_32(v128_mul_s16(s5, c90), v128_mul_s16(s7, c80));
-    O6   = v128_add_32(O6, tmp);
-    tmp1 = v128_add_32(v128_mul_s16(s9, c43), v128_mul_s16(s11, c9));
-    tmp2 = v128_sub_32(v128_mul_s16(s15, c87), v128_mul_s16(s13, c57));
-    O6   = v128_add_32(O6, v128_add_32(tmp1, tmp2));
-
-    /* O7 = 9*src[16] - 25*src[3*16] + 43*src[5*16] - 57*src[7*16]
-      + 70 * src[9 * 16] -80 * src[11 * 16] + 87 * src[13 * 16] - 90 * src[15 * 16]*/
-    O7   = v128_sub_32(v128_mul_s16(s1, c9), v128_mul_s16(s3, c25));
-    tmp  = v128_sub_32(v128_mul_s16(s5, c43), v128_mul_s16(s7, c57));
-    O7   = v128_add_32(O7, tmp);
-    tmp1 = v128_sub_32(v128_mul_s16(s9, c70), v128_mul_s16(s11, c80));
-    tmp2 = v128_sub_32(v128_mul_s16(s13, c87), v128_mul_s16(s15, c90));
-    O7   = v128_add_32(O7, v128_add_32(tmp1, tmp2));
-
-    /* EO[0] = g3mat[ 2][0]*src[ 2*16] + g3mat[ 6][0]*src[ 6*16]
-      + g3mat[10][0]*src[10*16] + g3mat[14][0]*src[14*16];*/
-    EO0 = v128_add_32(v128_mul_s16(s2, c89), v128_mul_s16(s6, c75));
-    tmp1 = v128_add_32(v128_mul_s16(s10, c50), v128_mul_s16(s14, c18));
-    EO0 = v128_add_32(EO0, tmp1);
-
-    /* EO[1] = g3mat[ 2][1]*src[ 2*16] + g3mat[ 6][1]*src[ 6*16]
-      + g3mat[10][1]*src[10*16] + g3mat[14][1]*src[14*16];*/
-    EO1 = v128_sub_32(v128_mul_s16(s2, c75), v128_mul_s16(s6, c18));
-    tmp1 = v128_add_32(v128_mul_s16(s10, c89), v128_mul_s16(s14, c50));
-    EO1 = v128_sub_32(EO1, tmp1);
-
-    /* EO[2] = g3mat[ 2][2]*src[ 2*16] + g3mat[ 6][2]*src[ 6*16]
-      + g3mat[10][2]*src[10*16] + g3mat[14][2]*src[14*16];*/
-    EO2 = v128_sub_32(v128_mul_s16(s2, c50), v128_mul_s16(s6, c89));
-    tmp1 = v128_add_32(v128_mul_s16(s10, c18), v128_mul_s16(s14, c75));
-    EO2 = v128_add_32(EO2, tmp1);
-
-    /* EO[3] = g3mat[ 2][3]*src[ 2*16] + g3mat[ 6][3]*src[ 6*16]
-      + g3mat[10][3]*src[10*16] + g3mat[14][3]*src[14*16];*/
-    EO3 = v128_sub_32(v128_mul_s16(s2, c18), v128_mul_s16(s6, c50));
-    tmp1 = v128_sub_32(v128_mul_s16(s10, c75), v128_mul_s16(s14, c89));
-    EO3 = v128_add_32(EO3, tmp1);
-
-    /* ee0 */
-    /* EEO[0] = g3mat[4][0]*src[ 4*16 ] + g3mat[12][0]*src[ 12*16 ];*/
-    EEO0 = v128_add_32(v128_mul_s16(s4, c83), v128_mul_s16(s12, c36));
-    /* EEE[0] = g3mat[0][0]*src[ 0      ] + g3mat[ 8][0]*src[ 8*16  ];*/
-    EEE0 = v128_add_32(v128_mul_s16(s0, c64), v128_mul_s16(s8, c64));
-    /* EEO[1] = g3mat[4][1]*src[ 4*16 ] + g3mat[12][1]*src[ 12*16 ];*/
-    EEO1 = v128_sub_32(v128_mul_s16(s4, c36), v128_mul_s16(s12, c83));
-    /* EEE[1] = g3mat[0][1]*src[ 0      ] + g3mat[ 8][1]*src[ 8*16  ];*/
-    EEE1 = v128_sub_32(v128_mul_s16(s0, c64), v128_mul_s16(s8, c64));
-
-    /* Combining even and odd terms at each hierarchy levels to calculate the final spatial domain vector */
-    EE0 = v128_add_32(EEE0, EEO0);
-    EE3 = v128_sub_32(EEE0, EEO0);
-    EE1 = v128_add_32(EEE1, EEO1);
-    EE2 = v128_sub_32(EEE1, EEO1);
-
-    round = v128_dup_32(1 << (shift-1));
-    E0 = v128_add_32(round, v128_add_32(EE0, EO0));
-    E7 = v128_add_32(round, v128_sub_32(EE0, EO0));
-    E4 = v128_add_32(round, v128_sub_32(EE3, EO3));
-    E3 = v128_add_32(round, v128_add_32(EE3, EO3));
-    E1 = v128_add_32(round, v128_add_32(EE1, EO1));
-    E6 = v128_add_32(round, v128_sub_32(EE1, EO1));
-    E5 = v128_add_32(round, v128_sub_32(EE2, EO2));
-    E2 = v128_add_32(round, v128_add_32(EE2, EO2));
-
-    d0 = v128_pack_s32_s16(v128_shr_s32(v128_add_32(E1, O1), shift),
-                           v128_shr_s32(v128_add_32(E0, O0), shift));
-    d1 = v128_pack_s32_s16(v128_shr_s32(v128_add_32(E3, O3), shift),
-                           v128_shr_s32(v128_add_32(E2, O2), shift));
-    d2 = v128_pack_s32_s16(v128_shr_s32(v128_add_32(E5, O5), shift),
-                           v128_shr_s32(v128_add_32(E4, O4), shift));
-    d3 = v128_pack_s32_s16(v128_shr_s32(v128_add_32(E7, O7), shift),
-                           v128_shr_s32(v128_add_32(E6, O6), shift));
-    d4 = v128_pack_s32_s16(v128_shr_s32(v128_sub_32(E6, O6), shift),
-                           v128_shr_s32(v128_sub_32(E7, O7), shift));
-    d5 = v128_pack_s32_s16(v128_shr_s32(v128_sub_32(E4, O4), shift),
-                           v128_shr_s32(v128_sub_32(E5, O5), shift));
-    d6 = v128_pack_s32_s16(v128_shr_s32(v128_sub_32(E2, O2), shift),
-                           v128_shr_s32(v128_sub_32(E3, O3), shift));
-    d7 = v128_pack_s32_s16(v128_shr_s32(v128_sub_32(E0, O0), shift),
-                           v128_shr_s32(v128_sub_32(E1, O1), shift));
-
-    o0 = v128_ziplo_16(d1, d0);
-    o1 = v128_ziphi_16(d1, d0);
-    o2 = v128_ziplo_16(d3, d2);
-    o3 = v128_ziphi_16(d3, d2);
-    o4 = v128_ziplo_16(d5, d4);
-    o5 = v128_ziphi_16(d5, d4);
-    o6 = v128_ziplo_16(d7, d6);
-    o7 = v128_ziphi_16(d7, d6);
-
-    d0 = v128_ziplo_16(o1, o0);
-    d1 = v128_ziphi_16(o1, o0);
-    d2 = v128_ziplo_16(o3, o2);
-    d3 = v128_ziphi_16(o3, o2);
-    d4 = v128_ziplo_16(o5, o4);
-    d5 = v128_ziphi_16(o5, o4);
-    d6 = v128_ziplo_16(o7, o6);
-    d7 = v128_ziphi_16(o7, o6);
-
-    v128_store_aligned(dst +  0, v128_from_v64(v128_low_v64(d2), v128_low_v64(d0)));
-    v128_store_aligned(dst +  8, v128_from_v64(v128_low_v64(d6), v128_low_v64(d4)));
-    v128_store_aligned(dst + 16, v128_from_v64(v128_high_v64(d2), v128_high_v64(d0)));
-    v128_store_aligned(dst + 24, v128_from_v64(v128_high_v64(d6), v128_high_v64(d4)));
-    v128_store_aligned(dst + 32, v128_from_v64(v128_low_v64(d3), v128_low_v64(d1)));
-    v128_store_aligned(dst + 40, v128_from_v64(v128_low_v64(d7), v128_low_v64(d5)));
-    v128_store_aligned(dst + 48, v128_from_v64(v128_high_v64(d3), v128_high_v64(d1)));
-    v128_store_aligned(dst + 56, v128_from_v64(v128_high_v64(d7), v128_high_v64(d5)));
-    dst += 64;
-    src += 4;
+/* 16x16 inverse transform, one dimension, as a matrix multiplication */
+static void inverse_transform16(const int16_t *src, int16_t *dst, int shift)
+{
+  /* Pairs of rows of the 16x16 matrix, interleaved so that one madd
+     covers 8 columns */
+  static const ALIGN(32) int16_t coeffs[8][2][16] = {
+    { {  64,  90,  64,  87,  64,  80,  64,  70,  64,  57,  64,  43,  64,  25,  64,   9 },
+      {  64,  -9,  64, -25,  64, -43,  64, -57,  64, -70,  64, -80,  64, -87,  64, -90 } },
+    { {  89,  87,  75,  57,  50,   9,  18, -43, -18, -80, -50, -90, -75, -70, -89, -25 },
+      { -89,  25, -75,  70, -50,  90, -18,  80,  18,  43,  50,  -9,  75, -57,  89, -87 } },
+    { {  83,  80,  36,   9, -36, -70, -83, -87, -83, -25, -36,  57,  36,  90,  83,  43 },
+      {  83, -43,  36, -90, -36, -57, -83,  25, -83,  87, -36,  70,  36,  -9,  83, -80 } },
+    { {  75,  70, -18, -43, -89, -87, -50,   9,  50,  90,  89,  25,  18, -80, -75, -57 },
+      { -75,  57,  18,  80,  89, -25,  50, -90, -50,  -9, -89,  87, -18,  43,  75, -70 } },
+    { {  64,  57, -64, -80, -64, -25,  64,  90,  64,  -9, -64, -87, -64,  43,  64,  70 },
+      {  64, -70, -64, -43, -64,  87,  64,   9,  64, -90, -64,  25, -64,  80,  64, -57 } },
+    { {  50,  43, -89, -90,  18,  57,  75,  25, -75, -87, -18,  70,  89,   9, -50, -80 },
+      { -50,  80,  89,  -9, -18, -70, -75,  87,  75, -25,  18, -57, -89,  90,  50, -43 } },
+    { {  36,  25, -83, -70,  83,  90, -36, -80, -36,  43,  83,   9, -83, -57,  36,  87 },
+      {  36, -87, -83,  57,  83,  -9, -36, -43, -36,  80,  83, -90, -83,  70,  36, -25 } },
+    { {  18,   9, -50, -25,  75,  43, -89, -57,  89,  70, -75, -80,  50,  87, -18, -90 },
+      { -18,  90,  50, -87, -75,  80,  89, -70, -89,  57,  75, -43, -50,  25,  18,  -9 } }
+  };
+  int16_t *tmp = thor_alloc(16*16*2, 32);
+  v256 round = v256_dup_32(1 << (shift-1));
+
+  /* Transpose so that the coefficients of each column become adjacent */
+  transpose8x8(src, 16, tmp, 16);
+  transpose8x8(src + 8, 16, tmp + 8*16, 16);
+  transpose8x8(src + 8*16, 16, tmp + 8, 16);
+  transpose8x8(src + 8*16 + 8, 16, tmp + 8*16 + 8, 16);
+
+  for (int j = 0; j < 16; j++) {
+    const uint32_t *s = (const uint32_t *)(tmp + j*16);
+    v256 lo = v256_zero();
+    v256 hi = v256_zero();
+    for (int m = 0; m < 8; m++) {
+      v256 p = v256_dup_32(s[m]);
+      lo = v256_add_32(lo, v256_madd_s16(p, v256_load_aligned(coeffs[m][0])));
+      hi = v256_add_32(hi, v256_madd_s16(p, v256_load_aligned(coeffs[m][1])));
+    }
+    lo = v256_shr_s32(v256_add_32(lo, round), shift);
+    hi = v256_shr_s32(v256_add_32(hi, round), shift);
+    v256_store_unaligned(dst + j*16, v256_pack_s32_s16(hi, lo));
   }
+  thor_free(tmp);
 }
 
 /* 16x16 inverse transform assuming everything but top left 4x4 is 0 */
@@ -1965,215 +1900,118 @@ static void transform8(const int16_t *src, int16_t *dst, int shift)
   }
 }
 
-/* 16x16 transform, one dimension, partial butterfly */
+/* 16x16 transform, one dimension, as a matrix multiplication */
 static void transform16(const int16_t *src, int16_t *dst, int shift)
 {
-  int j;
-  const v128 shuffle1 = v128_from_64(0x0100030205040706LL, 0x09080b0a0d0c0f0eLL);
-  const v128 shuffle2 = v128_from_64(0x0302010007060504LL, 0x0b0a09080f0e0d0cLL);
-  const v128 round = v128_dup_32(1 << (shift-1));
-
-  for (j = 0; j < 16; j += 4) {
-    v128 t0, t1, t2, t3, t4, t5, t6, t7;
-    v128 EEE0, EEE1, EEO0, EEO1;
-    v128 EE0, EE1, EE2, EE3;
-    v128 EO0, EO1, EO2, EO3;
-
-    v128 load0 = v128_load_aligned(src + 0);
-    v128 load1 = v128_shuffle_8(v128_load_aligned(src + 8), shuffle1);
-    v128 load2 = v128_load_aligned(src + 16);
-    v128 load3 = v128_shuffle_8(v128_load_aligned(src + 24), shuffle1);
-    v128 load4 = v128_load_aligned(src + 32);
-    v128 load5 = v128_shuffle_8(v128_load_aligned(src + 40), shuffle1);
-    v128 load6 = v128_load_aligned(src + 48);
-    v128 load7 = v128_shuffle_8(v128_load_aligned(src + 56), shuffle1);
-
-    /* E and O*/
-    v128 E0 = v128_add_16(load0, load1);
-    v128 O0 = v128_sub_16(load0, load1);
-    v128 E1 = v128_add_16(load2, load3);
-    v128 O1 = v128_sub_16(load2, load3);
-    v128 E2 = v128_add_16(load4, load5);
-    v128 O2 = v128_sub_16(load4, load5);
-    v128 E3 = v128_add_16(load6, load7);
-    v128 O3 = v128_sub_16(load6, load7);
-
-    /* EE and EO */
-    v128 hi = v128_unpackhi_s16_s32(E0);
-    v128 lo = v128_shuffle_8(v128_unpacklo_s16_s32(E0), shuffle2);
-    EE0 = v128_add_32(lo, hi);
-    EO0 = v128_sub_32(lo, hi);
-    hi = v128_unpackhi_s16_s32(E1);
-    lo = v128_shuffle_8(v128_unpacklo_s16_s32(E1), shuffle2);
-    EE1 = v128_add_32(lo, hi);
-    EO1 = v128_sub_32(lo, hi);
-    hi = v128_unpackhi_s16_s32(E2);
-    lo = v128_shuffle_8(v128_unpacklo_s16_s32(E2), shuffle2);
-    EE2 = v128_add_32(lo, hi);
-    EO2 = v128_sub_32(lo, hi);
-    hi = v128_unpackhi_s16_s32(E3);
-    lo = v128_shuffle_8(v128_unpacklo_s16_s32(E3), shuffle2);
-    EE3 = v128_add_32(lo, hi);
-    EO3 = v128_sub_32(lo, hi);
-
-    t0 = v128_ziphi_64(EO1, EO0);
-    t1 = v128_ziphi_64(EO3, EO2);
-    t2 = v128_ziplo_64(EO1, EO0);
-    t3 = v128_ziplo_64(EO3, EO2);
-    EO0 = v128_unziphi_32(t1, t0);
-    EO1 = v128_unziplo_32(t1, t0);
-    EO2 = v128_unziphi_32(t3, t2);
-    EO3 = v128_unziplo_32(t3, t2);
-
-    /* EEE and EEO */
-    t0 = v128_ziphi_64(EE1, EE0);
-    t1 = v128_ziphi_64(EE3, EE2);
-    t2 = v128_ziplo_64(EE1, EE0);
-    t3 = v128_ziplo_64(EE3, EE2);
-    t4 = v128_unziphi_32(t1, t0);
-    t5 = v128_unziplo_32(t3, t2);
-    t6 = v128_unziplo_32(t1, t0);
-    t7 = v128_unziphi_32(t3, t2);
-
-    EEE0 = v128_add_32(t4, t5);
-    EEE1 = v128_add_32(t6, t7);
-    EEO0 = v128_sub_32(t4, t5);
-    EEO1 = v128_sub_32(t6, t7);
-
-    /* EEEE and EEEO */
-    t0 = v128_shr_s32(v128_add_32(v128_shl_n_32(v128_add_32(EEE0, EEE1), 6), round), shift);
-    v64_store_aligned(dst, v128_low_v64(v128_unziplo_16(t0, t0)));
-    t0 = v128_shr_s32(v128_add_32(v128_shl_n_32(v128_sub_32(EEE0, EEE1), 6), round), shift);
-    v64_store_aligned(dst+8*16, v128_low_v64(v128_unziplo_16(t0, t0)));
-
-    /* */
-    t0 = v128_shr_s32(v128_add_32(v128_add_32(v128_mullo_s32(EEO0, v128_dup_32(83)),
-                                              v128_mullo_s32(EEO1, v128_dup_32(36))), round), shift);
-    v64_store_aligned(dst+4*16, v128_low_v64(v128_unziplo_16(t0, t0)));
-    t0 = v128_shr_s32(v128_add_32(v128_add_32(v128_mullo_s32(EEO0, v128_dup_32(36)),
-                                              v128_mullo_s32(EEO1, v128_dup_32(-83))), round), shift);
-    v64_store_aligned(dst+12*16, v128_low_v64(v128_unziplo_16(t0, t0)));
-
-    t0 = v128_shr_s32(v128_add_32(v128_add_32(v128_add_32(v128_mullo_s32(EO0, v128_dup_32(89)),
-                                                          v128_mullo_s32(EO1, v128_dup_32(75))),
-                                              v128_add_32(v128_mullo_s32(EO2, v128_dup_32(50)),
-                                                          v128_mullo_s32(EO3, v128_dup_32(18)))), round), shift);
-    v64_store_aligned(dst+2*16, v128_low_v64(v128_unziplo_16(t0, t0)));
-
-    t0 = v128_shr_s32(v128_add_32(v128_add_32(v128_add_32(v128_mullo_s32(EO0, v128_dup_32(75)),
-                                                          v128_mullo_s32(EO1, v128_dup_32(-18))),
-                                              v128_add_32(v128_mullo_s32(EO2, v128_dup_32(-89)),
-                                                          v128_mullo_s32(EO3, v128_dup_32(-50)))), round), shift);
-    v64_store_aligned(dst+6*16, v128_low_v64(v128_unziplo_16(t0, t0)));
-
-    t0 = v128_shr_s32(v128_add_32(v128_add_32(v128_add_32(v128_mullo_s32(EO0, v128_dup_32(50)),
-                                                          v128_mullo_s32(EO1, v128_dup_32(-89))),
-                                              v128_add_32(v128_mullo_s32(EO2, v128_dup_32(18)),
-                                                          v128_mullo_s32(EO3, v128_dup_32(75)))), round), shift);
-    v64_store_aligned(dst+10*16, v128_low_v64(v128_unziplo_16(t0, t0)));
-
-    t0 = v128_shr_s32(v128_add_32(v128_add_32(v128_add_32(v128_mullo_s32(EO0, v128_dup_32(18)),
-                                                          v128_mullo_s32(EO1, v128_dup_32(-50))),
-                                              v128_add_32(v128_mullo_s32(EO2, v128_dup_32(75)),
-                                                          v128_mullo_s32(EO3, v128_dup_32(-89)))), round), shift);
-    v64_store_aligned(dst+14*16, v128_low_v64(v128_unziplo_16(t0, t0)));
-
-    t0 = v128_from_64(0x00090019002b0039LL, 0x004600500057005aLL);
-    t0 = v128_shr_s32(v128_add_32(v128_from_32(v128_dotp_s16(O3, t0), v128_dotp_s16(O2, t0), v128_dotp_s16(O1, t0), v128_dotp_s16(O0, t0)), round), shift);
-    v64_store_aligned(dst+1*16, v128_low_v64(v128_unziplo_16(t0, t0)));
-
-    t0 = v128_from_64(0xffe7ffbaffa6ffb0LL, 0xffd5000900390057LL);
-    t0 = v128_shr_s32(v128_add_32(v128_from_32(v128_dotp_s16(O3, t0), v128_dotp_s16(O2, t0), v128_dotp_s16(O1, t0), v128_dotp_s16(O0, t0)), round), shift);
-    v64_store_aligned(dst+3*16, v128_low_v64(v128_unziplo_16(t0, t0)));
-
-    t0 = v128_from_64(0x002b005a0039ffe7LL, 0xffa9ffba00090050LL);
-    t0 = v128_shr_s32(v128_add_32(v128_from_32(v128_dotp_s16(O3, t0), v128_dotp_s16(O2, t0), v128_dotp_s16(O1, t0), v128_dotp_s16(O0, t0)), round), shift);
-    v64_store_aligned(dst+5*16, v128_low_v64(v128_unziplo_16(t0, t0)));
-
-    t0 = v128_from_64(0xffc7ffb00019005aLL, 0x0009ffa9ffd50046LL);
-    t0 = v128_shr_s32(v128_add_32(v128_from_32(v128_dotp_s16(O3, t0), v128_dotp_s16(O2, t0), v128_dotp_s16(O1, t0), v128_dotp_s16(O0, t0)), round), shift);
-    v64_store_aligned(dst+7*16, v128_low_v64(v128_unziplo_16(t0, t0)));
-
-    t0 = v128_from_64(0x0046002bffa9fff7LL, 0x005affe7ffb00039LL);
-    t0 = v128_shr_s32(v128_add_32(v128_from_32(v128_dotp_s16(O3, t0), v128_dotp_s16(O2, t0), v128_dotp_s16(O1, t0), v128_dotp_s16(O0, t0)), round), shift);
-    v64_store_aligned(dst+9*16, v128_low_v64(v128_unziplo_16(t0, t0)));
-
-    t0 = v128_from_64(0xffb000090046ffa9LL, 0x00190039ffa6002bLL);
-    t0 = v128_shr_s32(v128_add_32(v128_from_32(v128_dotp_s16(O3, t0), v128_dotp_s16(O2, t0), v128_dotp_s16(O1, t0), v128_dotp_s16(O0, t0)), round), shift);
-    v64_store_aligned(dst+11*16, v128_low_v64(v128_unziplo_16(t0, t0)));
-
-    t0 = v128_from_64(0x0057ffc70009002bLL, 0xffb0005affba0019LL);
-    t0 = v128_shr_s32(v128_add_32(v128_from_32(v128_dotp_s16(O3, t0), v128_dotp_s16(O2, t0), v128_dotp_s16(O1, t0), v128_dotp_s16(O0, t0)), round), shift);
-    v64_store_aligned(dst+13*16, v128_low_v64(v128_unziplo_16(t0, t0)));
-
-    t0 = v128_from_64(0xffa60057ffb00046LL, 0xffc7002bffe70009LL);
-    t0 = v128_shr_s32(v128_add_32(v128_from_32(v128_dotp_s16(O3, t0), v128_dotp_s16(O2, t0), v128_dotp_s16(O1, t0), v128_dotp_s16(O0, t0)), round), shift);
-    v64_store_aligned(dst+15*16, v128_low_v64(v128_unziplo_16(t0, t0)));
-
-    src += 16*4;
-    dst += 4;
+  /* Pairs of columns of the 16x16 matrix, interleaved so that one madd
+     covers 8 rows */
+  static const ALIGN(32) int16_t coeffs[8][2][16] = {
+    { {  64,  64,  90,  87,  89,  75,  87,  57,  83,  36,  80,   9,  75, -18,  70, -43 },
+      {  64, -64,  57, -80,  50, -89,  43, -90,  36, -83,  25, -70,  18, -50,   9, -25 } },
+    { {  64,  64,  80,  70,  50,  18,   9, -43, -36, -83, -70, -87, -89, -50, -87,   9 },
+      { -64,  64, -25,  90,  18,  75,  57,  25,  83, -36,  90, -80,  75, -89,  43, -57 } },
+    { {  64,  64,  57,  43, -18, -50, -80, -90, -83, -36, -25,  57,  50,  89,  90,  25 },
+      {  64, -64,  -9, -87, -75, -18, -87,  70, -36,  83,  43,   9,  89, -75,  70, -80 } },
+    { {  64,  64,  25,   9, -75, -89, -70, -25,  36,  83,  90,  43,  18, -75, -80, -57 },
+      { -64,  64,  43,  70,  89, -50,   9, -80, -83,  36, -57,  87,  50, -18,  87, -90 } },
+    { {  64,  64,  -9, -25, -89, -75,  25,  70,  83,  36, -43, -90, -75,  18,  57,  80 },
+      {  64, -64, -70, -43, -50,  89,  80,  -9,  36, -83, -87,  57, -18,  50,  90, -87 } },
+    { {  64,  64, -43, -57, -50, -18,  90,  80, -36, -83, -57,  25,  89,  50, -25, -90 },
+      { -64,  64,  87,   9, -18, -75, -70,  87,  83, -36,  -9, -43, -75,  89,  80, -70 } },
+    { {  64,  64, -70, -80,  18,  50,  43,  -9, -83, -36,  87,  70, -50, -89,  -9,  87 },
+      {  64, -64, -90,  25,  75,  18, -25, -57, -36,  83,  80, -90, -89,  75,  57, -43 } },
+    { {  64,  64, -87, -90,  75,  89, -57, -87,  36,  83,  -9, -80, -18,  75,  43, -70 },
+      { -64,  64,  80, -57, -89,  50,  90, -43, -83,  36,  70, -25, -50,  18,  25,  -9 } }
+  };
+  int16_t *tmp = thor_alloc(16*16*2, 32);
+  v256 round = v256_dup_32(1 << (shift-1));
+
+  for (int j = 0; j < 16; j++) {
+    const uint32_t *s = (const uint32_t *)(src + j*16);
+    v256 lo = v256_zero();
+    v256 hi = v256_zero();
+    for (int m = 0; m < 8; m++) {
+      v256 p = v256_dup_32(s[m]);
+      lo = v256_add_32(lo, v256_madd_s16(p, v256_load_aligned(coeffs[m][0])));
+      hi = v256_add_32(hi, v256_madd_s16(p, v256_load_aligned(coeffs[m][1])));
+    }
+    lo = v256_shr_s32(v256_add_32(lo, round), shift);
+    hi = v256_shr_s32(v256_add_32(hi, round), shift);
+    v256_store_aligned(tmp + j*16, v256_pack_s32_s16(hi, lo));
   }
+
+  transpose8x8(tmp, 16, dst, 16);
+  transpose8x8(tmp + 8, 16, dst + 8*16, 16);
+  transpose8x8(tmp + 8*16, 16, dst + 8, 16);
+  transpose8x8(tmp + 8*16 + 8, 16, dst + 8*16 + 8, 16);
+  thor_free(tmp);
 }
 
 
 static void transform32(const int16_t *src, int16_t *dst, int shift, int it)
 {
-  extern const int16_t g4mat_hevc[32][32];
-  int j, k;
-  int E[16], O[16];
-  int EE[8], EO[8];
-  int EEE[4], EEO[4];
-  int EEEE[2], EEEO[2];
-  int EEEEE;
-  int add = 1<<(shift-1);
-
-  for (j = 0; j < it; j++) {
-    /* E and O*/
-    for (k = 0; k < 16; k++) {
-      E[k] = src[k] + src[31-k];
-      O[k] = src[k] - src[31-k];
-    }
-    /* EE and EO */
-    for (k = 0; k < 8; k++) {
-      EE[k] = E[k] + E[15-k];
-      EO[k] = E[k] - E[15-k];
-    }
-    /* EEE and EEO */
-    for (k = 0; k < 4; k++) {
-      EEE[k] = EE[k] + EE[7-k];
-      EEO[k] = EE[k] - EE[7-k];
-    }
-    /* EEEE and EEEO */
-    EEEE[0] = EEE[0] + EEE[3];
-    EEEO[0] = EEE[0] - EEE[3];
-    EEEE[1] = EEE[1] + EEE[2];
-    EEEO[1] = EEE[1] - EEE[2];
-
-    /* EEEEE */
-    EEEEE = EEEE[0] + EEEE[1];
-
-    dst[0] = (g4mat_hevc[ 0][0]*EEEEE + add)>>shift;
-    dst[8*32] = (g4mat_hevc[ 8][0]*EEEO[0] + g4mat_hevc[ 8][1]*EEEO[1] + add)>>shift;
-    for (k = 4; k < 16; k += 8) {
-      dst[k*32] = (g4mat_hevc[k][0]*EEO[0] + g4mat_hevc[k][1]*EEO[1] + g4mat_hevc[k][2]*EEO[2] + g4mat_hevc[k][3]*EEO[3] + add)>>shift;
-    }
-    for (k = 2; k < 16; k += 4) {
-      dst[k*32] = (g4mat_hevc[k][0]*EO[0] + g4mat_hevc[k][1]*EO[1] + g4mat_hevc[k][2]*EO[2] + g4mat_hevc[k][3]*EO[3] +
-                   g4mat_hevc[k][4]*EO[4] + g4mat_hevc[k][5]*EO[5] + g4mat_hevc[k][6]*EO[6] + g4mat_hevc[k][7]*EO[7] + add)>>shift;
-    }
-    for (k = 1; k < 16; k += 2) {
-      dst[k*32] = (g4mat_hevc[k][ 0]*O[ 0] + g4mat_hevc[k][ 1]*O[ 1] + g4mat_hevc[k][ 2]*O[ 2] + g4mat_hevc[k][ 3]*O[ 3] +
-                   g4mat_hevc[k][ 4]*O[ 4] + g4mat_hevc[k][ 5]*O[ 5] + g4mat_hevc[k][ 6]*O[ 6] + g4mat_hevc[k][ 7]*O[ 7] +
-                   g4mat_hevc[k][ 8]*O[ 8] + g4mat_hevc[k][ 9]*O[ 9] + g4mat_hevc[k][10]*O[10] + g4mat_hevc[k][11]*O[11] +
-                   g4mat_hevc[k][12]*O[12] + g4mat_hevc[k][13]*O[13] + g4mat_hevc[k][14]*O[14] + g4mat_hevc[k][15]*O[15] + add)>>shift;
+  /* Pairs of columns of the 32x32 matrix for the first 16 rows (the
+     only ones used), interleaved so that one madd covers 8 rows */
+  static const ALIGN(32) int16_t coeffs[16][2][16] = {
+    { {  64,  64,  90,  90,  90,  87,  90,  82,  89,  75,  88,  67,  87,  57,  85,  46 },
+      {  83,  36,  82,  22,  80,   9,  78,  -4,  75, -18,  73, -31,  70, -43,  67, -54 } },
+    { {  64,  64,  88,  85,  80,  70,  67,  46,  50,  18,  31, -13,   9, -43, -13, -67 },
+      { -36, -83, -54, -90, -70, -87, -82, -73, -89, -50, -90, -22, -87,   9, -78,  38 } },
+    { {  64,  64,  82,  78,  57,  43,  22,  -4, -18, -50, -54, -82, -80, -90, -90, -73 },
+      { -83, -36, -61,  13, -25,  57,  13,  85,  50,  89,  78,  67,  90,  25,  85, -22 } },
+    { {  64,  64,  73,  67,  25,   9, -31, -54, -75, -89, -90, -78, -70, -25, -22,  38 },
+      {  36,  83,  78,  85,  90,  43,  67, -22,  18, -75, -38, -90, -80, -57, -90,   4 } },
+    { {  64,  64,  61,  54,  -9, -25, -73, -85, -89, -75, -46,  -4,  25,  70,  82,  88 },
+      {  83,  36,  31, -46, -43, -90, -88, -61, -75,  18, -13,  82,  57,  80,  90,  13 } },
+    { {  64,  64,  46,  38, -43, -57, -90, -88, -50, -18,  38,  73,  90,  80,  54,  -4 },
+      { -36, -83, -90, -67, -57,  25,  31,  90,  89,  50,  61, -46, -25, -90, -88, -31 } },
+    { {  64,  64,  31,  22, -70, -80, -78, -61,  18,  50,  90,  85,  43,  -9, -61, -90 },
+      { -83, -36,   4,  73,  87,  70,  54, -38, -50, -89, -88,  -4,  -9,  87,  82,  46 } },
+    { {  64,  64,  13,   4, -87, -90, -38, -13,  75,  89,  61,  22, -57, -87, -78, -31 },
+      {  36,  83,  88,  38,  -9, -80, -90, -46, -18,  75,  85,  54,  43, -70, -73, -61 } },
+    { {  64,  64,  -4, -13, -90, -87,  13,  38,  89,  75, -22, -61, -87, -57,  31,  78 },
+      {  83,  36, -38, -88, -80,  -9,  46,  90,  75, -18, -54, -85, -70,  43,  61,  73 } },
+    { {  64,  64, -22, -31, -80, -70,  61,  78,  50,  18, -85, -90,  -9,  43,  90,  61 },
+      { -36, -83, -73,  -4,  70,  87,  38, -54, -89, -50,   4,  88,  87,  -9, -46, -82 } },
+    { {  64,  64, -38, -46, -57, -43,  88,  90, -18, -50, -73, -38,  80,  90,   4, -54 },
+      { -83, -36,  67,  90,  25, -57, -90, -31,  50,  89,  46, -61, -90, -25,  31,  88 } },
+    { {  64,  64, -54, -61, -25,  -9,  85,  73, -75, -89,   4,  46,  70,  25, -88, -82 },
+      {  36,  83,  46, -31, -90, -43,  61,  88,  18, -75, -82,  13,  80,  57, -13, -90 } },
+    { {  64,  64, -67, -73,   9,  25,  54,  31, -89, -75,  78,  90, -25, -70, -38,  22 },
+      {  83,  36, -85, -78,  43,  90,  22, -67, -75,  18,  90,  38, -57, -80,  -4,  90 } },
+    { {  64,  64, -78, -82,  43,  57,   4, -22, -50, -18,  82,  54, -90, -80,  73,  90 },
+      { -36, -83, -13,  61,  57, -25, -85, -13,  89,  50, -67, -78,  25,  90,  22, -85 } },
+    { {  64,  64, -85, -88,  70,  80, -46, -67,  18,  50,  13, -31, -43,   9,  67,  13 },
+      { -83, -36,  90,  54, -87, -70,  73,  82, -50, -89,  22,  90,   9, -87, -38,  78 } },
+    { {  64,  64, -90, -90,  87,  90, -82, -90,  75,  89, -67, -88,  57,  87, -46, -85 },
+      {  36,  83, -22, -82,   9,  80,   4, -78, -18,  75,  31, -73, -43,  70,  54, -67 } }
+  };
+  int16_t *tmp = thor_alloc(32*16*2, 32);
+  v256 round = v256_dup_32(1 << (shift-1));
+
+  for (int j = 0; j < it; j++) {
+    const uint32_t *s = (const uint32_t *)(src + j*32);
+    v256 lo = v256_zero();
+    v256 hi = v256_zero();
+    for (int m = 0; m < 16; m++) {
+      v256 p = v256_dup_32(s[m]);
+      lo = v256_add_32(lo, v256_madd_s16(p, v256_load_aligned(coeffs[m][0])));
+      hi = v256_add_32(hi, v256_madd_s16(p, v256_load_aligned(coeffs[m][1])));
     }
-    src += 32;
-    dst++;
+    lo = v256_shr_s32(v256_add_32(lo, round), shift);
+    hi = v256_shr_s32(v256_add_32(hi, round), shift);
+    v256_store_aligned(tmp + j*16, v256_pack_s32_s16(hi, lo));
+  }
+
+  for (int j = 0; j < it; j += 8) {
+    transpose8x8(tmp + j*16, 16, dst + j, 32);
+    transpose8x8(tmp + j*16 + 8, 16, dst + 8*32 + j, 32);
   }
+  thor_free(tmp);
 }
 
 
-void transform_simd(const int16_t *block, int16_t *coeff, int size, int fast)
+void SIMD_KERNEL(transform_simd)(const int16_t *block, int16_t *coeff, int size, int fast)
 {
   if (size == 4) {
     transform4(block, coeff);
@@ -2249,7 +2087,7 @@ void transform_simd(const int16_t *block, int16_t *coeff, int size, int fast)
   }
 }
 
-void inverse_transform_simd(const int16_t *coeff, int16_t *block, int size)
+void SIMD_KERNEL(inverse_transform_simd)(const int16_t *coeff, int16_t *block, int size)
 {
   if (size == 4) {
     inverse_transform4(coeff, block);
@@ -2274,7 +2112,7 @@ void inverse_transform_simd(const int16_t *coeff, int16_t *block, int size)
     inverse_transform32(coeff, block);
 }
 
-void clpf_block4(const uint8_t *src, uint8_t *dst, int sstride, int dstride, int x0, int y0, int width, int height) {
+static void clpf_block4(const uint8_t *src, uint8_t *dst, int sstride, int dstride, int x0, int y0, int width, int height) {
   int left = (x0 & ~(MAX_BLOCK_SIZE/2-1)) - x0;
   int top = (y0 & ~(MAX_BLOCK_SIZE/2-1)) - y0;
   int right = min(width-1, left + MAX_BLOCK_SIZE/2-1);
@@ -2324,33 +2162,480 @@ void clpf_block4(const uint8_t *src, uint8_t *dst, int sstride, int dstride, int
   *(uint32_t*)(dst + 3*dstride) = v128_low_u32(r);
 }
 
-void clpf_block8(const uint8_t *src, uint8_t *dst, int sstride, int dstride, int x0, int y0, int width, int height) {
+static void clpf_block8(const uint8_t *src, uint8_t *dst, int sstride, int dstride, int x0, int y0, int width, int height) {
   int left = (x0 & ~(MAX_BLOCK_SIZE-1)) - x0;
   int top = (y0 & ~(MAX_BLOCK_SIZE-1)) - y0;
   int right = min(width-1, left + MAX_BLOCK_SIZE-1);
   int bottom = min(height-1, top + MAX_BLOCK_SIZE-1);
-  v64 c2 = v64_dup_8(-2);
-  v64 c128 = v64_dup_8(128);
-  v64 s1 = left ? v64_from_64(0x0706050403020100LL) : v64_from_64(0x0605040302010000LL);
-  v64 s2 = right == 7 ? v64_from_64(0x0707060504030201LL) : v64_from_64(0x0706050403020100LL);
+  v256 c2 = v256_dup_8(-2);
+  v256 c128 = v256_dup_8(128);
+  v64 s1lo = left ? v64_from_64(0x0706050403020100LL) : v64_from_64(0x0605040302010000LL);
+  v64 s1hi = left ? v64_from_64(0x0f0e0d0c0b0a0908LL) : v64_from_64(0x0e0d0c0b0a090808LL);
+  v64 s2lo = right == 7 ? v64_from_64(0x0707060504030201LL) : v64_from_64(0x0706050403020100LL);
+  v64 s2hi = right == 7 ? v64_from_64(0x0f0f0e0d0c0b0a09LL) : v64_from_64(0x0f0e0d0c0b0a0908LL);
+  v256 s1 = v256_from_v64(s1hi, s1lo, s1hi, s1lo);
+  v256 s2 = v256_from_v64(s2hi, s2lo, s2hi, s2lo);
 
   dst -= left + top*dstride;
   src += x0 + y0*sstride;
 
-  for (int y = 0; y < 8; y++) {
-    v64 o = v64_load_aligned(src);
-    v64 x = v64_sub_8(o, c128);
-    v64 a = v64_sub_8(v64_load_aligned(src - (y!=top)*sstride), c128);
-    v64 b = v64_shuffle_8(v64_sub_8(v64_load_unaligned(src - !!left), c128), s1);
-    v64 c = v64_shuffle_8(v64_sub_8(v64_load_unaligned(src + (right != 7)), c128), s2);
-    v64 d = v64_sub_8(v64_load_aligned(src + (y!=bottom)*sstride), c128);
-    v64 r1 = v64_add_8(v64_add_8(v64_cmplt_s8(a, x), v64_cmplt_s8(b, x)),
-                       v64_add_8(v64_cmplt_s8(c, x), v64_cmplt_s8(d, x)));
-    v64 r2 = v64_add_8(v64_add_8(v64_cmpgt_s8(a, x), v64_cmpgt_s8(b, x)),
-                       v64_add_8(v64_cmpgt_s8(c, x), v64_cmpgt_s8(d, x)));
-    v64 delta = v64_sub_8(v64_cmplt_s8(r1, c2), v64_cmplt_s8(r2, c2));
-    v64_store_aligned(dst, v64_add_8(o, delta));
-    src += sstride;
-    dst += dstride;
+  /* Four rows per iteration */
+  for (int y = 0; y < 8; y += 4) {
+    const uint8_t *p0 = src;
+    const uint8_t *p1 = src + sstride;
+    const uint8_t *p2 = src + 2*sstride;
+    const uint8_t *p3 = src + 3*sstride;
+    v256 o = v256_from_v64(v64_load_aligned(p3), v64_load_aligned(p2),
+                           v64_load_aligned(p1), v64_load_aligned(p0));
+    v256 x = v256_sub_8(o, c128);
+    v256 a = v256_sub_8(v256_from_v64(v64_load_aligned(p3 - (y+3!=top)*sstride), v64_load_aligned(p2 - (y+2!=top)*sstride),
+                                      v64_load_aligned(p1 - (y+1!=top)*sstride), v64_load_aligned(p0 - (y!=top)*sstride)), c128);
+    v256 b = v256_shuffle_8(v256_sub_8(v256_from_v64(v64_load_unaligned(p3 - !!left), v64_load_unaligned(p2 - !!left),
+                                                     v64_load_unaligned(p1 - !!left), v64_load_unaligned(p0 - !!left)), c128), s1);
+    v256 c = v256_shuffle_8(v256_sub_8(v256_from_v64(v64_load_unaligned(p3 + (right != 7)), v64_load_unaligned(p2 + (right != 7)),
+                                                     v64_load_unaligned(p1 + (right != 7)), v64_load_unaligned(p0 + (right != 7))), c128), s2);
+    v256 d = v256_sub_8(v256_from_v64(v64_load_aligned(p3 + (y+3!=bottom)*sstride), v64_load_aligned(p2 + (y+2!=bottom)*sstride),
+                                      v64_load_aligned(p1 + (y+1!=bottom)*sstride), v64_load_aligned(p0 + (y!=bottom)*sstride)), c128);
+    v256 r1 = v256_add_8(v256_add_8(v256_cmplt_s8(a, x), v256_cmplt_s8(b, x)),
+                         v256_add_8(v256_cmplt_s8(c, x), v256_cmplt_s8(d, x)));
+    v256 r2 = v256_add_8(v256_add_8(v256_cmpgt_s8(a, x), v256_cmpgt_s8(b, x)),
+                         v256_add_8(v256_cmpgt_s8(c, x), v256_cmpgt_s8(d, x)));
+    v256 delta = v256_sub_8(v256_cmplt_s8(r1, c2), v256_cmplt_s8(r2, c2));
+    v256 r = v256_add_8(o, delta);
+    v64_store_aligned(dst, v128_low_v64(v256_low_v128(r)));
+    v64_store_aligned(dst + dstride, v128_high_v64(v256_low_v128(r)));
+    v64_store_aligned(dst + 2*dstride, v128_low_v64(v256_high_v128(r)));
+    v64_store_aligned(dst + 3*dstride, v128_high_v64(v256_high_v128(r)));
+    src += 4*sstride;
+    dst += 4*dstride;
   }
 }
+
+/* Deblocking.  An 8 pixel edge segment is handled as two halves of 4
+   pixels, a and b, which are either the two halves of a luma segment
+   or the u and v segments of a chroma edge.  The p1, p0, q0 and q1
+   vectors hold the 8 pixels across the edge as 16 bit values. */
+
+void SIMD_KERNEL(clpf_block_simd)(const uint8_t *src, uint8_t *dst, int sstride, int dstride, int x0, int y0, int size, int width, int height) {
+  (size == 4 ? clpf_block4 : clpf_block8)(src, dst, sstride, dstride, x0, y0, width, height);
+}
+
+static void deblock_load_ver(const uint8_t *a, const uint8_t *b, int stride,
+                             v128 *p1, v128 *p0, v128 *q0, v128 *q1)
+{
+  /* Transpose 4x4 bytes */
+  const v128 t = v128_from_64(0x0f0b07030e0a0602LL, 0x0d0905010c080400LL);
+  v128 ra = v128_shuffle_8(v128_from_32(u32_load_unaligned(a + 3*stride - 2), u32_load_unaligned(a + 2*stride - 2),
+                                        u32_load_unaligned(a + 1*stride - 2), u32_load_unaligned(a - 2)), t);
+  v128 rb = v128_shuffle_8(v128_from_32(u32_load_unaligned(b + 3*stride - 2), u32_load_unaligned(b + 2*stride - 2),
+                                        u32_load_unaligned(b + 1*stride - 2), u32_load_unaligned(b - 2)), t);
+  v128 x = v128_ziplo_32(rb, ra);
+  v128 y = v128_ziphi_32(rb, ra);
+  *p1 = v128_unpacklo_u8_s16(x);
+  *p0 = v128_unpackhi_u8_s16(x);
+  *q0 = v128_unpacklo_u8_s16(y);
+  *q1 = v128_unpackhi_u8_s16(y);
+}
+
+static void deblock_store_ver(uint8_t *a, uint8_t *b, int stride,
+                              v128 p1, v128 p0, v128 q0, v128 q1, int filter)
+{
+  const v128 t = v128_from_64(0x0f0b07030e0a0602LL, 0x0d0905010c080400LL);
+  v128 x = v128_pack_s16_u8(p0, p1);
+  v128 y = v128_pack_s16_u8(q1, q0);
+  v128 lo = v128_ziplo_32(y, x);
+  v128 hi = v128_ziphi_32(y, x);
+  if (filter & 1) {
+    v128 r = v128_shuffle_8(v128_ziplo_32(hi, lo), t);
+    u32_store_unaligned(a - 2, v128_low_u32(r));
+    u32_store_unaligned(a + 1*stride - 2, v128_low_u32(v128_shr_n_byte(r, 4)));
+    u32_store_unaligned(a + 2*stride - 2, v128_low_u32(v128_shr_n_byte(r, 8)));
+    u32_store_unaligned(a + 3*stride - 2, v128_low_u32(v128_shr_n_byte(r, 12)));
+  }
+  if (filter & 2) {
+    v128 r = v128_shuffle_8(v128_ziphi_32(hi, lo), t);
+    u32_store_unaligned(b - 2, v128_low_u32(r));
+    u32_store_unaligned(b + 1*stride - 2, v128_low_u32(v128_shr_n_byte(r, 4)));
+    u32_store_unaligned(b + 2*stride - 2, v128_low_u32(v128_shr_n_byte(r, 8)));
+    u32_store_unaligned(b + 3*stride - 2, v128_low_u32(v128_shr_n_byte(r, 12)));
+  }
+}
+
+static void deblock_load_hor(const uint8_t *a, const uint8_t *b, int stride,
+                             v128 *p1, v128 *p0, v128 *q0, v128 *q1)
+{
+  *p1 = v128_unpack_u8_s16(v64_from_32(u32_load_unaligned(b - 2*stride), u32_load_unaligned(a - 2*stride)));
+  *p0 = v128_unpack_u8_s16(v64_from_32(u32_load_unaligned(b - 1*stride), u32_load_unaligned(a - 1*stride)));
+  *q0 = v128_unpack_u8_s16(v64_from_32(u32_load_unaligned(b), u32_load_unaligned(a)));
+  *q1 = v128_unpack_u8_s16(v64_from_32(u32_load_unaligned(b + 1*stride), u32_load_unaligned(a + 1*stride)));
+}
+
+static void deblock_store_hor(uint8_t *a, uint8_t *b, int stride,
+                              v128 p1, v128 p0, v128 q0, v128 q1, int filter)
+{
+  v128 x = v128_pack_s16_u8(p0, p1);
+  v128 y = v128_pack_s16_u8(q1, q0);
+  if (filter & 1) {
+    u32_store_unaligned(a - 2*stride, v128_low_u32(x));
+    u32_store_unaligned(a - 1*stride, v128_low_u32(v128_shr_n_byte(x, 8)));
+    u32_store_unaligned(a, v128_low_u32(y));
+    u32_store_unaligned(a + 1*stride, v128_low_u32(v128_shr_n_byte(y, 8)));
+  }
+  if (filter & 2) {
+    u32_store_unaligned(b - 2*stride, v128_low_u32(v128_shr_n_byte(x, 4)));
+    u32_store_unaligned(b - 1*stride, v128_low_u32(v128_shr_n_byte(x, 12)));
+    u32_store_unaligned(b, v128_low_u32(v128_shr_n_byte(y, 4)));
+    u32_store_unaligned(b + 1*stride, v128_low_u32(v128_shr_n_byte(y, 12)));
+  }
+}
+
+/* delta = clip((18*(q0-p0) - 6*(q1-p1) + 16)>>5, -tc, tc), with p1 and q1
+   moved by delta/2 rounded towards zero */
+static void deblock_filter_y(v128 *p1, v128 *p0, v128 *q0, v128 *q1, int tc)
+{
+  v128 ctc = v128_dup_16(tc);
+  v128 delta = v128_sub_16(v128_mullo_s16(v128_dup_16(18), v128_sub_16(*q0, *p0)),
+                           v128_mullo_s16(v128_dup_16(6), v128_sub_16(*q1, *p1)));
+  delta = v128_shr_n_s16(v128_add_16(delta, v128_dup_16(16)), 5);
+  delta = v128_min_s16(v128_max_s16(delta, v128_sub_16(v128_zero(), ctc)), ctc);
+  v128 half = v128_shr_n_s16(v128_sub_16(delta, v128_shr_n_s16(delta, 15)), 1);
+  *p1 = v128_add_16(*p1, half);
+  *p0 = v128_add_16(*p0, delta);
+  *q0 = v128_sub_16(*q0, delta);
+  *q1 = v128_sub_16(*q1, half);
+}
+
+/* delta = clip((4*(q0-p0) + (p1-q1) + 4)>>3, -tc, tc) */
+static void deblock_filter_uv(v128 p1, v128 *p0, v128 *q0, v128 q1, int tc)
+{
+  v128 ctc = v128_dup_16(tc);
+  v128 delta = v128_add_16(v128_shl_n_16(v128_sub_16(*q0, *p0), 2), v128_sub_16(p1, q1));
+  delta = v128_shr_n_s16(v128_add_16(delta, v128_dup_16(4)), 3);
+  delta = v128_min_s16(v128_max_s16(delta, v128_sub_16(v128_zero(), ctc)), ctc);
+  *p0 = v128_add_16(*p0, delta);
+  *q0 = v128_sub_16(*q0, delta);
+}
+
+/* Luma vertical edge, p at q0 of the first row.  Bit 0 of filter
+   selects rows 0-3, bit 1 rows 4-7. */
+void SIMD_KERNEL(deblock_ver_y_simd)(uint8_t *p, int stride, int tc, int filter)
+{
+  v128 p1, p0, q0, q1;
+  deblock_load_ver(p, p + 4*stride, stride, &p1, &p0, &q0, &q1);
+  deblock_filter_y(&p1, &p0, &q0, &q1, tc);
+  deblock_store_ver(p, p + 4*stride, stride, p1, p0, q0, q1, filter);
+}
+
+/* Luma horizontal edge, p at q0 of the first column.  Bit 0 of filter
+   selects columns 0-3, bit 1 columns 4-7. */
+void SIMD_KERNEL(deblock_hor_y_simd)(uint8_t *p, int stride, int tc, int filter)
+{
+  v128 p1, p0, q0, q1;
+  deblock_load_hor(p, p + 4, stride, &p1, &p0, &q0, &q1);
+  deblock_filter_y(&p1, &p0, &q0, &q1, tc);
+  deblock_store_hor(p, p + 4, stride, p1, p0, q0, q1, filter);
+}
+
+/* Chroma vertical edge in both planes, u and v at q0 of the first row */
+void SIMD_KERNEL(deblock_ver_uv_simd)(uint8_t *u, uint8_t *v, int stride, int tc)
+{
+  v128 p1, p0, q0, q1;
+  deblock_load_ver(u, v, stride, &p1, &p0, &q0, &q1);
+  deblock_filter_uv(p1, &p0, &q0, q1, tc);
+  deblock_store_ver(u, v, stride, p1, p0, q0, q1, 3);
+}
+
+/* Chroma horizontal edge in both planes, u and v at q0 of the first column */
+void SIMD_KERNEL(deblock_hor_uv_simd)(uint8_t *u, uint8_t *v, int stride, int tc)
+{
+  v128 p1, p0, q0, q1;
+  deblock_load_hor(u, v, stride, &p1, &p0, &q0, &q1);
+  deblock_filter_uv(p1, &p0, &q0, q1, tc);
+  deblock_store_hor(u, v, stride, p1, p0, q0, q1, 3);
+}
+
+/* Intra prediction.  Each mode reduces to building one line of filtered
+   edge pixels and copying each row of the block out of that line at a
+   row dependent offset, so the line is built once and the rows are
+   plain vector copies.  The line buffers are padded so that the 16 byte
+   loads and stores may run past the valid data. */
+
+#define INTRA_LINE (4*MAX_TR_SIZE+32)
+
+SIMD_INLINE void intra_copy_row(uint8_t *dst, const uint8_t *src, int size)
+{
+  if (size == 4)
+    u32_store_unaligned(dst, u32_load_unaligned(src));
+  else if (size == 8)
+    v64_store_unaligned(dst, v64_load_unaligned(src));
+  else
+    for (int j = 0; j < size; j += 16)
+      v128_store_unaligned(dst + j, v128_load_unaligned(src + j));
+}
+
+SIMD_INLINE void intra_fill_row(uint8_t *dst, v128 v, int size)
+{
+  if (size == 4)
+    u32_store_unaligned(dst, v128_low_u32(v));
+  else if (size == 8)
+    v64_store_unaligned(dst, v128_low_v64(v));
+  else
+    for (int j = 0; j < size; j += 16)
+      v128_store_unaligned(dst + j, v);
+}
+
+/* out[j] = (in[j-1] + 2*in[j] + in[j+1] + 2) >> 2 with the ends repeated,
+   which is the rounded average of in[j] and the truncated average of
+   its neighbours */
+SIMD_INLINE void intra_filter_121(const uint8_t *in, uint8_t *out, int len)
+{
+  uint8_t ext[INTRA_LINE];
+  ext[0] = in[0];
+  memcpy(ext + 1, in, len);
+  ext[len + 1] = in[len - 1];
+  for (int j = 0; j < len; j += 16) {
+    v128 a = v128_load_unaligned(ext + j);
+    v128 b = v128_load_unaligned(ext + j + 1);
+    v128 c = v128_load_unaligned(ext + j + 2);
+    v128_store_unaligned(out + j, v128_avg_u8(v128_rdavg_u8(a, c), b));
+  }
+}
+
+/* out[j] = in[j] + in[j+1] truncated to half for j < len */
+SIMD_INLINE void intra_halves(const uint8_t *in, uint8_t *out, int len)
+{
+  for (int j = 0; j < len; j += 16)
+    v128_store_unaligned(out + j, v128_rdavg_u8(v128_load_unaligned(in + j), v128_load_unaligned(in + j + 1)));
+}
+
+/* The [1 2 2 2 1] filter of the planar mode with the ends repeated */
+SIMD_INLINE void intra_filter_12221(const uint8_t *in, int16_t *out, int size)
+{
+  uint8_t ext[MAX_TR_SIZE+16];
+  ext[0] = ext[1] = in[0];
+  memcpy(ext + 2, in, size);
+  ext[size + 2] = ext[size + 3] = in[size - 1];
+  for (int j = 0; j < size; j += 8) {
+    v128 e0 = v128_unpack_u8_s16(v64_load_unaligned(ext + j));
+    v128 e1 = v128_unpack_u8_s16(v64_load_unaligned(ext + j + 1));
+    v128 e2 = v128_unpack_u8_s16(v64_load_unaligned(ext + j + 2));
+    v128 e3 = v128_unpack_u8_s16(v64_load_unaligned(ext + j + 3));
+    v128 e4 = v128_unpack_u8_s16(v64_load_unaligned(ext + j + 4));
+    v128_store_unaligned(out + j, v128_add_16(v128_add_16(e0, e4),
+                                              v128_shl_n_16(v128_add_16(v128_add_16(e1, e2), e3), 1)));
+  }
+}
+
+SIMD_INLINE void intra_dc(const uint8_t *left, const uint8_t *top, int size, uint8_t *pblock)
+{
+  sad128_internal s = v128_sad_u8_init();
+  if (size == 4)
+    s = v128_sad_u8(s, v128_from_32(0, 0, u32_load_unaligned(top), u32_load_unaligned(left)), v128_zero());
+  else if (size == 8)
+    s = v128_sad_u8(s, v128_from_v64(v64_load_unaligned(top), v64_load_unaligned(left)), v128_zero());
+  else
+    for (int j = 0; j < size; j += 16) {
+      s = v128_sad_u8(s, v128_load_unaligned(top + j), v128_zero());
+      s = v128_sad_u8(s, v128_load_unaligned(left + j), v128_zero());
+    }
+  v128 dc = v128_dup_8((v128_sad_u8_sum(s) + size)/(2*size));
+  for (int i = 0; i < size; i++)
+    intra_fill_row(pblock + i*size, dc, size);
+}
+
+SIMD_INLINE void intra_planar(const uint8_t *left, const uint8_t *top, int top_left, int size, uint8_t *pblock)
+{
+  int16_t topF[MAX_TR_SIZE+8];
+  int16_t leftF[MAX_TR_SIZE+8];
+  int top_leftF = left[1] + 2*left[0] + 2*top_left + 2*top[0] + top[1];
+
+  intra_filter_12221(top, topF, size);
+  intra_filter_12221(left, leftF, size);
+
+  /* (leftF + topF - top_leftF + 4)/8 clipped, where the arithmetic shift
+     only differs from the division for sums that clip to 0 anyway */
+  for (int i = 0; i < size; i++) {
+    v128 l = v128_dup_16(leftF[i] - top_leftF + 4);
+    if (size < 16) {
+      v128 r = v128_shr_n_s16(v128_add_16(v128_load_unaligned(topF), l), 3);
+      intra_fill_row(pblock + i*size, v128_pack_s16_u8(r, r), size);
+    } else {
+      for (int j = 0; j < size; j += 16) {
+        v128 r0 = v128_shr_n_s16(v128_add_16(v128_load_unaligned(topF + j), l), 3);
+        v128 r1 = v128_shr_n_s16(v128_add_16(v128_load_unaligned(topF + j + 8), l), 3);
+        v128_store_unaligned(pblock + i*size + j, v128_pack_s16_u8(r1, r0));
+      }
+    }
+  }
+}
+
+SIMD_INLINE void intra_pred(const uint8_t *left, const uint8_t *top, int top_left, int size, uint8_t *pblock, int mode)
+{
+  uint8_t leftF[INTRA_LINE];
+  uint8_t topF[INTRA_LINE];
+  uint8_t line[INTRA_LINE];
+  uint8_t line2[INTRA_LINE];
+  int top_leftF = 0;
+  int i, k;
+
+  if (mode == MODE_UPLEFT || mode == MODE_UPUPLEFT || mode == MODE_UPLEFTLEFT) {
+    intra_filter_121(left, leftF, size);
+    intra_filter_121(top, topF, size);
+    top_leftF = (2*top_left + left[0] + top[0] + 2) >> 2;
+  }
+
+  switch (mode) {
+  case MODE_HOR:
+    for (i = 0; i < size; i++)
+      intra_fill_row(pblock + i*size, v128_dup_8(left[i]), size);
+    break;
+  case MODE_VER:
+    for (i = 0; i < size; i++)
+      intra_copy_row(pblock + i*size, top, size);
+    break;
+  case MODE_PLANAR:
+    intra_planar(left, top, top_left, size, pblock);
+    break;
+  case MODE_UPLEFT:
+    /* Row i starts at line[size - i] */
+    for (k = 0; k < size; k++)
+      line[size - 1 - k] = leftF[k];
+    line[size] = top_leftF;
+    memcpy(line + size + 1, topF, size);
+    for (i = 0; i < size; i++)
+      intra_copy_row(pblock + i*size, line + size - i, size);
+    break;
+  case MODE_UPRIGHT:
+    intra_filter_121(top, topF, 2*size);
+    for (i = 0; i < size; i++)
+      intra_copy_row(pblock + i*size, topF + i + 1, size);
+    break;
+  case MODE_UPUPRIGHT:
+    /* Odd rows take topF, even rows the averages of neighbouring topF */
+    intra_filter_121(top, topF, 2*size);
+    intra_halves(topF, line, 2*size);
+    for (i = 0; i < size; i++)
+      intra_copy_row(pblock + i*size, i & 1 ? topF + (i + 1)/2 : line + i/2, size);
+    break;
+  case MODE_UPUPLEFT:
+    /* Row 2r starts at line[size - r], row 2r + 1 at line2[size - r] */
+    for (k = 1; k < size/2; k++) {
+      line[size - k] = leftF[2*k - 2];
+      line2[size - k] = leftF[2*k - 1];
+    }
+    line[size] = (top_leftF + topF[0]) >> 1;
+    line2[size] = top_leftF;
+    intra_halves(topF, line + size + 1, size);
+    memcpy(line2 + size + 1, topF, size);
+    for (i = 0; i < size; i++)
+      intra_copy_row(pblock + i*size, (i & 1 ? line2 : line) + size - i/2, size);
+    break;
+  case MODE_UPLEFTLEFT:
+    /* Row i starts at line[2*size - 2*i] */
+    for (k = 1; k <= 2*size - 2; k++)
+      line[2*size - k] = k & 1 ? leftF[k >> 1] : (leftF[k >> 1] + leftF[(k >> 1) - 1]) >> 1;
+    line[2*size] = (top_leftF + leftF[0]) >> 1;
+    line[2*size + 1] = top_leftF;
+    memcpy(line + 2*size + 2, topF, size);
+    for (i = 0; i < size; i++)
+      intra_copy_row(pblock + i*size, line + 2*size - 2*i, size);
+    break;
+  case MODE_DOWNLEFTLEFT:
+    /* Interleave the averages of neighbouring leftF with leftF, row i
+       starts at line[2*i] */
+    intra_filter_121(left, leftF, 2*size);
+    intra_halves(leftF, line2, 2*size);
+    for (k = 0; k < 3*size/2; k += 16) {
+      v128 h = v128_load_unaligned(line2 + k);
+      v128 l = v128_load_unaligned(leftF + k + 1);
+      v128_store_unaligned(line + 2*k, v128_ziplo_8(l, h));
+      v128_store_unaligned(line + 2*k + 16, v128_ziphi_8(l, h));
+    }
+    for (i = 0; i < size; i++)
+      intra_copy_row(pblock + i*size, line + 2*i, size);
+    break;
+  default:
+    intra_dc(left, top, size, pblock);
+    break;
+  }
+}
+
+/* Intra prediction of a size x size block (size 2 to 64) for an
+   intra_mode_t mode.  For MODE_DC left and top are the two edges to
+   average.  Constant sizes let each case be specialised. */
+void SIMD_KERNEL(intra_pred_simd)(const uint8_t *left, const uint8_t *top, int top_left, int size, uint8_t *pblock, int mode)
+{
+  switch (size) {
+  case 2: intra_pred_non_simd(left, top, top_left, size, pblock, mode); break;
+  case 4: intra_pred(left, top, top_left, 4, pblock, mode); break;
+  case 8: intra_pred(left, top, top_left, 8, pblock, mode); break;
+  case 16: intra_pred(left, top, top_left, 16, pblock, mode); break;
+  case 32: intra_pred(left, top, top_left, 32, pblock, mode); break;
+  default: intra_pred(left, top, top_left, 64, pblock, mode); break;
+  }
+}
+
+const common_kernels_t SIMD_KERNEL(common_kernels_simd) = {
+  SIMD_KERNEL(block_avg_simd),
+  SIMD_KERNEL(sad_calc_simd_unaligned),
+  SIMD_KERNEL(get_inter_prediction_luma_simd),
+  SIMD_KERNEL(get_inter_prediction_chroma_simd),
+  SIMD_KERNEL(transform_simd),
+  SIMD_KERNEL(inverse_transform_simd),
+  SIMD_KERNEL(clpf_block_simd),
+#if NEW_DEBLOCK_FILTER
+  SIMD_KERNEL(deblock_ver_y_simd),
+  SIMD_KERNEL(deblock_hor_y_simd),
+#else
+  /* The SIMD kernels only implement the NEW_DEBLOCK_FILTER formula */
+  deblock_ver_y_non_simd,
+  deblock_hor_y_non_simd,
+#endif
+  SIMD_KERNEL(deblock_ver_uv_simd),
+  SIMD_KERNEL(deblock_hor_uv_simd),
+  SIMD_KERNEL(intra_pred_simd),
+  SIMD_KERNEL(scale_frame_down2x2_simd)
+};
+
+#ifdef COMMON_KERNELS_DISPATCH
+
+#ifdef THOR_KERNELS_SSE4
+extern const common_kernels_t common_kernels_simd_sse4;
+#endif
+#ifdef THOR_KERNELS_AVX2
+extern const common_kernels_t common_kernels_simd_avx2;
+#endif
+
+/* The plain C versions, used when simd_level is SIMD_NONE */
+const common_kernels_t common_kernels_non_simd = {
+  block_avg_non_simd,
+  sad_calc_unaligned_non_simd,
+  get_inter_prediction_luma_non_simd,
+  get_inter_prediction_chroma_non_simd,
+  transform_non_simd,
+  inverse_transform_non_simd,
+  clpf_block,
+  deblock_ver_y_non_simd,
+  deblock_hor_y_non_simd,
+  deblock_ver_uv_non_simd,
+  deblock_hor_uv_non_simd,
+  intra_pred_non_simd,
+  scale_frame_down2x2_non_simd
+};
+
+const common_kernels_t *common_kernels = &common_kernels_non_simd;
+
+void init_common_kernels(void)
+{
+  common_kernels = simd_level > SIMD_NONE ? &common_kernels_simd : &common_kernels_non_simd;
+#ifdef THOR_KERNELS_SSE4
+  if (simd_level >= SIMD_SSE4)
+    common_kernels = &common_kernels_simd_sse4;
+#endif
+#ifdef THOR_KERNELS_AVX2
+  if (simd_level >= SIMD_AVX2)
+    common_kernels = &common_kernels_simd_avx2;
+#endif
+}
+
+#endif
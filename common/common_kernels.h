@@ -28,16 +28,59 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define COMMON_SIMDKERNELS_H
 
 #include <stdint.h>
+#include "types.h"
+
 void block_avg_simd(uint8_t *p,uint8_t *r0, uint8_t *r1, int sp, int s0, int s1, int width, int height);
 int sad_calc_simd_unaligned(uint8_t *a, uint8_t *b, int astride, int bstride, int width, int height);
 void get_inter_prediction_luma_simd(int width, int height, int xoff, int yoff, unsigned char *restrict qp, int qstride, const unsigned char *restrict ip, int istride, int bipred);
 void get_inter_prediction_chroma_simd(int width, int height, int xoff, int yoff, unsigned char *restrict qp, int qstride, const unsigned char *restrict ip, int istride);
 void transform_simd(const int16_t *block, int16_t *coeff, int size, int fast);
 void inverse_transform_simd(const int16_t *coeff, int16_t *block, int size);
-void clpf_block4(const uint8_t *src, uint8_t *dst, int sstride, int dstride, int x0, int y0, int width, int height);
-void clpf_block8(const uint8_t *src, uint8_t *dst, int sstride, int dstride, int x0, int y0, int width, int height);
-SIMD_INLINE void clpf_block_simd(const uint8_t *src, uint8_t *dst, int sstride, int dstride, int x0, int y0, int size, int width, int height) {
-  (size == 4 ? clpf_block4 : clpf_block8)(src, dst, sstride, dstride, x0, y0, width, height);
-}
+void clpf_block_simd(const uint8_t *src, uint8_t *dst, int sstride, int dstride, int x0, int y0, int size, int width, int height);
+void deblock_ver_y_simd(uint8_t *p, int stride, int tc, int filter);
+void deblock_hor_y_simd(uint8_t *p, int stride, int tc, int filter);
+void deblock_ver_uv_simd(uint8_t *u, uint8_t *v, int stride, int tc);
+void deblock_hor_uv_simd(uint8_t *u, uint8_t *v, int stride, int tc);
+void intra_pred_simd(const uint8_t *left, const uint8_t *top, int top_left, int size, uint8_t *pblock, int mode);
+void scale_frame_down2x2_simd(yuv_frame_t* sin, yuv_frame_t* sout);
+
+/* Plain C versions of the kernels, defined next to their callers.  The
+   SIMD kernels fall back to these for block sizes they don't handle. */
+void block_avg_non_simd(uint8_t *p,uint8_t *r0, uint8_t *r1, int sp, int s0, int s1, int width, int height);
+int sad_calc_unaligned_non_simd(uint8_t *a, uint8_t *b, int astride, int bstride, int width, int height);
+void get_inter_prediction_luma_non_simd(int width, int height, int xoff, int yoff, unsigned char *restrict qp, int qstride, const unsigned char *restrict ip, int istride, int bipred);
+void get_inter_prediction_chroma_non_simd(int width, int height, int xoff, int yoff, unsigned char *restrict qp, int qstride, const unsigned char *restrict ip, int istride);
+void transform_non_simd(const int16_t *block, int16_t *coeff, int size, int fast);
+void inverse_transform_non_simd(const int16_t *coeff, int16_t *block, int size);
+void clpf_block(const uint8_t *src, uint8_t *dst, int sstride, int dstride, int x0, int y0, int size, int width, int height);
+void deblock_ver_y_non_simd(uint8_t *p, int stride, int tc, int filter);
+void deblock_hor_y_non_simd(uint8_t *p, int stride, int tc, int filter);
+void deblock_ver_uv_non_simd(uint8_t *u, uint8_t *v, int stride, int tc);
+void deblock_hor_uv_non_simd(uint8_t *u, uint8_t *v, int stride, int tc);
+void intra_pred_non_simd(const uint8_t *left, const uint8_t *top, int top_left, int size, uint8_t *pblock, int mode);
+void scale_frame_down2x2_non_simd(yuv_frame_t* sin, yuv_frame_t* sout);
+
+/* The kernels above, as built for one SIMD level.  Callers go through
+   common_kernels, which init_common_kernels() points at the table
+   matching simd_level, or at the C versions for SIMD_NONE. */
+typedef struct
+{
+  void (*block_avg)(uint8_t *p,uint8_t *r0, uint8_t *r1, int sp, int s0, int s1, int width, int height);
+  int (*sad_calc_unaligned)(uint8_t *a, uint8_t *b, int astride, int bstride, int width, int height);
+  void (*get_inter_prediction_luma)(int width, int height, int xoff, int yoff, unsigned char *restrict qp, int qstride, const unsigned char *restrict ip, int istride, int bipred);
+  void (*get_inter_prediction_chroma)(int width, int height, int xoff, int yoff, unsigned char *restrict qp, int qstride, const unsigned char *restrict ip, int istride);
+  void (*transform)(const int16_t *block, int16_t *coeff, int size, int fast);
+  void (*inverse_transform)(const int16_t *coeff, int16_t *block, int size);
+  void (*clpf_block)(const uint8_t *src, uint8_t *dst, int sstride, int dstride, int x0, int y0, int size, int width, int height);
+  void (*deblock_ver_y)(uint8_t *p, int stride, int tc, int filter);
+  void (*deblock_hor_y)(uint8_t *p, int stride, int tc, int filter);
+  void (*deblock_ver_uv)(uint8_t *u, uint8_t *v, int stride, int tc);
+  void (*deblock_hor_uv)(uint8_t *u, uint8_t *v, int stride, int tc);
+  void (*intra_pred)(const uint8_t *left, const uint8_t *top, int top_left, int size, uint8_t *pblock, int mode);
+  void (*scale_frame_down2x2)(yuv_frame_t* sin, yuv_frame_t* sout);
+} common_kernels_t;
+
+extern const common_kernels_t *common_kernels;
+void init_common_kernels(void);
 
 #endif
@@ -59,7 +59,8 @@ static inline void fatalerror(char error_text[])
 #define NUM_BLOCK_SIZES 4        //Number of distinct block sizes (=log2(MAX_BLOCK_SIZE/MIN_BLOCK_SIZE)+1)
 #define MIN_PB_SIZE 4            //Minimum pu block size
 #define MAX_QUANT_SIZE 16        //Maximum quantization block size
-#define MAX_BUFFER_SIZE 4000000  //Maximum compressed buffer size per frame
+#define MAX_BUFFER_SIZE 4000000  //Initial compressed buffer size per frame, grown as needed
+#define MAX_SB_BUFFER_SIZE (16*MAX_BLOCK_SIZE*MAX_BLOCK_SIZE) //Initial compressed buffer size per superblock
 #define MAX_TR_SIZE 64           //Maximum transform size
 #define PADDING_Y 96             //One-sided padding range for luma
 #define MAX_UINT32 1<<31         //Used e.g. to initialize search for minimum cost
@@ -67,8 +68,12 @@ static inline void fatalerror(char error_text[])
 #define MAX_REF_FRAMES 33        //Maximum number of reference frames
 #define MAX_SKIP_FRAMES 8        //Maximum number of frames to skip/interpolate
 #define MAX_REORDER_BUFFER 32    //Maximum number of frames to store for reordering
+#define MAX_READ_AHEAD 4         //Number of input frames read ahead of the encoder
 #define ME_CANDIDATES 6          //Number of ME candidates
 #define MAX_QP 51                //Maximum QP value
+#define MAX_THREADS 64           //Maximum number of worker threads
+#define MAX_FRAME_JOBS 16        //Maximum number of frames being encoded concurrently
+#define MAX_TILES 256            //Maximum number of tile rows or columns
 
 #define DYADIC_CODING 1          // Support hierarchical B frames
 
@@ -69,117 +69,112 @@ static const int8_t filter_coeffsC[8][4] = {
     {-2, 10, 58, -2}
 };
 
-void get_inter_prediction_chroma(uint8_t *pblock, uint8_t *ref, int width, int height, int stride, int pstride, mv_t *mv, int sign)
+void get_inter_prediction_chroma_non_simd(int width, int height, int xoff, int yoff, unsigned char *restrict qp, int qstride, const unsigned char *restrict ip, int istride)
 {
-  int i,j;
-
-  int m,i_off,j_off;
-  mv_t mvtemp;
-  mvtemp.x = sign ? -mv->x : mv->x;
-  mvtemp.y = sign ? -mv->y : mv->y;
-  int ver_frac = (mvtemp.y)&7;
-  int hor_frac = (mvtemp.x)&7;
-  int ver_int = (mvtemp.y)>>3;
-  int hor_int = (mvtemp.x)>>3;
+  int i,j,m;
   int16_t tmp[80][80];
 
-  if (ver_frac==0 && hor_frac==0){
-    j_off = 0 + hor_int;
-    for(i=0;i<height;i++){
-      i_off = i + ver_int;
-      memcpy(pblock + i*pstride,ref + i_off*stride + j_off, width*sizeof(uint8_t));
+  /* Horizontal filtering */
+  for(i=-1;i<height+2;i++){
+    for (j=0;j<width;j++){
+      int sum = 0;
+      for (m=0;m<4;m++) sum += filter_coeffsC[xoff][m] * ip[i * istride + j + m - 1];
+      tmp[i+1][j] = sum;
     }
-    return;
   }
 
-  if (use_simd && width > 2)
-    get_inter_prediction_chroma_simd(width, height, hor_frac, ver_frac, pblock, pstride, ref + ver_int*stride + hor_int, stride);
-  else {
-    /* Horizontal filtering */
-    for(i=-1;i<height+2;i++){
-      for (j=0;j<width;j++){
-        int sum = 0;
-        i_off = i + ver_int;
-        j_off = j + hor_int;
-        for (m=0;m<4;m++) sum += filter_coeffsC[hor_frac][m] * ref[i_off * stride + j_off + m - 1];
-        tmp[i+1][j] = sum;
-      }
-    }
-
-    /* Vertical filtering */
-    for(i=0;i<height;i++){
-      for (j=0;j<width;j++){
-        int sum = 0;
-        for (m=0;m<4;m++) sum += filter_coeffsC[ver_frac][m] * tmp[i+m][j];
-        pblock[i*pstride+j] = clip255((sum + 2048)>>12);
-      }
+  /* Vertical filtering */
+  for(i=0;i<height;i++){
+    for (j=0;j<width;j++){
+      int sum = 0;
+      for (m=0;m<4;m++) sum += filter_coeffsC[yoff][m] * tmp[i+m][j];
+      qp[i*qstride+j] = clip255((sum + 2048)>>12);
     }
   }
 }
 
-void get_inter_prediction_luma(uint8_t *pblock, uint8_t *ref, int width, int height, int stride, int pstride, mv_t *mv, int sign, int bipred)
+void get_inter_prediction_luma_non_simd(int width, int height, int xoff, int yoff, unsigned char *restrict qp, int qstride, const unsigned char *restrict ip, int istride, int bipred)
 {
-  int i,j;
-  int m,i_off,j_off;
-  mv_t mvtemp;
-  mvtemp.x = sign ? -mv->x : mv->x;
-  mvtemp.y = sign ? -mv->y : mv->y;
-  int ver_frac = (mvtemp.y)&3;
-  int hor_frac = (mvtemp.x)&3;
-  int ver_int = (mvtemp.y)>>2;
-  int hor_int = (mvtemp.x)>>2;
+  int i,j,m;
   int32_t tmp[MAX_BLOCK_SIZE+16][MAX_BLOCK_SIZE + 16]; //7-bit filter exceeds 16 bit temporary storage
-  /* Integer position */
-  if (ver_frac==0 && hor_frac==0){
-    j_off = 0 + hor_int;
-    for(i=0;i<height;i++){
-      i_off = i + ver_int;
-      memcpy(pblock + i*pstride,ref + i_off*stride+j_off, width*sizeof(uint8_t));
-    }
-    return;
-  }
 
-  if (use_simd)
-    get_inter_prediction_luma_simd(width, height, hor_frac, ver_frac, pblock, pstride, ref + ver_int*stride + hor_int, stride, bipred);
   /* Special lowpass filter at center position */
-  else if (ver_frac == 2 && hor_frac == 2) {
+  if (yoff == 2 && xoff == 2) {
     for(i=0;i<height;i++){
       for (j=0;j<width;j++){
         int sum = 0;
-        i_off = i + ver_int;
-        j_off = j + hor_int;
-        sum += 0*ref[(i_off-1)*stride+j_off-1]+1*ref[(i_off-1)*stride+j_off+0]+1*ref[(i_off-1)*stride+j_off+1]+0*ref[(i_off-1)*stride+j_off+2];
-        sum += 1*ref[(i_off+0)*stride+j_off-1]+2*ref[(i_off+0)*stride+j_off+0]+2*ref[(i_off+0)*stride+j_off+1]+1*ref[(i_off+0)*stride+j_off+2];
-        sum += 1*ref[(i_off+1)*stride+j_off-1]+2*ref[(i_off+1)*stride+j_off+0]+2*ref[(i_off+1)*stride+j_off+1]+1*ref[(i_off+1)*stride+j_off+2];
-        sum += 0*ref[(i_off+2)*stride+j_off-1]+1*ref[(i_off+2)*stride+j_off+0]+1*ref[(i_off+2)*stride+j_off+1]+0*ref[(i_off+2)*stride+j_off+2];
-        pblock[i*pstride+j] = clip255((sum + 8)>>4);
+        sum += 0*ip[(i-1)*istride+j-1]+1*ip[(i-1)*istride+j+0]+1*ip[(i-1)*istride+j+1]+0*ip[(i-1)*istride+j+2];
+        sum += 1*ip[(i+0)*istride+j-1]+2*ip[(i+0)*istride+j+0]+2*ip[(i+0)*istride+j+1]+1*ip[(i+0)*istride+j+2];
+        sum += 1*ip[(i+1)*istride+j-1]+2*ip[(i+1)*istride+j+0]+2*ip[(i+1)*istride+j+1]+1*ip[(i+1)*istride+j+2];
+        sum += 0*ip[(i+2)*istride+j-1]+1*ip[(i+2)*istride+j+0]+1*ip[(i+2)*istride+j+1]+0*ip[(i+2)*istride+j+2];
+        qp[i*qstride+j] = clip255((sum + 8)>>4);
       }
     }
   } else {
     /* Vertical filtering */
-    const int16_t *filterV = (bipred ? filter_coeffsYbi : filter_coeffsYuni)[ver_frac];
+    const int16_t *filterV = (bipred ? filter_coeffsYbi : filter_coeffsYuni)[yoff];
     for(i=-OFFYM1;i<width+OFFY;i++){
       for (j=0;j<height;j++){
         int sum = 0;
-        i_off = i + hor_int;
-        j_off = j + ver_int;
-        for (m=0;m<NTAPY;m++) sum += filterV[m] * ref[(j_off + m - OFFYM1) * stride + i_off];
+        for (m=0;m<NTAPY;m++) sum += filterV[m] * ip[(j + m - OFFYM1) * istride + i];
         tmp[j][i+OFFYM1] = sum;
       }
     }
     /* Horizontal filtering */
-    const int16_t *filterH = (bipred ? filter_coeffsYbi : filter_coeffsYuni)[hor_frac];
+    const int16_t *filterH = (bipred ? filter_coeffsYbi : filter_coeffsYuni)[xoff];
     for(i=0;i<width;i++){
       for (j=0;j<height;j++){
         int sum = 0;
         for (m=0;m<NTAPY;m++) sum += filterH[m] * tmp[j][i+m];
-        pblock[j*pstride+i] = clip255((sum + 2048)>>12);
+        qp[j*qstride+i] = clip255((sum + 2048)>>12);
       }
     }
   }
 }
 
-mv_t get_mv_pred(int ypos,int xpos,int width,int height,int size,int ref_idx,deblock_data_t *deblock_data) //TODO: Remove ref_idx as argument if not needed
+void get_inter_prediction_chroma(uint8_t *pblock, uint8_t *ref, int width, int height, int stride, int pstride, mv_t *mv, int sign)
+{
+  int i;
+  mv_t mvtemp;
+  mvtemp.x = sign ? -mv->x : mv->x;
+  mvtemp.y = sign ? -mv->y : mv->y;
+  int ver_frac = (mvtemp.y)&7;
+  int hor_frac = (mvtemp.x)&7;
+  int ver_int = (mvtemp.y)>>3;
+  int hor_int = (mvtemp.x)>>3;
+
+  if (ver_frac==0 && hor_frac==0){
+    for(i=0;i<height;i++){
+      memcpy(pblock + i*pstride,ref + (i + ver_int)*stride + hor_int, width*sizeof(uint8_t));
+    }
+    return;
+  }
+
+  common_kernels->get_inter_prediction_chroma(width, height, hor_frac, ver_frac, pblock, pstride, ref + ver_int*stride + hor_int, stride);
+}
+
+void get_inter_prediction_luma(uint8_t *pblock, uint8_t *ref, int width, int height, int stride, int pstride, mv_t *mv, int sign, int bipred)
+{
+  int i;
+  mv_t mvtemp;
+  mvtemp.x = sign ? -mv->x : mv->x;
+  mvtemp.y = sign ? -mv->y : mv->y;
+  int ver_frac = (mvtemp.y)&3;
+  int hor_frac = (mvtemp.x)&3;
+  int ver_int = (mvtemp.y)>>2;
+  int hor_int = (mvtemp.x)>>2;
+  /* Integer position */
+  if (ver_frac==0 && hor_frac==0){
+    for(i=0;i<height;i++){
+      memcpy(pblock + i*pstride,ref + (i + ver_int)*stride + hor_int, width*sizeof(uint8_t));
+    }
+    return;
+  }
+
+  common_kernels->get_inter_prediction_luma(width, height, hor_frac, ver_frac, pblock, pstride, ref + ver_int*stride + hor_int, stride, bipred);
+}
+
+mv_t get_mv_pred(int ypos,int xpos,int width,int height,int size,int ref_idx,deblock_data_t *deblock_data,const tile_t *tile) //TODO: Remove ref_idx as argument if not needed
 {
   mv_t mvp, mva, mvb, mvc;
   inter_pred_t zero_pred, inter_predA, inter_predB, inter_predC;
@@ -216,10 +211,10 @@ mv_t get_mv_pred(int ypos,int xpos,int width,int height,int size,int ref_idx,deb
   int upleft_index = block_index - block_stride - 1;
 
    /* Determine availability */
-  int up_available = get_up_available(ypos,xpos,size,width);
-  int left_available = get_left_available(ypos,xpos,size,width);
-  int upright_available = get_upright_available(ypos,xpos,size,width);
-  int downleft_available = get_downleft_available(ypos,xpos,size,height);
+  int up_available = get_up_available(ypos-tile->ypos,xpos-tile->xpos,size,tile->width);
+  int left_available = get_left_available(ypos-tile->ypos,xpos-tile->xpos,size,tile->width);
+  int upright_available = get_upright_available(ypos-tile->ypos,xpos-tile->xpos,size,tile->width);
+  int downleft_available = get_downleft_available(ypos-tile->ypos,xpos-tile->xpos,size,tile->height);
 
   int U = up_available;
   int UR = upright_available;
@@ -293,7 +288,7 @@ mv_t get_mv_pred(int ypos,int xpos,int width,int height,int size,int ref_idx,deb
   return mvp;
 }
 
-int get_mv_merge(int yposY, int xposY, int width, int height, int size, deblock_data_t *deblock_data, inter_pred_t *merge_candidates)
+int get_mv_merge(int yposY, int xposY, int width, int height, int size, deblock_data_t *deblock_data, const tile_t *tile, inter_pred_t *merge_candidates)
 {
   int num_merge_vec = 0;
   int i, idx, duplicate;
@@ -324,9 +319,9 @@ int get_mv_merge(int yposY, int xposY, int width, int height, int size, deblock_
   int upright_index = block_index - block_stride + block_size;
 
   /* Determine availability */
-  int up_available = get_up_available(yposY, xposY, size, width);
-  int left_available = get_left_available(yposY, xposY, size, width);
-  int upright_available = get_upright_available(yposY, xposY, size, width);
+  int up_available = get_up_available(yposY-tile->ypos, xposY-tile->xpos, size, tile->width);
+  int left_available = get_left_available(yposY-tile->ypos, xposY-tile->xpos, size, tile->width);
+  int upright_available = get_upright_available(yposY-tile->ypos, xposY-tile->xpos, size, tile->width);
 
 #if LIMITED_SKIP
   /* Special case for rectangular skip blocks at frame boundaries */
@@ -351,7 +346,7 @@ int get_mv_merge(int yposY, int xposY, int width, int height, int size, deblock_
   int left_index1 = block_index + block_stride*((block_size - 1) / 2) - 1;
   int upleft_index = block_index - block_stride - 1;
   int downleft_index = block_index + block_stride*block_size - 1;
-  int downleft_available = get_downleft_available(yposY, xposY, size, height);
+  int downleft_available = get_downleft_available(yposY-tile->ypos, xposY-tile->xpos, size, tile->height);
 
   /* Special case for rectangular skip blocks at frame boundaries */
   if (yposY + size > height) {
@@ -446,7 +441,7 @@ int get_mv_merge(int yposY, int xposY, int width, int height, int size, deblock_
   return num_merge_vec;
 }
 
-int get_mv_skip(int yposY, int xposY, int width, int height, int size, deblock_data_t *deblock_data, inter_pred_t *skip_candidates, int bipred_copy)
+int get_mv_skip(int yposY, int xposY, int width, int height, int size, deblock_data_t *deblock_data, const tile_t *tile, inter_pred_t *skip_candidates, int bipred_copy)
 {
   int num_skip_vec=0;
   int i,idx,duplicate;
@@ -477,9 +472,9 @@ int get_mv_skip(int yposY, int xposY, int width, int height, int size, deblock_d
   int upright_index = block_index - block_stride + block_size;
 
   /* Determine availability */
-  int up_available = get_up_available(yposY,xposY,size,width);
-  int left_available = get_left_available(yposY,xposY,size,width);
-  int upright_available = get_upright_available(yposY,xposY,size,width);
+  int up_available = get_up_available(yposY-tile->ypos,xposY-tile->xpos,size,tile->width);
+  int left_available = get_left_available(yposY-tile->ypos,xposY-tile->xpos,size,tile->width);
+  int upright_available = get_upright_available(yposY-tile->ypos,xposY-tile->xpos,size,tile->width);
 
 #if LIMITED_SKIP
   /* Special case for rectangular skip blocks at frame boundaries */
@@ -504,7 +499,7 @@ int get_mv_skip(int yposY, int xposY, int width, int height, int size, deblock_d
   int left_index1 = block_index + block_stride*((block_size - 1) / 2) - 1;
   int upleft_index = block_index - block_stride - 1;
   int downleft_index = block_index + block_stride*block_size - 1;
-  int downleft_available = get_downleft_available(yposY, xposY, size, height);
+  int downleft_available = get_downleft_available(yposY-tile->ypos, xposY-tile->xpos, size, tile->height);
 
   /* Special case for rectangular skip blocks at frame boundaries */
   if (yposY + size > height) {
@@ -30,8 +30,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 void get_inter_prediction_luma(uint8_t *pblock, uint8_t *ref, int width, int height, int stride, int pstride, mv_t *mv, int sign, int bipred);
 void get_inter_prediction_chroma(uint8_t *pblock, uint8_t *ref, int width, int height, int stride, int pstride, mv_t *mv, int sign);
-mv_t get_mv_pred(int yposY,int xposY,int width,int height,int size,int ref_idx,deblock_data_t *deblock_data);
-int get_mv_skip(int yposY, int xposY, int width, int height, int size, deblock_data_t *deblock_data, inter_pred_t *skip_candidates, int bipred_copy);
-int get_mv_merge(int yposY, int xposY, int width, int height, int size, deblock_data_t *deblock_data, inter_pred_t *skip_candidates);
+mv_t get_mv_pred(int yposY,int xposY,int width,int height,int size,int ref_idx,deblock_data_t *deblock_data,const tile_t *tile);
+int get_mv_skip(int yposY, int xposY, int width, int height, int size, deblock_data_t *deblock_data, const tile_t *tile, inter_pred_t *skip_candidates, int bipred_copy);
+int get_mv_merge(int yposY, int xposY, int width, int height, int size, deblock_data_t *deblock_data, const tile_t *tile, inter_pred_t *skip_candidates);
 
 #endif
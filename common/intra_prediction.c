@@ -34,9 +34,11 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "global.h"
 #include "common_block.h"
+#include "simd.h"
+#include "common_kernels.h"
 
 
-static void filter_121(uint8_t* in, uint8_t* out, int len)
+static void filter_121(const uint8_t* in, uint8_t* out, int len)
 {
   int j;
   /* Calculate filtered 1D arrays */
@@ -47,7 +49,7 @@ static void filter_121(uint8_t* in, uint8_t* out, int len)
   out[len-1] = (uint8_t)((in[len-2] + 2*in[len-1] + in[len-1] + 2)>>2);
 }
 
-static void filter_121_all(uint8_t* left_in, uint8_t* left_out, uint8_t* top_in, uint8_t* top_out, int len, uint8_t tl_in, uint8_t* tl_out)
+static void filter_121_all(const uint8_t* left_in, uint8_t* left_out, const uint8_t* top_in, uint8_t* top_out, int len, uint8_t tl_in, uint8_t* tl_out)
 {
   filter_121(left_in,left_out,len);
   filter_121(top_in,top_out,len);
@@ -142,7 +144,8 @@ void make_top_and_left(uint8_t* left, uint8_t* top, uint8_t* top_left, uint8_t*
   }
 }
 
-void get_dc_pred(uint8_t* left, uint8_t* top, int size,uint8_t *pblock){
+static void dc_pred(const uint8_t *left, const uint8_t *top, int size,uint8_t *pblock)
+{
   int i,j,dc=128,sum;
 
   sum = 0;
@@ -158,7 +161,8 @@ void get_dc_pred(uint8_t* left, uint8_t* top, int size,uint8_t *pblock){
 }
 
 
-void get_hor_pred(uint8_t* left, int size,uint8_t *pblock){
+static void hor_pred(const uint8_t *left, int size,uint8_t *pblock)
+{
   int i,j;
 
   for (i=0;i<size;i++){
@@ -169,7 +173,8 @@ void get_hor_pred(uint8_t* left, int size,uint8_t *pblock){
 }
 
 
-void get_ver_pred(uint8_t* top, int size,uint8_t *pblock){
+static void ver_pred(const uint8_t *top, int size,uint8_t *pblock)
+{
   int i,j;
 
   for (i=0;i<size;i++){
@@ -179,7 +184,8 @@ void get_ver_pred(uint8_t* top, int size,uint8_t *pblock){
   }
 }
 
-void get_planar_pred(uint8_t* left, uint8_t* top, uint8_t top_left,int size,uint8_t *pblock){
+static void planar_pred(const uint8_t *left, const uint8_t *top, int top_left,int size,uint8_t *pblock)
+{
   int i,j;
 
   int16_t topF[MAX_TR_SIZE];
@@ -213,7 +219,8 @@ void get_planar_pred(uint8_t* left, uint8_t* top, uint8_t top_left,int size,uint
   }
 }
 
-void get_upleft_pred(uint8_t* left, uint8_t* top, uint8_t top_left, int size,uint8_t *pblock){
+static void upleft_pred(const uint8_t *left, const uint8_t *top, int top_left, int size,uint8_t *pblock)
+{
   int i,j,diag;
 
   uint8_t topF[MAX_TR_SIZE];
@@ -240,7 +247,8 @@ void get_upleft_pred(uint8_t* left, uint8_t* top, uint8_t top_left, int size,uin
   }
 }
 
-void get_upright_pred(uint8_t *top, int size, uint8_t *pblock){
+static void upright_pred(const uint8_t *top, int size, uint8_t *pblock)
+{
   int i,j,diag;
 
   //int upright_available;
@@ -257,7 +265,8 @@ void get_upright_pred(uint8_t *top, int size, uint8_t *pblock){
   }
 }
 
-void get_upupright_pred(uint8_t *top,int size,uint8_t *pblock){
+static void upupright_pred(const uint8_t *top,int size,uint8_t *pblock)
+{
   int i,j,diag;
 
   uint8_t topF[2*MAX_TR_SIZE];
@@ -278,7 +287,8 @@ void get_upupright_pred(uint8_t *top,int size,uint8_t *pblock){
   }
 }
 
-void get_upupleft_pred(uint8_t *left,uint8_t * top, uint8_t top_left, int size,uint8_t *pblock){
+static void upupleft_pred(const uint8_t *left,const uint8_t *top, int top_left, int size,uint8_t *pblock)
+{
   int i,j,diag;
 
   uint8_t topF[MAX_TR_SIZE];
@@ -309,7 +319,8 @@ void get_upupleft_pred(uint8_t *left,uint8_t * top, uint8_t top_left, int size,u
   }
 }
 
-void get_upleftleft_pred(uint8_t* left, uint8_t* top, uint8_t top_left, int size,uint8_t *pblock){
+static void upleftleft_pred(const uint8_t *left, const uint8_t *top, int top_left, int size,uint8_t *pblock)
+{
   int i,j,diag;
 
   uint8_t topF[MAX_TR_SIZE];
@@ -340,7 +351,8 @@ void get_upleftleft_pred(uint8_t* left, uint8_t* top, uint8_t top_left, int size
   }
 }
 
-void get_downleftleft_pred(uint8_t *left,int size,uint8_t *pblock){
+static void downleftleft_pred(const uint8_t *left,int size,uint8_t *pblock)
+{
   int i,j,diag;
 
   uint8_t leftF[2*MAX_TR_SIZE];
@@ -360,6 +372,62 @@ void get_downleftleft_pred(uint8_t *left,int size,uint8_t *pblock){
   }
 }
 
+void intra_pred_non_simd(const uint8_t *left, const uint8_t *top, int top_left, int size, uint8_t *pblock, int mode)
+{
+  switch (mode) {
+  case MODE_HOR:          hor_pred(left,size,pblock); break;
+  case MODE_VER:          ver_pred(top,size,pblock); break;
+  case MODE_PLANAR:       planar_pred(left,top,top_left,size,pblock); break;
+  case MODE_UPLEFT:       upleft_pred(left,top,top_left,size,pblock); break;
+  case MODE_UPRIGHT:      upright_pred(top,size,pblock); break;
+  case MODE_UPUPRIGHT:    upupright_pred(top,size,pblock); break;
+  case MODE_UPUPLEFT:     upupleft_pred(left,top,top_left,size,pblock); break;
+  case MODE_UPLEFTLEFT:   upleftleft_pred(left,top,top_left,size,pblock); break;
+  case MODE_DOWNLEFTLEFT: downleftleft_pred(left,size,pblock); break;
+  default:                dc_pred(left,top,size,pblock); break;
+  }
+}
+
+void get_dc_pred(uint8_t* left, uint8_t* top, int size,uint8_t *pblock){
+  common_kernels->intra_pred(left,top,0,size,pblock,MODE_DC);
+}
+
+void get_hor_pred(uint8_t* left, int size,uint8_t *pblock){
+  common_kernels->intra_pred(left,NULL,0,size,pblock,MODE_HOR);
+}
+
+void get_ver_pred(uint8_t* top, int size,uint8_t *pblock){
+  common_kernels->intra_pred(NULL,top,0,size,pblock,MODE_VER);
+}
+
+void get_planar_pred(uint8_t* left, uint8_t* top, uint8_t top_left,int size,uint8_t *pblock){
+  common_kernels->intra_pred(left,top,top_left,size,pblock,MODE_PLANAR);
+}
+
+void get_upleft_pred(uint8_t* left, uint8_t* top, uint8_t top_left, int size,uint8_t *pblock){
+  common_kernels->intra_pred(left,top,top_left,size,pblock,MODE_UPLEFT);
+}
+
+void get_upright_pred(uint8_t *top, int size, uint8_t *pblock){
+  common_kernels->intra_pred(NULL,top,0,size,pblock,MODE_UPRIGHT);
+}
+
+void get_upupright_pred(uint8_t *top,int size,uint8_t *pblock){
+  common_kernels->intra_pred(NULL,top,0,size,pblock,MODE_UPUPRIGHT);
+}
+
+void get_upupleft_pred(uint8_t *left,uint8_t * top, uint8_t top_left, int size,uint8_t *pblock){
+  common_kernels->intra_pred(left,top,top_left,size,pblock,MODE_UPUPLEFT);
+}
+
+void get_upleftleft_pred(uint8_t* left, uint8_t* top, uint8_t top_left, int size,uint8_t *pblock){
+  common_kernels->intra_pred(left,top,top_left,size,pblock,MODE_UPLEFTLEFT);
+}
+
+void get_downleftleft_pred(uint8_t *left,int size,uint8_t *pblock){
+  common_kernels->intra_pred(left,NULL,0,size,pblock,MODE_DOWNLEFTLEFT);
+}
+
 void get_intra_prediction(uint8_t* left, uint8_t* top, uint8_t top_left, int ypos,int xpos,
     int size, uint8_t *pblock,intra_mode_t intra_mode)
 {
@@ -0,0 +1,155 @@
+/*
+Copyright (c) 2015, Cisco Systems
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "global.h"
+#include "row_filter.h"
+#include "common_frame.h"
+#include "thread.h"
+
+/* Loop filtering of superblock rows on a helper thread while the rest of the
+   frame is being coded. Prediction of row k+1 reads the unfiltered bottom row
+   of row k, so row k is deblocked once row k+1 has been coded. CLPF of row k
+   reads the rows modified by the deblocking of row k+1, so it runs one row
+   behind the deblocking, followed by the copy into the reference frame and
+   the padding. Rows are filtered in the same order as by the frame level
+   functions, so the result is identical. */
+struct row_filter_t
+{
+  yuv_frame_t *rec;
+  yuv_frame_t *org;      //Original frame for the CLPF decision, if any
+  yuv_frame_t *ref;      //Reference frame to copy and pad the rows into, or NULL
+  deblock_data_t *deblock_data;
+  int deblocking;
+  uint8_t qp;
+  uint8_t qpc;
+  clpf_decision_t clpf;  //CLPF decision for each superblock, or NULL for no CLPF
+  void *clpf_stream;
+  row_progress_t progress; //Called with the number of finished rows, or NULL
+  void *progress_arg;
+  int num_sb_hor;
+  int num_sb_ver;
+  int *sb_done;          //Number of coded superblocks per row
+  int rows_done;         //Number of leading rows that have been completely coded
+  thor_mutex_t mutex;
+  thor_cond_t cond;
+  thor_thread_t thread;
+};
+
+static void finish_row(row_filter_t *rf, int k)
+{
+  int height = rf->rec->height;
+
+  if (rf->clpf && k < height/MAX_BLOCK_SIZE)
+    clpf_sb_row(rf->rec, rf->org, rf->deblock_data, rf->clpf_stream, rf->clpf, k);
+  if (rf->ref)
+    create_reference_rows(rf->ref, rf->rec, k*MAX_BLOCK_SIZE, min((k+1)*MAX_BLOCK_SIZE, height));
+  if (rf->progress)
+    rf->progress(rf->progress_arg, k+1);
+}
+
+static void *row_filter_worker(void *arg)
+{
+  row_filter_t *rf = (row_filter_t*)arg;
+  int width = rf->rec->width;
+  int height = rf->rec->height;
+
+  for (int k=0;k<rf->num_sb_ver;k++){
+    int wait_rows = min(k+2, rf->num_sb_ver);
+    thor_mutex_lock(&rf->mutex);
+    while (rf->rows_done < wait_rows)
+      thor_cond_wait(&rf->cond, &rf->mutex);
+    thor_mutex_unlock(&rf->mutex);
+
+    if (rf->deblocking){
+      int y0 = k*MAX_BLOCK_SIZE;
+      int y1 = min(y0 + MAX_BLOCK_SIZE, height);
+      deblock_rows_y(rf->rec, rf->deblock_data, width, height, rf->qp, y0, y1);
+      deblock_rows_uv(rf->rec, rf->deblock_data, width, height, rf->qpc, y0, y1);
+    }
+    if (k > 0)
+      finish_row(rf, k-1);
+  }
+  finish_row(rf, rf->num_sb_ver-1);
+  return NULL;
+}
+
+row_filter_t *create_row_filter(yuv_frame_t *rec, yuv_frame_t *org, yuv_frame_t *ref, deblock_data_t *deblock_data,
+                                int deblocking, uint8_t qp, uint8_t qpc, clpf_decision_t clpf, void *clpf_stream,
+                                row_progress_t progress, void *progress_arg)
+{
+  row_filter_t *rf = (row_filter_t*)malloc(sizeof(row_filter_t));
+  if (rf == NULL)
+    fatalerror("Memory allocation failed.");
+
+  rf->rec = rec;
+  rf->org = org;
+  rf->ref = ref;
+  rf->deblock_data = deblock_data;
+  rf->deblocking = deblocking;
+  rf->qp = qp;
+  rf->qpc = qpc;
+  rf->clpf = clpf;
+  rf->clpf_stream = clpf_stream;
+  rf->progress = progress;
+  rf->progress_arg = progress_arg;
+  rf->num_sb_hor = (rec->width + MAX_BLOCK_SIZE - 1)/MAX_BLOCK_SIZE;
+  rf->num_sb_ver = (rec->height + MAX_BLOCK_SIZE - 1)/MAX_BLOCK_SIZE;
+  rf->rows_done = 0;
+  rf->sb_done = (int*)calloc(rf->num_sb_ver, sizeof(int));
+  if (rf->sb_done == NULL)
+    fatalerror("Memory allocation failed.");
+
+  thor_mutex_init(&rf->mutex);
+  thor_cond_init(&rf->cond);
+  thor_thread_create(&rf->thread, row_filter_worker, rf);
+  return rf;
+}
+
+/* Signal that a superblock of row k has been coded. The superblocks of a row
+   may be coded in any order and by any thread. */
+void row_filter_sb_done(row_filter_t *rf, int k)
+{
+  thor_mutex_lock(&rf->mutex);
+  if (++rf->sb_done[k] == rf->num_sb_hor){
+    while (rf->rows_done < rf->num_sb_ver && rf->sb_done[rf->rows_done] == rf->num_sb_hor)
+      rf->rows_done++;
+    thor_cond_broadcast(&rf->cond);
+  }
+  thor_mutex_unlock(&rf->mutex);
+}
+
+/* Wait until the whole frame has been filtered */
+void close_row_filter(row_filter_t *rf)
+{
+  thor_thread_join(rf->thread);
+  thor_cond_destroy(&rf->cond);
+  thor_mutex_destroy(&rf->mutex);
+  free(rf->sb_done);
+  free(rf);
+}
@@ -0,0 +1,44 @@
+/*
+Copyright (c) 2015, Cisco Systems
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#if !defined(_ROW_FILTER_H_)
+#define _ROW_FILTER_H_
+
+#include "types.h"
+
+typedef int (*clpf_decision_t)(int, int, yuv_frame_t *, yuv_frame_t *, const deblock_data_t *, int, void *);
+
+typedef void (*row_progress_t)(void *arg, int rows);
+
+typedef struct row_filter_t row_filter_t;
+
+row_filter_t *create_row_filter(yuv_frame_t *rec, yuv_frame_t *org, yuv_frame_t *ref, deblock_data_t *deblock_data,
+                                int deblocking, uint8_t qp, uint8_t qpc, clpf_decision_t clpf, void *clpf_stream,
+                                row_progress_t progress, void *progress_arg);
+void row_filter_sb_done(row_filter_t *rf, int k);
+void close_row_filter(row_filter_t *rf);
+
+#endif
@@ -24,4 +24,36 @@ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
-int use_simd = 0;
+#include "simd.h"
+#include "common_kernels.h"
+
+int simd_level = SIMD_NONE;
+
+/* Highest kernel level the host can run */
+static int cpu_simd_level(void)
+{
+  /* SIMD optimisations supported only for little endian architectures */
+  const uint16_t t = 0x100;
+  if (!simd_available || *(const uint8_t *)&t)
+    return SIMD_NONE;
+#if defined(THOR_KERNELS_SSE4) || defined(THOR_KERNELS_AVX2)
+  __builtin_cpu_init();
+#ifdef THOR_KERNELS_AVX2
+  if (__builtin_cpu_supports("avx2"))
+    return SIMD_AVX2;
+#endif
+#ifdef THOR_KERNELS_SSE4
+  if (__builtin_cpu_supports("sse4.1"))
+    return SIMD_SSE4;
+#endif
+#endif
+  return SIMD_BASE;
+}
+
+void init_use_simd(int max_level)
+{
+  simd_level = cpu_simd_level();
+  if (max_level >= 0 && max_level < simd_level)
+    simd_level = max_level;
+  init_common_kernels();
+}
@@ -131,12 +131,26 @@ static const int simd_available = 0;
 #include "simd/v128_intrinsics.h"
 #endif
 
-extern int use_simd;
-SIMD_INLINE void init_use_simd()
-{
-  /* SIMD optimisations supported only for little endian architectures */
-  const uint16_t t = 0x100;
-  use_simd = simd_available && !*(const uint8_t *)&t;
-}
+#if (defined(__SSE2__) || _M_IX86_FP==2) && defined(__AVX2__) && defined(ALIGN)
+#include "simd/v256_intrinsics_x86.h"
+#else
+#include "simd/v256_intrinsics.h"
+#endif
+
+/* Kernel levels for run time dispatch, in increasing order.  SIMD_BASE
+   is whatever the build targets (ARCH), the others are variants that
+   are only built for x86. */
+enum {
+  SIMD_NONE = 0,
+  SIMD_BASE = 1,
+  SIMD_SSE4 = 2,
+  SIMD_AVX2 = 3
+};
+
+extern int simd_level;
+
+/* Pick the best level the host supports, but no higher than max_level
+   if that is not negative */
+void init_use_simd(int max_level);
 
 #endif /* _SIMD_H */
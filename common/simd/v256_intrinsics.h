@@ -0,0 +1,153 @@
+/*
+Copyright (c) 2015, Cisco Systems
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* -*- mode: c; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2; -*- */
+
+#ifndef _V256_INTRINSICS_H
+#define _V256_INTRINSICS_H
+
+/* Fallback for targets without native 256 bit vectors: a v256 is a pair
+   of v128, so this uses whichever v128 implementation was selected,
+   including the plain C one. */
+
+typedef struct { v128 hi, lo; } v256;
+
+SIMD_INLINE v128 v256_low_v128(v256 a) { return a.lo; }
+SIMD_INLINE v128 v256_high_v128(v256 a) { return a.hi; }
+
+SIMD_INLINE v256 v256_from_v128(v128 hi, v128 lo) {
+  v256 t;
+  t.hi = hi;
+  t.lo = lo;
+  return t;
+}
+
+SIMD_INLINE v256 v256_from_v64(v64 a, v64 b, v64 c, v64 d) {
+  return v256_from_v128(v128_from_v64(a, b), v128_from_v64(c, d));
+}
+
+SIMD_INLINE v256 v256_load_unaligned(const void *p) {
+  return v256_from_v128(v128_load_unaligned((const uint8_t*)p + 16), v128_load_unaligned(p));
+}
+
+SIMD_INLINE v256 v256_load_aligned(const void *p) {
+  return v256_from_v128(v128_load_aligned((const uint8_t*)p + 16), v128_load_aligned(p));
+}
+
+SIMD_INLINE void v256_store_unaligned(void *p, v256 a) {
+  v128_store_unaligned(p, a.lo);
+  v128_store_unaligned((uint8_t*)p + 16, a.hi);
+}
+
+SIMD_INLINE void v256_store_aligned(void *p, v256 a) {
+  v128_store_aligned(p, a.lo);
+  v128_store_aligned((uint8_t*)p + 16, a.hi);
+}
+
+SIMD_INLINE v256 v256_zero() { return v256_from_v128(v128_zero(), v128_zero()); }
+SIMD_INLINE v256 v256_dup_8(uint8_t x) { return v256_from_v128(v128_dup_8(x), v128_dup_8(x)); }
+SIMD_INLINE v256 v256_dup_16(uint16_t x) { return v256_from_v128(v128_dup_16(x), v128_dup_16(x)); }
+SIMD_INLINE v256 v256_dup_32(uint32_t x) { return v256_from_v128(v128_dup_32(x), v128_dup_32(x)); }
+
+typedef struct { sad128_internal hi, lo; } sad256_internal;
+
+SIMD_INLINE sad256_internal v256_sad_u8_init() {
+  sad256_internal s;
+  s.hi = v128_sad_u8_init();
+  s.lo = v128_sad_u8_init();
+  return s;
+}
+
+/* Implementation dependent return value.  Result must be finalised with v256_sad_u8_sum().
+   The result for more than 32 v256_sad_u8() calls is undefined. */
+SIMD_INLINE sad256_internal v256_sad_u8(sad256_internal s, v256 a, v256 b) {
+  sad256_internal r;
+  r.hi = v128_sad_u8(s.hi, a.hi, b.hi);
+  r.lo = v128_sad_u8(s.lo, a.lo, b.lo);
+  return r;
+}
+
+SIMD_INLINE uint32_t v256_sad_u8_sum(sad256_internal s) {
+  return v128_sad_u8_sum(s.hi) + v128_sad_u8_sum(s.lo);
+}
+
+typedef struct { ssd128_internal hi, lo; } ssd256_internal;
+
+SIMD_INLINE ssd256_internal v256_ssd_u8_init() {
+  ssd256_internal s;
+  s.hi = v128_ssd_u8_init();
+  s.lo = v128_ssd_u8_init();
+  return s;
+}
+
+/* Implementation dependent return value.  Result must be finalised with v256_ssd_u8_sum(). */
+SIMD_INLINE ssd256_internal v256_ssd_u8(ssd256_internal s, v256 a, v256 b) {
+  ssd256_internal r;
+  r.hi = v128_ssd_u8(s.hi, a.hi, b.hi);
+  r.lo = v128_ssd_u8(s.lo, a.lo, b.lo);
+  return r;
+}
+
+SIMD_INLINE uint32_t v256_ssd_u8_sum(ssd256_internal s) {
+  return v128_ssd_u8_sum(s.hi) + v128_ssd_u8_sum(s.lo);
+}
+
+SIMD_INLINE v256 v256_add_8(v256 a, v256 b) { return v256_from_v128(v128_add_8(a.hi, b.hi), v128_add_8(a.lo, b.lo)); }
+SIMD_INLINE v256 v256_sub_8(v256 a, v256 b) { return v256_from_v128(v128_sub_8(a.hi, b.hi), v128_sub_8(a.lo, b.lo)); }
+SIMD_INLINE v256 v256_add_16(v256 a, v256 b) { return v256_from_v128(v128_add_16(a.hi, b.hi), v128_add_16(a.lo, b.lo)); }
+SIMD_INLINE v256 v256_add_32(v256 a, v256 b) { return v256_from_v128(v128_add_32(a.hi, b.hi), v128_add_32(a.lo, b.lo)); }
+SIMD_INLINE v256 v256_mullo_s16(v256 a, v256 b) { return v256_from_v128(v128_mullo_s16(a.hi, b.hi), v128_mullo_s16(a.lo, b.lo)); }
+SIMD_INLINE v256 v256_madd_s16(v256 a, v256 b) { return v256_from_v128(v128_madd_s16(a.hi, b.hi), v128_madd_s16(a.lo, b.lo)); }
+SIMD_INLINE v256 v256_cmplt_s8(v256 a, v256 b) { return v256_from_v128(v128_cmplt_s8(a.hi, b.hi), v128_cmplt_s8(a.lo, b.lo)); }
+SIMD_INLINE v256 v256_cmpgt_s8(v256 a, v256 b) { return v256_from_v128(v128_cmpgt_s8(a.hi, b.hi), v128_cmpgt_s8(a.lo, b.lo)); }
+
+/* Byte shuffle within each 128 bit half, so pattern indices are 0-15. */
+SIMD_INLINE v256 v256_shuffle_8(v256 a, v256 pattern) {
+  return v256_from_v128(v128_shuffle_8(a.hi, pattern.hi), v128_shuffle_8(a.lo, pattern.lo));
+}
+
+SIMD_INLINE v256 v256_unpack_u8_s16(v128 a) {
+  return v256_from_v128(v128_unpackhi_u8_s16(a), v128_unpacklo_u8_s16(a));
+}
+
+SIMD_INLINE v256 v256_pack_s16_u8(v256 a, v256 b) {
+  return v256_from_v128(v128_pack_s16_u8(a.hi, a.lo), v128_pack_s16_u8(b.hi, b.lo));
+}
+
+SIMD_INLINE v256 v256_pack_s32_s16(v256 a, v256 b) {
+  return v256_from_v128(v128_pack_s32_s16(a.hi, a.lo), v128_pack_s32_s16(b.hi, b.lo));
+}
+
+SIMD_INLINE v256 v256_shr_s32(v256 a, unsigned int c) {
+  return v256_from_v128(v128_shr_s32(a.hi, c), v128_shr_s32(a.lo, c));
+}
+
+/* The v128 shifts may require immediate values, so we must use #defines
+   to enforce that. */
+#define v256_shr_n_s16(a, c) v256_from_v128(v128_shr_n_s16((a).hi, c), v128_shr_n_s16((a).lo, c))
+#define v256_shr_n_s32(a, c) v256_from_v128(v128_shr_n_s32((a).hi, c), v128_shr_n_s32((a).lo, c))
+
+#endif /* _V256_INTRINSICS_H */
@@ -8,6 +8,7 @@
 #include "common_frame.h"
 #include "simd.h"
 #include "common_kernels.h"
+#include "thread.h"
 
 #define BLOCK_STEP 16
 #define MAX_CANDS 20
@@ -47,8 +48,6 @@ typedef struct mv_data_t {
   int ratio;
   int reversed;
   int skip_thr;
-  mv_t skip_mv;
-  mv_t scaled_skip_mv;
   int bbs;
   int bs;
   int step;
@@ -107,10 +106,6 @@ mv_data_t* alloc_mv_data(int w, int h, int bs, int bbs, int ratio, int k, int in
   data->bbs=bbs;
   data->bs=bs;
   data->skip_thr=SKIP_THRESHOLD;/* FIXME: make adaptive*/
-  data->skip_mv.x=0;
-  data->skip_mv.y=0;
-  data->scaled_skip_mv.x=0;
-  data->scaled_skip_mv.y=0;
   data->mv[0]=(mv_t*) malloc(area*sizeof(mv_t));
   data->mv[1]=(mv_t*) malloc(area*sizeof(mv_t));
   data->cost[0]=(cost_t*) malloc(area*sizeof(cost_t));
@@ -148,100 +143,59 @@ void free_mv_data(mv_data_t* mv_data)
   free(mv_data);
 }
 
-static void scale_frame_down2x2(yuv_frame_t* sin, yuv_frame_t* sout)
+void block_avg_non_simd(uint8_t *p,uint8_t *r0, uint8_t *r1, int sp, int s0, int s1, int width, int height)
 {
-  int wo=sout->width;
-  int ho=sout->height;
-  int so=sout->stride_y;
-  int si=sin->stride_y;
-  int soc=sout->stride_c;
-  int sic=sin->stride_c;
-  int i, j;
-
-  for (i=0; i<ho; ++i) {
-
-    for (j=0; j<wo; ++j) {
-      sout->y[i*so+j]=( ((sin->y[(2*i+0)*si+(2*j+0)] + sin->y[(2*i+1)*si+(2*j+0)]+1)>>1)+
-                      + ((sin->y[(2*i+0)*si+(2*j+1)] + sin->y[(2*i+1)*si+(2*j+1)]+1)>>1) )>>1;
+  for (int i=0; i<height; ++i) {
+    for (int j=0; j<width; ++j) {
+      p[i*sp+j] = (r0[i*s0+j]+r1[i*s1+j]+1)/2;
     }
-
   }
-  ho /= 2;
-  wo /= 2;
-  for (int i=0; i<ho; ++i) {
-
-    for (j=0; j<wo; ++j) {
-      sout->u[i*soc+j]=( ((sin->u[(2*i+0)*sic+(2*j+0)] + sin->u[(2*i+1)*sic+(2*j+0)]+1)>>1)+
-                       + ((sin->u[(2*i+0)*sic+(2*j+1)] + sin->u[(2*i+1)*sic+(2*j+1)]+1)>>1) )>>1;
-    }
+}
 
-    for (j=0; j<wo; ++j) {
-      sout->v[i*soc+j]=( ((sin->v[(2*i+0)*sic+(2*j+0)] + sin->v[(2*i+1)*sic+(2*j+0)]+1)>>1)+
-                       + ((sin->v[(2*i+0)*sic+(2*j+1)] + sin->v[(2*i+1)*sic+(2*j+1)]+1)>>1) )>>1;
+int sad_calc_unaligned_non_simd(uint8_t *a, uint8_t *b, int astride, int bstride, int width, int height)
+{
+  int sad = 0;
+  for (int i=0; i<height; ++i) {
+    for (int j=0; j<width; ++j) {
+      sad += abs(a[i*astride+j]-b[i*bstride+j]);
     }
-
   }
-  pad_yuv_frame(sout);
+  return sad;
 }
 
-void scale_frame_down2x2_simd(yuv_frame_t* sin, yuv_frame_t* sout)
+void scale_frame_down2x2_non_simd(yuv_frame_t* sin, yuv_frame_t* sout)
 {
   int wo=sout->width;
   int ho=sout->height;
   int so=sout->stride_y;
   int si=sin->stride_y;
+  int soc=sout->stride_c;
+  int sic=sin->stride_c;
   int i, j;
-  v128 ones = v128_dup_8(1);
-  v128 z = v128_dup_8(0);
+
   for (i=0; i<ho; ++i) {
 
-    for (j=0; j<=wo-8; j+=8) {
-      v128 a = v128_load_aligned(&sin->y[(2*i+0)*si+2*j]);
-      v128 b = v128_load_aligned(&sin->y[(2*i+1)*si+2*j]);
-      v128 c = v128_avg_u8(a,b);
-      v128 d = v128_shr_s16(v128_madd_us8(c,ones),1);
-      v64_store_aligned(&sout->y[i*so+j], v128_low_v64(v128_pack_s16_u8(z,d)));
-    }
-    for (; j<wo; ++j) {
+    for (j=0; j<wo; ++j) {
       sout->y[i*so+j]=( ((sin->y[(2*i+0)*si+(2*j+0)] + sin->y[(2*i+1)*si+(2*j+0)]+1)>>1)+
                       + ((sin->y[(2*i+0)*si+(2*j+1)] + sin->y[(2*i+1)*si+(2*j+1)]+1)>>1) )>>1;
     }
 
   }
-#if USE_CHROMA
-  int soc=sout->stride_c;
-  int sic=sin->stride_c;
   ho /= 2;
   wo /= 2;
   for (int i=0; i<ho; ++i) {
 
-    for (j=0; j<=wo-8; j+=8) {
-      v128 a = v128_load_aligned(&sin->u[(2*i+0)*sic+2*j]);
-      v128 b = v128_load_aligned(&sin->u[(2*i+1)*sic+2*j]);
-      v128 c = v128_avg_u8(a,b);
-      v128 d = v128_shr_s16(v128_madd_us8(c,ones),1);
-      v64_store_aligned(&sout->u[i*soc+j], v128_low_v64(v128_pack_s16_u8(z,d)));
-    }
-    for (; j<wo; ++j) {
+    for (j=0; j<wo; ++j) {
       sout->u[i*soc+j]=( ((sin->u[(2*i+0)*sic+(2*j+0)] + sin->u[(2*i+1)*sic+(2*j+0)]+1)>>1)+
                        + ((sin->u[(2*i+0)*sic+(2*j+1)] + sin->u[(2*i+1)*sic+(2*j+1)]+1)>>1) )>>1;
     }
 
-    for (j=0; j<=wo-8; j+=8) {
-      v128 a = v128_load_aligned(&sin->v[(2*i+0)*sic+2*j]);
-      v128 b = v128_load_aligned(&sin->v[(2*i+1)*sic+2*j]);
-      v128 c = v128_avg_u8(a,b);
-      v128 d = v128_shr_s16(v128_madd_us8(c,ones),1);
-      v64_store_aligned(&sout->v[i*soc+j], v128_low_v64(v128_pack_s16_u8(z,d)));
-    }
-    for (; j<wo; ++j) {
+    for (j=0; j<wo; ++j) {
       sout->v[i*soc+j]=( ((sin->v[(2*i+0)*sic+(2*j+0)] + sin->v[(2*i+1)*sic+(2*j+0)]+1)>>1)+
                        + ((sin->v[(2*i+0)*sic+(2*j+1)] + sin->v[(2*i+1)*sic+(2*j+1)]+1)>>1) )>>1;
     }
 
   }
-#endif
-  pad_yuv_frame(sout);
 }
 
 static void upscale_mv_data_2x2(mv_data_t* mv_data_in, mv_data_t* mv_data_out)
@@ -401,15 +355,7 @@ void mot_comp_avg(int xstart, int ystart, uint8_t* ref0, int s0, uint8_t * ref1,
 
     uint8_t* r0=&ref0[ys[0]*s0+xs[0]];
     uint8_t* r1=&ref1[ys[1]*s1+xs[1]];
-    if (use_simd && size>=4) {
-      block_avg_simd(p,r0,r1,sp,s0,s1,size,size);
-    } else {
-      for (int i=0; i<size; ++i) {
-        for (int j=0; j<size; ++j) {
-          p[i*sp+j] = (r0[i*s0+j]+r1[i*s1+j]+1)/2;
-        }
-      }
-    }
+    common_kernels->block_avg(p,r0,r1,sp,s0,s1,size,size);
 
   } else if (xs[1]>=-pad && xs[1]+size <= wP && ys[1]>=-pad && ys[1]+size<=hP){
     uint8_t* r1=&ref1[ys[1]*s1+xs[1]];
@@ -467,39 +413,14 @@ static uint32_t sad_cost(int xstart, int ystart, yuv_frame_t* pic[2], mv_t mv[2]
 
     uint8_t* p0=&pic[0]->y[ys[0]*s0+xs[0]];
     uint8_t* p1=&pic[1]->y[ys[1]*s1+xs[1]];
-    if (use_simd && size >= 4) {
-      bcost += sad_calc_simd_unaligned(p0, p1, s0, s1, size, size);
-    } else {
-      for (int i=0; i<size; ++i) {
-        for (int j=0; j<size; ++j) {
-          bcost += abs(p1[i*s1+j]-p0[i*s0+j]);
-        }
-      }
-    }
+    bcost += common_kernels->sad_calc_unaligned(p0, p1, s0, s1, size, size);
 #if USE_CHROMA
     if (bcost < best_cost) {
       uint32_t ccost=0;
       int cpos0=(ys[0]/2)*sc0+(xs[0]/2);
       int cpos1=(ys[1]/2)*sc1+(xs[1]/2);
-      if (use_simd && size >= 8) {
-        ccost += sad_calc_simd_unaligned(&pic[0]->u[cpos0], &pic[1]->u[cpos1], sc0, sc1, size/2, size/2);
-        ccost += sad_calc_simd_unaligned(&pic[0]->v[cpos0], &pic[1]->v[cpos1], sc0, sc1, size/2, size/2);
-      } else {
-        p0=&pic[0]->u[cpos0];
-        p1=&pic[1]->u[cpos1];
-        for (int i=0; i<size/2; ++i) {
-          for (int j=0; j<size/2; ++j) {
-            ccost += abs(p1[i*sc1+j]-p0[i*sc0+j]);
-          }
-        }
-        p0=&pic[0]->v[cpos0];
-        p1=&pic[1]->v[cpos1];
-        for (int i=0; i<size/2; ++i) {
-          for (int j=0; j<size/2; ++j) {
-            ccost += abs(p1[i*sc1+j]-p0[i*sc0+j]);
-          }
-        }
-      }
+      ccost += common_kernels->sad_calc_unaligned(&pic[0]->u[cpos0], &pic[1]->u[cpos1], sc0, sc1, size/2, size/2);
+      ccost += common_kernels->sad_calc_unaligned(&pic[0]->v[cpos0], &pic[1]->v[cpos1], sc0, sc1, size/2, size/2);
       bcost += 4*ccost;// weight for chroma
     }
 #endif
@@ -522,14 +443,14 @@ static uint32_t sad_cost(int xstart, int ystart, yuv_frame_t* pic[2], mv_t mv[2]
   return bcost;
 }
 
-static void skip_test(mv_data_t* mv_data, yuv_frame_t* picdata[2], int xp, int yp)
+static void skip_test(mv_data_t* mv_data, yuv_frame_t* picdata[2], int xp, int yp, mv_t skip_mv, mv_t scaled_skip_mv)
 {
   // Do the search with the larger size, but data is stored at the smaller
   int xstart=xp*mv_data->bs;
   int ystart=yp*mv_data->bs;
 
-  mv_t mv1=mv_data->skip_mv;
-  mv_t mv0=mv_data->scaled_skip_mv;
+  mv_t mv1=skip_mv;
+  mv_t mv0=scaled_skip_mv;
 
   int xs[2];
   int ys[2];
@@ -556,18 +477,9 @@ static void skip_test(mv_data_t* mv_data, yuv_frame_t* picdata[2], int xp, int y
       // For the moment just round to the nearest integer - don't do subpel
       if (xs[0]>=-padx && xs[0]+8 <= wP && ys[0]>=-pady && ys[0]+8<=hP
           && xs[1]>=-padx && xs[1]+8 <= wP && ys[1]>=-pady && ys[1]+8<=hP) {
-        int sum=0;
         uint8_t* r0=&picdata[0]->y[ys[0]*s0+xs[0]];
         uint8_t* r1=&picdata[1]->y[ys[1]*s1+xs[1]];
-        if (use_simd) {
-          sum = sad_calc_simd_unaligned(r0, r1, s0, s1, 8, 8);
-        } else {
-          for (int i=0; i<8; i++) {
-            for (int j=0; j<8; j++) {
-              sum += abs(r0[i*s0+j]-r1[i*s1+j]);
-            }
-          }
-        }
+        int sum = common_kernels->sad_calc_unaligned(r0, r1, s0, s1, 8, 8);
         if (sum>thr) {
           skip=0;
           break;
@@ -598,23 +510,12 @@ static void skip_test(mv_data_t* mv_data, yuv_frame_t* picdata[2], int xp, int y
         xs[1]=q+((mv1.x+ACC_ROUND)>>ACC_BITS);
         ys[0]=p+((mv0.y+ACC_ROUND)>>ACC_BITS);
         ys[1]=p+((mv1.y+ACC_ROUND)>>ACC_BITS);
-        int sumU=0;
-        int sumV=0;
         uint8_t* r0U=&picdata[0]->u[ys[0]*s0C+xs[0]];
         uint8_t* r1U=&picdata[1]->u[ys[1]*s1C+xs[1]];
         uint8_t* r0V=&picdata[0]->v[ys[0]*s0C+xs[0]];
         uint8_t* r1V=&picdata[1]->v[ys[1]*s1C+xs[1]];
-        if (use_simd) {
-          sumU = sad_calc_simd_unaligned(r0U, r1U, s0C, s1C, 8, 8);
-          sumV = sad_calc_simd_unaligned(r0V, r1V, s0C, s1C, 8, 8);
-        } else {
-          for (int i=0; i<8; i++) {
-            for (int j=0; j<8; j++) {
-              sumU += abs(r0U[i*s0C+j]-r1U[i*s1C+j]);
-              sumV += abs(r0V[i*s0C+j]-r1V[i*s1C+j]);
-            }
-          }
-        }
+        int sumU = common_kernels->sad_calc_unaligned(r0U, r1U, s0C, s1C, 8, 8);
+        int sumV = common_kernels->sad_calc_unaligned(r0V, r1V, s0C, s1C, 8, 8);
         if (sumU>thrC || sumV>thrC) {
           skip=0;
           break;
@@ -627,8 +528,8 @@ static void skip_test(mv_data_t* mv_data, yuv_frame_t* picdata[2], int xp, int y
 #endif
   if (skip) {
     mv_data->bgmap[pos]=1;
-    mv_data->mv[1][pos]=mv_data->skip_mv;
-    mv_data->mv[0][pos]=mv_data->scaled_skip_mv;
+    mv_data->mv[1][pos]=skip_mv;
+    mv_data->mv[0][pos]=scaled_skip_mv;
     mv_data->cost[1][pos]=0;
     mv_data->cost[0][pos]=0;
   }
@@ -817,18 +718,18 @@ static mv_t mv_absdist_filter(mv_t* mlist, int num)
 //}
 
 
-static void make_skip_vector(mv_data_t* mv_data, int xp, int yp, int xstep, int ystep)
+static void make_skip_vector(mv_data_t* mv_data, int xp, int yp, int xstep, int ystep, mv_t* skip_mv, mv_t* scaled_skip_mv)
 {
   int bw=mv_data->bw;
-  mv_data->skip_mv.x=0;
-  mv_data->skip_mv.y=0;
+  skip_mv->x=0;
+  skip_mv->y=0;
   mv_t vlist[3];
   int num=0;
   if (yp>0 && xp<bw-xstep) vlist[num++]=mv_data->mv[1][(yp-ystep)*bw+xp+xstep];
   if (xp>0) vlist[num++]=mv_data->mv[1][yp*bw+xp-xstep];
   if (yp>0) vlist[num++]=mv_data->mv[1][(yp-ystep)*bw+xp];
-  if (num) mv_data->skip_mv=mv_absdist_filter(vlist,num);
-  mv_data->scaled_skip_mv=scale_mv(mv_data->skip_mv, -mv_data->wt[1], mv_data->wt[0]);
+  if (num) *skip_mv=mv_absdist_filter(vlist,num);
+  *scaled_skip_mv=scale_mv(*skip_mv, -mv_data->wt[1], mv_data->wt[0]);
 }
 
 
@@ -849,7 +750,139 @@ static void init_mv_data(mv_data_t* mv_data, const mv_data_t* guide_mv_data, int
 }
 */
 
-static void motion_estimate_bi(mv_data_t* mv_data, mv_data_t** guide_mv_data, int num_guides, yuv_frame_t* indata0, yuv_frame_t* indata1, int k)
+/* The passes of a pyramid level are split into rows of blocks and run by
+   num_threads threads. The block search of a row reads the vectors to the
+   left, above and above-right, so a row is searched in wavefront order: block
+   column c can be processed once the row above has finished column c+1. The
+   merge pass and the motion compensation only read vectors completed by the
+   previous pass, so their rows are independent. The result is the same for
+   any number of threads. */
+typedef struct ti_pass_t
+{
+  void (*process_row)(struct ti_pass_t *pass, int row);
+  int num_rows;
+  int next_row;          //Next row to be processed
+  int *cols_done;        //Number of finished block columns per row, for wavefront passes
+  thor_mutex_t mutex;
+  thor_cond_t cond;
+  mv_data_t *mv_data;
+  mv_data_t **guide_mv_data;
+  int num_guides;
+  yuv_frame_t *pic[2];
+  mv_t *mv0;
+  mv_t *mv1;
+  yuv_frame_t *outdata;
+  int w;
+  int h;
+} ti_pass_t;
+
+static void *ti_pass_worker(void *arg)
+{
+  ti_pass_t *pass = (ti_pass_t*)arg;
+
+  while (1){
+    thor_mutex_lock(&pass->mutex);
+    int row = pass->next_row++;
+    thor_mutex_unlock(&pass->mutex);
+    if (row >= pass->num_rows)
+      break;
+    pass->process_row(pass, row);
+  }
+  return NULL;
+}
+
+static void run_pass(ti_pass_t *pass, void (*process_row)(ti_pass_t*, int), int num_rows, int wavefront, int num_threads)
+{
+  thor_thread_t threads[MAX_THREADS];
+  int t;
+
+  pass->process_row = process_row;
+  pass->num_rows = num_rows;
+  pass->next_row = 0;
+  pass->cols_done = wavefront ? (int*)calloc(num_rows, sizeof(int)) : NULL;
+  thor_mutex_init(&pass->mutex);
+  thor_cond_init(&pass->cond);
+
+  num_threads = min(num_threads, num_rows);
+  if (num_threads > 1){
+    for (t=0;t<num_threads;t++)
+      thor_thread_create(&threads[t], ti_pass_worker, pass);
+    for (t=0;t<num_threads;t++)
+      thor_thread_join(threads[t]);
+  }
+  else{
+    ti_pass_worker(pass);
+  }
+
+  thor_cond_destroy(&pass->cond);
+  thor_mutex_destroy(&pass->mutex);
+  free(pass->cols_done);
+}
+
+static void search_row(ti_pass_t *pass, int row)
+{
+  mv_data_t* mv_data=pass->mv_data;
+  const int bw=mv_data->bw;
+  const int step=mv_data->step;
+  const int num_cols=(bw+step-1)/step;
+  mv_t cand_list[MAX_CANDS];
+  int i=row*step;
+
+  for (int j=0, c=0; j<bw; j+=step, c++) {
+    if (row>0) {
+      int above=min(c+2, num_cols);
+      thor_mutex_lock(&pass->mutex);
+      while (pass->cols_done[row-1]<above)
+        thor_cond_wait(&pass->cond, &pass->mutex);
+      thor_mutex_unlock(&pass->mutex);
+    }
+
+    mv_t skip_mv, scaled_skip_mv;
+    make_skip_vector(mv_data, j, i, step, step, &skip_mv, &scaled_skip_mv);
+    skip_test(mv_data, pass->pic, j, i, skip_mv, scaled_skip_mv);
+    int pos=i*bw+j;
+    if (mv_data->bgmap[pos]==0) {
+
+      int num_cands=get_cands(mv_data, cand_list, pass->guide_mv_data, pass->num_guides, j, i, MAX_CANDS, step, step);
+      adaptive_search_v2(mv_data, pass->num_guides!=0, cand_list, num_cands, pass->pic, j, i, step, step);
+    }
+    // propagate
+    const mv_t mv0=mv_data->mv[0][pos];
+    const mv_t mv1=mv_data->mv[1][pos];
+    int bgval=mv_data->bgmap[pos];
+    for (int q=0; q<step; ++q) {
+      for (int p=0; p<step; ++p) {
+        mv_data->mv[0][pos+q*bw+p]=mv0;
+        mv_data->mv[1][pos+q*bw+p]=mv1;
+        mv_data->bgmap[pos+q*bw+p]=bgval;
+      }
+    }
+
+    thor_mutex_lock(&pass->mutex);
+    pass->cols_done[row]=c+1;
+    thor_cond_broadcast(&pass->cond);
+    thor_mutex_unlock(&pass->mutex);
+  }
+}
+
+static void merge_row(ti_pass_t *pass, int i)
+{
+  mv_data_t* mv_data=pass->mv_data;
+  const int bw=mv_data->bw;
+  mv_t cand_list[MAX_CANDS];
+
+  for (int j=0; j<bw; j++) {
+    int num_cands=get_merge_cands(mv_data, cand_list, 1, j, i, MAX_CANDS);
+    if (num_cands>1){
+      merge_candidate_search(cand_list, num_cands, mv_data, pass->mv0, pass->mv1, pass->pic, j, i);
+    } else {
+      pass->mv0[i*bw+j]=mv_data->mv[0][i*bw+j];
+      pass->mv1[i*bw+j]=mv_data->mv[1][i*bw+j];
+    }
+  }
+}
+
+static void motion_estimate_bi(mv_data_t* mv_data, mv_data_t** guide_mv_data, int num_guides, yuv_frame_t* indata0, yuv_frame_t* indata1, int k, int num_threads)
 {
   // Estimate indata0 from indata1 and vice-versa
 
@@ -864,112 +897,92 @@ static void motion_estimate_bi(mv_data_t* mv_data, mv_data_t** guide_mv_data, in
   memset(mv_data->bgmap, 0, sizeof(int)*bw*bh);
 
   const int step=mv_data->step;
-  mv_t cand_list[MAX_CANDS];
-
-
-  yuv_frame_t* pic[2];
-  pic[0] = mv_data->reversed ? indata1 : indata0;
-  pic[1] = mv_data->reversed ? indata0 : indata1;
+  ti_pass_t pass;
 
-  for (int i=0; i<bh; i+=step) {
-    for (int j=0; j<bw; j+=step) {
-      make_skip_vector(mv_data, j, i, step, step);
-      skip_test(mv_data, pic, j, i);
-      int pos=i*bw+j;
-      if (mv_data->bgmap[pos]==0) {
+  pass.mv_data = mv_data;
+  pass.guide_mv_data = guide_mv_data;
+  pass.num_guides = num_guides;
+  pass.pic[0] = mv_data->reversed ? indata1 : indata0;
+  pass.pic[1] = mv_data->reversed ? indata0 : indata1;
 
-        int num_cands=get_cands(mv_data, cand_list, guide_mv_data, num_guides, j, i, MAX_CANDS, step, step);
-        adaptive_search_v2(mv_data, num_guides!=0, cand_list, num_cands, pic, j, i, step, step);
-      }
-      // propagate
-      const mv_t mv0=mv_data->mv[0][pos];
-      const mv_t mv1=mv_data->mv[1][pos];
-      int bgval=mv_data->bgmap[pos];
-      for (int q=0; q<step; ++q) {
-        for (int p=0; p<step; ++p) {
-          mv_data->mv[0][pos+q*bw+p]=mv0;
-          mv_data->mv[1][pos+q*bw+p]=mv1;
-          mv_data->bgmap[pos+q*bw+p]=bgval;
-        }
-      }
-    }
-  }
+  run_pass(&pass, search_row, (bh+step-1)/step, 1, num_threads);
 
-  mv_t * mv0 = (mv_t*) thor_alloc(bw*bh*sizeof(mv_t), 16);
-  mv_t * mv1 = (mv_t*) thor_alloc(bw*bh*sizeof(mv_t), 16);
+  pass.mv0 = (mv_t*) thor_alloc(bw*bh*sizeof(mv_t), 16);
+  pass.mv1 = (mv_t*) thor_alloc(bw*bh*sizeof(mv_t), 16);
 
-  for (int i=0; i<bh; i++) {
-    for (int j=0; j<bw; j++) {
-      int num_cands=get_merge_cands(mv_data, cand_list, 1, j, i, MAX_CANDS);
-      if (num_cands>1){
-        merge_candidate_search(cand_list, num_cands, mv_data, mv0, mv1, pic, j, i);
-      } else {
-        mv0[i*bw+j]=mv_data->mv[0][i*bw+j];
-        mv1[i*bw+j]=mv_data->mv[1][i*bw+j];
-      }
-    }
-  }
+  run_pass(&pass, merge_row, bh, 0, num_threads);
 
-  memcpy(mv_data->mv[0], mv0, bw*bh*sizeof(mv_t));
-  memcpy(mv_data->mv[1], mv1, bw*bh*sizeof(mv_t));
+  memcpy(mv_data->mv[0], pass.mv0, bw*bh*sizeof(mv_t));
+  memcpy(mv_data->mv[1], pass.mv1, bw*bh*sizeof(mv_t));
 
-  thor_free(mv0);
-  thor_free(mv1);
+  thor_free(pass.mv0);
+  thor_free(pass.mv1);
 }
 
 static void interpolate_comp(mv_data_t* mv_data, uint8_t* p0, int s0, uint8_t* p1, int s1,
-    uint8_t* out, int so, int wP, int hP, int pad, int chroma)
+    uint8_t* out, int so, int wP, int hP, int pad, int chroma, int yp)
 {
   const int bw=mv_data->bw;
-  const int bh=mv_data->bh;
   const int bs=chroma ? mv_data->bs/2 :  mv_data->bs;
 
-  for (int yp=0; yp<bh; yp++) {
-    for (int xp=0; xp<bw; xp++) {
-
-      int xstart=xp*bs;
-      int ystart=yp*bs;
-      mv_t mv0=mv_data->mv[0][yp*bw+xp];
-      mv_t mv1=mv_data->mv[1][yp*bw+xp];
-      if (chroma){
-        mv1.x >>= 1;
-        mv1.y >>= 1;
-        mv0 = scale_mv(mv1, -mv_data->wt[1], mv_data->wt[0]);
-      }
-      mot_comp_avg(xstart, ystart, p0, s0, p1, s1, out, so, mv0, mv1, wP, hP, pad, bs, mv_data->wt);
+  for (int xp=0; xp<bw; xp++) {
 
+    int xstart=xp*bs;
+    int ystart=yp*bs;
+    mv_t mv0=mv_data->mv[0][yp*bw+xp];
+    mv_t mv1=mv_data->mv[1][yp*bw+xp];
+    if (chroma){
+      mv1.x >>= 1;
+      mv1.y >>= 1;
+      mv0 = scale_mv(mv1, -mv_data->wt[1], mv_data->wt[0]);
     }
+    mot_comp_avg(xstart, ystart, p0, s0, p1, s1, out, so, mv0, mv1, wP, hP, pad, bs, mv_data->wt);
+
   }
 
 }
 
-static void interpolate_frame(mv_data_t* mv_data, yuv_frame_t* indata0, yuv_frame_t* indata1, yuv_frame_t* outdata, int w, int h, int k, int ratio)
+/* Row row of the pass is block row row%bh of component row/bh */
+static void interpolate_row(ti_pass_t *pass, int row)
 {
+  mv_data_t* mv_data=pass->mv_data;
+  yuv_frame_t** pic=pass->pic;
+  yuv_frame_t* outdata=pass->outdata;
+  int comp=row/mv_data->bh;
+  int yp=row%mv_data->bh;
 
-  yuv_frame_t* pic[2];
-  pic[0] = mv_data->reversed ? indata1 : indata0;
-  pic[1] = mv_data->reversed ? indata0 : indata1;
-
-  // Y
   // For MC purposes, pad by 1/2 a block
   int pad=mv_data->bs/2;
-  int wP=w+pad;
-  int hP=h+pad;
+  int wP=pass->w+pad;
+  int hP=pass->h+pad;
   int wPc=wP/2;
   int hPc=hP/2;
   int padc=pad/2;
 
-  interpolate_comp(mv_data, pic[0]->y, pic[0]->stride_y, pic[1]->y, pic[1]->stride_y, outdata->y, outdata->stride_y, wP, hP, pad, 0);
+  if (comp==0)
+    interpolate_comp(mv_data, pic[0]->y, pic[0]->stride_y, pic[1]->y, pic[1]->stride_y, outdata->y, outdata->stride_y, wP, hP, pad, 0, yp);
+  else if (comp==1)
+    interpolate_comp(mv_data, pic[0]->u, pic[0]->stride_c, pic[1]->u, pic[1]->stride_c, outdata->u, outdata->stride_c, wPc, hPc, padc, 1, yp);
+  else
+    interpolate_comp(mv_data, pic[0]->v, pic[0]->stride_c, pic[1]->v, pic[1]->stride_c, outdata->v, outdata->stride_c, wPc, hPc, padc, 1, yp);
+}
 
-  // U
-  interpolate_comp(mv_data, pic[0]->u, pic[0]->stride_c, pic[1]->u, pic[1]->stride_c, outdata->u, outdata->stride_c, wPc, hPc, padc, 1);
+static void interpolate_frame(mv_data_t* mv_data, yuv_frame_t* indata0, yuv_frame_t* indata1, yuv_frame_t* outdata, int w, int h, int k, int ratio, int num_threads)
+{
+  ti_pass_t pass;
 
-  // V
-  interpolate_comp(mv_data, pic[0]->v, pic[0]->stride_c, pic[1]->v, pic[1]->stride_c, outdata->v, outdata->stride_c, wPc, hPc, padc, 1);
+  pass.mv_data = mv_data;
+  pass.pic[0] = mv_data->reversed ? indata1 : indata0;
+  pass.pic[1] = mv_data->reversed ? indata0 : indata1;
+  pass.outdata = outdata;
+  pass.w = w;
+  pass.h = h;
 
+  // Y, U and V
+  run_pass(&pass, interpolate_row, 3*mv_data->bh, 0, num_threads);
 }
 
-void interpolate_frames(yuv_frame_t* new_frame, yuv_frame_t* ref0, yuv_frame_t* ref1, int ratio, int pos)
+void interpolate_frames(yuv_frame_t* new_frame, yuv_frame_t* ref0, yuv_frame_t* ref1, int ratio, int pos, int num_threads)
 {
   int widthin = ref0->width;
   int heightin = ref0->height;
@@ -1009,13 +1022,10 @@ void interpolate_frames(yuv_frame_t* new_frame, yuv_frame_t* ref0, yuv_frame_t*
   in_down[0][1]=ref1;
 
   for (int l=0; l<max_levels-1; ++l) {
-    if (use_simd) {
-      scale_frame_down2x2_simd(in_down[l][0], in_down[l+1][0]);
-      scale_frame_down2x2_simd(in_down[l][1], in_down[l+1][1]);
-    } else {
-      scale_frame_down2x2(in_down[l][0], in_down[l+1][0]);
-      scale_frame_down2x2(in_down[l][1], in_down[l+1][1]);
-    }
+    common_kernels->scale_frame_down2x2(in_down[l][0], in_down[l+1][0]);
+    common_kernels->scale_frame_down2x2(in_down[l][1], in_down[l+1][1]);
+    pad_yuv_frame(in_down[l+1][0]);
+    pad_yuv_frame(in_down[l+1][1]);
   }
 
 
@@ -1024,8 +1034,8 @@ void interpolate_frames(yuv_frame_t* new_frame, yuv_frame_t* ref0, yuv_frame_t*
     if (lvl!=max_levels-1) {
       guide_mv_data[num_guides++]=spatial_mv_data[lvl];
     }
-    motion_estimate_bi(mv_data[lvl], guide_mv_data, num_guides, in_down[lvl][0], in_down[lvl][1], pos);
-    if (lvl==0) interpolate_frame(mv_data[lvl], in_down[lvl][0], in_down[lvl][1], out_down[lvl], widthin, heightin, pos, ratio);
+    motion_estimate_bi(mv_data[lvl], guide_mv_data, num_guides, in_down[lvl][0], in_down[lvl][1], pos, num_threads);
+    if (lvl==0) interpolate_frame(mv_data[lvl], in_down[lvl][0], in_down[lvl][1], out_down[lvl], widthin, heightin, pos, ratio, num_threads);
     if (lvl>0) {
       upscale_mv_data_2x2(mv_data[lvl], spatial_mv_data[lvl-1]);
     }
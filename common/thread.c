@@ -0,0 +1,100 @@
+/*
+Copyright (c) 2015, Cisco Systems
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdlib.h>
+
+#include "global.h"
+#include "thread.h"
+
+#if defined(_WIN32)
+#include <process.h>
+
+typedef struct
+{
+  thor_thread_func func;
+  void *arg;
+} thread_start_t;
+
+static unsigned __stdcall thread_start(void *p)
+{
+  thread_start_t start = *(thread_start_t*)p;
+  free(p);
+  start.func(start.arg);
+  return 0;
+}
+
+void thor_thread_create(thor_thread_t *thread, thor_thread_func func, void *arg)
+{
+  thread_start_t *start = (thread_start_t*)malloc(sizeof(thread_start_t));
+  if (start == NULL)
+    fatalerror("Memory allocation failed.");
+  start->func = func;
+  start->arg = arg;
+  *thread = (HANDLE)_beginthreadex(NULL, 0, thread_start, start, 0, NULL);
+  if (*thread == 0)
+    fatalerror("Failed to create thread.");
+}
+
+void thor_thread_join(thor_thread_t thread)
+{
+  WaitForSingleObject(thread, INFINITE);
+  CloseHandle(thread);
+}
+
+void thor_mutex_init(thor_mutex_t *mutex) { InitializeCriticalSection(mutex); }
+void thor_mutex_destroy(thor_mutex_t *mutex) { DeleteCriticalSection(mutex); }
+void thor_mutex_lock(thor_mutex_t *mutex) { EnterCriticalSection(mutex); }
+void thor_mutex_unlock(thor_mutex_t *mutex) { LeaveCriticalSection(mutex); }
+
+void thor_cond_init(thor_cond_t *cond) { InitializeConditionVariable(cond); }
+void thor_cond_destroy(thor_cond_t *cond) { }
+void thor_cond_wait(thor_cond_t *cond, thor_mutex_t *mutex) { SleepConditionVariableCS(cond, mutex, INFINITE); }
+void thor_cond_broadcast(thor_cond_t *cond) { WakeAllConditionVariable(cond); }
+
+#else
+
+void thor_thread_create(thor_thread_t *thread, thor_thread_func func, void *arg)
+{
+  if (pthread_create(thread, NULL, func, arg))
+    fatalerror("Failed to create thread.");
+}
+
+void thor_thread_join(thor_thread_t thread)
+{
+  pthread_join(thread, NULL);
+}
+
+void thor_mutex_init(thor_mutex_t *mutex) { pthread_mutex_init(mutex, NULL); }
+void thor_mutex_destroy(thor_mutex_t *mutex) { pthread_mutex_destroy(mutex); }
+void thor_mutex_lock(thor_mutex_t *mutex) { pthread_mutex_lock(mutex); }
+void thor_mutex_unlock(thor_mutex_t *mutex) { pthread_mutex_unlock(mutex); }
+
+void thor_cond_init(thor_cond_t *cond) { pthread_cond_init(cond, NULL); }
+void thor_cond_destroy(thor_cond_t *cond) { pthread_cond_destroy(cond); }
+void thor_cond_wait(thor_cond_t *cond, thor_mutex_t *mutex) { pthread_cond_wait(cond, mutex); }
+void thor_cond_broadcast(thor_cond_t *cond) { pthread_cond_broadcast(cond); }
+
+#endif
@@ -0,0 +1,62 @@
+/*
+Copyright (c) 2015, Cisco Systems
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef _THREAD_H_
+#define _THREAD_H_
+
+/* Minimal portable threading layer: native Win32 primitives on Windows,
+   POSIX threads everywhere else. */
+
+#if defined(_WIN32)
+#include <windows.h>
+
+typedef HANDLE thor_thread_t;
+typedef CRITICAL_SECTION thor_mutex_t;
+typedef CONDITION_VARIABLE thor_cond_t;
+#else
+#include <pthread.h>
+
+typedef pthread_t thor_thread_t;
+typedef pthread_mutex_t thor_mutex_t;
+typedef pthread_cond_t thor_cond_t;
+#endif
+
+typedef void *(*thor_thread_func)(void *arg);
+
+void thor_thread_create(thor_thread_t *thread, thor_thread_func func, void *arg);
+void thor_thread_join(thor_thread_t thread);
+
+void thor_mutex_init(thor_mutex_t *mutex);
+void thor_mutex_destroy(thor_mutex_t *mutex);
+void thor_mutex_lock(thor_mutex_t *mutex);
+void thor_mutex_unlock(thor_mutex_t *mutex);
+
+void thor_cond_init(thor_cond_t *cond);
+void thor_cond_destroy(thor_cond_t *cond);
+void thor_cond_wait(thor_cond_t *cond, thor_mutex_t *mutex);
+void thor_cond_broadcast(thor_cond_t *cond);
+
+#endif
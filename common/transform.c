@@ -246,89 +246,90 @@ const int16_t g5mat_hevc[64][64] = {
 
 static const int16_t *transform_table[5] = { &g1mat_hevc[0][0], &g2mat_hevc[0][0], &g3mat_hevc[0][0], &g4mat_hevc[0][0], &g5mat_hevc[0][0]};
 
-void transform (const int16_t *block, int16_t *coeff, int size, int fast)
+void transform_non_simd(const int16_t *block, int16_t *coeff, int size, int fast)
 {
-  if (use_simd)
-    transform_simd(block, coeff, size, fast);
-  else {
-    int dsize = size;
-    int16_t tmp[MAX_TR_SIZE][MAX_TR_SIZE];
-    int16_t tmp2[32*32];
-    int tr_log2size = log2i(size);
-    int tr = tr_log2size - 2;
-    const int16_t * tr_matrix = transform_table[tr];
+  int dsize = size;
+  int16_t tmp[MAX_TR_SIZE][MAX_TR_SIZE];
+  int16_t tmp2[32*32];
+  int tr_log2size = log2i(size);
+  int tr = tr_log2size - 2;
+  const int16_t * tr_matrix = transform_table[tr];
 
-    const int bit_depth = 8;
+  const int bit_depth = 8;
 
-    int shift_1 = tr_log2size + bit_depth - 8;
-    int add_1 = 1 << (shift_1 - 1);
+  int shift_1 = tr_log2size + bit_depth - 8;
+  int add_1 = 1 << (shift_1 - 1);
 
-    int shift_2 = tr_log2size + 5;
-    int add_2 = 1 << (shift_2 -1);
+  int shift_2 = tr_log2size + 5;
+  int add_2 = 1 << (shift_2 -1);
 
-    int qsize = min(size,MAX_QUANT_SIZE);
-    const int16_t *in = block;
+  int qsize = min(size,MAX_QUANT_SIZE);
+  const int16_t *in = block;
 
-    /* Add into 16x16 block and do a 16x16 transform */
-    if (size > 16 && fast) {
-      tr_matrix = transform_table[2];
-      shift_1 += 1 + (size == 64);
-      add_1 = 1 << (shift_1 - 1);
-      shift_2 = 9;
-      add_2 = 256;
-      for (int i = 0; i < 16; i++)
-        for (int j = 0; j < 16; j++)
-          if (size == 32)
-            tmp2[i*16+j] =
-              block[(i*2+0)*32+j*2+0] + block[(i*2+1)*32+j*2+0] +
-              block[(i*2+0)*32+j*2+1] + block[(i*2+1)*32+j*2+1];
-          else
-            tmp2[i*16+j] =
-              block[(i*4+0)*64+j*4+0] + block[(i*4+1)*64+j*4+0] + block[(i*4+2)*64+j*4+0] + block[(i*4+3)*64+j*4+0] +
-              block[(i*4+0)*64+j*4+1] + block[(i*4+1)*64+j*4+1] + block[(i*4+2)*64+j*4+1] + block[(i*4+3)*64+j*4+1] +
-              block[(i*4+0)*64+j*4+2] + block[(i*4+1)*64+j*4+2] + block[(i*4+2)*64+j*4+2] + block[(i*4+3)*64+j*4+2] +
-              block[(i*4+0)*64+j*4+3] + block[(i*4+1)*64+j*4+3] + block[(i*4+2)*64+j*4+3] + block[(i*4+3)*64+j*4+3];
-      size = 16;
-      in = tmp2;
-    }
-    else if (size == 64) {
-      tr_matrix = transform_table[3];
-      shift_1 = 7;
-      add_1 = 1 << (shift_1 - 1);
-      shift_2 = 10;
-      add_2 = 1 << (shift_2 - 1);
-      for (int i = 0; i < 32; i++)
-        for (int j = 0; j < 32; j++)
-          tmp2[i * 32 + j] =
-          block[(i * 2 + 0) * 64 + j * 2 + 0] + block[(i * 2 + 1) * 64 + j * 2 + 0] +
-          block[(i * 2 + 0) * 64 + j * 2 + 1] + block[(i * 2 + 1) * 64 + j * 2 + 1];
-      size = 32;
-      in = tmp2;
-    }
-    /* 1st dimension */
-    for (int i = 0; i < qsize; i++){
-      for (int j = 0; j < size; j++){
-        int sum = 0;
-        for (int k = 0; k < size; k++){
-          sum += tr_matrix[i*size + k] * in[j*size + k];
-        }
-        tmp[i][j] = (sum + add_1) >> shift_1;
+  /* Add into 16x16 block and do a 16x16 transform */
+  if (size > 16 && fast) {
+    tr_matrix = transform_table[2];
+    shift_1 += 1 + (size == 64);
+    add_1 = 1 << (shift_1 - 1);
+    shift_2 = 9;
+    add_2 = 256;
+    for (int i = 0; i < 16; i++)
+      for (int j = 0; j < 16; j++)
+        if (size == 32)
+          tmp2[i*16+j] =
+            block[(i*2+0)*32+j*2+0] + block[(i*2+1)*32+j*2+0] +
+            block[(i*2+0)*32+j*2+1] + block[(i*2+1)*32+j*2+1];
+        else
+          tmp2[i*16+j] =
+            block[(i*4+0)*64+j*4+0] + block[(i*4+1)*64+j*4+0] + block[(i*4+2)*64+j*4+0] + block[(i*4+3)*64+j*4+0] +
+            block[(i*4+0)*64+j*4+1] + block[(i*4+1)*64+j*4+1] + block[(i*4+2)*64+j*4+1] + block[(i*4+3)*64+j*4+1] +
+            block[(i*4+0)*64+j*4+2] + block[(i*4+1)*64+j*4+2] + block[(i*4+2)*64+j*4+2] + block[(i*4+3)*64+j*4+2] +
+            block[(i*4+0)*64+j*4+3] + block[(i*4+1)*64+j*4+3] + block[(i*4+2)*64+j*4+3] + block[(i*4+3)*64+j*4+3];
+    size = 16;
+    in = tmp2;
+  }
+  else if (size == 64) {
+    tr_matrix = transform_table[3];
+    shift_1 = 7;
+    add_1 = 1 << (shift_1 - 1);
+    shift_2 = 10;
+    add_2 = 1 << (shift_2 - 1);
+    for (int i = 0; i < 32; i++)
+      for (int j = 0; j < 32; j++)
+        tmp2[i * 32 + j] =
+        block[(i * 2 + 0) * 64 + j * 2 + 0] + block[(i * 2 + 1) * 64 + j * 2 + 0] +
+        block[(i * 2 + 0) * 64 + j * 2 + 1] + block[(i * 2 + 1) * 64 + j * 2 + 1];
+    size = 32;
+    in = tmp2;
+  }
+  /* 1st dimension */
+  for (int i = 0; i < qsize; i++){
+    for (int j = 0; j < size; j++){
+      int sum = 0;
+      for (int k = 0; k < size; k++){
+        sum += tr_matrix[i*size + k] * in[j*size + k];
       }
+      tmp[i][j] = (sum + add_1) >> shift_1;
     }
+  }
 
-    /* 2nd dimension */
-    for (int i = 0; i < qsize; i++){
-      for (int j = 0; j < qsize; j++){
-        int sum = 0;
-        for (int k = 0; k < size; k++){
-          sum += tr_matrix[i*size + k] * tmp[j][k];
-        }
-        coeff[i*dsize + j] = (sum + add_2) >> shift_2;
+  /* 2nd dimension */
+  for (int i = 0; i < qsize; i++){
+    for (int j = 0; j < qsize; j++){
+      int sum = 0;
+      for (int k = 0; k < size; k++){
+        sum += tr_matrix[i*size + k] * tmp[j][k];
       }
+      coeff[i*dsize + j] = (sum + add_2) >> shift_2;
     }
   }
 }
 
+void transform (const int16_t *block, int16_t *coeff, int size, int fast)
+{
+  common_kernels->transform(block, coeff, size, fast);
+}
+
 void transform_1d_odd_l4(const int16_t *coeff, const int16_t *tr_matrix, int size, int j, int *o)
 {
   int i;
@@ -488,10 +489,7 @@ void inverse_transform_non_simd(const int16_t * coeff, int16_t *block, int size)
 void inverse_transform (const int16_t * coeff, int16_t *block, int size)
 {
   if (size < 64) {
-    if (use_simd)
-      inverse_transform_simd(coeff, block, size);
-    else
-      inverse_transform_non_simd(coeff, block, size);
+    common_kernels->inverse_transform(coeff, block, size);
   }
   else {
     int i, j;
@@ -500,10 +498,7 @@ void inverse_transform (const int16_t * coeff, int16_t *block, int size)
     for (i = 0; i < 32; i++) {
       memcpy(coeff2 + i * 32, coeff + i * 64, 32 * sizeof(int16_t));
     }
-    if (use_simd)
-      inverse_transform_simd(coeff2, block2, 32);
-    else
-      inverse_transform_non_simd(coeff2, block2, 32);
+    common_kernels->inverse_transform(coeff2, block2, 32);
     for (i = 0; i < 32; i++) {
       for (j = 0; j < 32; j++) {
         block[(2 * i + 0) * 64 + 2 * j + 0] =
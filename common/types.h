@@ -178,6 +178,16 @@ typedef struct
   uint8_t bheight;
 } block_pos_t;
 
+/* Rectangular group of superblocks. Neighbouring blocks outside the tile are
+   treated as unavailable, so that tiles can be coded independently. */
+typedef struct
+{
+  int ypos;    //Luma position of the top-left superblock
+  int xpos;
+  int height;  //Luma size, clipped to the frame
+  int width;
+} tile_t;
+
 typedef struct
 {
   int8_t split;
@@ -42,6 +42,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "inter_prediction.h"
 #include "intra_prediction.h"
 #include "simd.h"
+#include "frame_pool.h"
 
 extern int chroma_qp[52];
 
@@ -155,10 +156,31 @@ void copy_deblock_data(decoder_info_t *decoder_info, block_info_dec_t *block_inf
   }
 }
 
-void decode_block(decoder_info_t *decoder_info,int size,int ypos,int xpos){
+/* With frame threads, wait until the rows of the reference frames that the
+   motion vectors of the block point to have been decoded */
+static void wait_for_references(decoder_info_t *decoder_info, block_param_t *block_param, int ypos, int size)
+{
+  int num_lists = block_param->mode == MODE_BIPRED || block_param->dir == 2 ? 2 : 1;
+  for (int list=0;list<num_lists;list++){
+    int r = decoder_info->frame_info.ref_array[list ? block_param->ref_idx1 : block_param->ref_idx0];
+    mv_t *mv_arr = list ? block_param->mv_arr1 : block_param->mv_arr0;
+    int mv_y = 0;
+    if (r < 0)
+      continue;
+    for (int i=0;i<4;i++)
+      mv_y = max(mv_y, abs(mv_arr[i].y));
+    /* The interpolation filters reach 4 rows below the block */
+    frame_pool_wait_rows(decoder_info, decoder_info->ref[r], ypos + size + (mv_y>>2) + 8);
+  }
+}
+
+/* Predict and reconstruct a block that has been read from the bitstream */
+void reconstruct_block_dec(decoder_info_t *decoder_info, block_info_dec_t *block_info){
 
+  int size = block_info->block_pos.size;
+  int ypos = block_info->block_pos.ypos;
+  int xpos = block_info->block_pos.xpos;
   int width = decoder_info->width;
-  int height = decoder_info->height;
   int xposY = xpos;
   int yposY = ypos;
   int xposC = xpos/2;
@@ -166,23 +188,22 @@ void decode_block(decoder_info_t *decoder_info,int size,int ypos,int xpos){
   int sizeY = size;
   int sizeC = size/2;
 
-  block_mode_t mode;
+  block_mode_t mode = block_info->block_param.mode;
   mv_t mv;
   intra_mode_t intra_mode;
 
-  frame_type_t frame_type = decoder_info->frame_info.frame_type;
   int bipred = decoder_info->bipred;
 
-  int qpY = decoder_info->frame_info.qpb;
+  int qpY = block_info->qp;
   int qpC = chroma_qp[qpY];
 
   /* Intermediate block variables */
   uint8_t *pblock_y = thor_alloc(MAX_BLOCK_SIZE*MAX_BLOCK_SIZE, 16);
   uint8_t *pblock_u = thor_alloc(MAX_BLOCK_SIZE*MAX_BLOCK_SIZE, 16);
   uint8_t *pblock_v = thor_alloc(MAX_BLOCK_SIZE*MAX_BLOCK_SIZE, 16);
-  int16_t *coeff_y = thor_alloc(2*MAX_TR_SIZE*MAX_TR_SIZE, 16);
-  int16_t *coeff_u = thor_alloc(2*MAX_TR_SIZE*MAX_TR_SIZE, 16);
-  int16_t *coeff_v = thor_alloc(2*MAX_TR_SIZE*MAX_TR_SIZE, 16);
+  int16_t *coeff_y = block_info->coeffq_y;
+  int16_t *coeff_u = block_info->coeffq_u;
+  int16_t *coeff_v = block_info->coeffq_v;
 
   /* Block variables for bipred */
   uint8_t *pblock0_y = thor_alloc(MAX_BLOCK_SIZE*MAX_BLOCK_SIZE, 16);
@@ -208,50 +229,38 @@ void decode_block(decoder_info_t *decoder_info,int size,int ypos,int xpos){
   uint8_t *ref_u = ref->u + ref_posC;
   uint8_t *ref_v = ref->v + ref_posC;
 
-  stream_t *stream = decoder_info->stream;
-
-  /* Read data from bitstream */
-  block_info_dec_t block_info;
-  block_info.block_pos.size = size;
-  block_info.block_pos.ypos = ypos;
-  block_info.block_pos.xpos = xpos;
-  block_info.coeffq_y = coeff_y;
-  block_info.coeffq_u = coeff_u;
-  block_info.coeffq_v = coeff_v;
-
   /* Used for rectangular skip blocks */
-  int bwidth = min(size,width - xpos);
-  int bheight = min(size,height - ypos);
-  block_info.block_pos.bwidth = bwidth;
-  block_info.block_pos.bheight = bheight;
+  int bwidth = block_info->block_pos.bwidth;
+  int bheight = block_info->block_pos.bheight;
 
-  read_block(decoder_info,stream,&block_info,frame_type);
-  mode = block_info.block_param.mode;
+  if (decoder_info->frame_pool && mode != MODE_INTRA)
+    wait_for_references(decoder_info, &block_info->block_param, yposY, size);
 
   if (mode == MODE_INTRA){
     /* Dequantize, inverse tranform, predict and reconstruct */
-    intra_mode = block_info.block_param.intra_mode;
-    int upright_available = get_upright_available(ypos,xpos,size,width);
-    int downleft_available = get_downleft_available(ypos,xpos,size,height);
-    int tb_split = block_info.block_param.tb_split;
-    decode_and_reconstruct_block_intra(rec_y,rec->stride_y,sizeY,qpY,pblock_y,coeff_y,tb_split,upright_available,downleft_available,intra_mode,yposY,xposY,width,0);
-    decode_and_reconstruct_block_intra(rec_u,rec->stride_c,sizeC,qpC,pblock_u,coeff_u,tb_split&&size>8,upright_available,downleft_available,intra_mode,yposC,xposC,width/2,1);
-    decode_and_reconstruct_block_intra(rec_v,rec->stride_c,sizeC,qpC,pblock_v,coeff_v,tb_split&&size>8,upright_available,downleft_available,intra_mode,yposC,xposC,width/2,2);
+    intra_mode = block_info->block_param.intra_mode;
+    tile_t *tile = &decoder_info->tile;
+    int upright_available = get_upright_available(ypos-tile->ypos,xpos-tile->xpos,size,tile->width);
+    int downleft_available = get_downleft_available(ypos-tile->ypos,xpos-tile->xpos,size,tile->height);
+    int tb_split = block_info->block_param.tb_split;
+    decode_and_reconstruct_block_intra(rec_y,rec->stride_y,sizeY,qpY,pblock_y,coeff_y,tb_split,upright_available,downleft_available,intra_mode,yposY-tile->ypos,xposY-tile->xpos,width,0);
+    decode_and_reconstruct_block_intra(rec_u,rec->stride_c,sizeC,qpC,pblock_u,coeff_u,tb_split&&size>8,upright_available,downleft_available,intra_mode,yposC-tile->ypos/2,xposC-tile->xpos/2,width/2,1);
+    decode_and_reconstruct_block_intra(rec_v,rec->stride_c,sizeC,qpC,pblock_v,coeff_v,tb_split&&size>8,upright_available,downleft_available,intra_mode,yposC-tile->ypos/2,xposC-tile->xpos/2,width/2,2);
   }
   else
   {
     if (mode==MODE_SKIP){
-      if (block_info.block_param.dir==2){
+      if (block_info->block_param.dir==2){
         uint8_t *ref0_y,*ref0_u,*ref0_v;
         uint8_t *ref1_y,*ref1_u,*ref1_v;
 
-        int r0 = decoder_info->frame_info.ref_array[block_info.block_param.ref_idx0];
+        int r0 = decoder_info->frame_info.ref_array[block_info->block_param.ref_idx0];
         yuv_frame_t *ref0 = r0>=0 ? decoder_info->ref[r0] : decoder_info->interp_frames[0];
         ref0_y = ref0->y + ref_posY;
         ref0_u = ref0->u + ref_posC;
         ref0_v = ref0->v + ref_posC;
 
-        int r1 = decoder_info->frame_info.ref_array[block_info.block_param.ref_idx1];
+        int r1 = decoder_info->frame_info.ref_array[block_info->block_param.ref_idx1];
         yuv_frame_t *ref1 = r1>=0 ? decoder_info->ref[r1] : decoder_info->interp_frames[0];
         ref1_y = ref1->y + ref_posY;
         ref1_u = ref1->u + ref_posC;
@@ -259,11 +268,11 @@ void decode_block(decoder_info_t *decoder_info,int size,int ypos,int xpos){
         int sign0 = ref0->frame_num >= rec->frame_num;
         int sign1 = ref1->frame_num >= rec->frame_num;
 
-        mv = block_info.block_param.mv_arr0[0];
+        mv = block_info->block_param.mv_arr0[0];
         get_inter_prediction_luma  (pblock0_y, ref0_y, bwidth,   bheight,   ref->stride_y, sizeY, &mv, sign0, bipred);
         get_inter_prediction_chroma(pblock0_u, ref0_u, bwidth/2, bheight/2, ref->stride_c, sizeC, &mv, sign0);
         get_inter_prediction_chroma(pblock0_v, ref0_v, bwidth/2, bheight/2, ref->stride_c, sizeC, &mv, sign0);
-        mv = block_info.block_param.mv_arr1[0];
+        mv = block_info->block_param.mv_arr1[0];
         get_inter_prediction_luma  (pblock1_y, ref1_y, bwidth,   bheight,   ref->stride_y, sizeY, &mv, sign1, bipred);
         get_inter_prediction_chroma(pblock1_u, ref1_u, bwidth/2, bheight/2, ref->stride_c, sizeC, &mv, sign1);
         get_inter_prediction_chroma(pblock1_v, ref1_v, bwidth/2, bheight/2, ref->stride_c, sizeC, &mv, sign1);
@@ -281,11 +290,10 @@ void decode_block(decoder_info_t *decoder_info,int size,int ypos,int xpos){
             rec_v[i*rec->stride_c+j] = (uint8_t)(((int)pblock0_v[i*sizeC+j] + (int)pblock1_v[i*sizeC+j])>>1);
           }
         }
-        copy_deblock_data(decoder_info,&block_info);
       }
       else{
-        mv = block_info.block_param.mv_arr0[0];
-        int ref_idx = block_info.block_param.ref_idx0; //TODO: Move to top
+        mv = block_info->block_param.mv_arr0[0];
+        int ref_idx = block_info->block_param.ref_idx0; //TODO: Move to top
         int r = decoder_info->frame_info.ref_array[ref_idx];
         ref = r>=0 ? decoder_info->ref[r] : decoder_info->interp_frames[0];
         int sign = ref->frame_num > rec->frame_num;
@@ -304,22 +312,20 @@ void decode_block(decoder_info_t *decoder_info,int size,int ypos,int xpos){
           memcpy(&rec_u[j*rec->stride_c],&pblock_u[j*sizeC],(bwidth/2)*sizeof(uint8_t));
           memcpy(&rec_v[j*rec->stride_c],&pblock_v[j*sizeC],(bwidth/2)*sizeof(uint8_t));
         }
-        copy_deblock_data(decoder_info,&block_info);
       }
-      return;
     }
     else if (mode==MODE_MERGE){
-      if (block_info.block_param.dir==2){
+      if (block_info->block_param.dir==2){
         uint8_t *ref0_y,*ref0_u,*ref0_v;
         uint8_t *ref1_y,*ref1_u,*ref1_v;
 
-        int r0 = decoder_info->frame_info.ref_array[block_info.block_param.ref_idx0];
+        int r0 = decoder_info->frame_info.ref_array[block_info->block_param.ref_idx0];
         yuv_frame_t *ref0 = r0>=0 ? decoder_info->ref[r0] : decoder_info->interp_frames[0];
         ref0_y = ref0->y + ref_posY;
         ref0_u = ref0->u + ref_posC;
         ref0_v = ref0->v + ref_posC;
 
-        int r1 = decoder_info->frame_info.ref_array[block_info.block_param.ref_idx1];
+        int r1 = decoder_info->frame_info.ref_array[block_info->block_param.ref_idx1];
         yuv_frame_t *ref1 = r1>=0 ? decoder_info->ref[r1] : decoder_info->interp_frames[0];
         ref1_y = ref1->y + ref_posY;
         ref1_u = ref1->u + ref_posC;
@@ -328,11 +334,11 @@ void decode_block(decoder_info_t *decoder_info,int size,int ypos,int xpos){
         int sign0 = ref0->frame_num >= rec->frame_num;
         int sign1 = ref1->frame_num >= rec->frame_num;
 
-        mv = block_info.block_param.mv_arr0[0];
+        mv = block_info->block_param.mv_arr0[0];
         get_inter_prediction_luma  (pblock0_y, ref0_y, bwidth,   bheight,   ref->stride_y, sizeY, &mv, sign0, bipred);
         get_inter_prediction_chroma(pblock0_u, ref0_u, bwidth/2, bheight/2, ref->stride_c, sizeC, &mv, sign0);
         get_inter_prediction_chroma(pblock0_v, ref0_v, bwidth/2, bheight/2, ref->stride_c, sizeC, &mv, sign0);
-        mv = block_info.block_param.mv_arr1[0];
+        mv = block_info->block_param.mv_arr1[0];
         get_inter_prediction_luma  (pblock1_y, ref1_y, bwidth,   bheight,   ref->stride_y, sizeY, &mv, sign1, bipred);
         get_inter_prediction_chroma(pblock1_u, ref1_u, bwidth/2, bheight/2, ref->stride_c, sizeC, &mv, sign1);
         get_inter_prediction_chroma(pblock1_v, ref1_v, bwidth/2, bheight/2, ref->stride_c, sizeC, &mv, sign1);
@@ -351,8 +357,8 @@ void decode_block(decoder_info_t *decoder_info,int size,int ypos,int xpos){
         }
       }
       else{
-        mv = block_info.block_param.mv_arr0[0];
-        int ref_idx = block_info.block_param.ref_idx0; //TODO: Move to top
+        mv = block_info->block_param.mv_arr0[0];
+        int ref_idx = block_info->block_param.ref_idx0; //TODO: Move to top
         int r = decoder_info->frame_info.ref_array[ref_idx];
         ref = r>=0 ? decoder_info->ref[r] : decoder_info->interp_frames[0];
         int sign = ref->frame_num > rec->frame_num;
@@ -371,7 +377,7 @@ void decode_block(decoder_info_t *decoder_info,int size,int ypos,int xpos){
       int psizeC = sizeC/2;
       int pstrideY = sizeY;
       int pstrideC = sizeC;
-      int ref_idx = block_info.block_param.ref_idx0;
+      int ref_idx = block_info->block_param.ref_idx0;
       int r = decoder_info->frame_info.ref_array[ref_idx];
       ref = r>=0 ? decoder_info->ref[r] : decoder_info->interp_frames[0];
       int sign = ref->frame_num > rec->frame_num;
@@ -385,7 +391,7 @@ void decode_block(decoder_info_t *decoder_info,int size,int ypos,int xpos){
         int offsetpC = idy*psizeC*pstrideC + idx*psizeC;
         int offsetrY = idy*psizeY*ref->stride_y + idx*psizeY;
         int offsetrC = idy*psizeC*ref->stride_c + idx*psizeC;
-        mv = block_info.block_param.mv_arr0[index];
+        mv = block_info->block_param.mv_arr0[index];
         get_inter_prediction_luma  (pblock_y + offsetpY, ref_y + offsetrY, psizeY, psizeY, ref->stride_y, pstrideY, &mv, sign, bipred);
         get_inter_prediction_chroma(pblock_u + offsetpC, ref_u + offsetrC, psizeC, psizeC, ref->stride_c, pstrideC, &mv, sign);
         get_inter_prediction_chroma(pblock_v + offsetpC, ref_v + offsetrC, psizeC, psizeC, ref->stride_c, pstrideC, &mv, sign);
@@ -401,13 +407,13 @@ void decode_block(decoder_info_t *decoder_info,int size,int ypos,int xpos){
       uint8_t *ref0_y,*ref0_u,*ref0_v;
       uint8_t *ref1_y,*ref1_u,*ref1_v;
 
-      int r0 = decoder_info->frame_info.ref_array[block_info.block_param.ref_idx0];
+      int r0 = decoder_info->frame_info.ref_array[block_info->block_param.ref_idx0];
       yuv_frame_t *ref0 = r0>=0 ? decoder_info->ref[r0] : decoder_info->interp_frames[0];
       ref0_y = ref0->y + ref_posY;
       ref0_u = ref0->u + ref_posC;
       ref0_v = ref0->v + ref_posC;
 
-      int r1 = decoder_info->frame_info.ref_array[block_info.block_param.ref_idx1];
+      int r1 = decoder_info->frame_info.ref_array[block_info->block_param.ref_idx1];
       yuv_frame_t *ref1 = r1>=0 ? decoder_info->ref[r1] : decoder_info->interp_frames[0];
       ref1_y = ref1->y + ref_posY;
       ref1_u = ref1->u + ref_posC;
@@ -423,11 +429,11 @@ void decode_block(decoder_info_t *decoder_info,int size,int ypos,int xpos){
         int offsetpC = idy*psizeC*pstrideC + idx*psizeC;
         int offsetrY = idy*psizeY*ref->stride_y + idx*psizeY;
         int offsetrC = idy*psizeC*ref->stride_c + idx*psizeC;
-        mv = block_info.block_param.mv_arr0[index];
+        mv = block_info->block_param.mv_arr0[index];
         get_inter_prediction_luma  (pblock0_y + offsetpY, ref0_y + offsetrY, psizeY, psizeY, ref->stride_y, pstrideY, &mv, sign0, bipred);
         get_inter_prediction_chroma(pblock0_u + offsetpC, ref0_u + offsetrC, psizeC, psizeC, ref->stride_c, pstrideC, &mv, sign0);
         get_inter_prediction_chroma(pblock0_v + offsetpC, ref0_v + offsetrC, psizeC, psizeC, ref->stride_c, pstrideC, &mv, sign0);
-        mv = block_info.block_param.mv_arr1[index];
+        mv = block_info->block_param.mv_arr1[index];
         get_inter_prediction_luma  (pblock1_y + offsetpY, ref1_y + offsetrY, psizeY, psizeY, ref->stride_y, pstrideY, &mv, sign1, bipred);
         get_inter_prediction_chroma(pblock1_u + offsetpC, ref1_u + offsetrC, psizeC, psizeC, ref->stride_c, pstrideC, &mv, sign1);
         get_inter_prediction_chroma(pblock1_v + offsetpC, ref1_v + offsetrC, psizeC, psizeC, ref->stride_c, pstrideC, &mv, sign1);
@@ -447,15 +453,14 @@ void decode_block(decoder_info_t *decoder_info,int size,int ypos,int xpos){
     }
 
     /* Dequantize, invere tranform and reconstruct */
-    int tb_split = block_info.block_param.tb_split;
-    decode_and_reconstruct_block_inter(rec_y,rec->stride_y,sizeY,qpY,pblock_y,coeff_y,tb_split);
-    decode_and_reconstruct_block_inter(rec_u,rec->stride_c,sizeC,qpC,pblock_u,coeff_u,tb_split&&size>8);
-    decode_and_reconstruct_block_inter(rec_v,rec->stride_c,sizeC,qpC,pblock_v,coeff_v,tb_split&&size>8);
+    if (mode != MODE_SKIP){
+      int tb_split = block_info->block_param.tb_split;
+      decode_and_reconstruct_block_inter(rec_y,rec->stride_y,sizeY,qpY,pblock_y,coeff_y,tb_split);
+      decode_and_reconstruct_block_inter(rec_u,rec->stride_c,sizeC,qpC,pblock_u,coeff_u,tb_split&&size>8);
+      decode_and_reconstruct_block_inter(rec_v,rec->stride_c,sizeC,qpC,pblock_v,coeff_v,tb_split&&size>8);
+    }
   }
 
-  /* Copy deblock data to frame array */
-  copy_deblock_data(decoder_info,&block_info);
-
   thor_free(pblock0_y);
   thor_free(pblock0_u);
   thor_free(pblock0_v);
@@ -465,9 +470,56 @@ void decode_block(decoder_info_t *decoder_info,int size,int ypos,int xpos){
   thor_free(pblock_y);
   thor_free(pblock_u);
   thor_free(pblock_v);
-  thor_free(coeff_y);
-  thor_free(coeff_u);
-  thor_free(coeff_v);
+}
+
+/* Read a block from the bitstream. The block is reconstructed right away, or
+   stored with its coefficients in the block buffer for two-phase decoding. */
+void decode_block(decoder_info_t *decoder_info,int size,int ypos,int xpos){
+
+  block_buffer_t *block_buffer = decoder_info->block_buffer;
+  block_info_dec_t block_info_local;
+  block_info_dec_t *block_info;
+
+  if (block_buffer){
+    int16_t *coeff = block_buffer->coeff + block_buffer->coeff_pos;
+    block_info = &block_buffer->blocks[block_buffer->num_blocks++];
+    block_info->coeffq_y = coeff;
+    block_info->coeffq_u = coeff + size*size;
+    block_info->coeffq_v = coeff + size*size + size*size/4;
+  }
+  else{
+    block_info = &block_info_local;
+    block_info->coeffq_y = thor_alloc(2*MAX_TR_SIZE*MAX_TR_SIZE, 16);
+    block_info->coeffq_u = thor_alloc(2*MAX_TR_SIZE*MAX_TR_SIZE, 16);
+    block_info->coeffq_v = thor_alloc(2*MAX_TR_SIZE*MAX_TR_SIZE, 16);
+  }
+
+  /* Read data from bitstream */
+  block_info->block_pos.size = size;
+  block_info->block_pos.ypos = ypos;
+  block_info->block_pos.xpos = xpos;
+
+  /* Used for rectangular skip blocks */
+  block_info->block_pos.bwidth = min(size,decoder_info->width - xpos);
+  block_info->block_pos.bheight = min(size,decoder_info->height - ypos);
+
+  read_block(decoder_info,decoder_info->stream,block_info,decoder_info->frame_info.frame_type);
+  block_info->qp = decoder_info->frame_info.qpb;
+
+  /* Copy deblock data to frame array */
+  copy_deblock_data(decoder_info,block_info);
+
+  if (block_buffer){
+    /* Skip blocks have no coefficients */
+    if (block_info->block_param.mode != MODE_SKIP)
+      block_buffer->coeff_pos += size*size*3/2;
+  }
+  else{
+    reconstruct_block_dec(decoder_info,block_info);
+    thor_free(block_info->coeffq_y);
+    thor_free(block_info->coeffq_u);
+    thor_free(block_info->coeffq_v);
+  }
 }
 
 
@@ -641,7 +693,7 @@ void process_block_dec(decoder_info_t *decoder_info,int size,int yposY,int xposY
   int mode = MODE_SKIP;
  
   block_context_t block_context;
-  find_block_contexts(yposY, xposY, height, width, size, decoder_info->deblock_data, &block_context, decoder_info->use_block_contexts);
+  find_block_contexts(yposY, xposY, height, width, size, decoder_info->deblock_data, &decoder_info->tile, &block_context, decoder_info->use_block_contexts);
   decoder_info->block_context = &block_context;
 
   split_flag = decode_super_mode(decoder_info,size,decode_this_size);
@@ -30,5 +30,6 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "maindec.h"
 
 void process_block_dec(decoder_info_t *encoder_info,int size,int yposY,int xposY);
+void reconstruct_block_dec(decoder_info_t *decoder_info, block_info_dec_t *block_info);
 
 #endif
@@ -24,6 +24,8 @@ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "global.h"
@@ -31,6 +33,10 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "common_block.h"
 #include "common_frame.h"
 #include "temporal_interp.h"
+#include "row_filter.h"
+#include "frame_pool.h"
+#include "thread.h"
+#include "simd.h"
 
 extern int chroma_qp[52];
 
@@ -42,18 +48,256 @@ static int clpf_bit(int k, int l, yuv_frame_t *r, yuv_frame_t *o, const deblock_
   return getbits((stream_t*)stream, 1);
 }
 
-void decode_frame(decoder_info_t *decoder_info, yuv_frame_t* rec_buffer)
+/* Add the bit counts and statistics of src to dst */
+void add_bit_count(bit_count_t *dst, bit_count_t *src)
+{
+  uint32_t *d = &dst->sequence_header;
+  uint32_t *s = &src->sequence_header;
+  int n = (int)((sizeof(bit_count_t) - offsetof(bit_count_t, sequence_header))/sizeof(uint32_t));
+  for (int i=0;i<n;i++)
+    d[i] += s[i];
+}
+
+static void decode_tile(decoder_info_t *decoder_info)
+{
+  tile_t *tile = &decoder_info->tile;
+  int k,l;
+
+  decoder_info->frame_info.qpb = decoder_info->frame_info.qp;
+  for (k=tile->ypos/MAX_BLOCK_SIZE;k*MAX_BLOCK_SIZE<tile->ypos+tile->height;k++){
+    for (l=tile->xpos/MAX_BLOCK_SIZE;l*MAX_BLOCK_SIZE<tile->xpos+tile->width;l++){
+      int xposY = l*MAX_BLOCK_SIZE;
+      int yposY = k*MAX_BLOCK_SIZE;
+      process_block_dec(decoder_info,MAX_BLOCK_SIZE,yposY,xposY);
+      if (decoder_info->row_filter)
+        row_filter_sb_done(decoder_info->row_filter, k);
+    }
+  }
+}
+
+/* Tiles are coded in byte-aligned substreams preceded by their size in bytes.
+   The substreams are read into memory and the tiles decoded in parallel, each
+   with a private copy of decoder_info. Up to decoder_info->threads workers,
+   the calling thread included, take tiles from a shared counter until all
+   are done. */
+typedef struct
+{
+  decoder_info_t *tiles;
+  int num_tiles;
+  int next_tile;         //Next tile to be decoded
+  thor_mutex_t mutex;
+} tile_pool_t;
+
+static void *tile_worker(void *arg)
+{
+  tile_pool_t *tp = (tile_pool_t*)arg;
+
+  while (1){
+    thor_mutex_lock(&tp->mutex);
+    int t = tp->next_tile++;
+    thor_mutex_unlock(&tp->mutex);
+    if (t >= tp->num_tiles)
+      break;
+    decode_tile(&tp->tiles[t]);
+  }
+  return NULL;
+}
+
+static void decode_tiles(decoder_info_t *decoder_info)
 {
-  int height = decoder_info->height;
-  int width = decoder_info->width;
-  int k,l,r;
-  int num_sb_hor = (width + MAX_BLOCK_SIZE - 1)/MAX_BLOCK_SIZE;
-  int num_sb_ver = (height + MAX_BLOCK_SIZE - 1)/MAX_BLOCK_SIZE;
   stream_t *stream = decoder_info->stream;
-  memset(decoder_info->deblock_data, 0, ((height/MIN_PB_SIZE) * (width/MIN_PB_SIZE) * sizeof(deblock_data_t)) );
+  int num_tiles = decoder_info->tile_cols*decoder_info->tile_rows;
+  int num_threads = min(num_tiles, decoder_info->threads);
+  thor_thread_t threads[MAX_THREADS];
+  tile_pool_t tp;
+  stream_t *streams;
+  uint8_t **bufs;
+  int t,i;
+
+  tp.num_tiles = num_tiles;
+  tp.next_tile = 0;
+  tp.tiles = (decoder_info_t*)malloc(num_tiles * sizeof(decoder_info_t));
+  streams = (stream_t*)malloc(num_tiles * sizeof(stream_t));
+  bufs = (uint8_t**)malloc(num_tiles * sizeof(uint8_t*));
+  if (tp.tiles == NULL || streams == NULL || bufs == NULL)
+    fatalerror("Memory allocation failed.");
+
+  getbits(stream, (8 - stream->bitcnt%8)%8);
+  for (t=0;t<num_tiles;t++){
+    int tile_bytes = getbits(stream, 32);
+    bufs[t] = (uint8_t*)malloc(max(tile_bytes, 1));
+    if (bufs[t] == NULL)
+      fatalerror("Memory allocation failed.");
+    for (i=0;i<tile_bytes;i++)
+      bufs[t][i] = getbits(stream, 8);
+    initbits_dec_mem(bufs[t], tile_bytes, &streams[t]);
+
+    tp.tiles[t] = *decoder_info;
+    tp.tiles[t].stream = &streams[t];
+    get_tile(&tp.tiles[t].tile, decoder_info->width, decoder_info->height, decoder_info->tile_rows, decoder_info->tile_cols,
+             t/decoder_info->tile_cols, t%decoder_info->tile_cols);
+    memset(&tp.tiles[t].bit_count, 0, sizeof(bit_count_t));
+    tp.tiles[t].bit_count.stat_frame_type = decoder_info->bit_count.stat_frame_type;
+  }
+
+  thor_mutex_init(&tp.mutex);
+  for (t=0;t<num_threads-1;t++)
+    thor_thread_create(&threads[t], tile_worker, &tp);
+  tile_worker(&tp);
+  for (t=0;t<num_threads-1;t++)
+    thor_thread_join(threads[t]);
+  thor_mutex_destroy(&tp.mutex);
+
+  /* Accumulate the bit counts of the tiles */
+  for (t=0;t<num_tiles;t++){
+    add_bit_count(&decoder_info->bit_count, &tp.tiles[t].bit_count);
+    free(bufs[t]);
+  }
+
+  free(bufs);
+  free(streams);
+  free(tp.tiles);
+}
+
+/* Two-phase decoding. The superblocks are read from the bitstream in raster
+   order into a block buffer and reconstructed by worker threads while the rest
+   of the frame is being read. Reading a block only depends on the modes and
+   motion vectors of the neighbouring blocks, which are stored in deblock_data
+   as soon as the block has been read. Superblock (k,l) can be reconstructed
+   once it has been read and (k-1,l+1) has been reconstructed, since intra
+   prediction uses the pixels up to the above-right superblock. Each worker
+   reconstructs whole rows, so (k,l-1) is always done before (k,l). */
+typedef struct
+{
+  decoder_info_t decoder_info;   //Copy of the frame state for the reconstruction
+  block_buffer_t *block_buffer;
+  int num_sb_hor;
+  int num_sb_ver;
+  int sb_read;           //Number of superblocks read from the bitstream
+  int next_row;          //Next superblock row to be reconstructed
+  int *sb_done;          //Number of reconstructed superblocks per row
+  thor_mutex_t mutex;
+  thor_cond_t cond;
+} recon_pool_t;
+
+static void *recon_worker(void *arg)
+{
+  recon_pool_t *rp = (recon_pool_t*)arg;
+  decoder_info_t *decoder_info = &rp->decoder_info;
+  block_buffer_t *block_buffer = rp->block_buffer;
+
+  while (1){
+    thor_mutex_lock(&rp->mutex);
+    int k = rp->next_row++;
+    thor_mutex_unlock(&rp->mutex);
+    if (k >= rp->num_sb_ver)
+      break;
+
+    for (int l=0;l<rp->num_sb_hor;l++){
+      int sb = k*rp->num_sb_hor + l;
+      int above = min(l+2, rp->num_sb_hor);
+      thor_mutex_lock(&rp->mutex);
+      while (rp->sb_read <= sb || (k > 0 && rp->sb_done[k-1] < above))
+        thor_cond_wait(&rp->cond, &rp->mutex);
+      thor_mutex_unlock(&rp->mutex);
+
+      for (int b=block_buffer->sb_first[sb];b<block_buffer->sb_first[sb+1];b++){
+        reconstruct_block_dec(decoder_info, &block_buffer->blocks[b]);
+      }
+      if (decoder_info->row_filter)
+        row_filter_sb_done(decoder_info->row_filter, k);
+
+      thor_mutex_lock(&rp->mutex);
+      rp->sb_done[k] = l+1;
+      thor_cond_broadcast(&rp->cond);
+      thor_mutex_unlock(&rp->mutex);
+    }
+  }
+  return NULL;
+}
+
+static void decode_superblocks_two_phase(decoder_info_t *decoder_info, int num_sb_hor, int num_sb_ver)
+{
+  int num_sb = num_sb_hor*num_sb_ver;
+  int max_blocks = num_sb*(MAX_BLOCK_SIZE/MIN_BLOCK_SIZE)*(MAX_BLOCK_SIZE/MIN_BLOCK_SIZE);
+  int num_threads = min(decoder_info->threads, num_sb_ver);
+  thor_thread_t threads[MAX_THREADS];
+  block_buffer_t block_buffer;
+  recon_pool_t *rp;
+  int k,l,t;
+
+  /* The blocks that are not skipped lie inside the frame and do not overlap */
+  block_buffer.blocks = (block_info_dec_t*)malloc(max_blocks * sizeof(block_info_dec_t));
+  block_buffer.sb_first = (int*)malloc((num_sb + 1) * sizeof(int));
+  block_buffer.coeff = (int16_t*)thor_alloc(decoder_info->width*decoder_info->height*3/2*sizeof(int16_t), 16);
+  rp = (recon_pool_t*)malloc(sizeof(recon_pool_t));
+  if (block_buffer.blocks == NULL || block_buffer.sb_first == NULL || block_buffer.coeff == NULL || rp == NULL)
+    fatalerror("Memory allocation failed.");
+  block_buffer.num_blocks = 0;
+  block_buffer.sb_first[0] = 0;
+  block_buffer.coeff_pos = 0;
+
+  rp->decoder_info = *decoder_info;
+  rp->block_buffer = &block_buffer;
+  rp->num_sb_hor = num_sb_hor;
+  rp->num_sb_ver = num_sb_ver;
+  rp->sb_read = 0;
+  rp->next_row = 0;
+  rp->sb_done = (int*)calloc(num_sb_ver, sizeof(int));
+  if (rp->sb_done == NULL)
+    fatalerror("Memory allocation failed.");
+  thor_mutex_init(&rp->mutex);
+  thor_cond_init(&rp->cond);
+
+  if (num_threads > 1){
+    for (t=0;t<num_threads;t++)
+      thor_thread_create(&threads[t], recon_worker, rp);
+  }
+
+  decoder_info->block_buffer = &block_buffer;
+  for (k=0;k<num_sb_ver;k++){
+    for (l=0;l<num_sb_hor;l++){
+      int sb = k*num_sb_hor + l;
+      process_block_dec(decoder_info,MAX_BLOCK_SIZE,k*MAX_BLOCK_SIZE,l*MAX_BLOCK_SIZE);
+      block_buffer.sb_first[sb+1] = block_buffer.num_blocks;
+      thor_mutex_lock(&rp->mutex);
+      rp->sb_read = sb+1;
+      thor_cond_broadcast(&rp->cond);
+      thor_mutex_unlock(&rp->mutex);
+    }
+  }
+  decoder_info->block_buffer = NULL;
+
+  if (num_threads > 1){
+    for (t=0;t<num_threads;t++)
+      thor_thread_join(threads[t]);
+  }
+  else{
+    recon_worker(rp);
+  }
+
+  thor_cond_destroy(&rp->cond);
+  thor_mutex_destroy(&rp->mutex);
+  free(rp->sb_done);
+  free(rp);
+  thor_free(block_buffer.coeff);
+  free(block_buffer.sb_first);
+  free(block_buffer.blocks);
+}
 
+static void ref_rows_done(void *arg, int rows)
+{
+  decoder_info_t *decoder_info = (decoder_info_t*)arg;
+  frame_pool_set_rows(decoder_info->frame_pool, decoder_info->ref_out, rows);
+}
+
+/* Parse the frame header and select the reconstruction buffer */
+void decode_frame_header(decoder_info_t *decoder_info, yuv_frame_t* rec_buffer)
+{
+  stream_t *stream = decoder_info->stream;
   int bit_start = stream->bitcnt;
   int rec_buffer_idx;
+  int r;
 
   decoder_info->frame_info.frame_type = getbits(stream,1);
   decoder_info->bit_count.stat_frame_type = decoder_info->frame_info.frame_type;
@@ -86,6 +330,43 @@ void decode_frame(decoder_info_t *decoder_info, yuv_frame_t* rec_buffer)
 
   rec_buffer_idx = decoder_info->frame_info.display_frame_num%MAX_REORDER_BUFFER;
   decoder_info->rec = &rec_buffer[rec_buffer_idx];
+
+  decoder_info->bit_count.frame_header[decoder_info->bit_count.stat_frame_type] += (stream->bitcnt - bit_start);
+  decoder_info->bit_count.frame_type[decoder_info->bit_count.stat_frame_type] += 1;
+  decoder_info->frame_info.qp = qp;
+  decoder_info->frame_info.qpb = qp;
+}
+
+/* Deblocking of finished superblock rows on a helper thread. The CLPF flags
+   follow the last superblock, so with CLPF enabled in the sequence header
+   the CLPF and the padding are done once the frame has been decoded. The
+   padded reference frame is otherwise made on the helper thread as well,
+   unless this frame reads from the reference buffer slot it replaces. With
+   frame threads the rows of the reference frame are then made available to
+   the following frames as soon as they are done. */
+static int early_reference(decoder_info_t *decoder_info, yuv_frame_t *ref_out)
+{
+  if (!(decoder_info->threads > 1 || decoder_info->frame_pool) || decoder_info->clpf)
+    return 0;
+  for (int r=0;r<decoder_info->frame_info.num_ref;r++){
+    if (decoder_info->frame_info.ref_array[r] >= 0 && decoder_info->ref[decoder_info->frame_info.ref_array[r]] == ref_out)
+      return 0;
+  }
+  return 1;
+}
+
+/* Decode the superblocks following the frame header. The loop filters may
+   still be running on the row filter thread when this returns. */
+void decode_frame_blocks(decoder_info_t *decoder_info, yuv_frame_t *ref_out)
+{
+  int height = decoder_info->height;
+  int width = decoder_info->width;
+  int k,l;
+  int num_sb_hor = (width + MAX_BLOCK_SIZE - 1)/MAX_BLOCK_SIZE;
+  int num_sb_ver = (height + MAX_BLOCK_SIZE - 1)/MAX_BLOCK_SIZE;
+  int qp = decoder_info->frame_info.qp;
+  memset(decoder_info->deblock_data, 0, ((height/MIN_PB_SIZE) * (width/MIN_PB_SIZE) * sizeof(deblock_data_t)) );
+  decoder_info->ref_out = ref_out;
   decoder_info->rec->frame_num = decoder_info->frame_info.display_frame_num;
 
   if (decoder_info->frame_info.num_ref>2 && decoder_info->frame_info.ref_array[0]==-1) {
@@ -93,6 +374,8 @@ void decode_frame(decoder_info_t *decoder_info, yuv_frame_t* rec_buffer)
     yuv_frame_t* ref1=decoder_info->ref[decoder_info->frame_info.ref_array[1]];
     yuv_frame_t* ref2=decoder_info->ref[decoder_info->frame_info.ref_array[2]];
     int display_frame_num = decoder_info->frame_info.display_frame_num;
+    frame_pool_wait_rows(decoder_info, ref1, decoder_info->height);
+    frame_pool_wait_rows(decoder_info, ref2, decoder_info->height);
     int off1 = ref2->frame_num - display_frame_num;
     int off2 = display_frame_num - ref1->frame_num;
     if (off1 < 0 && off2 < 0) {
@@ -103,25 +386,53 @@ void decode_frame(decoder_info_t *decoder_info, yuv_frame_t* rec_buffer)
       off1 = off2 = 1;
     }
     // FIXME: won't work for the 1-sided case
-    interpolate_frames(decoder_info->interp_frames[0], ref1, ref2, off1+off2 , off2);
+    interpolate_frames(decoder_info->interp_frames[0], ref1, ref2, off1+off2 , off2, decoder_info->threads);
     pad_yuv_frame(decoder_info->interp_frames[0]);
     decoder_info->interp_frames[0]->frame_num = display_frame_num;
   }
 
-  decoder_info->bit_count.frame_header[decoder_info->bit_count.stat_frame_type] += (stream->bitcnt - bit_start);
-  decoder_info->bit_count.frame_type[decoder_info->bit_count.stat_frame_type] += 1;
-  decoder_info->frame_info.qp = qp;
-  decoder_info->frame_info.qpb = qp;
+  int early_ref = early_reference(decoder_info, ref_out);
+  if (decoder_info->threads > 1 || decoder_info->frame_pool){
+    if (decoder_info->deblocking || early_ref)
+      decoder_info->row_filter = create_row_filter(decoder_info->rec, NULL, early_ref ? ref_out : NULL, decoder_info->deblock_data,
+                                                   decoder_info->deblocking, qp, chroma_qp[qp], NULL, NULL,
+                                                   decoder_info->frame_pool && early_ref ? ref_rows_done : NULL, decoder_info);
+  }
 
-  for (k=0;k<num_sb_ver;k++){
-    for (l=0;l<num_sb_hor;l++){
-      int xposY = l*MAX_BLOCK_SIZE;
-      int yposY = k*MAX_BLOCK_SIZE;
-      process_block_dec(decoder_info,MAX_BLOCK_SIZE,yposY,xposY);
+  if (decoder_info->tile_cols*decoder_info->tile_rows > 1){
+    decode_tiles(decoder_info);
+  }
+  else if (decoder_info->two_phase){
+    decode_superblocks_two_phase(decoder_info, num_sb_hor, num_sb_ver);
+  }
+  else{
+    for (k=0;k<num_sb_ver;k++){
+      for (l=0;l<num_sb_hor;l++){
+        int xposY = l*MAX_BLOCK_SIZE;
+        int yposY = k*MAX_BLOCK_SIZE;
+        process_block_dec(decoder_info,MAX_BLOCK_SIZE,yposY,xposY);
+        if (decoder_info->row_filter)
+          row_filter_sb_done(decoder_info->row_filter, k);
+      }
     }
   }
+}
 
-  if (decoder_info->deblocking){
+/* Finish the loop filtering of a frame whose superblocks have been decoded
+   and write the padded reconstruction into the reference buffer slot ref_out */
+void decode_frame_finish(decoder_info_t *decoder_info, yuv_frame_t *ref_out)
+{
+  int height = decoder_info->height;
+  int width = decoder_info->width;
+  int num_sb_ver = (height + MAX_BLOCK_SIZE - 1)/MAX_BLOCK_SIZE;
+  int qp = decoder_info->frame_info.qp;
+  stream_t *stream = decoder_info->stream;
+
+  if (decoder_info->row_filter){
+    close_row_filter(decoder_info->row_filter);
+    decoder_info->row_filter = NULL;
+  }
+  else if (decoder_info->deblocking){
     deblock_frame_y(decoder_info->rec, decoder_info->deblock_data, width, height, qp);
     int qpc = chroma_qp[qp];
     deblock_frame_uv(decoder_info->rec, decoder_info->deblock_data, width, height, qpc);
@@ -132,19 +443,45 @@ void decode_frame(decoder_info_t *decoder_info, yuv_frame_t* rec_buffer)
                getbits(stream, 1) ? clpf_true : clpf_bit);
   }
 
-  /* Sliding window operation for reference frame buffer by circular buffer */
+  /* Pad the reconstructed frame and write into its reference buffer slot.
+     The frame number of the slot is set by the thread that parses the
+     headers, since other frames may be reading it. */
+  if (!early_reference(decoder_info, ref_out)){
+    create_reference_rows(ref_out, decoder_info->rec, 0, height);
+    if (decoder_info->frame_pool)
+      frame_pool_set_rows(decoder_info->frame_pool, ref_out, num_sb_ver);
+  }
+}
+
+/* Decode the frame data following the header and write the padded
+   reconstruction into the reference buffer slot ref_out */
+void decode_frame_data(decoder_info_t *decoder_info, yuv_frame_t *ref_out)
+{
+  decode_frame_blocks(decoder_info, ref_out);
+  decode_frame_finish(decoder_info, ref_out);
+}
 
+/* Sliding window operation for reference frame buffer by circular buffer */
+void shift_reference_frames(yuv_frame_t **ref)
+{
   /* Store pointer to reference frame that is shifted out of reference buffer */
-  yuv_frame_t *tmp = decoder_info->ref[MAX_REF_FRAMES-1];
+  yuv_frame_t *tmp = ref[MAX_REF_FRAMES-1];
 
   /* Update remaining pointers to implement sliding window reference buffer operation */
-  memmove(decoder_info->ref+1, decoder_info->ref, sizeof(yuv_frame_t*)*(MAX_REF_FRAMES-1));
+  memmove(ref+1, ref, sizeof(yuv_frame_t*)*(MAX_REF_FRAMES-1));
 
   /* Set ref[0] to the memory slot where the new current reconstructed frame wil replace reference frame being shifted out */
-  decoder_info->ref[0] = tmp;
+  ref[0] = tmp;
+}
+
+void decode_frame(decoder_info_t *decoder_info, yuv_frame_t* rec_buffer)
+{
+  decode_frame_header(decoder_info, rec_buffer);
 
-  /* Pad the reconstructed frame and write into ref[0] */
-  create_reference_frame(decoder_info->ref[0],decoder_info->rec);
+  /* The reconstructed frame replaces the reference frame that is shifted out of the buffer */
+  decode_frame_data(decoder_info, decoder_info->ref[MAX_REF_FRAMES-1]);
+  decoder_info->ref[MAX_REF_FRAMES-1]->frame_num = decoder_info->frame_info.display_frame_num;
+  shift_reference_frames(decoder_info->ref);
 }
 
 
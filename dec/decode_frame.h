@@ -30,5 +30,11 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "maindec.h"
 
 void decode_frame(decoder_info_t *encoder_info,yuv_frame_t* rec_buffer);
+void decode_frame_header(decoder_info_t *decoder_info, yuv_frame_t* rec_buffer);
+void decode_frame_data(decoder_info_t *decoder_info, yuv_frame_t *ref_out);
+void decode_frame_blocks(decoder_info_t *decoder_info, yuv_frame_t *ref_out);
+void decode_frame_finish(decoder_info_t *decoder_info, yuv_frame_t *ref_out);
+void shift_reference_frames(yuv_frame_t **ref);
+void add_bit_count(bit_count_t *dst, bit_count_t *src);
 
 #endif
@@ -0,0 +1,272 @@
+/*
+Copyright (c) 2015, Cisco Systems
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "global.h"
+#include "decode_service.h"
+#include "decode_stream.h"
+#include "thread.h"
+#include "simd.h"
+
+/* Batch decoding of many bitstreams on one pool of worker threads. The
+   streams are listed in a text file with an input and an optional output
+   file name per line. A worker takes one frame of the stream whose turn it
+   is, so that all streams that are being decoded make progress at the same
+   rate. A new stream is only started when no started stream is waiting for a
+   worker, and when its frame buffers fit in the memory budget along with the
+   streams that are being decoded. */
+
+#define MAX_PATH_LEN 1024
+
+typedef enum {
+  STREAM_WAITING,  //Not started
+  STREAM_OPENING,  //Files and sequence header being read by a worker
+  STREAM_IDLE,     //Started, waiting for a worker
+  STREAM_BUSY,
+  STREAM_FINISHED
+} service_state_t;
+
+typedef struct
+{
+  char infilestr[MAX_PATH_LEN];
+  char outfilestr[MAX_PATH_LEN];
+  dec_stream_t *ds;
+  size_t memory;             //Frame buffer memory of the stream
+  service_state_t state;
+} service_stream_t;
+
+typedef struct
+{
+  service_stream_t *streams;
+  int num_streams;
+  int next_start;            //Next stream in the list to be started
+  int next_turn;             //Round robin position among the started streams
+  int num_finished;
+  size_t mem_limit;          //Frame buffer budget in bytes, or 0 for no limit
+  size_t mem_used;
+  thor_mutex_t mutex;
+  thor_cond_t cond;
+} decode_service_t;
+
+/* Open the files and read the sequence header of the next stream to be
+   started. Called without the service lock held, with the stream marked as
+   STREAM_OPENING. Returns 0 if the stream cannot be opened. */
+static int open_service_stream(service_stream_t *st)
+{
+  FILE *infile;
+  FILE *outfile = NULL;
+
+  if (!(infile = fopen(st->infilestr, "rb"))){
+    fprintf(stderr, "Could not open %s for reading.\n", st->infilestr);
+    return 0;
+  }
+  if (st->outfilestr[0] && !(outfile = fopen(st->outfilestr, "wb"))){
+    fprintf(stderr, "Could not open %s for writing.\n", st->outfilestr);
+    fclose(infile);
+    return 0;
+  }
+  st->ds = (dec_stream_t *)malloc(sizeof(dec_stream_t));
+  if (st->ds == NULL)
+    fatalerror("Memory allocation failed.");
+  open_dec_stream(st->ds, infile, outfile, 1, 0);
+  st->memory = dec_stream_memory(st->ds);
+  return 1;
+}
+
+static void finish_service_stream(service_stream_t *st)
+{
+  close_dec_stream(st->ds);
+  fclose(st->ds->infile);
+  if (st->ds->out.outfile)
+    fclose(st->ds->out.outfile);
+  printf("%s: %d frames %dx%d\n", st->infilestr, st->ds->decode_frame_num, st->ds->decoder_info.width, st->ds->decoder_info.height);
+  free(st->ds);
+  st->ds = NULL;
+}
+
+static void *service_worker(void *arg)
+{
+  decode_service_t *sv = (decode_service_t*)arg;
+
+  thor_mutex_lock(&sv->mutex);
+  while (sv->num_finished < sv->num_streams){
+    service_stream_t *st = NULL;
+    int start = 0;
+    int i;
+
+    /* Next frame of the started stream whose turn it is */
+    for (i=0;i<sv->num_streams;i++){
+      int idx = (sv->next_turn+i)%sv->num_streams;
+      if (sv->streams[idx].state == STREAM_IDLE){
+        st = &sv->streams[idx];
+        sv->next_turn = idx+1;
+        break;
+      }
+    }
+
+    /* Otherwise start the next stream if it fits in the budget. The stream is
+       opened first, outside the lock, to learn its memory requirement. */
+    if (st == NULL && sv->next_start < sv->num_streams){
+      service_stream_t *next = &sv->streams[sv->next_start];
+      if (next->state == STREAM_WAITING && next->ds == NULL){
+        next->state = STREAM_OPENING;
+        thor_mutex_unlock(&sv->mutex);
+        int opened = open_service_stream(next);
+        thor_mutex_lock(&sv->mutex);
+        if (opened)
+          next->state = STREAM_WAITING;
+        else{
+          next->state = STREAM_FINISHED;
+          sv->next_start++;
+          sv->num_finished++;
+        }
+        thor_cond_broadcast(&sv->cond);
+        continue;
+      }
+      if (next->state == STREAM_WAITING &&
+          (sv->mem_limit == 0 || sv->mem_used == 0 || sv->mem_used + next->memory <= sv->mem_limit)){
+        sv->mem_used += next->memory;
+        sv->next_start++;
+        st = next;
+        start = 1;
+      }
+    }
+
+    if (st == NULL){
+      thor_cond_wait(&sv->cond, &sv->mutex);
+      continue;
+    }
+    st->state = STREAM_BUSY;
+    thor_mutex_unlock(&sv->mutex);
+
+    if (start)
+      alloc_dec_stream(st->ds);
+    int done = decode_stream_frame(st->ds);
+    if (done)
+      finish_service_stream(st);
+
+    thor_mutex_lock(&sv->mutex);
+    if (done){
+      st->state = STREAM_FINISHED;
+      sv->mem_used -= st->memory;
+      sv->num_finished++;
+    }
+    else{
+      st->state = STREAM_IDLE;
+    }
+    thor_cond_broadcast(&sv->cond);
+  }
+  thor_mutex_unlock(&sv->mutex);
+  return NULL;
+}
+
+static void read_stream_list(decode_service_t *sv, char *listfilestr)
+{
+  FILE *listfile;
+  char line[2*MAX_PATH_LEN+16];
+  int max_streams = 0;
+
+  if (!(listfile = fopen(listfilestr, "r")))
+    fatalerror("Could not open stream list for reading.");
+
+  sv->streams = NULL;
+  sv->num_streams = 0;
+  while (fgets(line, sizeof(line), listfile)){
+    char in[MAX_PATH_LEN];
+    char out[MAX_PATH_LEN];
+    int n = sscanf(line, "%1023s %1023s", in, out);
+    if (n < 1 || in[0] == '#')
+      continue;
+    if (sv->num_streams == max_streams){
+      max_streams = max(2*max_streams, 16);
+      sv->streams = (service_stream_t *)realloc(sv->streams, max_streams*sizeof(service_stream_t));
+      if (sv->streams == NULL)
+        fatalerror("Memory allocation failed.");
+    }
+    service_stream_t *st = &sv->streams[sv->num_streams++];
+    strcpy(st->infilestr, in);
+    strcpy(st->outfilestr, n > 1 ? out : "");
+    st->ds = NULL;
+    st->memory = 0;
+    st->state = STREAM_WAITING;
+  }
+  fclose(listfile);
+}
+
+/* Thordec -batch listfile [-threads n] [-mem_limit MB] [-simd level] */
+int decode_service_main(int argc, char** argv)
+{
+  decode_service_t sv;
+  thor_thread_t threads[MAX_THREADS];
+  int num_threads = 1;
+  int mem_limit = 0;
+  int simd = -1;
+  int i,t;
+
+  if (argc < 3){
+    fprintf(stdout, "usage: %s -batch listfile [-threads n] [-mem_limit MB] [-simd level]\n", argv[0]);
+    fatalerror("Wrong number of arguments.");
+  }
+  for (i=3;i<argc;i++){
+    if (strcmp(argv[i], "-threads") == 0 && i+1 < argc){
+      num_threads = atoi(argv[++i]);
+      if (num_threads < 1 || num_threads > MAX_THREADS)
+        fatalerror("Number of threads out of range.");
+    }
+    else if (strcmp(argv[i], "-mem_limit") == 0 && i+1 < argc){
+      mem_limit = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "-simd") == 0 && i+1 < argc){
+      simd = atoi(argv[++i]);
+    }
+    else{
+      fatalerror("Unknown argument.");
+    }
+  }
+  init_use_simd(simd);
+
+  read_stream_list(&sv, argv[2]);
+  sv.next_start = 0;
+  sv.next_turn = 0;
+  sv.num_finished = 0;
+  sv.mem_limit = (size_t)max(mem_limit, 0) << 20;
+  sv.mem_used = 0;
+  thor_mutex_init(&sv.mutex);
+  thor_cond_init(&sv.cond);
+
+  num_threads = min(num_threads, max(sv.num_streams, 1));
+  for (t=0;t<num_threads;t++)
+    thor_thread_create(&threads[t], service_worker, &sv);
+  for (t=0;t<num_threads;t++)
+    thor_thread_join(threads[t]);
+
+  thor_cond_destroy(&sv.cond);
+  thor_mutex_destroy(&sv.mutex);
+  free(sv.streams);
+  return 0;
+}
@@ -0,0 +1,231 @@
+/*
+Copyright (c) 2015, Cisco Systems
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "global.h"
+#include "decode_stream.h"
+#include "decode_frame.h"
+#include "common_block.h"
+#include "common_frame.h"
+#include "getbits.h"
+
+/* Mark a decoded frame as available and write the next frame in display order if it is */
+void output_frame(dec_output_t *out, int decode_frame_num, int display_frame_num, int bitcnt)
+{
+    int op_rec_buffer_idx;
+
+    out->rec_available[display_frame_num%MAX_REORDER_BUFFER] = 1;
+
+    op_rec_buffer_idx = (out->last_frame_output+1)%MAX_REORDER_BUFFER;
+    if (out->rec_available[op_rec_buffer_idx]) {
+      out->last_frame_output++;
+      if (out->outfile)
+        write_yuv_frame(&out->rec[op_rec_buffer_idx],out->width,out->height,out->outfile);
+      out->rec_available[op_rec_buffer_idx] = 0;
+    }
+    if (out->verbose)
+      printf("decode_frame_num=%4d display_frame_num=%4d input_file_size=%12d bitcnt=%12d\n",
+          decode_frame_num,display_frame_num,out->input_file_size,bitcnt);
+}
+
+/* Read the sequence header of a bitstream */
+void open_dec_stream(dec_stream_t *ds, FILE *infile, FILE *outfile, int threads, int verbose)
+{
+    decoder_info_t *decoder_info = &ds->decoder_info;
+    stream_t *stream = &ds->stream;
+    int width;
+    int height;
+
+    ds->infile = infile;
+    ds->decode_frame_num = 0;
+    ds->done = 0;
+
+    decoder_info->threads = threads;
+    decoder_info->two_phase = 0;
+    decoder_info->row_filter = NULL;
+    decoder_info->block_buffer = NULL;
+    decoder_info->frame_pool = NULL;
+
+    fseek(infile, 0, SEEK_END);
+    int input_file_size = ftell(infile);
+    fseek(infile, 0, SEEK_SET);
+
+    stream->buf = NULL;
+    stream->buf_size = 0;
+    initbits_dec(infile, stream);
+
+    decoder_info->stream = stream;
+
+    memset(&decoder_info->bit_count,0,sizeof(bit_count_t));
+
+    int bit_start = stream->bitcnt;
+    /* Read sequence header */
+    width = getbits(stream,16);
+    height = getbits(stream,16);
+
+    decoder_info->width = width;
+    decoder_info->height = height;
+    get_tile(&decoder_info->tile, width, height, 1, 1, 0, 0);
+    if (verbose)
+      printf("width=%4d height=%4d\n",width,height);
+
+    decoder_info->pb_split = getbits(stream,1);
+    if (verbose)
+      printf("pb_split_enable=%1d\n",decoder_info->pb_split); //TODO: Rename variable to pb_split_enable
+
+    decoder_info->tb_split_enable = getbits(stream,1);
+    if (verbose)
+      printf("tb_split_enable=%1d\n",decoder_info->tb_split_enable);
+
+    decoder_info->max_num_ref = getbits(stream,2) + 1;
+    if (verbose)
+      fprintf(stderr,"num refs is %d\n",decoder_info->max_num_ref);
+
+    decoder_info->interp_ref = getbits(stream,1);
+
+    decoder_info->max_delta_qp = getbits(stream,3);
+
+    decoder_info->deblocking = getbits(stream,1);
+    decoder_info->clpf = getbits(stream,1);
+    decoder_info->use_block_contexts = getbits(stream,1);
+    decoder_info->bipred = getbits(stream,1);
+    decoder_info->tile_cols = 1;
+    decoder_info->tile_rows = 1;
+    if (getbits(stream,1)){
+      decoder_info->tile_cols = getbits(stream,8) + 1;
+      decoder_info->tile_rows = getbits(stream,8) + 1;
+      getbits(stream,(8 - stream->bitcnt%8)%8);
+    }
+
+    decoder_info->bit_count.sequence_header += (stream->bitcnt - bit_start);
+
+    ds->out.outfile = outfile;
+    ds->out.rec = ds->rec;
+    memset(ds->out.rec_available, 0, sizeof(ds->out.rec_available));
+    ds->out.last_frame_output = -1;
+    ds->out.width = width;
+    ds->out.height = height;
+    ds->out.input_file_size = input_file_size;
+    ds->out.verbose = verbose;
+}
+
+/* Size in bytes of a frame allocated by create_yuv_frame */
+static size_t yuv_frame_memory(int width, int height, int pad_y, int pad_c)
+{
+    size_t stride_y = (width + 2*pad_y + 15) & ~15;
+    size_t stride_c = (width/2 + 2*pad_c + 15) & ~15;
+    size_t area_y = ((height + 2*pad_y) * stride_y + 16 + 15) & ~15;
+    size_t area_c = ((height/2 + 2*pad_c) * stride_c + 16 + 15) & ~15;
+    return area_y + 2*area_c;
+}
+
+/* Frame buffer memory that alloc_dec_stream will allocate */
+size_t dec_stream_memory(dec_stream_t *ds)
+{
+    int width = ds->decoder_info.width;
+    int height = ds->decoder_info.height;
+    size_t size = MAX_REORDER_BUFFER*yuv_frame_memory(width,height,0,0) +
+                  MAX_REF_FRAMES*yuv_frame_memory(width,height,PADDING_Y,PADDING_Y/2) +
+                  (height/MIN_PB_SIZE) * (width/MIN_PB_SIZE) * sizeof(deblock_data_t);
+    if (ds->decoder_info.interp_ref)
+      size += yuv_frame_memory(width,height,PADDING_Y,PADDING_Y/2);
+    return size;
+}
+
+void alloc_dec_stream(dec_stream_t *ds)
+{
+    decoder_info_t *decoder_info = &ds->decoder_info;
+    int width = decoder_info->width;
+    int height = decoder_info->height;
+    int r;
+
+    for (r=0;r<MAX_REORDER_BUFFER;r++){
+      create_yuv_frame(&ds->rec[r],width,height,0,0,0,0);
+    }
+    for (r=0;r<MAX_REF_FRAMES;r++){
+      create_yuv_frame(&ds->ref[r],width,height,PADDING_Y,PADDING_Y,PADDING_Y/2,PADDING_Y/2);
+      decoder_info->ref[r] = &ds->ref[r];
+    }
+    /* Frames are only interpolated into interp_frames[0] */
+    for (r=0;r<MAX_SKIP_FRAMES;r++){
+      decoder_info->interp_frames[r] = NULL;
+    }
+    if (decoder_info->interp_ref) {
+      decoder_info->interp_frames[0] = malloc(sizeof(yuv_frame_t));
+      create_yuv_frame(decoder_info->interp_frames[0],width,height,PADDING_Y,PADDING_Y,PADDING_Y/2,PADDING_Y/2);
+    }
+
+    decoder_info->deblock_data = (deblock_data_t *)malloc((height/MIN_PB_SIZE) * (width/MIN_PB_SIZE) * sizeof(deblock_data_t));
+    if (decoder_info->deblock_data == NULL)
+      fatalerror("Memory allocation failed.");
+}
+
+/* Decode and output the next frame. Returns 1 after the last frame. */
+int decode_stream_frame(dec_stream_t *ds)
+{
+    decoder_info_t *decoder_info = &ds->decoder_info;
+
+    decoder_info->frame_info.decode_order_frame_num = ds->decode_frame_num;
+    decode_frame(decoder_info,ds->rec);
+
+    ds->done = initbits_dec(ds->infile, &ds->stream);
+
+    output_frame(&ds->out, ds->decode_frame_num, decoder_info->frame_info.display_frame_num, ds->stream.bitcnt);
+    ds->decode_frame_num++;
+    return ds->done;
+}
+
+/* Output the frames that are left in the reorder buffer and free the stream */
+void close_dec_stream(dec_stream_t *ds)
+{
+    decoder_info_t *decoder_info = &ds->decoder_info;
+    dec_output_t *out = &ds->out;
+    int i,r;
+
+    for (i=1; i<=MAX_REORDER_BUFFER; ++i) {
+      int op_rec_buffer_idx=(out->last_frame_output+i) % MAX_REORDER_BUFFER;
+      if (!out->rec_available[op_rec_buffer_idx])
+        break;
+      if (out->outfile)
+        write_yuv_frame(&ds->rec[op_rec_buffer_idx],out->width,out->height,out->outfile);
+    }
+
+    for (r=0;r<MAX_REORDER_BUFFER;r++){
+      close_yuv_frame(&ds->rec[r]);
+    }
+    for (r=0;r<MAX_REF_FRAMES;r++){
+      close_yuv_frame(&ds->ref[r]);
+    }
+    if (decoder_info->interp_frames[0]) {
+      close_yuv_frame(decoder_info->interp_frames[0]);
+      free(decoder_info->interp_frames[0]);
+    }
+
+    free(decoder_info->deblock_data);
+    freebits_dec(&ds->stream);
+}
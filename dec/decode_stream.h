@@ -0,0 +1,65 @@
+/*
+Copyright (c) 2015, Cisco Systems
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#if !defined(_DECODE_STREAM_H_)
+#define _DECODE_STREAM_H_
+
+#include <stdio.h>
+#include "maindec.h"
+
+typedef struct
+{
+    FILE *outfile;
+    yuv_frame_t *rec;
+    int rec_available[MAX_REORDER_BUFFER];
+    int last_frame_output;
+    int width;
+    int height;
+    int input_file_size;
+    int verbose;
+} dec_output_t;
+
+/* State of one decoded bitstream */
+typedef struct
+{
+    FILE *infile;
+    decoder_info_t decoder_info;
+    stream_t stream;
+    yuv_frame_t rec[MAX_REORDER_BUFFER];
+    yuv_frame_t ref[MAX_REF_FRAMES];
+    dec_output_t out;
+    int decode_frame_num;
+    int done;
+} dec_stream_t;
+
+void output_frame(dec_output_t *out, int decode_frame_num, int display_frame_num, int bitcnt);
+void open_dec_stream(dec_stream_t *ds, FILE *infile, FILE *outfile, int threads, int verbose);
+size_t dec_stream_memory(dec_stream_t *ds);
+void alloc_dec_stream(dec_stream_t *ds);
+int decode_stream_frame(dec_stream_t *ds);
+void close_dec_stream(dec_stream_t *ds);
+
+#endif
@@ -0,0 +1,344 @@
+/*
+Copyright (c) 2015, Cisco Systems
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "global.h"
+#include "frame_pool.h"
+#include "decode_frame.h"
+#include "common_frame.h"
+
+/* Frames are submitted in decoding order once their header has been parsed.
+   A submitted frame is decoded by the first idle worker right away. Each
+   reference buffer slot tracks how many superblock rows of its frame have
+   been filtered and padded, and a frame only waits for the rows that its
+   motion vectors reach. Finished frames are retired in decoding order.
+
+   With the post-filter thread, a worker hands a frame over once its
+   superblocks have been decoded and moves on to the next frame. The
+   post-filter thread then waits for the row filter, does the CLPF and makes
+   the reference frame, while the next frame only waits for the reference rows
+   it needs. */
+
+static int ref_slot_index(frame_pool_t *pool, yuv_frame_t *frame)
+{
+  return (int)(frame - pool->ref_base);
+}
+
+static void complete_job(frame_pool_t *pool, frame_job_t *job)
+{
+  for (int i=0;i<job->num_deps;i++){
+    pool->ref_users[job->deps[i]]--;
+  }
+  job->state = JOB_DONE;
+  thor_cond_broadcast(&pool->cond);
+}
+
+static void *frame_worker(void *arg)
+{
+  frame_pool_t *pool = (frame_pool_t*)arg;
+
+  thor_mutex_lock(&pool->mutex);
+  while (1){
+    /* Take the oldest queued frame so that the frames it depends on are
+       always being decoded already */
+    frame_job_t *job = NULL;
+    for (int i=0;i<pool->count;i++){
+      frame_job_t *j = &pool->jobs[(pool->head+i)%pool->num_jobs];
+      if (j->state == JOB_QUEUED){
+        job = j;
+        break;
+      }
+    }
+    if (job == NULL){
+      if (pool->quit)
+        break;
+      thor_cond_wait(&pool->cond, &pool->mutex);
+      continue;
+    }
+    job->state = JOB_RUNNING;
+    thor_mutex_unlock(&pool->mutex);
+    if (pool->post_filter){
+      decode_frame_blocks(&job->decoder_info, job->ref_slot);
+      thor_mutex_lock(&pool->mutex);
+      job->state = JOB_FILTER;
+      thor_cond_broadcast(&pool->cond);
+    }
+    else{
+      decode_frame_data(&job->decoder_info, job->ref_slot);
+      thor_mutex_lock(&pool->mutex);
+      complete_job(pool, job);
+    }
+  }
+  thor_mutex_unlock(&pool->mutex);
+  return NULL;
+}
+
+static void *post_filter_worker(void *arg)
+{
+  frame_pool_t *pool = (frame_pool_t*)arg;
+
+  thor_mutex_lock(&pool->mutex);
+  while (1){
+    frame_job_t *job = NULL;
+    for (int i=0;i<pool->count;i++){
+      frame_job_t *j = &pool->jobs[(pool->head+i)%pool->num_jobs];
+      if (j->state == JOB_FILTER){
+        job = j;
+        break;
+      }
+    }
+    if (job == NULL){
+      if (pool->quit)
+        break;
+      thor_cond_wait(&pool->cond, &pool->mutex);
+      continue;
+    }
+    thor_mutex_unlock(&pool->mutex);
+    /* Only the pixels of the slot are written here. Its frame number was
+       set by frame_pool_submit() and may be read by other frames. */
+    decode_frame_finish(&job->decoder_info, job->ref_slot);
+    thor_mutex_lock(&pool->mutex);
+    complete_job(pool, job);
+  }
+  thor_mutex_unlock(&pool->mutex);
+  return NULL;
+}
+
+void frame_pool_init(frame_pool_t *pool, decoder_info_t *decoder_info, yuv_frame_t *ref_base, int num_threads, int post_filter)
+{
+  int width = decoder_info->width;
+  int height = decoder_info->height;
+
+  pool->num_threads = num_threads;
+  pool->post_filter = post_filter;
+  pool->num_jobs = min(2*num_threads + post_filter, MAX_FRAME_JOBS);
+  pool->head = 0;
+  pool->count = 0;
+  pool->quit = 0;
+  pool->ref_base = ref_base;
+  pool->num_sb_ver = (height + MAX_BLOCK_SIZE - 1)/MAX_BLOCK_SIZE;
+  for (int r=0;r<MAX_REF_FRAMES;r++){
+    pool->ref_rows[r] = pool->num_sb_ver;
+    pool->ref_users[r] = 0;
+  }
+
+  for (int i=0;i<pool->num_jobs;i++){
+    frame_job_t *job = &pool->jobs[i];
+    job->decoder_info = *decoder_info;
+    job->state = JOB_FREE;
+    job->stream.buf = NULL;
+    job->stream.buf_size = 0;
+
+    job->decoder_info.deblock_data = (deblock_data_t *)malloc((height/MIN_PB_SIZE) * (width/MIN_PB_SIZE) * sizeof(deblock_data_t));
+    if (job->decoder_info.deblock_data == NULL)
+      fatalerror("Memory allocation failed.");
+
+    for (int r=0;r<MAX_SKIP_FRAMES;r++){
+      job->decoder_info.interp_frames[r] = NULL;
+    }
+    if (decoder_info->interp_ref){
+      job->decoder_info.interp_frames[0] = malloc(sizeof(yuv_frame_t));
+      create_yuv_frame(job->decoder_info.interp_frames[0],width,height,PADDING_Y,PADDING_Y,PADDING_Y/2,PADDING_Y/2);
+    }
+  }
+
+  thor_mutex_init(&pool->mutex);
+  thor_cond_init(&pool->cond);
+  for (int t=0;t<pool->num_threads;t++){
+    thor_thread_create(&pool->threads[t], frame_worker, pool);
+  }
+  if (pool->post_filter)
+    thor_thread_create(&pool->post_thread, post_filter_worker, pool);
+}
+
+void frame_pool_close(frame_pool_t *pool)
+{
+  thor_mutex_lock(&pool->mutex);
+  pool->quit = 1;
+  thor_cond_broadcast(&pool->cond);
+  thor_mutex_unlock(&pool->mutex);
+  for (int t=0;t<pool->num_threads;t++){
+    thor_thread_join(pool->threads[t]);
+  }
+  if (pool->post_filter)
+    thor_thread_join(pool->post_thread);
+  thor_cond_destroy(&pool->cond);
+  thor_mutex_destroy(&pool->mutex);
+
+  for (int i=0;i<pool->num_jobs;i++){
+    frame_job_t *job = &pool->jobs[i];
+    freebits_dec(&job->stream);
+    free(job->decoder_info.deblock_data);
+    if (job->decoder_info.interp_frames[0]){
+      close_yuv_frame(job->decoder_info.interp_frames[0]);
+      free(job->decoder_info.interp_frames[0]);
+    }
+  }
+}
+
+/* Return the job to use for the next frame in decoding order, or NULL if all
+   jobs are in flight and the oldest one has to be retired first */
+frame_job_t *frame_pool_next_job(frame_pool_t *pool)
+{
+  if (pool->count == pool->num_jobs)
+    return NULL;
+  return &pool->jobs[(pool->head+pool->count)%pool->num_jobs];
+}
+
+/* Read the next length-prefixed frame payload into the job. Returns 1 at the
+   end of the file. */
+int frame_pool_read(frame_job_t *job, FILE *infile)
+{
+  return initbits_dec(infile, &job->stream);
+}
+
+/* Move the rest of the current payload of a stream into the job, e.g. the
+   first frame that follows the sequence header. The stream gets the unused
+   buffer of the job in return. */
+void frame_pool_take_stream(frame_job_t *job, stream_t *str)
+{
+  stream_t tmp = job->stream;
+  job->stream = *str;
+  *str = tmp;
+}
+
+/* Submit a frame whose header has been parsed into decoder_info. The
+   reference buffer window of decoder_info is advanced immediately so that the
+   header of the next frame can be parsed before this one has been decoded. */
+void frame_pool_submit(frame_pool_t *pool, frame_job_t *job, decoder_info_t *decoder_info)
+{
+  frame_info_t *frame_info = &decoder_info->frame_info;
+  yuv_frame_t **ref = decoder_info->ref;
+  decoder_info_t *job_info = &job->decoder_info;
+  deblock_data_t *deblock_data = job_info->deblock_data;
+  yuv_frame_t *interp_frame = job_info->interp_frames[0];
+
+  *job_info = *decoder_info;
+  job_info->stream = &job->stream;
+  job_info->deblock_data = deblock_data;
+  job_info->interp_frames[0] = interp_frame;
+  job_info->frame_pool = pool;
+  memset(&job_info->bit_count, 0, sizeof(bit_count_t));
+  job_info->bit_count.stat_frame_type = decoder_info->bit_count.stat_frame_type;
+
+  /* Store pointer to reference frame that is shifted out of reference buffer */
+  yuv_frame_t *tmp = ref[MAX_REF_FRAMES-1];
+  int slot = ref_slot_index(pool, tmp);
+
+  /* Slots read by this frame. A frame that reads from the slot being shifted
+     out overwrites it once it has been decoded, and is decoded on its own. */
+  int self_ref = 0;
+  job->num_deps = 0;
+  for (int r=0;r<frame_info->num_ref;r++){
+    if (frame_info->ref_array[r] < 0)
+      continue;
+    if (ref[frame_info->ref_array[r]] == tmp)
+      self_ref = 1;
+    else
+      job->deps[job->num_deps++] = ref_slot_index(pool, ref[frame_info->ref_array[r]]);
+  }
+
+  thor_mutex_lock(&pool->mutex);
+
+  /* The slot can be reused once it is complete and no frame in flight reads from it */
+  while (pool->ref_rows[slot] < pool->num_sb_ver || pool->ref_users[slot])
+    thor_cond_wait(&pool->cond, &pool->mutex);
+  pool->ref_rows[slot] = 0;
+  for (int i=0;i<job->num_deps;i++){
+    pool->ref_users[job->deps[i]]++;
+  }
+
+  shift_reference_frames(ref);
+  if (!self_ref)
+    tmp->frame_num = frame_info->display_frame_num;
+  job->ref_slot = tmp;
+
+  job->state = JOB_QUEUED;
+  pool->count++;
+  thor_cond_broadcast(&pool->cond);
+  while (self_ref && job->state != JOB_DONE)
+    thor_cond_wait(&pool->cond, &pool->mutex);
+  /* Decoding such a frame needs the old frame number of the slot */
+  if (self_ref)
+    tmp->frame_num = frame_info->display_frame_num;
+  thor_mutex_unlock(&pool->mutex);
+}
+
+/* Return the oldest job in decoding order once it has been decoded, or NULL
+   if there is no job in flight */
+frame_job_t *frame_pool_oldest(frame_pool_t *pool)
+{
+  frame_job_t *job;
+  thor_mutex_lock(&pool->mutex);
+  while (pool->count && pool->jobs[pool->head].state != JOB_DONE)
+    thor_cond_wait(&pool->cond, &pool->mutex);
+  job = pool->count ? &pool->jobs[pool->head] : NULL;
+  thor_mutex_unlock(&pool->mutex);
+  return job;
+}
+
+/* Release the oldest job after its output has been written */
+void frame_pool_release(frame_pool_t *pool)
+{
+  thor_mutex_lock(&pool->mutex);
+  pool->jobs[pool->head].state = JOB_FREE;
+  pool->head = (pool->head+1)%pool->num_jobs;
+  pool->count--;
+  thor_cond_broadcast(&pool->cond);
+  thor_mutex_unlock(&pool->mutex);
+}
+
+/* Publish that the first rows superblock rows of a reference buffer slot are
+   filtered and padded */
+void frame_pool_set_rows(frame_pool_t *pool, yuv_frame_t *ref, int rows)
+{
+  thor_mutex_lock(&pool->mutex);
+  pool->ref_rows[ref_slot_index(pool, ref)] = rows;
+  thor_cond_broadcast(&pool->cond);
+  thor_mutex_unlock(&pool->mutex);
+}
+
+/* Wait until a reference frame is ready down to luma row y, including the
+   bottom padding if y is below the frame. Does nothing without frame threads,
+   and for frames that are not in the reference buffer. */
+void frame_pool_wait_rows(decoder_info_t *decoder_info, yuv_frame_t *ref, int y)
+{
+  frame_pool_t *pool = decoder_info->frame_pool;
+  if (pool == NULL || ref == decoder_info->ref_out)
+    return;
+  int slot = ref_slot_index(pool, ref);
+  if (slot < 0 || slot >= MAX_REF_FRAMES)
+    return;
+  int rows = y >= decoder_info->height ? pool->num_sb_ver : max(y, 0)/MAX_BLOCK_SIZE + 1;
+
+  thor_mutex_lock(&pool->mutex);
+  while (pool->ref_rows[slot] < rows)
+    thor_cond_wait(&pool->cond, &pool->mutex);
+  thor_mutex_unlock(&pool->mutex);
+}
@@ -27,136 +27,81 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "global.h"
 #include "getbits.h"
 
-
-/* to mask the n least significant bits of an integer */
-static const unsigned int msk[33] =
-{
-  0x00000000,0x00000001,0x00000003,0x00000007,
-  0x0000000f,0x0000001f,0x0000003f,0x0000007f,
-  0x000000ff,0x000001ff,0x000003ff,0x000007ff,
-  0x00000fff,0x00001fff,0x00003fff,0x00007fff,
-  0x0000ffff,0x0001ffff,0x0003ffff,0x0007ffff,
-  0x000fffff,0x001fffff,0x003fffff,0x007fffff,
-  0x00ffffff,0x01ffffff,0x03ffffff,0x07ffffff,
-  0x0fffffff,0x1fffffff,0x3fffffff,0x7fffffff,
-  0xffffffff
-};
-
+/* Read the next length-prefixed frame payload into the buffer of the stream.
+   The buffer must be NULL or allocated by an earlier call. Returns 1 at the
+   end of the file. */
 int initbits_dec(FILE *infile, stream_t *str)
 {
   uint8_t frame_bytes_buf[4];
-  uint32_t length;
-  int ret;
+  int length;
 
-  str->incnt = 0;
-  str->rdptr = str->rdbfr + 2048;
-  str->bitcnt = 0;
   str->infile = infile;
-
-  length = 0;
-  ret = fread(frame_bytes_buf, sizeof(frame_bytes_buf), 1, infile) != 1;
-  if (!ret)
-  {
-    length = frame_bytes_buf[0] << 24 | frame_bytes_buf[1] << 16
-     | frame_bytes_buf[2] << 8 | frame_bytes_buf[3];
-  }
-  str->length = length;
-
-  return ret;
-}
-
-int fillbfr(stream_t *str)
-{
-    //int l;
-
-  while (str->incnt <= 24 && (str->rdptr < str->rdbfr + 2048))
+  if (fread(frame_bytes_buf, sizeof(frame_bytes_buf), 1, infile) != 1)
   {
-    str->inbfr = (str->inbfr << 8) | *str->rdptr++;
-    str->incnt += 8;
+    initbits_dec_mem(str->buf, 0, str);
+    return 1;
   }
+  length = frame_bytes_buf[0] << 24 | frame_bytes_buf[1] << 16
+   | frame_bytes_buf[2] << 8 | frame_bytes_buf[3];
 
-  if (str->rdptr >= str->rdbfr + 2048)
+  if (length > str->buf_size)
   {
-    int read_size;
-    read_size = str->length;
-    if (read_size > 0) {
-      if (read_size > 2048) read_size = 2048;
-      //l = (int)fread(str->rdbfr,sizeof(unsigned char),2048,str->infile);
-      str->rdptr = str->rdbfr + 2048 - read_size;
-      fread(str->rdptr, sizeof(*str->rdptr), read_size, str->infile);
-      str->length -= read_size;
-
-      while (str->incnt <= 24 && (str->rdptr < str->rdbfr + 2048))
-      {
-        str->inbfr = (str->inbfr << 8) | *str->rdptr++;
-        str->incnt += 8;
-      }
-    }
-    else
-    {
-      str->inbfr <<= (32 - str->incnt);
-      str->incnt = 32;
-    }
+    free(str->buf);
+    str->buf = (unsigned char *)malloc(length);
+    if (str->buf == NULL)
+      fatalerror("Memory allocation failed.");
+    str->buf_size = length;
   }
+  if (fread(str->buf, 1, length, infile) != (size_t)length)
+    fatalerror("Unexpected end of file.");
+  initbits_dec_mem(str->buf, length, str);
 
   return 0;
 }
 
-unsigned int getbits(stream_t *str, int n)
+void initbits_dec_mem(const unsigned char *buf, int length, stream_t *str)
 {
+  str->rdptr = buf;
+  str->rdend = buf + length;
+  str->cache = 0;
+  str->incnt = 0;
+  str->bitcnt = 0;
+}
 
-  if (str->incnt < n)
-  {
-    fillbfr(str);
-    if (str->incnt < n)
-    {
-      unsigned int l = str->inbfr;
-      unsigned int k = *str->rdptr++;
-      int shift = n-str->incnt;
-      str->inbfr = (str->inbfr << 8) | k;
-      str->incnt = str->incnt - n + 8;
-      str->bitcnt += n;
-      return (((l << shift) | (k >> (8-shift))) & msk[n]);
-    }
-  }
-
-  str->incnt -= n;
-  str->bitcnt += n;
-  return ((str->inbfr >> str->incnt) & msk[n]);
+void freebits_dec(stream_t *str)
+{
+  free(str->buf);
+  str->buf = NULL;
+  str->buf_size = 0;
 }
 
-unsigned int getbits1(stream_t *str)
+static uint64_t load_be64(const unsigned char *p)
 {
-  if (str->incnt < 1)
-  {
-    fillbfr(str);
-  }
-  str->incnt--;
-  str->bitcnt++;
-  return ((str->inbfr >> str->incnt) & 1);
+  return (uint64_t)p[0] << 56 | (uint64_t)p[1] << 48 | (uint64_t)p[2] << 40 | (uint64_t)p[3] << 32 |
+         (uint64_t)p[4] << 24 | (uint64_t)p[5] << 16 | (uint64_t)p[6] << 8 | (uint64_t)p[7];
 }
 
-unsigned int showbits(stream_t *str, int n)
+/* Top up the cache to at least 56 bits. Zeros are read past the end of the
+   payload. */
+void fillbfr(stream_t *str)
 {
-  if (str->incnt < n)
+  if (str->rdend - str->rdptr >= 8)
   {
-    fillbfr(str);
-    if (str->incnt < n)
-    {
-      int shift = n-str->incnt;
-      return (((str->inbfr << shift) | (str->rdptr[0] >> (8-shift))) & msk[n]);
-    }
+    int bytes = (63 - str->incnt) >> 3;
+    str->cache |= load_be64(str->rdptr) >> str->incnt;
+    str->rdptr += bytes;
+    str->incnt += bytes << 3;
+    return;
   }
 
-  return ((str->inbfr >> (str->incnt-n)) & msk[n]);
-}
-
-int flushbits(stream_t *str, int n)
-{
-  str->incnt -= n;
-  str->bitcnt += n;
-  return 0;
+  while (str->incnt <= 56)
+  {
+    if (str->rdptr < str->rdend)
+      str->cache |= (uint64_t)*str->rdptr++ << (56 - str->incnt);
+    str->incnt += 8;
+  }
 }
@@ -27,24 +27,57 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #if !defined(_GETBITS_H_)
 #define _GETBITS_H_
 
+#include <stdint.h>
 #include <stdio.h>
 
+/* Reads bits from a frame payload held in memory through a 64-bit cache.
+   The cache holds incnt unread bits starting at its most significant bit;
+   the bits below them are either zero or the stream bits that follow. */
 typedef struct
 {
   FILE *infile;
-  unsigned char rdbfr[2051];
-  unsigned char *rdptr;
-  unsigned int inbfr;
+  unsigned char *buf;          //Payload read from infile, owned by the stream
+  int buf_size;
+  const unsigned char *rdptr;  //Next payload byte to enter the cache
+  const unsigned char *rdend;
+  uint64_t cache;
   int incnt;
   int bitcnt;
-  int length;
 } stream_t;
 
 int initbits_dec(FILE *infile, stream_t *str);
-int fillbfr(stream_t *str);
-unsigned int showbits(stream_t *str, int n);
-unsigned int getbits1(stream_t *str);
-int flushbits(stream_t *str, int n);
-unsigned int getbits(stream_t *str, int n);
+void initbits_dec_mem(const unsigned char *buf, int length, stream_t *str);
+void freebits_dec(stream_t *str);
+void fillbfr(stream_t *str);
+
+/* n is at most 32 */
+static inline unsigned int showbits(stream_t *str, int n)
+{
+  if (str->incnt < n)
+    fillbfr(str);
+  return (unsigned int)((str->cache >> 32) >> (32 - n));
+}
+
+static inline int flushbits(stream_t *str, int n)
+{
+  if (str->incnt < n)
+    fillbfr(str);
+  str->cache <<= n;
+  str->incnt -= n;
+  str->bitcnt += n;
+  return 0;
+}
+
+static inline unsigned int getbits(stream_t *str, int n)
+{
+  unsigned int val = showbits(str, n);
+  flushbits(str, n);
+  return val;
+}
+
+static inline unsigned int getbits1(stream_t *str)
+{
+  return getbits(str, 1);
+}
 
 #endif
@@ -29,8 +29,29 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "global.h"
 #include "getbits.h"
 #include "getvlc.h"
+#include "simd.h"
 
-int get_vlc0_limit(int maxbit,stream_t *str){
+/* Every VLC family is a run of zeros followed by fixed length fields, so a
+   single peek at the next VLC_PEEK bits gives both the value and the length
+   of a code from its number of leading zeros.  Codes that do not fit in the
+   peek are rare and are read bit by bit. */
+#define VLC_PEEK 24
+
+/* Bits [pos, pos+len) of the peek, counting from the most significant one */
+#define VLC_FIELD(peek,pos,len) (((peek) >> (VLC_PEEK - (pos) - (len))) & ((1 << (len)) - 1))
+
+/* Table 9 codes starting with a one, indexed by the four bits after it */
+static const uint8_t vlc9_short[16][2] = {
+  {0,3},{0,3},{0,3},{0,3},{1,4},{1,4},{2,4},{2,4},
+  {3,5},{4,5},{5,5},{6,5},{7,5},{8,5},{9,5},{10,5}
+};
+
+static int leading_zeros(unsigned int peek)
+{
+  return peek ? VLC_PEEK - 1 - log2i(peek) : VLC_PEEK;
+}
+
+static int get_vlc0_limit_bitwise(int maxbit,stream_t *str){
   int code;
   int tmp = 0;
   int nbit = 0;
@@ -42,7 +63,20 @@ int get_vlc0_limit(int maxbit,stream_t *str){
   return code;
 }
 
-int get_vlc(int n,stream_t *str)
+int get_vlc0_limit(int maxbit,stream_t *str){
+  int zeroes = leading_zeros(showbits(str,VLC_PEEK));
+
+  if (zeroes >= maxbit){
+    flushbits(str,maxbit);
+    return maxbit;
+  }
+  if (zeroes == VLC_PEEK)
+    return get_vlc0_limit_bitwise(maxbit,str);
+  flushbits(str,zeroes+1);
+  return zeroes;
+}
+
+static int get_vlc_bitwise(int n,stream_t *str)
 {
   int cw,bit,zeroes=0,done=0,tmp;
   unsigned int val = 0;
@@ -205,3 +239,82 @@ int get_vlc(int n,stream_t *str)
   else printf("Illegal VLC table number. 0-10 allowed only.");
   return val;
 }
+
+int get_vlc(int n,stream_t *str)
+{
+  unsigned int peek = showbits(str,VLC_PEEK);
+  int zeroes = leading_zeros(peek);
+  unsigned int val;
+  int len;
+
+  if (n < 6)
+  {
+    if (zeroes < 6)
+    {
+      len = zeroes+1+n;
+      val = (zeroes<<n)+VLC_FIELD(peek,zeroes+1,n);
+    }
+    else
+    {
+      int lead = n+zeroes-6;
+      len = zeroes+lead+1;
+      if (len > VLC_PEEK) return get_vlc_bitwise(n,str);
+      val = 5 * (1 << n) + VLC_FIELD(peek,zeroes,lead+1);
+    }
+  }
+  else if (n < 8)
+  {
+    len = zeroes+1+n-4;
+    if (len > VLC_PEEK) return get_vlc_bitwise(n,str);
+    val = (zeroes<<(n-4))+VLC_FIELD(peek,zeroes+1,n-4);
+  }
+  else if (n == 8)
+  {
+    val = min(zeroes,2);
+    len = min(zeroes+1,2);
+  }
+  else if (n == 9)
+  {
+    if (zeroes == 0)
+    {
+      val = vlc9_short[VLC_FIELD(peek,1,4)][0];
+      len = vlc9_short[VLC_FIELD(peek,1,4)][1];
+    }
+    else
+    {
+      len = zeroes+1+4;
+      if (len > VLC_PEEK) return get_vlc_bitwise(n,str);
+      val = ((zeroes-1)<<4)+VLC_FIELD(peek,zeroes+1,4)+11;
+    }
+  }
+  else if (n == 10)
+  {
+    len = 2*zeroes+1;
+    if (len > VLC_PEEK) return get_vlc_bitwise(n,str);
+    val = VLC_FIELD(peek,zeroes,zeroes+1)-1;
+  }
+  else if (n == 11)
+  {
+    if (zeroes < 2)
+    {
+      val = zeroes;
+      len = zeroes+1;
+    }
+    else
+    {
+      len = zeroes+2;
+      if (len > VLC_PEEK) return get_vlc_bitwise(n,str);
+      val = 2*(zeroes-1)+VLC_FIELD(peek,zeroes+1,1);
+    }
+  }
+  else if (n == 12 || n == 13)
+  {
+    int maxbit = n == 12 ? 4 : 6;
+    val = min(zeroes,maxbit);
+    len = zeroes < maxbit ? zeroes+1 : maxbit;
+  }
+  else return get_vlc_bitwise(n,str);
+
+  flushbits(str,len);
+  return val;
+}
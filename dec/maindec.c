@@ -35,8 +35,12 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "global.h"
 #include "maindec.h"
 #include "decode_frame.h"
+#include "common_block.h"
 #include "common_frame.h"
 #include "getbits.h"
+#include "frame_pool.h"
+#include "decode_stream.h"
+#include "decode_service.h"
 #include "../common/simd.h"
 
 void rferror(char error_text[])
@@ -47,11 +51,13 @@ void rferror(char error_text[])
     exit(1);
 }
 
-void parse_arg(int argc, char** argv, FILE **infile, FILE **outfile)
+void parse_arg(int argc, char** argv, FILE **infile, FILE **outfile, int *threads, int *frame_threads, int *two_phase, int *post_filter, int *simd)
 {
+    int i = 2;
+
     if (argc < 2)
     {
-        fprintf(stdout, "usage: %s infile [outfile]\n", argv[0]);
+        fprintf(stdout, "usage: %s infile [outfile] [-threads n] [-frame_threads n] [-two_phase 0|1] [-post_filter 0|1] [-simd level]\n", argv[0]);
         rferror("Wrong number of arguments.");
     }
 
@@ -60,17 +66,55 @@ void parse_arg(int argc, char** argv, FILE **infile, FILE **outfile)
         rferror("Could not open in-file for reading.");
     }
 
-    if (argc > 2)
+    if (argc > 2 && argv[2][0] != '-')
     {
         if (!(*outfile = fopen(argv[2], "wb")))
         {
             rferror("Could not open out-file for writing.");
         }
+        i = 3;
     }
     else
     {
         *outfile = NULL;
     }
+
+    *threads = 1;
+    *frame_threads = 1;
+    *two_phase = 0;
+    *post_filter = 0;
+    *simd = -1;
+    for (; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-threads") == 0 && i+1 < argc)
+        {
+            *threads = atoi(argv[++i]);
+            if (*threads < 1 || *threads > MAX_THREADS)
+                rferror("Number of threads out of range.");
+        }
+        else if (strcmp(argv[i], "-frame_threads") == 0 && i+1 < argc)
+        {
+            *frame_threads = atoi(argv[++i]);
+            if (*frame_threads < 1 || *frame_threads > MAX_FRAME_JOBS)
+                rferror("Number of frame threads out of range.");
+        }
+        else if (strcmp(argv[i], "-two_phase") == 0 && i+1 < argc)
+        {
+            *two_phase = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-post_filter") == 0 && i+1 < argc)
+        {
+            *post_filter = atoi(argv[++i]) != 0;
+        }
+        else if (strcmp(argv[i], "-simd") == 0 && i+1 < argc)
+        {
+            *simd = atoi(argv[++i]);
+        }
+        else
+        {
+            rferror("Unknown argument.");
+        }
+    }
 }
 
 unsigned int leading_zeros(unsigned int code)
@@ -88,113 +132,96 @@ unsigned int leading_zeros(unsigned int code)
   return count;
 }
 
-int main(int argc, char** argv)
+/* Wait for the oldest frame in flight and output it */
+static void retire_frame(frame_pool_t *pool, decoder_info_t *decoder_info, dec_output_t *out)
 {
-    FILE *infile,*outfile;
-    decoder_info_t decoder_info;
-    stream_t stream;
-    yuv_frame_t rec[MAX_REORDER_BUFFER];
-    yuv_frame_t ref[MAX_REF_FRAMES];
-    int rec_available[MAX_REORDER_BUFFER]={0};
-    int rec_buffer_idx;
-    int op_rec_buffer_idx;
-    int decode_frame_num = 0;
-    int last_frame_output = -1;
-    int done = 0;
-    int width;
-    int height;
-    int r;
-
-    init_use_simd();
-
-    parse_arg(argc, argv, &infile, &outfile);
-    
-	  fseek(infile, 0, SEEK_END);
-	  int input_file_size = ftell(infile);
-	  fseek(infile, 0, SEEK_SET);
-    
-    initbits_dec(infile, &stream);
-
-    decoder_info.stream = &stream;
-
-    memset(&decoder_info.bit_count,0,sizeof(bit_count_t));
-
-    int bit_start = stream.bitcnt;
-    /* Read sequence header */
-    width = getbits(&stream,16);
-    height = getbits(&stream,16);
-
-    decoder_info.width = width;
-    decoder_info.height = height;
-    printf("width=%4d height=%4d\n",width,height);
-
-    decoder_info.pb_split = getbits(&stream,1);
-    printf("pb_split_enable=%1d\n",decoder_info.pb_split); //TODO: Rename variable to pb_split_enable
+    frame_job_t *job = frame_pool_oldest(pool);
+    frame_info_t *frame_info = &job->decoder_info.frame_info;
 
-    decoder_info.tb_split_enable = getbits(&stream,1);
-    printf("tb_split_enable=%1d\n",decoder_info.tb_split_enable);
-
-    decoder_info.max_num_ref = getbits(&stream,2) + 1;
-    fprintf(stderr,"num refs is %d\n",decoder_info.max_num_ref);
-
-    decoder_info.interp_ref = getbits(&stream,1);
-
-    decoder_info.max_delta_qp = getbits(&stream,3);
-
-    decoder_info.deblocking = getbits(&stream,1);
-    decoder_info.clpf = getbits(&stream,1);
-    decoder_info.use_block_contexts = getbits(&stream,1);
-    decoder_info.bipred = getbits(&stream,1);
-
-    decoder_info.bit_count.sequence_header += (stream.bitcnt - bit_start);
+    add_bit_count(&decoder_info->bit_count, &job->decoder_info.bit_count);
+    output_frame(out, frame_info->decode_order_frame_num, frame_info->display_frame_num, 0);
+    frame_pool_release(pool);
+}
 
-    for (r=0;r<MAX_REORDER_BUFFER;r++){
-      create_yuv_frame(&rec[r],width,height,0,0,0,0);
-    }
-    for (r=0;r<MAX_REF_FRAMES;r++){
-      create_yuv_frame(&ref[r],width,height,PADDING_Y,PADDING_Y,PADDING_Y/2,PADDING_Y/2);
-      decoder_info.ref[r] = &ref[r];
-    }
-    if (decoder_info.interp_ref) {
-      for (r=0;r<MAX_SKIP_FRAMES;r++){
-        decoder_info.interp_frames[r] = malloc(sizeof(yuv_frame_t));
-        create_yuv_frame(decoder_info.interp_frames[r],width,height,PADDING_Y,PADDING_Y,PADDING_Y/2,PADDING_Y/2);
-      }
+/* Check whether a reconstruction buffer slot is still to be output or still being decoded into */
+static int rec_busy(frame_pool_t *pool, dec_output_t *out, int rec_buffer_idx)
+{
+    if (out->rec_available[rec_buffer_idx])
+      return 1;
+    for (int i=0;i<pool->count;i++){
+      frame_job_t *job = &pool->jobs[(pool->head+i)%pool->num_jobs];
+      if (job->decoder_info.rec == &out->rec[rec_buffer_idx])
+        return 1;
     }
+    return 0;
+}
 
-    decoder_info.deblock_data = (deblock_data_t *)malloc((height/MIN_PB_SIZE) * (width/MIN_PB_SIZE) * sizeof(deblock_data_t));
+int main(int argc, char** argv)
+{
+    FILE *infile,*outfile;
+    dec_stream_t *ds;
+    int threads;
+    int two_phase;
+    int frame_threads;
+    int post_filter;
+    int simd;
+    int i,j;
 
-    do
-    {
-      decoder_info.frame_info.decode_order_frame_num = decode_frame_num;
-      decode_frame(&decoder_info,rec);
-      rec_buffer_idx = decoder_info.frame_info.display_frame_num%MAX_REORDER_BUFFER;
-      rec_available[rec_buffer_idx]=1;
-
-      done = initbits_dec(infile, &stream);
-
-      op_rec_buffer_idx = (last_frame_output+1)%MAX_REORDER_BUFFER;
-      if (rec_available[op_rec_buffer_idx]) {
-        last_frame_output++;
-        write_yuv_frame(&rec[op_rec_buffer_idx],width,height,outfile);
-        rec_available[op_rec_buffer_idx] = 0;
+    if (argc > 1 && strcmp(argv[1], "-batch") == 0)
+      return decode_service_main(argc, argv);
+
+    parse_arg(argc, argv, &infile, &outfile, &threads, &frame_threads, &two_phase, &post_filter, &simd);
+    init_use_simd(simd);
+
+    ds = (dec_stream_t *)malloc(sizeof(dec_stream_t));
+    if (ds == NULL)
+      fatalerror("Memory allocation failed.");
+    open_dec_stream(ds, infile, outfile, threads, 1);
+    alloc_dec_stream(ds);
+    decoder_info_t *decoder_info = &ds->decoder_info;
+    decoder_info->two_phase = two_phase;
+
+    if (frame_threads > 1 || post_filter) {
+      /* Frame threads: parse each frame header here and decode the frame
+         data on the pool while the next headers are parsed */
+      dec_output_t *out = &ds->out;
+      frame_pool_t *pool = (frame_pool_t *)malloc(sizeof(frame_pool_t));
+      if (pool == NULL)
+        fatalerror("Memory allocation failed.");
+      frame_pool_init(pool, decoder_info, ds->ref, frame_threads, post_filter);
+      frame_job_t *job = frame_pool_next_job(pool);
+      frame_pool_take_stream(job, &ds->stream);
+      do
+      {
+        decoder_info->stream = &job->stream;
+        decoder_info->frame_info.decode_order_frame_num = ds->decode_frame_num;
+        decode_frame_header(decoder_info,ds->rec);
+
+        /* Frames are output in the same order as when decoding serially */
+        int rec_buffer_idx = decoder_info->frame_info.display_frame_num%MAX_REORDER_BUFFER;
+        while (pool->count && rec_busy(pool, out, rec_buffer_idx))
+          retire_frame(pool, decoder_info, out);
+
+        frame_pool_submit(pool, job, decoder_info);
+        ds->decode_frame_num++;
+
+        while ((job = frame_pool_next_job(pool)) == NULL)
+          retire_frame(pool, decoder_info, out);
+        ds->done = frame_pool_read(job, infile);
       }
-      printf("decode_frame_num=%4d display_frame_num=%4d input_file_size=%12d bitcnt=%12d\n",
-          decode_frame_num,decoder_info.frame_info.display_frame_num,input_file_size,stream.bitcnt);
-      decode_frame_num++;
+      while (!ds->done);
+      while (pool->count)
+        retire_frame(pool, decoder_info, out);
+      frame_pool_close(pool);
+      free(pool);
     }
-    while (!done);
-    // Output the tail
-    int i,j;
-    for (i=1; i<=MAX_REORDER_BUFFER; ++i) {
-      op_rec_buffer_idx=(last_frame_output+i) % MAX_REORDER_BUFFER;
-      if (rec_available[op_rec_buffer_idx])
-        write_yuv_frame(&rec[op_rec_buffer_idx],width,height,outfile);
-      else
-        break;
+    else {
+      while (!decode_stream_frame(ds));
     }
+    // Output the tail
+    close_dec_stream(ds);
 
-    bit_count_t bit_count = decoder_info.bit_count;
+    bit_count_t bit_count = decoder_info->bit_count;
     uint32_t tot_bits[NUM_FRAME_TYPES] = {0};
 
     for (i=0;i<NUM_FRAME_TYPES;i++){
@@ -265,10 +292,10 @@ int main(int argc, char** argv)
     printf("64x64-blocks (8x8):    %9d  %9d  %9d  %9d  %9d\n", bit_count.size_and_mode[B_FRAME][3][0], bit_count.size_and_mode[B_FRAME][3][1], bit_count.size_and_mode[B_FRAME][3][2], bit_count.size_and_mode[B_FRAME][3][3], bit_count.size_and_mode[B_FRAME][3][4]);
 
     int idx;
-    int num = 5 + decoder_info.max_num_ref;
+    int num = 5 + decoder_info->max_num_ref;
     printf("\nSuper-mode distribution for P pictures:\n");
     printf("                    SKIP   SPLIT INTERr0   MERGE   BIPRED  INTRA ");
-    for (i = 1; i < decoder_info.max_num_ref; i++) printf("INTERr%1d ", i);
+    for (i = 1; i < decoder_info->max_num_ref; i++) printf("INTERr%1d ", i);
     printf("\n");
     for (idx=0;idx<NUM_BLOCK_SIZES;idx++){
       int size = 8<<idx;
@@ -281,7 +308,7 @@ int main(int argc, char** argv)
    
     printf("\nSuper-mode distribution for B pictures:\n");
     printf("                    SKIP   SPLIT INTERr0   MERGE   BIPRED  INTRA ");
-    for (i = 1; i < decoder_info.max_num_ref; i++) printf("INTERr%1d ", i);
+    for (i = 1; i < decoder_info->max_num_ref; i++) printf("INTERr%1d ", i);
     printf("\n");
     for (idx = 0; idx<NUM_BLOCK_SIZES; idx++) {
       int size = 8 << idx;
@@ -299,7 +326,7 @@ int main(int argc, char** argv)
     for (i=0;i<NUM_BLOCK_SIZES;i++){
       size = 1<<(i+3);
       printf("%2d x %2d-blocks: ",size,size);
-      for (j=0;j<decoder_info.max_num_ref;j++){
+      for (j=0;j<decoder_info->max_num_ref;j++){
         printf("%6d",bit_count.size_and_ref_idx[P_FRAME][i][j]);
       }
       printf("\n");
@@ -310,7 +337,7 @@ int main(int argc, char** argv)
     for (i = 0; i<NUM_BLOCK_SIZES; i++) {
       size = 1 << (i + 3);
       printf("%2d x %2d-blocks: ", size, size);
-      for (j = 0; j<decoder_info.max_num_ref; j++) {
+      for (j = 0; j<decoder_info->max_num_ref; j++) {
         printf("%6d", bit_count.size_and_ref_idx[B_FRAME][i][j]);
       }
       printf("\n");
@@ -327,20 +354,7 @@ int main(int argc, char** argv)
     }
     printf("\n");
     printf("-----------------------------------------------------------------\n");
-    for (r=0;r<MAX_REORDER_BUFFER;r++){
-      close_yuv_frame(&rec[r]);
-    }
-    for (r=0;r<MAX_REF_FRAMES;r++){
-      close_yuv_frame(&ref[r]);
-    }
-    if (decoder_info.interp_ref) {
-      for (r=0;r<MAX_SKIP_FRAMES;r++){
-        close_yuv_frame(decoder_info.interp_frames[r]);
-        free(decoder_info.interp_frames[r]);
-      }
-    }
-
-    free(decoder_info.deblock_data);
+    free(ds);
 
     return 0;
 }
@@ -30,6 +30,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdio.h>
 #include "getbits.h"
 #include "types.h"
+#include "row_filter.h"
 
 typedef struct 
 {
@@ -54,8 +55,20 @@ typedef struct
   int16_t *coeffq_u;
   int16_t *coeffq_v;
   int delta_qp;
+  int qp;
 } block_info_dec_t;
 
+/* Blocks of a frame that have been read from the bitstream and not yet
+   reconstructed, for two-phase decoding */
+typedef struct
+{
+  block_info_dec_t *blocks;
+  int num_blocks;
+  int *sb_first;   //Index of the first block of each superblock in raster order
+  int16_t *coeff;  //Coefficients of the blocks that are not skipped, Y then U then V
+  int coeff_pos;
+} block_buffer_t;
+
 typedef struct 
 {
     frame_info_t frame_info;
@@ -64,6 +77,15 @@ typedef struct
     yuv_frame_t *interp_frames[MAX_SKIP_FRAMES];
     stream_t *stream;
     deblock_data_t *deblock_data;
+    tile_t tile;
+    int tile_cols;
+    int tile_rows;
+    int threads; //Number of worker threads
+    row_filter_t *row_filter; //Loop filtering of finished superblock rows, or NULL
+    struct frame_pool_t *frame_pool; //Frame threads sharing the reference buffer, or NULL
+    yuv_frame_t *ref_out; //Reference buffer slot receiving the reconstructed frame
+    int two_phase; //Read the whole frame before reconstructing it
+    block_buffer_t *block_buffer; //Parsed blocks of the current frame with two-phase decoding, or NULL
     int width;
     int height;
     bit_count_t bit_count;
@@ -57,8 +57,6 @@ void read_mv(stream_t *stream,mv_t *mv,mv_t *mvp)
     mv->y = mvp->y + mvd.y;
 }
 
-int YPOS,XPOS;
-
 
 int find_index(int code, int maxrun, int type){
 
@@ -232,9 +230,6 @@ int read_block(decoder_info_t *decoder_info,stream_t *stream,block_info_dec_t *b
   int ypos = block_info->block_pos.ypos;
   int xpos = block_info->block_pos.xpos;
 
-  YPOS = ypos;
-  XPOS = xpos;
-
   int sizeY = size;
   int sizeC = size/2;
 
@@ -266,7 +261,7 @@ int read_block(decoder_info_t *decoder_info,stream_t *stream,block_info_dec_t *b
     int num_skip_vec,skip_idx;
     int bipred_copy = decoder_info->frame_info.interp_ref || stat_frame_type == P_FRAME ? 0 : 1;
     inter_pred_t skip_candidates[MAX_NUM_SKIP];
-    num_skip_vec = get_mv_skip(ypos, xpos, width, height, size, decoder_info->deblock_data, skip_candidates, bipred_copy);
+    num_skip_vec = get_mv_skip(ypos, xpos, width, height, size, decoder_info->deblock_data, &decoder_info->tile, skip_candidates, bipred_copy);
     for (int idx = 0; idx < num_skip_vec; idx++) {
       mv_skip[idx] = skip_candidates[idx].mv0;
     }
@@ -309,10 +304,10 @@ int read_block(decoder_info_t *decoder_info,stream_t *stream,block_info_dec_t *b
   }
   else if (mode == MODE_MERGE){
     /* Derive skip vector candidates and number of skip vector candidates from neighbour blocks */
-    mv_t mv_skip[MAX_NUM_SKIP];
+    mv_t mv_skip[MAX_NUM_SKIP] = {{0}};
     int num_skip_vec,skip_idx;
     inter_pred_t merge_candidates[MAX_NUM_SKIP];
-    num_skip_vec = get_mv_merge(ypos, xpos, width, height, size, decoder_info->deblock_data, merge_candidates);
+    num_skip_vec = get_mv_merge(ypos, xpos, width, height, size, decoder_info->deblock_data, &decoder_info->tile, merge_candidates);
     for (int idx = 0; idx < num_skip_vec; idx++) {
       mv_skip[idx] = merge_candidates[idx].mv0;
     }
@@ -388,7 +383,7 @@ int read_block(decoder_info_t *decoder_info,stream_t *stream,block_info_dec_t *b
     //if (mode==MODE_INTER)
     decoder_info->bit_count.size_and_ref_idx[stat_frame_type][log2i(size)-3][ref_idx] += 1;
 
-    mvp = get_mv_pred(ypos,xpos,width,height,size,ref_idx,decoder_info->deblock_data);
+    mvp = get_mv_pred(ypos,xpos,width,height,size,ref_idx,decoder_info->deblock_data,&decoder_info->tile);
 
     /* Deode motion vectors for each prediction block */
     mv_t mvp2 = mvp;
@@ -427,7 +422,7 @@ int read_block(decoder_info_t *decoder_info,stream_t *stream,block_info_dec_t *b
   }
   else if (mode==MODE_BIPRED){
     int ref_idx = 0;
-    mvp = get_mv_pred(ypos,xpos,width,height,size,ref_idx,decoder_info->deblock_data);
+    mvp = get_mv_pred(ypos,xpos,width,height,size,ref_idx,decoder_info->deblock_data,&decoder_info->tile);
 
     /* Deode motion vectors */
     mv_t mvp2 = mvp;
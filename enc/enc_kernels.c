@@ -26,13 +26,26 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 /* -*- mode: c; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2; -*- */
 
+#include <string.h>
+
 #include "simd.h"
 #include "global.h"
+#include "enc_kernels.h"
+
+/* This file is also compiled into per instruction set variants, which
+   define SIMD_KERNEL to give the exported kernels distinct names. */
+#ifndef SIMD_KERNEL
+#define SIMD_KERNEL(name) name
+#define ENC_KERNELS_DISPATCH
+#endif
 
-int sad_calc_simd(uint8_t *a, uint8_t *b, int astride, int bstride, int width, int height)
+int SIMD_KERNEL(sad_calc_simd)(uint8_t *a, uint8_t *b, int astride, int bstride, int width, int height)
 {
   int i, j;
 
+  if (width <= 4)
+    return sad_calc_non_simd(a, b, astride, bstride, width, height);
+
   if (width == 8) {
     sad64_internal s = v64_sad_u8_init();
     if ((intptr_t)b & 7)
@@ -54,6 +67,12 @@ int sad_calc_simd(uint8_t *a, uint8_t *b, int astride, int bstride, int width, i
         b += 4*bstride;
       }
     return v64_sad_u8_sum(s);
+  } else if (width >= 32) {
+    sad256_internal s = v256_sad_u8_init();
+    for (i = 0; i < height; i++)
+      for (j = 0; j < width; j += 32)
+        s = v256_sad_u8(s, v256_load_unaligned(a + i*astride + j), v256_load_unaligned(b + i*bstride + j));
+    return v256_sad_u8_sum(s);
   } else {
     sad128_internal s = v128_sad_u8_init();
     if ((intptr_t)b & 15)
@@ -68,8 +87,166 @@ int sad_calc_simd(uint8_t *a, uint8_t *b, int astride, int bstride, int width, i
   }
 }
 
-unsigned int widesad_calc_simd(uint8_t *a, uint8_t *b, int astride, int bstride, int width, int height, int *x)
+/* SADs of one block against four reference positions, loading each row
+   of the block once */
+void SIMD_KERNEL(sad_calc_x4_simd)(uint8_t *a, uint8_t **b, int astride, int bstride, int width, int height, unsigned int *sad)
+{
+  int i, j, k;
+
+  if (width <= 4) {
+    sad_calc_x4_non_simd(a, b, astride, bstride, width, height, sad);
+    return;
+  }
+
+  if (width == 8) {
+    sad64_internal s[4];
+    for (k = 0; k < 4; k++)
+      s[k] = v64_sad_u8_init();
+    for (i = 0; i < height; i++) {
+      v64 aa = v64_load_aligned(a + i*astride);
+      for (k = 0; k < 4; k++)
+        s[k] = v64_sad_u8(s[k], aa, v64_load_unaligned(b[k] + i*bstride));
+    }
+    for (k = 0; k < 4; k++)
+      sad[k] = v64_sad_u8_sum(s[k]);
+  } else if (width >= 32) {
+    sad256_internal s[4];
+    for (k = 0; k < 4; k++)
+      s[k] = v256_sad_u8_init();
+    for (i = 0; i < height; i++)
+      for (j = 0; j < width; j += 32) {
+        v256 aa = v256_load_unaligned(a + i*astride + j);
+        for (k = 0; k < 4; k++)
+          s[k] = v256_sad_u8(s[k], aa, v256_load_unaligned(b[k] + i*bstride + j));
+      }
+    for (k = 0; k < 4; k++)
+      sad[k] = v256_sad_u8_sum(s[k]);
+  } else {
+    sad128_internal s[4];
+    for (k = 0; k < 4; k++)
+      s[k] = v128_sad_u8_init();
+    for (i = 0; i < height; i++)
+      for (j = 0; j < width; j += 16) {
+        v128 aa = v128_load_aligned(a + i*astride + j);
+        for (k = 0; k < 4; k++)
+          s[k] = v128_sad_u8(s[k], aa, v128_load_unaligned(b[k] + i*bstride + j));
+      }
+    for (k = 0; k < 4; k++)
+      sad[k] = v128_sad_u8_sum(s[k]);
+  }
+}
+
+/* Hadamard transform across eight vectors of 16 bit lanes */
+SIMD_INLINE void hadamard8_16(v128 *x)
+{
+  for (int s = 1; s < 8; s <<= 1)
+    for (int i = 0; i < 8; i++)
+      if (!(i & s)) {
+        v128 a = x[i];
+        x[i] = v128_add_16(a, x[i + s]);
+        x[i + s] = v128_sub_16(a, x[i + s]);
+      }
+}
+
+SIMD_INLINE void transpose8x8_16(v128 *x)
+{
+  v128 t0 = v128_ziplo_16(x[1], x[0]);
+  v128 t1 = v128_ziphi_16(x[1], x[0]);
+  v128 t2 = v128_ziplo_16(x[3], x[2]);
+  v128 t3 = v128_ziphi_16(x[3], x[2]);
+  v128 t4 = v128_ziplo_16(x[5], x[4]);
+  v128 t5 = v128_ziphi_16(x[5], x[4]);
+  v128 t6 = v128_ziplo_16(x[7], x[6]);
+  v128 t7 = v128_ziphi_16(x[7], x[6]);
+  v128 u0 = v128_ziplo_32(t2, t0);
+  v128 u1 = v128_ziphi_32(t2, t0);
+  v128 u2 = v128_ziplo_32(t3, t1);
+  v128 u3 = v128_ziphi_32(t3, t1);
+  v128 u4 = v128_ziplo_32(t6, t4);
+  v128 u5 = v128_ziphi_32(t6, t4);
+  v128 u6 = v128_ziplo_32(t7, t5);
+  v128 u7 = v128_ziphi_32(t7, t5);
+  x[0] = v128_ziplo_64(u4, u0);
+  x[1] = v128_ziphi_64(u4, u0);
+  x[2] = v128_ziplo_64(u5, u1);
+  x[3] = v128_ziphi_64(u5, u1);
+  x[4] = v128_ziplo_64(u6, u2);
+  x[5] = v128_ziphi_64(u6, u2);
+  x[6] = v128_ziplo_64(u7, u3);
+  x[7] = v128_ziphi_64(u7, u3);
+}
+
+/* Sum of absolute 4x4 Hadamard transformed differences, (sum + 1) >> 1.
+   The two rows of a vector are transformed vertically, then the lanes
+   two apart.  The last stage uses |p + q| + |p - q| = 2*max(|p|, |q|),
+   summed over both lanes of each pair. */
+static unsigned int satd4x4(const uint8_t *a, const uint8_t *b, int astride, int bstride)
+{
+  v128 pa = v128_from_32(u32_load_unaligned(a + 3*astride), u32_load_unaligned(a + 2*astride),
+                         u32_load_unaligned(a + 1*astride), u32_load_unaligned(a));
+  v128 pb = v128_from_32(u32_load_unaligned(b + 3*bstride), u32_load_unaligned(b + 2*bstride),
+                         u32_load_unaligned(b + 1*bstride), u32_load_unaligned(b));
+  v128 x01 = v128_sub_16(v128_unpacklo_u8_s16(pa), v128_unpacklo_u8_s16(pb));
+  v128 x23 = v128_sub_16(v128_unpackhi_u8_s16(pa), v128_unpackhi_u8_s16(pb));
+
+  v128 s = v128_add_16(x01, x23);
+  v128 d = v128_sub_16(x01, x23);
+  v128 c0 = v128_ziplo_64(d, s);
+  v128 c1 = v128_ziphi_64(d, s);
+  v128 e = v128_add_16(c0, c1);
+  v128 f = v128_sub_16(c0, c1);
+
+  v128 lo = v128_unziplo_32(f, e);
+  v128 hi = v128_unziphi_32(f, e);
+  v128 u = v128_abs_s16(v128_add_16(lo, hi));
+  v128 v = v128_abs_s16(v128_sub_16(lo, hi));
+  u = v128_max_s16(u, v128_or(v128_shl_n_32(u, 16), v128_shr_n_u32(u, 16)));
+  v = v128_max_s16(v, v128_or(v128_shl_n_32(v, 16), v128_shr_n_u32(v, 16)));
+
+  v128 t = v128_add_32(v128_padd_s16(u), v128_padd_s16(v));
+  t = v128_add_32(t, v128_shr_n_byte(t, 8));
+  t = v128_add_32(t, v128_shr_n_byte(t, 4));
+  return (v128_low_u32(t) + 1) >> 1;
+}
+
+/* Sum of absolute 8x8 Hadamard transformed differences, (sum + 2) >> 2
+   per 8x8 block.  Sizes that aren't multiples of 8 use 4x4 blocks. */
+unsigned int SIMD_KERNEL(satd_calc_simd)(uint8_t *a, uint8_t *b, int astride, int bstride, int width, int height)
+{
+  unsigned int satd = 0;
+
+  if ((width & 7) || (height & 7)) {
+    for (int i = 0; i < height; i += 4)
+      for (int j = 0; j < width; j += 4)
+        satd += satd4x4(a + i*astride + j, b + i*bstride + j, astride, bstride);
+    return satd;
+  }
+
+  for (int i = 0; i < height; i += 8)
+    for (int j = 0; j < width; j += 8) {
+      v128 x[8];
+      for (int k = 0; k < 8; k++)
+        x[k] = v128_sub_16(v128_unpack_u8_s16(v64_load_unaligned(a + (i + k)*astride + j)),
+                           v128_unpack_u8_s16(v64_load_unaligned(b + (i + k)*bstride + j)));
+      hadamard8_16(x);
+      transpose8x8_16(x);
+      hadamard8_16(x);
+
+      v128 s = v128_zero();
+      for (int k = 0; k < 8; k++)
+        s = v128_add_32(s, v128_padd_s16(v128_abs_s16(x[k])));
+      s = v128_add_32(s, v128_shr_n_byte(s, 8));
+      s = v128_add_32(s, v128_shr_n_byte(s, 4));
+      satd += (v128_low_u32(s) + 2) >> 2;
+    }
+  return satd;
+}
+
+unsigned int SIMD_KERNEL(widesad_calc_simd)(uint8_t *a, uint8_t *b, int astride, int bstride, int width, int height, int *x)
 {
+  if (width != 16 || height != 16)
+    return widesad_calc_non_simd(a, b, astride, bstride, width, height, x);
+
   // Calculate the 16x16 SAD for five positions x.xXx.x and return the best
   sad128_internal s0 = v128_sad_u8_init();
   sad128_internal s1 = v128_sad_u8_init();
@@ -97,9 +274,13 @@ unsigned int widesad_calc_simd(uint8_t *a, uint8_t *b, int astride, int bstride,
   return r >> 3;
 }
 
-int ssd_calc_simd(uint8_t *a, uint8_t *b, int astride, int bstride, int size)
+int SIMD_KERNEL(ssd_calc_simd)(uint8_t *a, uint8_t *b, int astride, int bstride, int width, int height)
 {
   int i, j;
+  int size = width;
+
+  if (width <= 4 || width != height)
+    return ssd_calc_non_simd(a, b, astride, bstride, width, height);
 
   if (size == 8) {
     ssd64_internal s = v64_ssd_u8_init();
@@ -112,6 +293,12 @@ int ssd_calc_simd(uint8_t *a, uint8_t *b, int astride, int bstride, int size)
     s = v64_ssd_u8(s, v64_load_aligned(a + 6*astride), v64_load_aligned(b + 6*bstride));
     s = v64_ssd_u8(s, v64_load_aligned(a + 7*astride), v64_load_aligned(b + 7*bstride));
     return v64_ssd_u8_sum(s);
+  } else if (size >= 32) {
+    ssd256_internal s = v256_ssd_u8_init();
+    for (i = 0; i < size; i++)
+      for (j = 0; j < size; j += 32)
+        s = v256_ssd_u8(s, v256_load_unaligned(a + i*astride + j), v256_load_unaligned(b + i*bstride + j));
+    return v256_ssd_u8_sum(s);
   } else {
     ssd128_internal s = v128_ssd_u8_init();
     for (i = 0; i < size; i++)
@@ -121,7 +308,7 @@ int ssd_calc_simd(uint8_t *a, uint8_t *b, int astride, int bstride, int size)
   }
 }
 
-void detect_clpf_simd(const uint8_t *rec,const uint8_t *org,int x0, int y0, int width, int height, int so,int stride, int *sum0, int *sum1)
+void SIMD_KERNEL(detect_clpf_simd)(const uint8_t *rec,const uint8_t *org,int x0, int y0, int width, int height, int so,int stride, int *sum0, int *sum1)
 {
   int left = (x0 & ~(MAX_BLOCK_SIZE-1)) - x0;
   int top = (y0 & ~(MAX_BLOCK_SIZE-1)) - y0;
@@ -159,11 +346,14 @@ void detect_clpf_simd(const uint8_t *rec,const uint8_t *org,int x0, int y0, int
 }
 
 /* Return the best approximated half-pel position around the centre */
-unsigned int sad_calc_fasthalf_simd(const uint8_t *a, const uint8_t *b, int as, int bs, int width, int height, int *x, int *y, unsigned int *maxsad)
+unsigned int SIMD_KERNEL(sad_calc_fasthalf_simd)(const uint8_t *a, const uint8_t *b, int as, int bs, int width, int height, int *x, int *y)
 {
   unsigned int sad_tl, sad_tr, sad_br, sad_bl;
   unsigned int sad_top, sad_right, sad_down, sad_left;
 
+  if (width <= 4)
+    return sad_calc_fasthalf(a, b, as, bs, width, height, x, y);
+
   if (width == 8) {
     sad64_internal top = v64_sad_u8_init();
     sad64_internal right = v64_sad_u8_init();
@@ -345,12 +535,15 @@ unsigned int sad_calc_fasthalf_simd(const uint8_t *a, const uint8_t *b, int as,
 
 
 /* Return the best approximated quarter-pel position around the centre */
-unsigned int sad_calc_fastquarter_simd(const uint8_t *po, const uint8_t *r, int os, int rs, int width, int height, int *x, int *y)
+unsigned int SIMD_KERNEL(sad_calc_fastquarter_simd)(const uint8_t *po, const uint8_t *r, int os, int rs, int width, int height, int *x, int *y)
 {
   unsigned int sad_tl, sad_tr, sad_br, sad_bl;
   unsigned int sad_top, sad_right, sad_down, sad_left;
   int bestx = 0, besty = -1;
 
+  if (width <= 4)
+    return sad_calc_fastquarter(po, r, os, rs, width, height, x, y);
+
   sad64_internal top = v64_sad_u8_init();
   sad64_internal right = v64_sad_u8_init();
   sad64_internal down = v64_sad_u8_init();
@@ -646,3 +839,106 @@ unsigned int sad_calc_fastquarter_simd(const uint8_t *po, const uint8_t *r, int
   *y = besty;
   return sad_top;
 }
+
+/* Quantization of n coefficients (a multiple of 16) in scan order.  The
+   last significant position is found with the small dead zone offset,
+   scanning 16 levels at a time backwards, and the coefficients up to it
+   are then quantized with the forward offsets.  Returns cbp. */
+int SIMD_KERNEL(quantize_scan_simd)(const int *scoeff, int *scoeffq, int n, int scale, int shift2, int intra_block, int chroma_flag, int *last_pos)
+{
+  const v128 vscale = v128_dup_32(scale);
+  const v128 offl = v128_dup_32((intra_block ? 38 : -26) * (1 << (shift2-8)));
+  const v128 off0 = v128_dup_32((intra_block ? 102 : 51) * (1 << (shift2-8)));
+  const v128 doff = v128_dup_32(chroma_flag ? 0 : ((intra_block ? 115 : 90) - (intra_block ? 102 : 51)) * (1 << (shift2-8)));
+  v128 nz = v128_zero();
+  int pos, last = -1;
+
+  /* Find last_pos */
+  for (pos = n - 16; pos >= 0 && last < 0; pos -= 16) {
+    v128 l[4];
+    for (int k = 0; k < 4; k++) {
+      v128 c = v128_load_unaligned(scoeff + pos + 4*k);
+      v128 s = v128_shr_n_s32(c, 31);
+      v128 a = v128_add_32(v128_mullo_s32(v128_sub_32(v128_xor(c, s), s), vscale), offl);
+      s = v128_shr_n_s32(a, 31);
+      l[k] = v128_shr_s32(v128_sub_32(v128_xor(a, s), s), shift2);
+    }
+    v128 levels = v128_pack_s16_u8(v128_pack_s32_s16(l[3], l[2]), v128_pack_s32_s16(l[1], l[0]));
+    if (v64_u64(v128_low_v64(levels)) | v64_u64(v128_high_v64(levels))) {
+      uint8_t b[16];
+      v128_store_unaligned(b, levels);
+      for (last = 15; !b[last]; last--);
+      last += pos;
+    }
+  }
+
+  /* Forward scan up to last_pos */
+  for (pos = 0; pos <= last; pos += 4) {
+    v128 c = v128_load_unaligned(scoeff + pos);
+    v128 s = v128_shr_n_s32(c, 31);
+    v128 a = v128_mullo_s32(v128_sub_32(v128_xor(c, s), s), vscale);
+    /* The larger offset applies where the level without offset is non-zero */
+    v128 big = v128_shr_n_s32(v128_sub_32(v128_zero(), v128_shr_s32(a, shift2)), 31);
+    v128 level = v128_shr_s32(v128_add_32(v128_add_32(a, off0), v128_and(big, doff)), shift2);
+    if (pos + 3 > last)
+      level = v128_and(level, v128_from_32(pos + 3 <= last ? -1 : 0, pos + 2 <= last ? -1 : 0,
+                                           pos + 1 <= last ? -1 : 0, -1));
+    nz = v128_or(nz, level);
+    v128_store_unaligned(scoeffq + pos, v128_sub_32(v128_xor(level, s), s));
+  }
+  memset(scoeffq + pos, 0, (n - pos)*sizeof(int));
+
+  *last_pos = last;
+  return (v64_u64(v128_low_v64(nz)) | v64_u64(v128_high_v64(nz))) != 0;
+}
+
+const enc_kernels_t SIMD_KERNEL(enc_kernels_simd) = {
+  SIMD_KERNEL(sad_calc_simd),
+  SIMD_KERNEL(ssd_calc_simd),
+  SIMD_KERNEL(detect_clpf_simd),
+  SIMD_KERNEL(sad_calc_fasthalf_simd),
+  SIMD_KERNEL(sad_calc_fastquarter_simd),
+  SIMD_KERNEL(widesad_calc_simd),
+  SIMD_KERNEL(quantize_scan_simd),
+  SIMD_KERNEL(sad_calc_x4_simd),
+  SIMD_KERNEL(satd_calc_simd)
+};
+
+#ifdef ENC_KERNELS_DISPATCH
+
+#ifdef THOR_KERNELS_SSE4
+extern const enc_kernels_t enc_kernels_simd_sse4;
+#endif
+#ifdef THOR_KERNELS_AVX2
+extern const enc_kernels_t enc_kernels_simd_avx2;
+#endif
+
+/* The plain C versions, used when simd_level is SIMD_NONE */
+const enc_kernels_t enc_kernels_non_simd = {
+  sad_calc_non_simd,
+  ssd_calc_non_simd,
+  detect_clpf,
+  sad_calc_fasthalf,
+  sad_calc_fastquarter,
+  widesad_calc_non_simd,
+  quantize_scan,
+  sad_calc_x4_non_simd,
+  satd_calc_non_simd
+};
+
+const enc_kernels_t *enc_kernels = &enc_kernels_non_simd;
+
+void init_enc_kernels(void)
+{
+  enc_kernels = simd_level > SIMD_NONE ? &enc_kernels_simd : &enc_kernels_non_simd;
+#ifdef THOR_KERNELS_SSE4
+  if (simd_level >= SIMD_SSE4)
+    enc_kernels = &enc_kernels_simd_sse4;
+#endif
+#ifdef THOR_KERNELS_AVX2
+  if (simd_level >= SIMD_AVX2)
+    enc_kernels = &enc_kernels_simd_avx2;
+#endif
+}
+
+#endif
@@ -30,10 +30,44 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdint.h>
 
 int sad_calc_simd(uint8_t *a, uint8_t *b, int astride, int bstride, int width, int height);
-int ssd_calc_simd(uint8_t *a, uint8_t *b, int astride, int bstride, int size);
+void sad_calc_x4_simd(uint8_t *a, uint8_t **b, int astride, int bstride, int width, int height, unsigned int *sad);
+unsigned int satd_calc_simd(uint8_t *a, uint8_t *b, int astride, int bstride, int width, int height);
+int ssd_calc_simd(uint8_t *a, uint8_t *b, int astride, int bstride, int width, int height);
 void detect_clpf_simd(const uint8_t *rec,const uint8_t *org,int x0, int y0, int width, int height, int so,int stride, int *sum0, int *sum1);
 unsigned int sad_calc_fasthalf_simd(const uint8_t *a, const uint8_t *b, int astride, int bstride, int width, int height, int *x, int *y);
 unsigned int sad_calc_fastquarter_simd(const uint8_t *o, const uint8_t *r, int os, int rs, int width, int height, int *x, int *y);
 unsigned int widesad_calc_simd(uint8_t *a, uint8_t *b, int astride, int bstride, int width, int height, int *x);
+int quantize_scan_simd(const int *scoeff, int *scoeffq, int n, int scale, int shift2, int intra_block, int chroma_flag, int *last_pos);
+
+/* Plain C versions of the kernels, defined in encode_block.c.  The SIMD
+   kernels fall back to these for block sizes they don't handle. */
+int sad_calc_non_simd(uint8_t *a, uint8_t *b, int astride, int bstride, int width, int height);
+void sad_calc_x4_non_simd(uint8_t *a, uint8_t **b, int astride, int bstride, int width, int height, unsigned int *sad);
+unsigned int satd_calc_non_simd(uint8_t *a, uint8_t *b, int astride, int bstride, int width, int height);
+int ssd_calc_non_simd(uint8_t *a, uint8_t *b, int astride, int bstride, int width, int height);
+void detect_clpf(const uint8_t *rec,const uint8_t *org,int x0, int y0, int width, int height, int so,int stride, int *sum0, int *sum1);
+unsigned int sad_calc_fasthalf(const uint8_t *a, const uint8_t *b, int astride, int bstride, int width, int height, int *x, int *y);
+unsigned int sad_calc_fastquarter(const uint8_t *o, const uint8_t *r, int os, int rs, int width, int height, int *x, int *y);
+unsigned int widesad_calc_non_simd(uint8_t *a, uint8_t *b, int astride, int bstride, int width, int height, int *x);
+int quantize_scan(const int *scoeff, int *scoeffq, int n, int scale, int shift2, int intra_block, int chroma_flag, int *last_pos);
+
+/* The kernels above, as built for one SIMD level.  Callers go through
+   enc_kernels, which init_enc_kernels() points at the table matching
+   simd_level, or at the C versions for SIMD_NONE. */
+typedef struct
+{
+  int (*sad_calc)(uint8_t *a, uint8_t *b, int astride, int bstride, int width, int height);
+  int (*ssd_calc)(uint8_t *a, uint8_t *b, int astride, int bstride, int width, int height);
+  void (*detect_clpf)(const uint8_t *rec,const uint8_t *org,int x0, int y0, int width, int height, int so,int stride, int *sum0, int *sum1);
+  unsigned int (*sad_calc_fasthalf)(const uint8_t *a, const uint8_t *b, int astride, int bstride, int width, int height, int *x, int *y);
+  unsigned int (*sad_calc_fastquarter)(const uint8_t *o, const uint8_t *r, int os, int rs, int width, int height, int *x, int *y);
+  unsigned int (*widesad_calc)(uint8_t *a, uint8_t *b, int astride, int bstride, int width, int height, int *x);
+  int (*quantize_scan)(const int *scoeff, int *scoeffq, int n, int scale, int shift2, int intra_block, int chroma_flag, int *last_pos);
+  void (*sad_calc_x4)(uint8_t *a, uint8_t **b, int astride, int bstride, int width, int height, unsigned int *sad);
+  unsigned int (*satd_calc)(uint8_t *a, uint8_t *b, int astride, int bstride, int width, int height);
+} enc_kernels_t;
+
+extern const enc_kernels_t *enc_kernels;
+void init_enc_kernels(void);
 
 #endif
@@ -46,8 +46,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "inter_prediction.h"
 #include "intra_prediction.h"
 #include "enc_kernels.h"
-
-int YPOS,XPOS;
+#include "me_analysis.h"
 
 extern int chroma_qp[52];
 extern int zigzag16[16];
@@ -57,6 +56,8 @@ extern uint16_t gquant_table[6];
 extern uint16_t gdequant_table[6];
 extern double squared_lambda_QP [MAX_QP+1];
 
+#define MAX_ME_CANDS 25 //Largest motion search stage, the 5x5 telescope grid
+
 static inline uint64_t mv_mask_hash(const mv_t *mv) { return (uint64_t)1 << (((mv->y << 3) ^ mv->x) & 63); }
 
 static inline void add_mvcandidate(const mv_t *mv, mv_t *list, int *list_len, uint64_t *mask)
@@ -72,69 +73,77 @@ static inline void add_mvcandidate(const mv_t *mv, mv_t *list, int *list_len, ui
   *mask |= m;
 }
 
-int quantize (int16_t *coeff, int16_t *coeffq, int qp, int size, int coeff_block_type, int rdoq)
+int quantize_scan(const int *scoeff, int *scoeffq, int n, int scale, int shift2, int intra_block, int chroma_flag, int *last_pos)
 {
-  int intra_block = (coeff_block_type>>1) & 1;
-  int chroma_flag = coeff_block_type & 1;
-  int tr_log2size = log2i(size);
-  int qsize = min(MAX_QUANT_SIZE,size); //Only quantize 16x16 low frequency coefficients
-  int scale = gquant_table[qp%6];
-  int scoeff[MAX_QUANT_SIZE*MAX_QUANT_SIZE];
-  int scoeffq[MAX_QUANT_SIZE*MAX_QUANT_SIZE];
-  int i,j,c,sign,offset,level,cbp,pos,last_pos,level0,abs_coeff,offset0,offset1;
-  int shift2 = 21 - tr_log2size + qp/6;
-
-  int *zigzagptr = zigzag64;
-  if (qsize==4)
-    zigzagptr = zigzag16;
-  else if (qsize==8)
-    zigzagptr = zigzag64;
-  else if (qsize==16)
-    zigzagptr = zigzag256;
+  int c,sign,offset,level,cbp,pos,level0,abs_coeff,offset0,offset1;
 
   /* Initialize 1D array of quantized coefficients to zero */
-  memset(scoeffq,0,qsize*qsize*sizeof(int));
-
-  /* Zigzag scan of 8x8 low frequency coefficients */
-  for(i=0;i<qsize;i++){
-    for (j=0;j<qsize;j++){
-      scoeff[zigzagptr[i*qsize+j]] = coeff[i*size+j];
-    }
-  }
+  memset(scoeffq,0,n*sizeof(int));
 
   /* Find last_pos */
   offset = intra_block ? 38 : -26; //Scaled by 256 relative to quantization step size
-  offset = offset<<(shift2-8);
+  offset = offset*(1<<(shift2-8));
   level = 0;
-  pos = qsize*qsize-1;
+  pos = n-1;
   while (level==0 && pos>=0){
     c = scoeff[pos];
     level = abs((abs(c)*scale + offset))>>shift2;
     pos--;
   }
-  last_pos = level ? pos+1 : pos;
+  *last_pos = level ? pos+1 : pos;
 
   /* Forward scan up to last_pos */
   cbp = 0;
 
   offset0 = intra_block ? 102 : 51; //Scaled by 256 relative to quantization step size
   offset1 = intra_block ? 115 : 90; //Scaled by 256 relative to quantization step size
-  for (pos=0;pos<=last_pos;pos++){
+  for (pos=0;pos<=*last_pos;pos++){
     c = scoeff[pos];
     sign = c < 0 ? -1 : 1;
     abs_coeff = scale*abs(c);
     level0 = (abs_coeff + 0)>>shift2;
     offset = ((level0==0 || chroma_flag) ? offset0 : offset1);
-    offset = offset<<(shift2-8);
+    offset = offset*(1<<(shift2-8));
     level = (abs_coeff + offset)>>shift2;
     scoeffq[pos] = sign * level;
     cbp = cbp || (level != 0);
   }
+  return cbp;
+}
+
+int quantize (int16_t *coeff, int16_t *coeffq, int qp, int size, int coeff_block_type, int rdoq)
+{
+  int intra_block = (coeff_block_type>>1) & 1;
+  int chroma_flag = coeff_block_type & 1;
+  int tr_log2size = log2i(size);
+  int qsize = min(MAX_QUANT_SIZE,size); //Only quantize 16x16 low frequency coefficients
+  int scale = gquant_table[qp%6];
+  int scoeff[MAX_QUANT_SIZE*MAX_QUANT_SIZE] = {0};
+  int scoeffq[MAX_QUANT_SIZE*MAX_QUANT_SIZE];
+  int i,j,c,sign,level,cbp,pos,last_pos;
+  int shift2 = 21 - tr_log2size + qp/6;
+
+  int *zigzagptr = zigzag64;
+  if (qsize==4)
+    zigzagptr = zigzag16;
+  else if (qsize==8)
+    zigzagptr = zigzag64;
+  else if (qsize==16)
+    zigzagptr = zigzag256;
+
+  /* Zigzag scan of 8x8 low frequency coefficients */
+  for(i=0;i<qsize;i++){
+    for (j=0;j<qsize;j++){
+      scoeff[zigzagptr[i*qsize+j]] = coeff[i*size+j];
+    }
+  }
+
+  cbp = enc_kernels->quantize_scan(scoeff,scoeffq,qsize*qsize,scale,shift2,intra_block,chroma_flag,&last_pos);
 
   /* RDOQ light - adapted to coefficient encoding */
   if (cbp){
     int pos;
-    int N = chroma_flag ? last_pos+1 : qsize*qsize;
+    int N = last_pos+1; //Nothing changes past last_pos where all levels are zero
     int K1,K2,K3,K4;
 
     for (pos=2;pos<N;pos++){
@@ -196,6 +205,12 @@ int quantize (int16_t *coeff, int16_t *coeffq, int qp, int size, int coeff_block
     uint32_t cost0=0,cost1;
     uint32_t min_cost = MAX_UINT32;
 
+    /* Error of zeroing every coefficient after pos, for the EOB candidates */
+    uint32_t tail_err[MAX_QUANT_SIZE*MAX_QUANT_SIZE];
+    tail_err[N-1] = 0;
+    for (pos1=N-1;pos1>0;pos1--)
+      tail_err[pos1-1] = tail_err[pos1] + scoeff[pos1]*scoeff[pos1];
+
     int level_mode = 1;
     level = 1;
     pos = 0;
@@ -220,11 +235,7 @@ int quantize (int16_t *coeff, int16_t *coeffq, int qp, int size, int coeff_block
           if (chroma_flag==1 && pos==0 && level==1)
             bit = 1;
           cost0 += (err + (int)(lambda * (double)bit + 0.5));
-          cost1 = cost0;
-          for (pos1=pos+1;pos1<N;pos1++){
-            err = scoeff[pos1]*scoeff[pos1];
-            cost1 += err;
-          }
+          cost1 = cost0 + tail_err[pos];
           /* Bit usage for EOB */
           bit = 0;
           if (pos < N-1){
@@ -317,11 +328,7 @@ int quantize (int16_t *coeff, int16_t *coeffq, int qp, int size, int coeff_block
           rec = ((c * scale_dec << lshift) + add_dec) >> rshift;
           err = (rec-org)*(rec-org);
           cost0 += (err + (int)(lambda * (double)bit + 0.5));
-          cost1 = cost0;
-          for (pos1=pos+1;pos1<N;pos1++){
-            err = scoeff[pos1]*scoeff[pos1];
-            cost1 += err;
-          }
+          cost1 = cost0 + tail_err[pos];
           /* Bit usage for EOB */
           bit = 0;
           if (pos < N-1){
@@ -410,11 +417,7 @@ int quantize (int16_t *coeff, int16_t *coeffq, int qp, int size, int coeff_block
 
     int start_bits,end_bits,write_bits;
     stream_t tmp_stream;
-    tmp_stream.bitstream = (uint8_t *)malloc(2*MAX_QUANT_SIZE*MAX_QUANT_SIZE * sizeof(uint8_t));
-    tmp_stream.bitbuf = 0;
-    tmp_stream.bitrest = 32;
-    tmp_stream.bytepos = 0;
-    tmp_stream.bytesize = 2*MAX_QUANT_SIZE*MAX_QUANT_SIZE;
+    init_stream(&tmp_stream, 2*MAX_QUANT_SIZE*MAX_QUANT_SIZE);
     stream_t *stream = &tmp_stream;
 
     start_bits = get_bit_pos(stream);
@@ -425,7 +428,7 @@ int quantize (int16_t *coeff, int16_t *coeffq, int qp, int size, int coeff_block
       printf("write_bits=%8d nbits=%8d\n",write_bits,nbit);
     }
 
-    free (tmp_stream.bitstream);
+    free_stream(&tmp_stream);
 
 #endif
 
@@ -737,65 +740,134 @@ unsigned int sad_calc_fastquarter(const uint8_t *o, const uint8_t *r, int os, in
   return top;
 }
 
-unsigned int sad_calc(uint8_t *a, uint8_t *b, int astride, int bstride, int width, int height)
+int sad_calc_non_simd(uint8_t *a, uint8_t *b, int astride, int bstride, int width, int height)
 {
-  unsigned int i,j,sad = 0;
+  int i,j,sad = 0;
 
-  if (use_simd && width > 4){
-    return sad_calc_simd(a, b, astride, bstride, width, height);
+  for(i=0;i<height;i++){
+    for (j=0;j<width;j++){
+      sad += abs(a[i*astride+j] - b[i*bstride+j]);
+    }
   }
-  else {
-    for(i=0;i<height;i++){
-      for (j=0;j<width;j++){
-        sad += abs(a[i*astride+j] - b[i*bstride+j]);
+  return sad;
+}
+
+unsigned int sad_calc(uint8_t *a, uint8_t *b, int astride, int bstride, int width, int height)
+{
+  return enc_kernels->sad_calc(a, b, astride, bstride, width, height);
+}
+
+/* In place Hadamard transform of n values at the given stride */
+static void hadamard(int *x, int n, int stride)
+{
+  for (int s = 1; s < n; s <<= 1)
+    for (int i = 0; i < n; i++)
+      if (!(i & s)) {
+        int t = x[i*stride];
+        x[i*stride] = t + x[(i + s)*stride];
+        x[(i + s)*stride] = t - x[(i + s)*stride];
       }
+}
+
+/* Sum of absolute Hadamard transformed differences, using 8x8 blocks when
+   the size allows and 4x4 blocks otherwise.  The block sums are scaled by
+   1/4 and 1/2 to be on a par with SAD for typical residuals. */
+unsigned int satd_calc_non_simd(uint8_t *a, uint8_t *b, int astride, int bstride, int width, int height)
+{
+  int n = (width & 7) || (height & 7) ? 4 : 8;
+  unsigned int satd = 0;
+
+  for (int i = 0; i < height; i += n)
+    for (int j = 0; j < width; j += n) {
+      int d[64];
+      unsigned int sum = 0;
+      for (int k = 0; k < n; k++)
+        for (int l = 0; l < n; l++)
+          d[k*n + l] = a[(i + k)*astride + j + l] - b[(i + k)*bstride + j + l];
+      for (int k = 0; k < n; k++)
+        hadamard(d + k*n, n, 1);
+      for (int k = 0; k < n; k++)
+        hadamard(d + k, n, n);
+      for (int k = 0; k < n*n; k++)
+        sum += abs(d[k]);
+      satd += n == 8 ? (sum + 2) >> 2 : (sum + 1) >> 1;
+    }
+  return satd;
+}
+
+unsigned int satd_calc(uint8_t *a, uint8_t *b, int astride, int bstride, int width, int height)
+{
+  return enc_kernels->satd_calc(a, b, astride, bstride, width, height);
+}
+
+void sad_calc_x4_non_simd(uint8_t *a, uint8_t **b, int astride, int bstride, int width, int height, unsigned int *sad)
+{
+  for (int k = 0; k < 4; k++)
+    sad[k] = sad_calc_non_simd(a, b[k], astride, bstride, width, height);
+}
+
+void sad_calc_x4(uint8_t *a, uint8_t **b, int astride, int bstride, int width, int height, unsigned int *sad)
+{
+  enc_kernels->sad_calc_x4(a, b, astride, bstride, width, height, sad);
+}
+
+/* SADs of the integer positions of n motion vectors, four at a time */
+static void sad_calc_mvs(uint8_t *orig, uint8_t *ref, int size, int stride_r, int width, int height, int s, const mv_t *mv, int n, unsigned int *sad)
+{
+  for (int i = 0; i < n; i += 4) {
+    uint8_t *b[4];
+    unsigned int sad4[4];
+    for (int k = 0; k < 4; k++) {
+      const mv_t *m = &mv[min(i + k, n - 1)];
+      b[k] = ref + s*(m->x >> 2) + s*(m->y >> 2)*stride_r;
     }
+    sad_calc_x4(orig, b, size, stride_r, width, height, sad4);
+    for (int k = 0; k < 4 && i + k < n; k++)
+      sad[i + k] = sad4[k];
   }
-  return sad;
 }
 
-unsigned int widesad_calc(uint8_t *a, uint8_t *b, int astride, int bstride, int width, int height, int *x)
+unsigned int widesad_calc_non_simd(uint8_t *a, uint8_t *b, int astride, int bstride, int width, int height, int *x)
 {
   // Calculate the SAD for five positions x.xXx.x and return the best
-  if (use_simd && width == 16 && height == 16) {
-    return widesad_calc_simd(a, b, astride, bstride, width, height, x);
-  }
-  else {
-    static int off[] = { -3, -1, 0, 1, 3 };
-    unsigned int bestsad = 1<<31;
-    int bestx = 0;
-    for(int k = 0; k < sizeof(off) / sizeof(int); k++) {
-      unsigned int sad = 0;
-      for(int i = 0; i < height; i++)
-        for (int j = 0; j < width; j++)
-          sad += abs(a[i*astride + j] - b[i*bstride + j + off[k]]);
-      if (sad < bestsad) {
-        bestsad = sad;
-        bestx = off[k];
-      }
+  static int off[] = { -3, -1, 0, 1, 3 };
+  unsigned int bestsad = 1<<31;
+  int bestx = 0;
+  for(int k = 0; k < sizeof(off) / sizeof(int); k++) {
+    unsigned int sad = 0;
+    for(int i = 0; i < height; i++)
+      for (int j = 0; j < width; j++)
+        sad += abs(a[i*astride + j] - b[i*bstride + j + off[k]]);
+    if (sad < bestsad) {
+      bestsad = sad;
+      bestx = off[k];
     }
-    *x = bestx;
-    return bestsad;
   }
+  *x = bestx;
+  return bestsad;
 }
 
-int ssd_calc(uint8_t *a, uint8_t *b, int astride, int bstride, int width,int height)
+unsigned int widesad_calc(uint8_t *a, uint8_t *b, int astride, int bstride, int width, int height, int *x)
+{
+  return enc_kernels->widesad_calc(a, b, astride, bstride, width, height, x);
+}
+
+int ssd_calc_non_simd(uint8_t *a, uint8_t *b, int astride, int bstride, int width,int height)
 {
   int i,j,ssd = 0;
-  if (use_simd && width > 4 && width==height){
-    int size = width;
-    return ssd_calc_simd(a, b, astride, bstride, size);
-  }
-  else{
-    for(i=0;i<height;i++){
-      for (j=0;j<width;j++){
-        ssd += (a[i*astride+j] - b[i*bstride+j]) * (a[i*astride+j] - b[i*bstride+j]);
-      }
+  for(i=0;i<height;i++){
+    for (j=0;j<width;j++){
+      ssd += (a[i*astride+j] - b[i*bstride+j]) * (a[i*astride+j] - b[i*bstride+j]);
     }
   }
   return ssd;
 }
 
+int ssd_calc(uint8_t *a, uint8_t *b, int astride, int bstride, int width,int height)
+{
+  return enc_kernels->ssd_calc(a, b, astride, bstride, width, height);
+}
+
 int quote_mv_bits(int mv_diff_y, int mv_diff_x)
 {
   int bits = 0;
@@ -831,6 +903,8 @@ int motion_estimate(uint8_t *orig, uint8_t *ref, int size, int stride_r, int wid
   unsigned int sad;
   uint32_t min_sad;
   uint8_t *rf = thor_alloc(MAX_BLOCK_SIZE*MAX_BLOCK_SIZE, 16);
+  mv_t cand[MAX_ME_CANDS]; //Positions of one search stage, whose SADs are computed together
+  unsigned int cand_sad[MAX_ME_CANDS];
   mv_t mv_cand;
   mv_t mv_opt;
   mv_t mv_ref;
@@ -840,31 +914,38 @@ int motion_estimate(uint8_t *orig, uint8_t *ref, int size, int stride_r, int wid
   mv_ref.y = (((mvc->y) + 2) >> 2) << 2;
   mv_ref.x = (((mvc->x) + 2) >> 2) << 2;
 
-  if ((size == 16 && enable_bipred) || params->encoder_speed == 0) {
+  if (((size == 16 && enable_bipred) || params->encoder_speed == 0) && !params->me_analysis) {
 
-    /* Telescope search */
+    /* Telescope search (the motion pre-analysis field is used as candidates instead) */
     int step = 32;
     while (step >= 4) {
       int range = 2*step;
+      int n = 0;
       for (int k = -range; k <= range; k += step) {
         for (int l = -range; l <= range; l += step) {
           if (step < 32 && !k && !l)
             continue; //Center position was investigated at previous step
 
-          mv_cand.y = mv_ref.y + k;
-          mv_cand.x = mv_ref.x + l;
-          clip_mv(&mv_cand, ypos, xpos, fwidth, fheight, size, sign);
-          if (step == 32 && size == 16 && params->encoder_speed < 2 && params->encoder_speed > 0) {
-            int x = 0;
-            sad = widesad_calc(orig,ref + s*(mv_cand.x >> 2) + s*(mv_cand.y >> 2)*stride_r,size,stride_r,width,height,&x);
-            mv_cand.x += s*x << 2;
-          } else
-            sad = sad_calc(orig,ref + s*(mv_cand.x >> 2) + s*(mv_cand.y >> 2)*stride_r,size,stride_r,width,height);
-          sad += (unsigned int)(lambda * (double)quote_mv_bits(mv_cand.y - mvp->y, mv_cand.x - mvp->x) + 0.5);
-          if (sad < min_sad){
-            min_sad = sad;
-            mv_opt = mv_cand;
-          }
+          cand[n].y = mv_ref.y + k;
+          cand[n].x = mv_ref.x + l;
+          clip_mv(&cand[n], ypos, xpos, fwidth, fheight, size, sign);
+          n++;
+        }
+      }
+      if (step == 32 && size == 16 && params->encoder_speed < 2 && params->encoder_speed > 0) {
+        for (int i = 0; i < n; i++) {
+          int x = 0;
+          cand_sad[i] = widesad_calc(orig,ref + s*(cand[i].x >> 2) + s*(cand[i].y >> 2)*stride_r,size,stride_r,width,height,&x);
+          cand[i].x += s*x << 2;
+        }
+      } else
+        sad_calc_mvs(orig,ref,size,stride_r,width,height,s,cand,n,cand_sad);
+
+      for (int i = 0; i < n; i++) {
+        sad = cand_sad[i] + (unsigned int)(lambda * (double)quote_mv_bits(cand[i].y - mvp->y, cand[i].x - mvp->x) + 0.5);
+        if (sad < min_sad){
+          min_sad = sad;
+          mv_opt = cand[i];
         }
       }
 
@@ -874,20 +955,28 @@ int motion_estimate(uint8_t *orig, uint8_t *ref, int size, int stride_r, int wid
   }
 
   /* Candidate search */
-  for (int idx = 0; idx < *mvcand_num; idx++){
-    int x = 0;
-    mv_cand.y = mvcand[idx].y << 2;
-    mv_cand.x = mvcand[idx].x << 2;
-    clip_mv(&mv_cand, ypos, xpos, fwidth, fheight, size, sign);
-    if (size == 16)
-      sad = widesad_calc(orig,ref + s*(mv_cand.x >> 2) + s*(mv_cand.y >> 2)*stride_r,size,stride_r,width,height, &x);
-    else
-      sad = sad_calc(orig,ref + s*(mv_cand.x >> 2) + s*(mv_cand.y >> 2)*stride_r,size,stride_r,width,height);
-    mv_cand.x += s*x << 2;
-    sad += (unsigned int)(lambda * (double)quote_mv_bits(mv_cand.y - mvp->y, mv_cand.x - mvp->x) + 0.5);
-    if (sad < min_sad){
-      min_sad = sad;
-      mv_opt = mv_cand;
+  for (int idx0 = 0; idx0 < *mvcand_num; idx0 += MAX_ME_CANDS) {
+    int n = min(*mvcand_num - idx0, MAX_ME_CANDS);
+    for (int i = 0; i < n; i++) {
+      cand[i].y = mvcand[idx0 + i].y << 2;
+      cand[i].x = mvcand[idx0 + i].x << 2;
+      clip_mv(&cand[i], ypos, xpos, fwidth, fheight, size, sign);
+    }
+    if (size == 16) {
+      for (int i = 0; i < n; i++) {
+        int x = 0;
+        cand_sad[i] = widesad_calc(orig,ref + s*(cand[i].x >> 2) + s*(cand[i].y >> 2)*stride_r,size,stride_r,width,height, &x);
+        cand[i].x += s*x << 2;
+      }
+    } else
+      sad_calc_mvs(orig,ref,size,stride_r,width,height,s,cand,n,cand_sad);
+
+    for (int i = 0; i < n; i++) {
+      sad = cand_sad[i] + (unsigned int)(lambda * (double)quote_mv_bits(cand[i].y - mvp->y, cand[i].x - mvp->x) + 0.5);
+      if (sad < min_sad){
+        min_sad = sad;
+        mv_opt = cand[i];
+      }
     }
   }
 
@@ -901,24 +990,29 @@ int motion_estimate(uint8_t *orig, uint8_t *ref, int size, int stride_r, int wid
   for (int step = 1; step < maxsteps; step++) {
     int dir = start-1;
     int best_dir = -1;
+    int cand_dir[6];
+    int n = 0;
 
     do {
       dir++;
       dir = dir == 6 ? 0 : dir;
       static int diy[] = {  1, 2, 1, -1, -2, -1 };
       static int dix[] = { -1, 0, 1,  1,  0, -1 };
-      mv_cand.y = mv_ref.y + dix[dir]*4;
-      mv_cand.x = mv_ref.x + diy[dir]*4;
+      cand[n].y = mv_ref.y + dix[dir]*4;
+      cand[n].x = mv_ref.x + diy[dir]*4;
+      clip_mv(&cand[n], ypos, xpos, fwidth, fheight, size, sign);
+      cand_dir[n++] = dir;
+    } while (dir != end);
 
-      clip_mv(&mv_cand, ypos, xpos, fwidth, fheight, size, sign);
-      sad = sad_calc(orig,ref + s*(mv_cand.x >> 2) + s*(mv_cand.y >> 2)*stride_r,size,stride_r,width,height);
-      sad += (unsigned int)(lambda * (double)quote_mv_bits(mv_cand.y - mvp->y, mv_cand.x - mvp->x) + 0.5);
+    sad_calc_mvs(orig,ref,size,stride_r,width,height,s,cand,n,cand_sad);
+    for (int i = 0; i < n; i++) {
+      sad = cand_sad[i] + (unsigned int)(lambda * (double)quote_mv_bits(cand[i].y - mvp->y, cand[i].x - mvp->x) + 0.5);
       if (sad < min_sad){
         min_sad = sad;
-        mv_opt = mv_cand;
-        best_dir = dir;
+        mv_opt = cand[i];
+        best_dir = cand_dir[i];
       }
-    } while (dir != end);
+    }
 
     mv_ref = mv_opt;
     start = best_dir ? best_dir - 1 : 5;
@@ -936,6 +1030,13 @@ int motion_estimate(uint8_t *orig, uint8_t *ref, int size, int stride_r, int wid
   unsigned int cmin = min_sad;
 
   if (params->encoder_speed == 0) {
+    unsigned int (*dist)(uint8_t *, uint8_t *, int, int, int, int) = params->satd ? satd_calc : sad_calc;
+
+    /* Compare the sub-pel positions with the full-pel one in the same metric */
+    if (params->satd) {
+      cmin = min_sad = satd_calc(orig,ref + s*(mv_opt.x >> 2) + s*(mv_opt.y >> 2)*stride_r,size,stride_r,width,height) +
+        (unsigned int)(lambda * (double)quote_mv_bits(mv_opt.y - mvp->y, mv_opt.x - mvp->x) + 0.5);
+    }
 
     /* Half-pel search */
     for (int i = 1; i <= 8; i++) {
@@ -945,7 +1046,7 @@ int motion_estimate(uint8_t *orig, uint8_t *ref, int size, int stride_r, int wid
       mv_cand.y = mv_ref.y + hmpos[i];
       mv_cand.x = mv_ref.x + hnpos[i];
       get_inter_prediction_luma(rf,ref,width,height,stride_r,width,&mv_cand, sign,enable_bipred);
-      sad = sad_calc(orig,rf,size,width,width,height);
+      sad = dist(orig,rf,size,width,width,height);
       sad += (unsigned int)(lambda * (double)quote_mv_bits(mv_cand.y - mvp->y, mv_cand.x - mvp->x) + 0.5);
 
       if (sad < cmin) {
@@ -966,7 +1067,7 @@ int motion_estimate(uint8_t *orig, uint8_t *ref, int size, int stride_r, int wid
       mv_cand.y = mv_opt.y + qmpos[i];
       mv_cand.x = mv_opt.x + qnpos[i];
       get_inter_prediction_luma(rf,ref,width,height,stride_r,width,&mv_cand, sign,enable_bipred);
-      sad = sad_calc(orig,rf,size,width,width,height);
+      sad = dist(orig,rf,size,width,width,height);
       sad += (int)(lambda * (double)quote_mv_bits(mv_cand.y - mvp->y, mv_cand.x - mvp->x) + 0.5);
       if (sad < cmin) {
         cmin = sad;
@@ -980,7 +1081,7 @@ int motion_estimate(uint8_t *orig, uint8_t *ref, int size, int stride_r, int wid
 
     /* Half-pel search */
     int spx, spy;
-    sad = (use_simd && width > 4 ? sad_calc_fasthalf_simd : sad_calc_fasthalf)(orig, ref + (mv_ref.x >> 2) + (mv_ref.y >> 2)*stride_r, size, stride_r, width, height, &spx, &spy);
+    sad = enc_kernels->sad_calc_fasthalf(orig, ref + (mv_ref.x >> 2) + (mv_ref.y >> 2)*stride_r, size, stride_r, width, height, &spx, &spy);
     sad += (unsigned int)(lambda * (double)quote_mv_bits(mv_ref.y + s*spy - mvp->y, mv_ref.x + s*spx - mvp->x) + 0.5);
 
     if (sad < cmin) {
@@ -997,7 +1098,7 @@ int motion_estimate(uint8_t *orig, uint8_t *ref, int size, int stride_r, int wid
     mv_opt.y += ydelta_hp;
 
     /* Quarter-pel search */
-    sad = (use_simd && width > 4 ? sad_calc_fastquarter_simd : sad_calc_fastquarter)(orig, ref + s*(mv_ref.x >> 2) + s*(mv_ref.y >> 2)*stride_r, size, stride_r, width, height, &spx, &spy);
+    sad = enc_kernels->sad_calc_fastquarter(orig, ref + s*(mv_ref.x >> 2) + s*(mv_ref.y >> 2)*stride_r, size, stride_r, width, height, &spx, &spy);
     sad += (int)(lambda * (double)quote_mv_bits(mv_ref.y + s*spy - mvp->y, mv_ref.x + s*spx - mvp->x) + 0.5);
 
     if (sad < cmin) {
@@ -1227,104 +1328,66 @@ uint32_t cost_calc(yuv_block_t *org_block,yuv_block_t *rec_block,int stride,int
   return cost;
 }
 
-int search_intra_prediction_params(uint8_t *org_y,yuv_frame_t *rec,block_pos_t *block_pos,int width,int height,int num_intra_modes,intra_mode_t *intra_mode)
+/* Order in which the intra modes are searched, which decides ties */
+static const intra_mode_t intra_search_order[MAX_NUM_INTRA_MODES] = {
+  MODE_DC, MODE_HOR, MODE_VER, MODE_PLANAR, MODE_UPLEFT, MODE_UPRIGHT,
+  MODE_UPUPRIGHT, MODE_UPUPLEFT, MODE_UPLEFTLEFT, MODE_DOWNLEFTLEFT
+};
+
+/* Distortion (SAD, or SATD if satd is set) of the prediction of each intra
+   mode, for the first 4 modes in search order or all of them */
+static void intra_mode_costs(uint8_t *org_y,yuv_frame_t *rec,block_pos_t *block_pos,const tile_t *tile,int num_intra_modes,int satd,int *cost)
 {
   int size = block_pos->size;
   int yposY = block_pos->ypos;
   int xposY = block_pos->xpos;
-  int sad,min_sad;
   uint8_t *pblock = thor_alloc(MAX_BLOCK_SIZE*MAX_BLOCK_SIZE, 16);
   uint8_t* left = (uint8_t*)thor_alloc(2*MAX_TR_SIZE+2,16)+1;
   uint8_t* top = (uint8_t*)thor_alloc(2*MAX_TR_SIZE+2,16)+1;
   uint8_t top_left;
-
-  int upright_available = get_upright_available(yposY,xposY,size,width);
-  int downleft_available = get_downleft_available(yposY,xposY,size,height);
-  make_top_and_left(left,top,&top_left,&rec->y[yposY*rec->stride_y+xposY],rec->stride_y,NULL,0,0,0,yposY,xposY,size,upright_available,downleft_available,0);
-
-
-  /* Search for intra modes */
-  min_sad = (1<<30);
-  *intra_mode = MODE_DC;
-
-  get_dc_pred(xposY >=0 ? left:top,yposY >= 0 ? top:left,size,pblock);
-  sad = sad_calc(org_y,pblock,size,size,size,size);
-  if (sad < min_sad){
-    *intra_mode = MODE_DC;
-    min_sad = sad;
-  }
-  get_hor_pred(left,size,pblock);
-  sad = sad_calc(org_y,pblock,size,size,size,size);
-  if (sad < min_sad){
-    *intra_mode = MODE_HOR;
-    min_sad = sad;
-  }
-
-  get_ver_pred(top,size,pblock);
-  sad = sad_calc(org_y,pblock,size,size,size,size);
-  if (sad < min_sad){
-    *intra_mode = MODE_VER;
-    min_sad = sad;
-  }
-
-  get_planar_pred(left,top,top_left,size,pblock);
-  sad = sad_calc(org_y,pblock,size,size,size,size);
-  if (sad < min_sad){
-    *intra_mode = MODE_PLANAR;
-    min_sad = sad;
-  }
-
-  if (num_intra_modes == 4) { //TODO: generalize
-    thor_free(left - 1);
-    thor_free(top - 1);
-    thor_free(pblock);
-    return min_sad;
-  }
-
-  get_upleft_pred(left,top,top_left,size,pblock);
-  sad = sad_calc(org_y,pblock,size,size,size,size);
-  if (sad < min_sad){
-    *intra_mode = MODE_UPLEFT;
-    min_sad = sad;
-  }
-
-  get_upright_pred(top,size,pblock);
-  sad = sad_calc(org_y,pblock,size,size,size,size);
-  if (sad < min_sad){
-    *intra_mode = MODE_UPRIGHT;
-    min_sad = sad;
-  }
-
-  get_upupright_pred(top,size,pblock);
-  sad = sad_calc(org_y,pblock,size,size,size,size);
-  if (sad < min_sad){
-    *intra_mode = MODE_UPUPRIGHT;
-    min_sad = sad;
+  unsigned int (*dist)(uint8_t *, uint8_t *, int, int, int, int) = satd ? satd_calc : sad_calc;
+  int num_modes = num_intra_modes == 4 ? 4 : MAX_NUM_INTRA_MODES; //TODO: generalize
+
+  int upright_available = get_upright_available(yposY-tile->ypos,xposY-tile->xpos,size,tile->width);
+  int downleft_available = get_downleft_available(yposY-tile->ypos,xposY-tile->xpos,size,tile->height);
+  make_top_and_left(left,top,&top_left,&rec->y[yposY*rec->stride_y+xposY],rec->stride_y,NULL,0,0,0,yposY-tile->ypos,xposY-tile->xpos,size,upright_available,downleft_available,0);
+
+  for (int i = 0; i < num_modes; i++) {
+    intra_mode_t mode = intra_search_order[i];
+    switch (mode) {
+    case MODE_HOR:          get_hor_pred(left,size,pblock); break;
+    case MODE_VER:          get_ver_pred(top,size,pblock); break;
+    case MODE_PLANAR:       get_planar_pred(left,top,top_left,size,pblock); break;
+    case MODE_UPLEFT:       get_upleft_pred(left,top,top_left,size,pblock); break;
+    case MODE_UPRIGHT:      get_upright_pred(top,size,pblock); break;
+    case MODE_UPUPRIGHT:    get_upupright_pred(top,size,pblock); break;
+    case MODE_UPUPLEFT:     get_upupleft_pred(left,top,top_left,size,pblock); break;
+    case MODE_UPLEFTLEFT:   get_upleftleft_pred(left,top,top_left,size,pblock); break;
+    case MODE_DOWNLEFTLEFT: get_downleftleft_pred(left,size,pblock); break;
+    default:                get_dc_pred(xposY >=0 ? left:top,yposY >= 0 ? top:left,size,pblock); break;
+    }
+    cost[mode] = dist(org_y,pblock,size,size,size,size);
   }
+  thor_free(left - 1);
+  thor_free(top - 1);
+  thor_free(pblock);
+}
 
-  get_upupleft_pred(left,top,top_left,size,pblock);
-  sad = sad_calc(org_y,pblock,size,size,size,size);
-  if (sad < min_sad){
-    *intra_mode = MODE_UPUPLEFT;
-    min_sad = sad;
-  }
+int search_intra_prediction_params(uint8_t *org_y,yuv_frame_t *rec,block_pos_t *block_pos,const tile_t *tile,int num_intra_modes,int satd,intra_mode_t *intra_mode)
+{
+  int cost[MAX_NUM_INTRA_MODES];
+  int num_modes = num_intra_modes == 4 ? 4 : MAX_NUM_INTRA_MODES;
+  int min_sad = (1<<30);
 
-  get_upleftleft_pred(left,top,top_left,size,pblock);
-  sad = sad_calc(org_y,pblock,size,size,size,size);
-  if (sad < min_sad){
-    *intra_mode = MODE_UPLEFTLEFT;
-    min_sad = sad;
-  }
+  intra_mode_costs(org_y,rec,block_pos,tile,num_intra_modes,satd,cost);
 
-  get_downleftleft_pred(left,size,pblock);
-  sad = sad_calc(org_y,pblock,size,size,size,size);
-  if (sad < min_sad){
-    *intra_mode = MODE_DOWNLEFTLEFT;
-    min_sad = sad;
+  *intra_mode = MODE_DC;
+  for (int i = 0; i < num_modes; i++) {
+    if (cost[intra_search_order[i]] < min_sad){
+      *intra_mode = intra_search_order[i];
+      min_sad = cost[intra_search_order[i]];
+    }
   }
-  thor_free(left - 1);
-  thor_free(top - 1);
-  thor_free(pblock);
   return min_sad;
 }
 
@@ -1665,19 +1728,19 @@ int encode_block(encoder_info_t *encoder_info, stream_t *stream, block_info_t *b
   if (mode==MODE_INTRA){
     intra_mode = block_param->intra_mode;
     int width = encoder_info->width;
-    int height = encoder_info->height;
-    int upright_available = get_upright_available(yposY,xposY,sizeY,width);
-    int downleft_available = get_downleft_available(yposY,xposY,sizeY,height);
+    tile_t *tile = &encoder_info->tile;
+    int upright_available = get_upright_available(yposY-tile->ypos,xposY-tile->xpos,sizeY,tile->width);
+    int downleft_available = get_downleft_available(yposY-tile->ypos,xposY-tile->xpos,sizeY,tile->height);
     uint8_t* yrec = &rec->y[yposY*rec->stride_y+xposY];
     uint8_t* urec = &rec->u[yposC*rec->stride_c+xposC];
     uint8_t* vrec = &rec->v[yposC*rec->stride_c+xposC];
 
     /* Predict, create residual, transform, quantize, and reconstruct.*/
-    cbp.y = encode_and_reconstruct_block_intra (encoder_info, org_y,sizeY,yrec,rec->stride_y,yposY,xposY,sizeY,qpY,pblock_y,coeffq_y,rec_y,((frame_type==I_FRAME)<<1)|0,
+    cbp.y = encode_and_reconstruct_block_intra (encoder_info, org_y,sizeY,yrec,rec->stride_y,yposY-tile->ypos,xposY-tile->xpos,sizeY,qpY,pblock_y,coeffq_y,rec_y,((frame_type==I_FRAME)<<1)|0,
         tb_split,encoder_info->params->rdoq,width,intra_mode,upright_available,downleft_available);
-    cbp.u = encode_and_reconstruct_block_intra (encoder_info, org_u,sizeC,urec,rec->stride_c,yposC,xposC,sizeC,qpC,pblock_u,coeffq_u,rec_u,((frame_type==I_FRAME)<<1)|1,
+    cbp.u = encode_and_reconstruct_block_intra (encoder_info, org_u,sizeC,urec,rec->stride_c,yposC-tile->ypos/2,xposC-tile->xpos/2,sizeC,qpC,pblock_u,coeffq_u,rec_u,((frame_type==I_FRAME)<<1)|1,
         tb_split&&(size>8),encoder_info->params->rdoq,width/2,intra_mode,upright_available,downleft_available);
-    cbp.v = encode_and_reconstruct_block_intra (encoder_info, org_v,sizeC,vrec,rec->stride_c,yposC,xposC,sizeC,qpC,pblock_v,coeffq_v,rec_v,((frame_type==I_FRAME)<<1)|1,
+    cbp.v = encode_and_reconstruct_block_intra (encoder_info, org_v,sizeC,vrec,rec->stride_c,yposC-tile->ypos/2,xposC-tile->xpos/2,sizeC,qpC,pblock_v,coeffq_v,rec_v,((frame_type==I_FRAME)<<1)|1,
         tb_split&&(size>8),encoder_info->params->rdoq,width/2,intra_mode,upright_available,downleft_available);
 
     if (cbp.y) memcpy(block_param->coeff_y, coeffq_y, size*size*sizeof(uint16_t));
@@ -2209,7 +2272,10 @@ int mode_decision_rdo(encoder_info_t *encoder_info,block_info_t *block_info)
   int width = encoder_info->width;
   int height = encoder_info->height;
 
-  stream_t *stream = encoder_info->stream;
+  /* The candidates are only costed, so their bits are counted rather than written */
+  stream_t estimate_stream;
+  init_estimate_stream(&estimate_stream);
+  stream_t *stream = &estimate_stream;
   int enable_bipred = encoder_info->params->enable_bipred;
 
   yuv_frame_t *rec = encoder_info->rec;
@@ -2245,10 +2311,6 @@ int mode_decision_rdo(encoder_info_t *encoder_info,block_info_t *block_info)
   uint32_t sad_inter = MAX_UINT32;
   uint32_t cost,sad;
 
-  /* Set reference bitstream position before doing anything at this block size */
-  stream_pos_t stream_pos_ref;
-  read_stream_pos(&stream_pos_ref,stream);
-
   /* FIND BEST MODE */
 
   /* Evaluate skip candidates */
@@ -2304,7 +2366,7 @@ int mode_decision_rdo(encoder_info_t *encoder_info,block_info_t *block_info)
       }
 
       if (intra_inter_sad){
-        sad_intra = search_intra_prediction_params(org_block->y,rec,&block_info->block_pos,encoder_info->width,encoder_info->height,encoder_info->frame_info.num_intra_modes,&intra_mode);      
+        sad_intra = search_intra_prediction_params(org_block->y,rec,&block_info->block_pos,&encoder_info->tile,encoder_info->frame_info.num_intra_modes,encoder_info->params->satd,&intra_mode);      
         nbits = 2;
         sad_intra += (int)(sqrt(lambda)*(double)nbits + 0.5);
       }
@@ -2326,9 +2388,19 @@ int mode_decision_rdo(encoder_info_t *encoder_info,block_info_t *block_info)
         ref = r>=0 ? encoder_info->ref[r] : encoder_info->interp_frames[0];
         tmp_block_param.ref_idx0 = ref_idx;
         tmp_block_param.ref_idx1 = ref_idx;
-        mvp = get_mv_pred(ypos,xpos,width,height,size,ref_idx,encoder_info->deblock_data);
+        mvp = get_mv_pred(ypos,xpos,width,height,size,ref_idx,encoder_info->deblock_data,&encoder_info->tile);
         add_mvcandidate(&mvp, frame_info->mvcand[ref_idx], frame_info->mvcand_num + ref_idx, frame_info->mvcand_mask + ref_idx);
         block_info->mvp = mvp;
+        if (encoder_info->mv_field[ref_idx]){
+          /* Refine from the motion pre-analysis field, sampled on a 4x4 grid for large blocks */
+          int step = max(ME_CELL_SIZE, size/4);
+          for (int i=0;i<size && ypos+i<height;i+=step){
+            for (int j=0;j<size && xpos+j<width;j+=step){
+              mv_t mvf = get_field_mv(encoder_info, ref_idx, ypos+i, xpos+j);
+              add_mvcandidate(&mvf, frame_info->mvcand[ref_idx], frame_info->mvcand_num + ref_idx, frame_info->mvcand_mask + ref_idx);
+            }
+          }
+        }
 
         int sign = ref->frame_num >= rec->frame_num;
 
@@ -2438,7 +2510,26 @@ int mode_decision_rdo(encoder_info_t *encoder_info,block_info_t *block_info)
         uint32_t min_intra_cost = MAX_UINT32;
         intra_mode_t best_intra_mode = MODE_DC;
         int num_intra_modes = frame_info->num_intra_modes;
+        int max_rdo_modes = encoder_info->params->intra_rdo_modes;
+        int rdo_mode[MAX_NUM_INTRA_MODES];
+        for (intra_mode = MODE_DC; intra_mode < num_intra_modes; intra_mode++)
+          rdo_mode[intra_mode] = 1;
+
+        /* Only the modes with the lowest prediction error go through RDO */
+        if (max_rdo_modes > 0 && max_rdo_modes < num_intra_modes) {
+          int cost[MAX_NUM_INTRA_MODES];
+          intra_mode_costs(org_block->y, rec, &block_info->block_pos, &encoder_info->tile, num_intra_modes, encoder_info->params->satd, cost);
+          for (intra_mode = MODE_DC; intra_mode < num_intra_modes; intra_mode++) {
+            int rank = 0;
+            for (int m = 0; m < num_intra_modes; m++)
+              rank += cost[m] < cost[intra_mode] || (cost[m] == cost[intra_mode] && m < (int)intra_mode);
+            rdo_mode[intra_mode] = rank < max_rdo_modes;
+          }
+        }
+
         for (intra_mode = MODE_DC; intra_mode < num_intra_modes; intra_mode++) {
+          if (!rdo_mode[intra_mode])
+            continue;
           tmp_block_param.intra_mode = intra_mode;
           for (tb_param = 0; tb_param <= max_tb_param; tb_param++) {
             tmp_block_param.tb_param = tb_param;
@@ -2454,7 +2545,7 @@ int mode_decision_rdo(encoder_info_t *encoder_info,block_info_t *block_info)
         intra_mode = best_intra_mode;
       }
       else {
-        search_intra_prediction_params(org_block->y, rec, &block_info->block_pos, encoder_info->width, encoder_info->height, frame_info->num_intra_modes, &intra_mode);
+        search_intra_prediction_params(org_block->y, rec, &block_info->block_pos, &encoder_info->tile, frame_info->num_intra_modes, encoder_info->params->satd, &intra_mode);
       }
 
       /* Do final encoding with selected intra mode */
@@ -2472,9 +2563,6 @@ int mode_decision_rdo(encoder_info_t *encoder_info,block_info_t *block_info)
     } //if do_intra
   } //if !rectangular_flag
 
-  /* Rewind bitstream to reference position */
-  write_stream_pos(stream,&stream_pos_ref);
-
   return min_cost;
 }
 
@@ -2755,6 +2843,8 @@ int search_early_skip_candidates(encoder_info_t *encoder_info,block_info_t *bloc
   yuv_block_t *rec_block = block_info->rec_block;
   double lambda = encoder_info->frame_info.lambda;
   block_param_t tmp_block_param;
+  stream_t estimate_stream;
+  init_estimate_stream(&estimate_stream);
 
   /* Loop over all skip vector candidates */
   for (skip_idx=0; skip_idx<num_skip_vec; skip_idx++){
@@ -2771,7 +2861,7 @@ int search_early_skip_candidates(encoder_info_t *encoder_info,block_info_t *bloc
       /* Calculate RD cost for this skip vector */
       early_skip_flag = 1;
       tmp_block_param.mode = MODE_SKIP;
-      nbit = encode_block(encoder_info,encoder_info->stream,block_info,&tmp_block_param);
+      nbit = encode_block(encoder_info,&estimate_stream,block_info,&tmp_block_param);
       cost = cost_calc(org_block,rec_block,size,size,size,nbit,lambda);
       if (cost < min_cost){
         min_cost = cost;
@@ -2816,7 +2906,7 @@ int process_block(encoder_info_t *encoder_info,int size,int ypos,int xpos,int qp
   yuv_block_t *rec_block = thor_alloc(sizeof(yuv_block_t),16);
   yuv_block_t *rec_block_best = thor_alloc(sizeof(yuv_block_t),16);
   block_context_t block_context;
-  find_block_contexts(ypos, xpos, height, width, size, encoder_info->deblock_data, &block_context,encoder_info->params->use_block_contexts);
+  find_block_contexts(ypos, xpos, height, width, size, encoder_info->deblock_data, &encoder_info->tile, &block_context,encoder_info->params->use_block_contexts);
 
 #if TEST_AVAILABILITY
   frame_info_t *frame_info =  &encoder_info->frame_info;
@@ -2867,12 +2957,12 @@ int process_block(encoder_info_t *encoder_info,int size,int ypos,int xpos,int qp
       /* Find motion vector predictor (mvp) and skip vector candidates (mv-skip) */
       int bipred_copy = encoder_info->frame_info.interp_ref || frame_type == P_FRAME ? 0 : 1;
       inter_pred_t skip_candidates[MAX_NUM_SKIP];
-      block_info.num_skip_vec = get_mv_skip(ypos, xpos, width, height, size, encoder_info->deblock_data, skip_candidates, bipred_copy);
+      block_info.num_skip_vec = get_mv_skip(ypos, xpos, width, height, size, encoder_info->deblock_data, &encoder_info->tile, skip_candidates, bipred_copy);
       for (int idx = 0; idx < block_info.num_skip_vec; idx++) {
         memcpy(&block_info.skip_candidates[idx], &skip_candidates[idx], sizeof(inter_pred_t));
       }
       inter_pred_t merge_candidates[MAX_NUM_SKIP];
-      block_info.num_merge_vec = get_mv_merge(ypos, xpos, width, height, size, encoder_info->deblock_data, merge_candidates);
+      block_info.num_merge_vec = get_mv_merge(ypos, xpos, width, height, size, encoder_info->deblock_data, &encoder_info->tile, merge_candidates);
       for (int idx = 0; idx < block_info.num_merge_vec; idx++) {
         memcpy(&block_info.merge_candidates[idx], &merge_candidates[idx], sizeof(inter_pred_t));
       }
@@ -2880,9 +2970,6 @@ int process_block(encoder_info_t *encoder_info,int size,int ypos,int xpos,int qp
   }
 
   if (encode_this_size){
-    YPOS = ypos;
-    XPOS = xpos;
-
     if (encoder_info->frame_info.frame_type != I_FRAME && encoder_info->params->early_skip_thr > 0.0){
 
       /* Search through all skip candidates for early skip */
@@ -2890,8 +2977,6 @@ int process_block(encoder_info_t *encoder_info,int size,int ypos,int xpos,int qp
 
       early_skip_flag = search_early_skip_candidates(encoder_info,&block_info);
 
-      /* Revind stream to start position of this block size */
-      write_stream_pos(stream,&stream_pos_ref);
       if (early_skip_flag){
 
         /* Encode block with final choice of skip_idx */
@@ -2946,8 +3031,6 @@ int process_block(encoder_info_t *encoder_info,int size,int ypos,int xpos,int qp
   }
 
   if (encode_this_size){
-    YPOS = ypos;
-    XPOS = xpos;
 #if TEST_AVAILABILITY
     int ur = get_upright_available(ypos,xpos,size,width);
     int dl = get_downleft_available(ypos,xpos,size,height);
@@ -3002,9 +3085,6 @@ int process_block(encoder_info_t *encoder_info,int size,int ypos,int xpos,int qp
   }
   else if (encode_rectangular_size){
 
-    YPOS = ypos;
-    XPOS = xpos;
-
     /* Find best skip_idx */
     block_info.final_encode = 0;
     cost = mode_decision_rdo(encoder_info,&block_info);
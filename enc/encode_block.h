@@ -27,6 +27,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #if !defined(_ENCODE_BLOCK_H_)
 #define _ENCODE_BLOCK_H_
 
+int motion_estimate(uint8_t *orig, uint8_t *ref, int size, int stride_r, int width, int height, mv_t *mv, mv_t *mvc, mv_t *mvp, double lambda,enc_params *params, int sign, int fwidth, int fheight, int xpos, int ypos, mv_t *mvcand, int *mvcand_num, int enable_bipred);
 int process_block(encoder_info_t *encoder_info,int size,int yposY,int xposY, int qp);
 void detect_clpf(const uint8_t *rec,const uint8_t *org,int x0, int y0,int width, int height, int so,int stride, int *sum0, int *sum1);
 
@@ -25,6 +25,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include "global.h"
+#include <stdlib.h>
 #include <string.h>
 
 #include "mainenc.h"
@@ -32,6 +33,9 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "common_block.h"
 #include "common_frame.h"
 #include "enc_kernels.h"
+#include "me_analysis.h"
+#include "row_filter.h"
+#include "thread.h"
 
 extern int chroma_qp[52];
 const double squared_lambda_QP [52] = {
@@ -55,13 +59,451 @@ static int clpf_decision(int k, int l, yuv_frame_t *rec, yuv_frame_t *org, const
       int ypos = k*MAX_BLOCK_SIZE + m*block_size;
       int index = (ypos/MIN_PB_SIZE)*(rec->width/MIN_PB_SIZE) + (xpos/MIN_PB_SIZE);
       if (deblock_data[index].cbp.y && deblock_data[index].mode != MODE_BIPRED)
-        (use_simd ? detect_clpf_simd : detect_clpf)(rec->y,org->y,xpos,ypos,rec->width,rec->height,org->stride_y,rec->stride_y,&sum0,&sum1);
+        enc_kernels->detect_clpf(rec->y,org->y,xpos,ypos,rec->width,rec->height,org->stride_y,rec->stride_y,&sum0,&sum1);
     }
   }
   putbits(1, sum1 < sum0, (stream_t*)stream);
   return sum1 < sum0;
 }
 
+/* Parallel delta QP search, used with qp_threads > 1. Every candidate QP of a
+   superblock is encoded on a cloned context with its own bitstream,
+   reconstruction and deblock_data, so the candidates do not depend on each
+   other and can be evaluated in parallel. Before the search the area around
+   the superblock that is used for prediction is copied into each clone. The
+   reconstruction, deblock_data and bits of the cheapest candidate are then
+   copied back, which replaces the final encode with the best QP. The
+   worker threads are started once per context by create_qp_search() and
+   wait for the candidates of each superblock.
+   Each candidate starts from the mvcand/best_ref state at the start of the
+   superblock, while the serial search lets every candidate inherit the state
+   left by the ones before it, so the two give different bitstreams. */
+typedef struct
+{
+  encoder_info_t encoder_info;
+  stream_t stream;
+  yuv_frame_t rec;
+  deblock_data_t *deblock_data;
+  int qp;
+  int cost;
+} qp_candidate_t;
+
+struct qp_search_t
+{
+  qp_candidate_t *cand;
+  int num_cand;
+  int next_cand;         //Next candidate to be encoded
+  int cand_done;         //Number of candidates encoded for this superblock
+  int ypos;
+  int xpos;
+  int num_threads;       //Worker threads, the caller is not included
+  int quit;
+  thor_thread_t threads[MAX_THREADS];
+  thor_mutex_t mutex;
+  thor_cond_t cond;
+};
+
+/* Encode the candidates of the current superblock until none are left to
+   start. Called with the mutex held. */
+static void encode_candidates(qp_search_t *qs)
+{
+  while (qs->next_cand < qs->num_cand){
+    qp_candidate_t *qc = &qs->cand[qs->next_cand++];
+    thor_mutex_unlock(&qs->mutex);
+    qc->cost = process_block(&qc->encoder_info,MAX_BLOCK_SIZE,qs->ypos,qs->xpos,qc->qp);
+    thor_mutex_lock(&qs->mutex);
+    if (++qs->cand_done == qs->num_cand)
+      thor_cond_broadcast(&qs->cond);
+  }
+}
+
+static void *qp_search_worker(void *arg)
+{
+  qp_search_t *qs = (qp_search_t*)arg;
+
+  thor_mutex_lock(&qs->mutex);
+  while (1){
+    encode_candidates(qs);
+    if (qs->quit)
+      break;
+    thor_cond_wait(&qs->cond, &qs->mutex);
+  }
+  thor_mutex_unlock(&qs->mutex);
+  return NULL;
+}
+
+static qp_search_t *create_qp_search(encoder_info_t *encoder_info)
+{
+  enc_params *params = encoder_info->params;
+  int width = encoder_info->width;
+  int height = encoder_info->height;
+  qp_search_t *qs = (qp_search_t*)malloc(sizeof(qp_search_t));
+  if (qs == NULL)
+    fatalerror("Memory allocation failed.");
+
+  qs->num_cand = 2*params->max_delta_qp/params->delta_qp_step + 1;
+  qs->cand = (qp_candidate_t*)malloc(qs->num_cand * sizeof(qp_candidate_t));
+  if (qs->cand == NULL)
+    fatalerror("Memory allocation failed.");
+  for (int c=0;c<qs->num_cand;c++){
+    qp_candidate_t *qc = &qs->cand[c];
+    init_stream(&qc->stream, MAX_SB_BUFFER_SIZE);
+    qc->deblock_data = (deblock_data_t*)malloc((height/MIN_PB_SIZE) * (width/MIN_PB_SIZE) * sizeof(deblock_data_t));
+    if (qc->deblock_data == NULL)
+      fatalerror("Memory allocation failed.");
+    create_yuv_frame(&qc->rec,width,height,0,0,0,0);
+  }
+  qs->next_cand = qs->num_cand;
+  qs->cand_done = qs->num_cand;
+  qs->quit = 0;
+  thor_mutex_init(&qs->mutex);
+  thor_cond_init(&qs->cond);
+  qs->num_threads = min(min(params->qp_threads, qs->num_cand), MAX_THREADS) - 1;
+  for (int t=0;t<qs->num_threads;t++)
+    thor_thread_create(&qs->threads[t], qp_search_worker, qs);
+  return qs;
+}
+
+static void close_qp_search(qp_search_t *qs)
+{
+  thor_mutex_lock(&qs->mutex);
+  qs->quit = 1;
+  thor_cond_broadcast(&qs->cond);
+  thor_mutex_unlock(&qs->mutex);
+  for (int t=0;t<qs->num_threads;t++)
+    thor_thread_join(qs->threads[t]);
+
+  for (int c=0;c<qs->num_cand;c++){
+    free_stream(&qs->cand[c].stream);
+    free(qs->cand[c].deblock_data);
+    close_yuv_frame(&qs->cand[c].rec);
+  }
+  thor_mutex_destroy(&qs->mutex);
+  thor_cond_destroy(&qs->cond);
+  free(qs->cand);
+  free(qs);
+}
+
+/* Copy the rectangle [ypos,ypos+h) x [xpos,xpos+w) (in luma samples) of the
+   reconstruction and deblock_data from one context to another */
+static void copy_area(encoder_info_t *dst, encoder_info_t *src, int ypos, int xpos, int h, int w)
+{
+  int i;
+  int dbstride = src->width/MIN_PB_SIZE;
+  for (i=ypos;i<ypos+h;i++)
+    memcpy(dst->rec->y + i*dst->rec->stride_y + xpos, src->rec->y + i*src->rec->stride_y + xpos, w);
+  for (i=ypos/2;i<(ypos+h)/2;i++){
+    memcpy(dst->rec->u + i*dst->rec->stride_c + xpos/2, src->rec->u + i*src->rec->stride_c + xpos/2, w/2);
+    memcpy(dst->rec->v + i*dst->rec->stride_c + xpos/2, src->rec->v + i*src->rec->stride_c + xpos/2, w/2);
+  }
+  for (i=ypos/MIN_PB_SIZE;i<(ypos+h)/MIN_PB_SIZE;i++)
+    memcpy(dst->deblock_data + i*dbstride + xpos/MIN_PB_SIZE, src->deblock_data + i*dbstride + xpos/MIN_PB_SIZE, w/MIN_PB_SIZE*sizeof(deblock_data_t));
+}
+
+static void search_delta_qp_parallel(encoder_info_t *encoder_info, int ypos, int xpos)
+{
+  qp_search_t *qs = encoder_info->qp_search;
+  tile_t *tile = &encoder_info->tile;
+  int c;
+
+  /* Area used for prediction: the superblock itself, the row above it up to
+     the end of the above-right superblock and the column to the left of it */
+  int y0 = max(ypos - MIN_PB_SIZE, tile->ypos);
+  int x0 = max(xpos - MIN_PB_SIZE, tile->xpos);
+  int y1 = min(ypos + MAX_BLOCK_SIZE, tile->ypos + tile->height);
+  int x1 = min(xpos + 2*MAX_BLOCK_SIZE, tile->xpos + tile->width);
+
+  /* The workers are idle until next_cand is reset below */
+  for (c=0;c<qs->num_cand;c++){
+    qp_candidate_t *qc = &qs->cand[c];
+    qc->encoder_info = *encoder_info;
+    qc->encoder_info.stream = &qc->stream;
+    qc->encoder_info.rec = &qc->rec;
+    qc->rec.frame_num = encoder_info->rec->frame_num;
+    qc->encoder_info.deblock_data = qc->deblock_data;
+    reset_stream(&qc->stream);
+    qc->qp = encoder_info->frame_info.qp - encoder_info->params->max_delta_qp + c*encoder_info->params->delta_qp_step;
+    copy_area(&qc->encoder_info, encoder_info, y0, x0, y1-y0, x1-x0);
+  }
+
+  thor_mutex_lock(&qs->mutex);
+  qs->ypos = ypos;
+  qs->xpos = xpos;
+  qs->next_cand = 0;
+  qs->cand_done = 0;
+  thor_cond_broadcast(&qs->cond);
+  encode_candidates(qs);
+  while (qs->cand_done < qs->num_cand)
+    thor_cond_wait(&qs->cond, &qs->mutex);
+  thor_mutex_unlock(&qs->mutex);
+
+  /* Commit the candidate with the lowest cost, the first one on ties */
+  qp_candidate_t *best = &qs->cand[0];
+  for (c=1;c<qs->num_cand;c++){
+    if (qs->cand[c].cost < best->cost)
+      best = &qs->cand[c];
+  }
+  copy_area(encoder_info, &best->encoder_info, ypos, xpos,
+            min(MAX_BLOCK_SIZE, encoder_info->height - ypos), min(MAX_BLOCK_SIZE, encoder_info->width - xpos));
+  encoder_info->frame_info = best->encoder_info.frame_info;
+  append_stream(encoder_info->stream, &best->stream);
+}
+
+static void search_delta_qp(encoder_info_t *encoder_info, int ypos, int xpos)
+{
+  stream_t *stream = encoder_info->stream;
+  int qp = encoder_info->frame_info.qp;
+  int max_delta_qp = encoder_info->params->max_delta_qp;
+  int cost,min_cost,best_qp,qp0;
+  stream_pos_t stream_pos_ref;
+
+  if (encoder_info->qp_search){
+    search_delta_qp_parallel(encoder_info, ypos, xpos);
+    return;
+  }
+
+  min_cost = 1<<30;
+  read_stream_pos(&stream_pos_ref,stream);
+  best_qp = qp;
+  for (qp0=qp-max_delta_qp;qp0<=qp+max_delta_qp;qp0+=encoder_info->params->delta_qp_step){
+    cost = process_block(encoder_info,MAX_BLOCK_SIZE,ypos,xpos,qp0);
+    if (cost < min_cost){
+      min_cost = cost;
+      best_qp = qp0;
+    }
+  }
+  write_stream_pos(stream,&stream_pos_ref);
+  process_block(encoder_info,MAX_BLOCK_SIZE,ypos,xpos,best_qp);
+}
+
+static void encode_superblock(encoder_info_t *encoder_info, int k, int l)
+{
+  frame_info_t *frame_info = &(encoder_info->frame_info);
+  uint8_t qp = frame_info->qp;
+  int xposY = l*MAX_BLOCK_SIZE;
+  int yposY = k*MAX_BLOCK_SIZE;
+
+  for (int ref_idx = 0; ref_idx <= frame_info->num_ref - 1; ref_idx++){
+    frame_info->mvcand_num[ref_idx] = 0;
+    frame_info->mvcand_mask[ref_idx] = 0;
+  }
+  frame_info->best_ref = -1;
+
+  if (encoder_info->params->max_delta_qp){
+    /* RDO-based search for best QP value */
+    search_delta_qp(encoder_info, yposY, xposY);
+  }
+  else{
+    process_block(encoder_info,MAX_BLOCK_SIZE,yposY,xposY,qp);
+  }
+  if (encoder_info->row_filter)
+    row_filter_sb_done(encoder_info->row_filter, k);
+}
+
+/* Wavefront parallel processing of superblock rows. Superblock (k,l) can be
+   encoded once (k-1,l+1) is done, since that is the furthest neighbour used for
+   prediction and for motion vector candidates. Each worker encodes whole rows
+   with a private copy of encoder_info (frame_info holds the per-superblock
+   mvcand/best_ref state) and a private bitstream. The rows are appended to the
+   frame bitstream in raster order, so the output is identical to the
+   single-threaded encoder. */
+typedef struct
+{
+  encoder_info_t *encoder_info;
+  int num_sb_hor;
+  int num_sb_ver;
+  int next_row;          //Next superblock row to be encoded
+  int rows_written;      //Number of superblock rows appended to the frame bitstream
+  int *sb_done;          //Number of encoded superblocks per row
+  thor_mutex_t mutex;
+  thor_cond_t cond;
+} wavefront_t;
+
+typedef struct
+{
+  wavefront_t *wf;
+  stream_t stream;
+} wavefront_worker_t;
+
+static void *wavefront_worker(void *arg)
+{
+  wavefront_worker_t *worker = (wavefront_worker_t*)arg;
+  wavefront_t *wf = worker->wf;
+  encoder_info_t encoder_info = *wf->encoder_info;
+  encoder_info.stream = &worker->stream;
+  if (encoder_info.params->max_delta_qp && encoder_info.params->qp_threads > 1)
+    encoder_info.qp_search = create_qp_search(&encoder_info);
+
+  while (1){
+    thor_mutex_lock(&wf->mutex);
+    int k = wf->next_row++;
+    thor_mutex_unlock(&wf->mutex);
+    if (k >= wf->num_sb_ver)
+      break;
+
+    reset_stream(&worker->stream);
+
+    for (int l=0;l<wf->num_sb_hor;l++){
+      if (k > 0){
+        int above = min(l+2, wf->num_sb_hor);
+        thor_mutex_lock(&wf->mutex);
+        while (wf->sb_done[k-1] < above)
+          thor_cond_wait(&wf->cond, &wf->mutex);
+        thor_mutex_unlock(&wf->mutex);
+      }
+      encode_superblock(&encoder_info, k, l);
+      thor_mutex_lock(&wf->mutex);
+      wf->sb_done[k] = l+1;
+      thor_cond_broadcast(&wf->cond);
+      thor_mutex_unlock(&wf->mutex);
+    }
+
+    thor_mutex_lock(&wf->mutex);
+    while (wf->rows_written < k)
+      thor_cond_wait(&wf->cond, &wf->mutex);
+    thor_mutex_unlock(&wf->mutex);
+
+    append_stream(wf->encoder_info->stream, &worker->stream);
+
+    thor_mutex_lock(&wf->mutex);
+    wf->rows_written++;
+    thor_cond_broadcast(&wf->cond);
+    thor_mutex_unlock(&wf->mutex);
+  }
+  if (encoder_info.qp_search)
+    close_qp_search(encoder_info.qp_search);
+  return NULL;
+}
+
+static void encode_superblocks_wavefront(encoder_info_t *encoder_info, int num_sb_hor, int num_sb_ver)
+{
+  int num_threads = min(encoder_info->params->threads, num_sb_ver);
+  thor_thread_t threads[MAX_THREADS];
+  wavefront_worker_t workers[MAX_THREADS];
+  wavefront_t wf;
+  int t;
+
+  wf.encoder_info = encoder_info;
+  wf.num_sb_hor = num_sb_hor;
+  wf.num_sb_ver = num_sb_ver;
+  wf.next_row = 0;
+  wf.rows_written = 0;
+  wf.sb_done = (int*)calloc(num_sb_ver, sizeof(int));
+  if (wf.sb_done == NULL)
+    fatalerror("Memory allocation failed.");
+  thor_mutex_init(&wf.mutex);
+  thor_cond_init(&wf.cond);
+
+  for (t=0;t<num_threads;t++){
+    workers[t].wf = &wf;
+    init_stream(&workers[t].stream, MAX_BUFFER_SIZE);
+    thor_thread_create(&threads[t], wavefront_worker, &workers[t]);
+  }
+  for (t=0;t<num_threads;t++){
+    thor_thread_join(threads[t]);
+    free_stream(&workers[t].stream);
+  }
+
+  thor_cond_destroy(&wf.cond);
+  thor_mutex_destroy(&wf.mutex);
+  free(wf.sb_done);
+}
+
+/* Tiles. Each tile is coded into its own byte-aligned substream, with the
+   neighbours outside the tile treated as unavailable, so the tiles of a frame
+   can be encoded and decoded in parallel. The substreams are written to the
+   frame bitstream in raster order, each preceded by its size in bytes. */
+typedef struct
+{
+  encoder_info_t *encoder_info;
+  stream_t *streams;
+  int num_tiles;
+  int next_tile;         //Next tile to be encoded
+  thor_mutex_t mutex;
+} tile_pool_t;
+
+static void encode_tile(encoder_info_t *encoder_info, int tile_idx, stream_t *stream)
+{
+  enc_params *params = encoder_info->params;
+  tile_t *tile = &encoder_info->tile;
+  int k,l;
+
+  get_tile(tile, encoder_info->width, encoder_info->height, params->tile_rows, params->tile_cols,
+           tile_idx/params->tile_cols, tile_idx%params->tile_cols);
+  encoder_info->stream = stream;
+  reset_stream(stream);
+
+  for (k=tile->ypos/MAX_BLOCK_SIZE;k*MAX_BLOCK_SIZE<tile->ypos+tile->height;k++){
+    for (l=tile->xpos/MAX_BLOCK_SIZE;l*MAX_BLOCK_SIZE<tile->xpos+tile->width;l++){
+      encode_superblock(encoder_info, k, l);
+    }
+  }
+  putbits(stream->bitrest%8, 0, stream);
+}
+
+static void *tile_worker(void *arg)
+{
+  tile_pool_t *tp = (tile_pool_t*)arg;
+  encoder_info_t encoder_info = *tp->encoder_info;
+  if (encoder_info.params->max_delta_qp && encoder_info.params->qp_threads > 1)
+    encoder_info.qp_search = create_qp_search(&encoder_info);
+
+  while (1){
+    thor_mutex_lock(&tp->mutex);
+    int t = tp->next_tile++;
+    thor_mutex_unlock(&tp->mutex);
+    if (t >= tp->num_tiles)
+      break;
+    encode_tile(&encoder_info, t, &tp->streams[t]);
+  }
+  if (encoder_info.qp_search)
+    close_qp_search(encoder_info.qp_search);
+  return NULL;
+}
+
+static void encode_tiles(encoder_info_t *encoder_info)
+{
+  enc_params *params = encoder_info->params;
+  stream_t *stream = encoder_info->stream;
+  int num_tiles = params->tile_cols*params->tile_rows;
+  int num_threads = min(params->threads, num_tiles);
+  thor_thread_t threads[MAX_THREADS];
+  tile_pool_t tp;
+  int t;
+
+  tp.encoder_info = encoder_info;
+  tp.num_tiles = num_tiles;
+  tp.next_tile = 0;
+  tp.streams = (stream_t*)malloc(num_tiles * sizeof(stream_t));
+  if (tp.streams == NULL)
+    fatalerror("Memory allocation failed.");
+  for (t=0;t<num_tiles;t++){
+    init_stream(&tp.streams[t], MAX_BUFFER_SIZE);
+  }
+  thor_mutex_init(&tp.mutex);
+
+  if (num_threads > 1){
+    for (t=0;t<num_threads;t++)
+      thor_thread_create(&threads[t], tile_worker, &tp);
+    for (t=0;t<num_threads;t++)
+      thor_thread_join(threads[t]);
+  }
+  else{
+    tile_worker(&tp);
+  }
+
+  /* Tile substreams start at a byte boundary */
+  putbits(stream->bitrest%8, 0, stream);
+  for (t=0;t<num_tiles;t++){
+    putbits(32, get_bit_pos(&tp.streams[t])/8, stream);
+    append_stream(stream, &tp.streams[t]);
+    free_stream(&tp.streams[t]);
+  }
+
+  thor_mutex_destroy(&tp.mutex);
+  free(tp.streams);
+}
+
 void encode_frame(encoder_info_t *encoder_info)
 {
   int k,l;
@@ -93,6 +535,9 @@ void encode_frame(encoder_info_t *encoder_info)
   }
   frame_info->lambda = lambda_coeff*squared_lambda_QP[frame_info->qp];
 
+  if (encoder_info->params->me_analysis && frame_info->frame_type != I_FRAME)
+    analyse_motion_field(encoder_info);
+
   putbits(1,encoder_info->frame_info.frame_type!=I_FRAME,stream);
   uint8_t qp = encoder_info->frame_info.qp;
   putbits(8,(int)qp,stream);
@@ -109,42 +554,50 @@ void encode_frame(encoder_info_t *encoder_info)
   // 16 bit frame number for now
   putbits(16,encoder_info->frame_info.frame_num,stream);
 
-  for (k=0;k<num_sb_ver;k++){
-    for (l=0;l<num_sb_hor;l++){
-      int xposY = l*MAX_BLOCK_SIZE;
-      int yposY = k*MAX_BLOCK_SIZE;
+  /* Deblocking, CLPF and padding of finished superblock rows on a helper
+     thread. The CLPF flags of the superblocks are collected in a separate
+     bitstream that is appended after the last superblock. */
+  int sb_signal = 1;
+  stream_t clpf_stream;
+  if (encoder_info->params->filter_thread){
+    init_stream(&clpf_stream, num_sb_hor*num_sb_ver/8 + 16);
+    encoder_info->row_filter = create_row_filter(encoder_info->rec, encoder_info->orig, encoder_info->ref_out, encoder_info->deblock_data,
+                                                 encoder_info->params->deblocking, qp, chroma_qp[qp],
+                                                 encoder_info->params->clpf ? (sb_signal ? clpf_decision : clpf_true) : NULL, &clpf_stream,
+                                                 NULL, NULL);
+  }
 
-      for (int ref_idx = 0; ref_idx <= frame_info->num_ref - 1; ref_idx++){
-        frame_info->mvcand_num[ref_idx] = 0;
-        frame_info->mvcand_mask[ref_idx] = 0;
-      }
-      frame_info->best_ref = -1;
-
-      int max_delta_qp = encoder_info->params->max_delta_qp;
-      if (max_delta_qp){
-        /* RDO-based search for best QP value */
-        int cost,min_cost,best_qp,qp0,max_delta_qp,min_qp,max_qp;
-        max_delta_qp = encoder_info->params->max_delta_qp;
-        min_cost = 1<<30;
-        stream_pos_t stream_pos_ref;
-        read_stream_pos(&stream_pos_ref,stream);
-        best_qp = qp;
-        min_qp = qp-max_delta_qp;
-        max_qp = qp+max_delta_qp;
-        for (qp0=min_qp;qp0<=max_qp;qp0+=encoder_info->params->delta_qp_step){
-          cost = process_block(encoder_info,MAX_BLOCK_SIZE,yposY,xposY,qp0);
-          if (cost < min_cost){
-            min_cost = cost;
-            best_qp = qp0;
-          }
-        }
-        write_stream_pos(stream,&stream_pos_ref);
-        process_block(encoder_info,MAX_BLOCK_SIZE,yposY,xposY,best_qp);
-      }
-      else{
-        process_block(encoder_info,MAX_BLOCK_SIZE,yposY,xposY,qp);
+  if (encoder_info->params->tile_cols*encoder_info->params->tile_rows > 1){
+    encode_tiles(encoder_info);
+  }
+  else if (encoder_info->params->threads > 1 && num_sb_ver > 1){
+    encode_superblocks_wavefront(encoder_info, num_sb_hor, num_sb_ver);
+  }
+  else{
+    if (encoder_info->params->max_delta_qp && encoder_info->params->qp_threads > 1)
+      encoder_info->qp_search = create_qp_search(encoder_info);
+    for (k=0;k<num_sb_ver;k++){
+      for (l=0;l<num_sb_hor;l++){
+        encode_superblock(encoder_info, k, l);
       }
     }
+    if (encoder_info->qp_search){
+      close_qp_search(encoder_info->qp_search);
+      encoder_info->qp_search = NULL;
+    }
+  }
+  close_motion_field(encoder_info);
+
+  if (encoder_info->row_filter){
+    close_row_filter(encoder_info->row_filter);
+    encoder_info->row_filter = NULL;
+    if (encoder_info->params->clpf){
+      putbits(1, 1, stream);
+      putbits(1, !sb_signal, stream);
+      append_stream(stream, &clpf_stream);
+    }
+    free_stream(&clpf_stream);
+    return;
   }
 
   if (encoder_info->params->deblocking){
@@ -153,8 +606,6 @@ void encode_frame(encoder_info_t *encoder_info)
     deblock_frame_uv(encoder_info->rec, encoder_info->deblock_data, width, height, qpc);
   }
 
-  int sb_signal = 1;
-
   if (encoder_info->params->clpf){
     putbits(1, 1, stream);
     putbits(1, !sb_signal, stream);
@@ -162,33 +613,9 @@ void encode_frame(encoder_info_t *encoder_info)
                sb_signal ? clpf_decision : clpf_true);
   }
 
-  /* Sliding window operation for reference frame buffer by circular buffer */
-
-  /* Store pointer to reference frame that is shifted out of reference buffer */
-  yuv_frame_t *tmp = encoder_info->ref[MAX_REF_FRAMES-1];
-
-  /* Update remaining pointers to implement sliding window reference buffer operation */
-  memmove(encoder_info->ref+1, encoder_info->ref, sizeof(yuv_frame_t*)*(MAX_REF_FRAMES-1));
-
-  /* Set ref[0] to the memory slot where the new current reconstructed frame wil replace reference frame being shifted out */
-  encoder_info->ref[0] = tmp;
-
-  /* Pad the reconstructed frame and write into ref[0] */
-  create_reference_frame(encoder_info->ref[0],encoder_info->rec);
-
-#if 0
-  /* To test sliding window operation */
-  int offsetx = 500;
-  int offsety = 200;
-  int offset_rec = offsety * encoder_info->rec->stride_y +  offsetx;
-  int offset_ref = offsety * encoder_info->ref[0]->stride_y +  offsetx;
-  printf("rec: %3d ",encoder_info->rec->y[offset_rec]);
-  printf("ref: ");
-  for (r=0;r<MAX_REF_FRAMES;r++){
-    printf("%3d ",encoder_info->ref[r]->y[offset_ref]);
-  }
-#endif
-
+  /* Pad the reconstructed frame and write into its reference buffer slot.
+     The frame number of the slot was set by frame_pool_submit(), since
+     other frames may be reading it. */
+  if (encoder_info->ref_out)
+    create_reference_rows(encoder_info->ref_out, encoder_info->rec, 0, height);
 }
-
-
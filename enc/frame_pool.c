@@ -0,0 +1,298 @@
+/*
+Copyright (c) 2015, Cisco Systems
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "global.h"
+#include "frame_pool.h"
+#include "encode_frame.h"
+#include "common_frame.h"
+#include "temporal_interp.h"
+
+/* Frames are submitted in coding order. A submitted frame is encoded by the
+   first idle worker once every reference buffer slot it reads from has been
+   reconstructed, so frames at the same level of a hierarchical GOP are
+   encoded concurrently. Finished frames are retired in coding order. */
+
+static int ref_slot_index(frame_pool_t *pool, yuv_frame_t *frame)
+{
+  return (int)(frame - pool->ref_base);
+}
+
+static int job_ready(frame_pool_t *pool, frame_job_t *job)
+{
+  for (int i=0;i<job->num_deps;i++){
+    if (!pool->ref_ready[job->deps[i]])
+      return 0;
+  }
+  return 1;
+}
+
+static void run_job(frame_job_t *job)
+{
+  encoder_info_t *encoder_info = &job->encoder_info;
+
+  if (encoder_info->frame_info.interp_ref){
+    /* Interpolate the two reference frames to make a new reference frame */
+    interpolate_frames(encoder_info->interp_frames[0], job->interp_src[0], job->interp_src[1], job->interp_ratio, job->interp_pos, encoder_info->params->threads);
+    pad_yuv_frame(encoder_info->interp_frames[0]);
+    encoder_info->interp_frames[0]->frame_num = encoder_info->frame_info.frame_num;
+  }
+
+  reset_stream(&job->stream);
+  /* The reconstructed frame is padded and written into its reference buffer slot by encode_frame */
+  encoder_info->ref_out = job->ref_slot;
+  encode_frame(encoder_info);
+}
+
+static void complete_job(frame_pool_t *pool, frame_job_t *job)
+{
+  for (int i=0;i<job->num_deps;i++){
+    pool->ref_users[job->deps[i]]--;
+  }
+  pool->ref_ready[ref_slot_index(pool, job->ref_slot)] = 1;
+  job->state = JOB_DONE;
+  thor_cond_broadcast(&pool->cond);
+}
+
+static void *frame_worker(void *arg)
+{
+  frame_pool_t *pool = (frame_pool_t*)arg;
+
+  thor_mutex_lock(&pool->mutex);
+  while (1){
+    frame_job_t *job = NULL;
+    for (int i=0;i<pool->count;i++){
+      frame_job_t *j = &pool->jobs[(pool->head+i)%pool->num_jobs];
+      if (j->state == JOB_QUEUED && job_ready(pool, j)){
+        job = j;
+        break;
+      }
+    }
+    if (job == NULL){
+      if (pool->quit)
+        break;
+      thor_cond_wait(&pool->cond, &pool->mutex);
+      continue;
+    }
+    job->state = JOB_RUNNING;
+    thor_mutex_unlock(&pool->mutex);
+    run_job(job);
+    thor_mutex_lock(&pool->mutex);
+    complete_job(pool, job);
+  }
+  thor_mutex_unlock(&pool->mutex);
+  return NULL;
+}
+
+void frame_pool_init(frame_pool_t *pool, encoder_info_t *encoder_info, yuv_frame_t *ref_base, int num_threads)
+{
+  int width = encoder_info->width;
+  int height = encoder_info->height;
+
+  pool->num_threads = num_threads > 1 ? num_threads : 0;
+  pool->num_jobs = num_threads > 1 ? min(2*num_threads, MAX_FRAME_JOBS) : 1;
+  pool->head = 0;
+  pool->count = 0;
+  pool->flushing = 0;
+  pool->quit = 0;
+  pool->ref_base = ref_base;
+  for (int r=0;r<MAX_REF_FRAMES;r++){
+    pool->ref_ready[r] = 1;
+    pool->ref_users[r] = 0;
+  }
+
+  for (int i=0;i<pool->num_jobs;i++){
+    frame_job_t *job = &pool->jobs[i];
+    job->encoder_info = *encoder_info;
+    job->state = JOB_FREE;
+
+    create_yuv_frame(&job->orig,width,height,0,0,0,0);
+    job->encoder_info.orig = &job->orig;
+
+    init_stream(&job->stream, MAX_BUFFER_SIZE);
+    job->encoder_info.stream = &job->stream;
+
+    job->encoder_info.deblock_data = (deblock_data_t *)malloc((height/MIN_PB_SIZE) * (width/MIN_PB_SIZE) * sizeof(deblock_data_t));
+    if (job->encoder_info.deblock_data == NULL)
+      fatalerror("Memory allocation failed.");
+
+    for (int r=0;r<MAX_SKIP_FRAMES;r++){
+      job->encoder_info.interp_frames[r] = NULL;
+    }
+    if (encoder_info->params->interp_ref){
+      job->encoder_info.interp_frames[0] = malloc(sizeof(yuv_frame_t));
+      create_yuv_frame(job->encoder_info.interp_frames[0],width,height,PADDING_Y,PADDING_Y,PADDING_Y/2,PADDING_Y/2);
+    }
+  }
+
+  thor_mutex_init(&pool->mutex);
+  thor_cond_init(&pool->cond);
+  for (int t=0;t<pool->num_threads;t++){
+    thor_thread_create(&pool->threads[t], frame_worker, pool);
+  }
+}
+
+void frame_pool_close(frame_pool_t *pool)
+{
+  thor_mutex_lock(&pool->mutex);
+  pool->quit = 1;
+  thor_cond_broadcast(&pool->cond);
+  thor_mutex_unlock(&pool->mutex);
+  for (int t=0;t<pool->num_threads;t++){
+    thor_thread_join(pool->threads[t]);
+  }
+  thor_cond_destroy(&pool->cond);
+  thor_mutex_destroy(&pool->mutex);
+
+  for (int i=0;i<pool->num_jobs;i++){
+    frame_job_t *job = &pool->jobs[i];
+    close_yuv_frame(&job->orig);
+    free_stream(&job->stream);
+    free(job->encoder_info.deblock_data);
+    if (job->encoder_info.interp_frames[0]){
+      close_yuv_frame(job->encoder_info.interp_frames[0]);
+      free(job->encoder_info.interp_frames[0]);
+    }
+  }
+}
+
+/* Return the job to use for the next frame in coding order. If all jobs are
+   in flight, wait until the oldest one is released if wait is 1, otherwise
+   return NULL so that the caller can retire it. */
+frame_job_t *frame_pool_next_job(frame_pool_t *pool, int wait)
+{
+  frame_job_t *job = NULL;
+  thor_mutex_lock(&pool->mutex);
+  while (wait && pool->count == pool->num_jobs)
+    thor_cond_wait(&pool->cond, &pool->mutex);
+  if (pool->count < pool->num_jobs)
+    job = &pool->jobs[(pool->head+pool->count)%pool->num_jobs];
+  thor_mutex_unlock(&pool->mutex);
+  return job;
+}
+
+/* Submit a frame set up in encoder_info. The reference buffer window of
+   encoder_info is advanced immediately so that the next frame can be set up
+   before this one has been encoded. */
+void frame_pool_submit(frame_pool_t *pool, frame_job_t *job, encoder_info_t *encoder_info)
+{
+  frame_info_t *frame_info = &encoder_info->frame_info;
+  yuv_frame_t **ref = encoder_info->ref;
+
+  job->encoder_info.frame_info = *frame_info;
+  job->encoder_info.rec = encoder_info->rec;
+  memcpy(job->encoder_info.ref, ref, sizeof(job->encoder_info.ref));
+  for (int r=0;r<MAX_REF_FRAMES;r++){
+    job->ref_frame_num[r] = ref[r]->frame_num;
+  }
+
+  /* Store pointer to reference frame that is shifted out of reference buffer */
+  yuv_frame_t *tmp = ref[MAX_REF_FRAMES-1];
+  int slot = ref_slot_index(pool, tmp);
+
+  /* Slots read by this frame. The slot being shifted out is only overwritten
+     by this frame itself once it has been encoded. */
+  job->num_deps = 0;
+  for (int r=0;r<frame_info->num_ref;r++){
+    if (frame_info->ref_array[r] >= 0 && ref[frame_info->ref_array[r]] != tmp)
+      job->deps[job->num_deps++] = ref_slot_index(pool, ref[frame_info->ref_array[r]]);
+  }
+  if (frame_info->interp_ref){
+    for (int i=0;i<2;i++){
+      if (job->interp_src[i] != tmp)
+        job->deps[job->num_deps++] = ref_slot_index(pool, job->interp_src[i]);
+    }
+  }
+
+  thor_mutex_lock(&pool->mutex);
+
+  /* The slot can be reused once it is complete and no frame in flight reads from it */
+  while (!pool->ref_ready[slot] || pool->ref_users[slot])
+    thor_cond_wait(&pool->cond, &pool->mutex);
+  pool->ref_ready[slot] = 0;
+  for (int i=0;i<job->num_deps;i++){
+    pool->ref_users[job->deps[i]]++;
+  }
+
+  /* Sliding window operation for reference frame buffer by circular buffer */
+  memmove(ref+1, ref, sizeof(yuv_frame_t*)*(MAX_REF_FRAMES-1));
+  ref[0] = tmp;
+  tmp->frame_num = frame_info->frame_num;
+  job->ref_slot = tmp;
+
+  /* Without workers the frame is encoded right away by the caller */
+  job->state = pool->num_threads ? JOB_QUEUED : JOB_RUNNING;
+  pool->count++;
+  thor_cond_broadcast(&pool->cond);
+  thor_mutex_unlock(&pool->mutex);
+
+  if (pool->num_threads == 0){
+    run_job(job);
+    thor_mutex_lock(&pool->mutex);
+    complete_job(pool, job);
+    thor_mutex_unlock(&pool->mutex);
+  }
+}
+
+/* Return the oldest job in coding order once it has been encoded. Returns
+   NULL if wait is 0 and it is not finished yet, or if there is no such job
+   and frame_pool_flush() has been called. If wait is 0 or the pool is being
+   flushed, NULL is also returned when there is no job in flight. */
+frame_job_t *frame_pool_oldest(frame_pool_t *pool, int wait)
+{
+  frame_job_t *job;
+  thor_mutex_lock(&pool->mutex);
+  while (wait && (pool->count ? pool->jobs[pool->head].state != JOB_DONE : !pool->flushing))
+    thor_cond_wait(&pool->cond, &pool->mutex);
+  job = pool->count ? &pool->jobs[pool->head] : NULL;
+  if (job && job->state != JOB_DONE)
+    job = NULL;
+  thor_mutex_unlock(&pool->mutex);
+  return job;
+}
+
+/* Release the oldest job after its output has been written */
+void frame_pool_release(frame_pool_t *pool)
+{
+  thor_mutex_lock(&pool->mutex);
+  pool->jobs[pool->head].state = JOB_FREE;
+  pool->head = (pool->head+1)%pool->num_jobs;
+  pool->count--;
+  thor_cond_broadcast(&pool->cond);
+  thor_mutex_unlock(&pool->mutex);
+}
+
+/* Signal that all frames have been submitted */
+void frame_pool_flush(frame_pool_t *pool)
+{
+  thor_mutex_lock(&pool->mutex);
+  pool->flushing = 1;
+  thor_cond_broadcast(&pool->cond);
+  thor_mutex_unlock(&pool->mutex);
+}
@@ -0,0 +1,80 @@
+/*
+Copyright (c) 2015, Cisco Systems
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#if !defined(_FRAME_POOL_H_)
+#define _FRAME_POOL_H_
+
+#include "mainenc.h"
+#include "thread.h"
+
+typedef enum {
+  JOB_FREE,
+  JOB_QUEUED,
+  JOB_RUNNING,
+  JOB_DONE
+} job_state_t;
+
+typedef struct
+{
+  encoder_info_t encoder_info;    //Private copy of the encoder state for this frame
+  yuv_frame_t orig;
+  stream_t stream;
+  yuv_frame_t *ref_slot;          //Reference buffer slot receiving the reconstructed frame
+  yuv_frame_t *interp_src[2];     //Frames to interpolate from when frame_info.interp_ref is set
+  int interp_ratio;
+  int interp_pos;
+  int num_deps;
+  int deps[MAX_REF_FRAMES+2];     //Reference buffer slots which must be complete before encoding
+  int ref_frame_num[MAX_REF_FRAMES];
+  job_state_t state;
+} frame_job_t;
+
+typedef struct
+{
+  frame_job_t jobs[MAX_FRAME_JOBS];
+  int num_jobs;
+  int head;                       //Oldest job in coding order
+  int count;                      //Number of jobs submitted and not yet released
+  yuv_frame_t *ref_base;          //Reference buffer the slot indices refer to
+  int ref_ready[MAX_REF_FRAMES];
+  int ref_users[MAX_REF_FRAMES];
+  int num_threads;
+  int flushing;                   //No more frames will be submitted
+  int quit;
+  thor_thread_t threads[MAX_FRAME_JOBS];
+  thor_mutex_t mutex;
+  thor_cond_t cond;
+} frame_pool_t;
+
+void frame_pool_init(frame_pool_t *pool, encoder_info_t *encoder_info, yuv_frame_t *ref_base, int num_threads);
+void frame_pool_close(frame_pool_t *pool);
+frame_job_t *frame_pool_next_job(frame_pool_t *pool, int wait);
+void frame_pool_submit(frame_pool_t *pool, frame_job_t *job, encoder_info_t *encoder_info);
+frame_job_t *frame_pool_oldest(frame_pool_t *pool, int wait);
+void frame_pool_release(frame_pool_t *pool);
+void frame_pool_flush(frame_pool_t *pool);
+
+#endif
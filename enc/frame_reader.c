@@ -0,0 +1,143 @@
+/*
+Copyright (c) 2015, Cisco Systems
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "global.h"
+#include "frame_reader.h"
+#include "common_frame.h"
+
+/* Input prefetch. A reader thread reads the input frames sequentially into a
+   ring of frame buffers, a few frames ahead of the encoder. The encoder takes
+   the frames out of the ring in coding order, so the ring holds a whole
+   reordering sub-GOP plus the frames read ahead. A frame is handed over by
+   swapping buffers with the caller. */
+
+static void read_frame(frame_reader_t *fr, yuv_frame_t *frame, int frame_num)
+{
+  enc_params *params = fr->params;
+  int frame_size = params->width*params->height + 2*(params->width*params->height/4);
+  fseek(fr->infile, frame_num*(frame_size+params->frame_headerlen)+params->file_headerlen+params->frame_headerlen, SEEK_SET);
+  read_yuv_frame(frame,params->width,params->height,fr->infile);
+}
+
+static void *reader_worker(void *arg)
+{
+  frame_reader_t *fr = (frame_reader_t*)arg;
+
+  thor_mutex_lock(&fr->mutex);
+  while (!fr->quit && fr->next_read < fr->end_frame){
+    int n = fr->next_read;
+    int s = n%fr->num_slots;
+    if (fr->slot_frame_num[s] >= 0){
+      thor_cond_wait(&fr->cond, &fr->mutex);
+      continue;
+    }
+    thor_mutex_unlock(&fr->mutex);
+
+    /* The slot is free, so it is not touched by the encoder until it is marked as read */
+    read_frame(fr, &fr->slots[s], n);
+
+    thor_mutex_lock(&fr->mutex);
+    fr->slot_frame_num[s] = n;
+    fr->next_read++;
+    thor_cond_broadcast(&fr->cond);
+  }
+  thor_mutex_unlock(&fr->mutex);
+  return NULL;
+}
+
+/* Prepare reading frames first_frame to end_frame-1 of infile. Without a
+   reader thread each frame is read when requested. */
+void frame_reader_init(frame_reader_t *fr, FILE *infile, enc_params *params, int first_frame, int end_frame, int threaded)
+{
+  fr->infile = infile;
+  fr->params = params;
+  fr->first_frame = first_frame;
+  fr->end_frame = end_frame;
+  fr->next_read = first_frame;
+  fr->threaded = threaded && end_frame > first_frame;
+  fr->quit = 0;
+  fr->num_slots = 0;
+  fr->slots = NULL;
+  fr->slot_frame_num = NULL;
+  if (!fr->threaded)
+    return;
+
+  fr->num_slots = max(1,params->num_reorder_pics+1) + MAX_READ_AHEAD;
+  fr->slots = (yuv_frame_t*)malloc(fr->num_slots * sizeof(yuv_frame_t));
+  fr->slot_frame_num = (int*)malloc(fr->num_slots * sizeof(int));
+  if (fr->slots == NULL || fr->slot_frame_num == NULL)
+    fatalerror("Memory allocation failed.");
+  for (int s=0;s<fr->num_slots;s++){
+    create_yuv_frame(&fr->slots[s],params->width,params->height,0,0,0,0);
+    fr->slot_frame_num[s] = -1;
+  }
+  thor_mutex_init(&fr->mutex);
+  thor_cond_init(&fr->cond);
+  thor_thread_create(&fr->thread, reader_worker, fr);
+}
+
+/* Return input frame frame_num in frame. The buffers of frame may be
+   exchanged with those of a prefetched frame. */
+void frame_reader_get(frame_reader_t *fr, yuv_frame_t *frame, int frame_num)
+{
+  if (!fr->threaded || frame_num < fr->first_frame || frame_num >= fr->end_frame){
+    read_frame(fr, frame, frame_num);
+    return;
+  }
+
+  int s = frame_num%fr->num_slots;
+  thor_mutex_lock(&fr->mutex);
+  while (fr->slot_frame_num[s] != frame_num)
+    thor_cond_wait(&fr->cond, &fr->mutex);
+  yuv_frame_t tmp = *frame;
+  *frame = fr->slots[s];
+  fr->slots[s] = tmp;
+  fr->slot_frame_num[s] = -1;
+  thor_cond_broadcast(&fr->cond);
+  thor_mutex_unlock(&fr->mutex);
+}
+
+void frame_reader_close(frame_reader_t *fr)
+{
+  if (!fr->threaded)
+    return;
+
+  thor_mutex_lock(&fr->mutex);
+  fr->quit = 1;
+  thor_cond_broadcast(&fr->cond);
+  thor_mutex_unlock(&fr->mutex);
+  thor_thread_join(fr->thread);
+
+  for (int s=0;s<fr->num_slots;s++)
+    close_yuv_frame(&fr->slots[s]);
+  thor_cond_destroy(&fr->cond);
+  thor_mutex_destroy(&fr->mutex);
+  free(fr->slots);
+  free(fr->slot_frame_num);
+}
@@ -0,0 +1,55 @@
+/*
+Copyright (c) 2015, Cisco Systems
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#if !defined(_FRAME_READER_H_)
+#define _FRAME_READER_H_
+
+#include <stdio.h>
+#include "mainenc.h"
+#include "thread.h"
+
+typedef struct
+{
+  FILE *infile;
+  enc_params *params;
+  int first_frame;                //First frame read ahead
+  int end_frame;                  //One past the last frame read ahead
+  int num_slots;
+  yuv_frame_t *slots;             //Frame n is read into slots[n%num_slots]
+  int *slot_frame_num;            //Frame number held by each slot, -1 if free
+  int next_read;                  //Next frame to be read
+  int threaded;
+  int quit;
+  thor_thread_t thread;
+  thor_mutex_t mutex;
+  thor_cond_t cond;
+} frame_reader_t;
+
+void frame_reader_init(frame_reader_t *fr, FILE *infile, enc_params *params, int first_frame, int end_frame, int threaded);
+void frame_reader_get(frame_reader_t *fr, yuv_frame_t *frame, int frame_num);
+void frame_reader_close(frame_reader_t *fr);
+
+#endif
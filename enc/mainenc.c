@@ -36,13 +36,18 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "strings.h"
 #include "snr.h"
 #include "mainenc.h"
+#include "common_block.h"
 #include "common_frame.h"
 #include "encode_frame.h"
 #include "putbits.h"
 #include "putvlc.h"
 #include "transform.h"
 #include "temporal_interp.h"
+#include "frame_pool.h"
+#include "frame_reader.h"
+#include "thread.h"
 #include "../common/simd.h"
+#include "enc_kernels.h"
 
 // Coding order to display order
 static const int cd1[1] = {0};
@@ -70,149 +75,202 @@ static int reorder_frame_offset(int idx, int sub_gop, int dyadic)
   }
 }
 
-int main(int argc, char **argv)
+typedef struct
 {
-  FILE *infile, *strfile, *reconfile;
-
-  uint32_t input_file_size; //TODO: Support file size values larger than 32 bits 
-  yuv_frame_t orig,ref[MAX_REF_FRAMES];
-  yuv_frame_t rec[MAX_REORDER_BUFFER];
-  int rec_available[MAX_REORDER_BUFFER] = {0};
-  int last_frame_output=-1;
-  int num_encoded_frames,num_bits,start_bits,end_bits;
-  int sub_gop=1;
-  int rec_buffer_idx;
-  int frame_num,frame_num0,k,r;
-  int frame_offset;
-  int ysize,csize,frame_size;
-  int width,height;
-  int min_interp_depth;
-  int last_intra_frame_num = 0;
-  uint32_t acc_num_bits;
-  snrvals psnr;
-  snrvals accsnr;
-  double bit_rate_in_kbps;
   enc_params *params;
-  encoder_info_t encoder_info;
+  FILE *strfile;
+  FILE *reconfile;
+  FILE *logfile;                     //Per-frame statistics
   int y4m_output;
-  // Keep track of last P frame for using the right references for the tail of a sequence in re-ordered modes
-  int last_PorI_frame;
+  stream_t *stream;                  //Holds the sequence header until the first frame is written
+  int frame_num_offset;              //Coded frame number of the first frame in the output
+  yuv_frame_t *rec;
+  int rec_available[MAX_REORDER_BUFFER];
+  int last_frame_output;
+  uint32_t acc_num_bits;
+  snrvals accsnr;
+} enc_output_t;
 
-  init_use_simd();
+typedef struct
+{
+  enc_params params;                 //Private copy with skip and num_frames covering the segment
+  int frame_count;                   //Number of frames in the sequence before the segment
+  FILE *infile;
+  uint32_t input_file_size;
+  stream_t stream;
+  enc_output_t out;
+  int num_encoded_frames;
+} segment_t;
 
-  /* Read commands from command line and from configuration file(s) */
-  if (argc < 3)
-  {
-    fprintf(stdout,"usage: %s <parameters>\n",argv[0]);
-    fatalerror("");
+/* Write out the oldest frame in flight once it has been encoded. Frames are
+   retired in coding order. Returns 0 if no frame was retired. */
+static int retire_frame(frame_pool_t *pool, enc_output_t *out, int wait)
+{
+  frame_job_t *job = frame_pool_oldest(pool, wait);
+  if (job == NULL)
+    return 0;
+
+  enc_params *params = out->params;
+  encoder_info_t *encoder_info = &job->encoder_info;
+  int width = encoder_info->width;
+  int height = encoder_info->height;
+  int frame_num = encoder_info->frame_info.frame_num + params->skip;
+  int rec_buffer_idx = encoder_info->frame_info.frame_num%MAX_REORDER_BUFFER;
+  int num_bits = get_bit_pos(&job->stream);
+  snrvals psnr;
+
+  out->rec_available[rec_buffer_idx]=1;
+
+  /* Compute SNR */
+  if (params->snrcalc){
+    snr_yuv(&psnr,encoder_info->orig,&out->rec[rec_buffer_idx],height,width);
   }
-  params = parse_config_params(argc, argv);
-  if (params == NULL)
-  {
-    fatalerror("Error while reading encoder paramaters.");
+  else{
+    psnr.y =  psnr.u = psnr.v = 0.0;
+  }
+  out->accsnr.y += psnr.y;
+  out->accsnr.u += psnr.u;
+  out->accsnr.v += psnr.v;
+
+  out->acc_num_bits += num_bits;
+
+  if (encoder_info->frame_info.frame_type==I_FRAME)
+    fprintf(out->logfile,"%4d I %4d %10d %10.4f %8.4f %8.4f ",frame_num,encoder_info->frame_info.qp,num_bits,psnr.y,psnr.u,psnr.v);
+  else if (encoder_info->frame_info.frame_type==P_FRAME)
+    fprintf(out->logfile,"%4d P %4d %10d %10.4f %8.4f %8.4f ",frame_num,encoder_info->frame_info.qp,num_bits,psnr.y,psnr.u,psnr.v);
+  else 
+    fprintf(out->logfile,"%4d B %4d %10d %10.4f %8.4f %8.4f ",frame_num,encoder_info->frame_info.qp,num_bits,psnr.y,psnr.u,psnr.v);
+
+  int ref_idx;
+  for (ref_idx=0; ref_idx<encoder_info->frame_info.num_ref; ref_idx++){
+    encoder_info->frame_info.ref_array[ref_idx]==-1 ? fprintf(out->logfile,"I(%d,%d) ",encoder_info->frame_info.ref_array[ref_idx+1],encoder_info->frame_info.ref_array[ref_idx+2])
+      : fprintf(out->logfile,"%3d",encoder_info->frame_info.ref_array[ref_idx]);
   }
-  check_parameters(params);
 
-  /* Open files */
-  if (!(infile = fopen(params->infilestr,"rb")))
-  {
-    fatalerror("Could not open in-file for reading.");
+  for (ref_idx = encoder_info->frame_info.num_ref; ref_idx < params->max_num_ref; ref_idx++) {
+    fprintf(out->logfile, "   ");
   }
-  if (!(strfile = fopen(params->outfilestr,"wb")))
-  {
-    fatalerror("Could not open out-file for writing.");
+  fprintf(out->logfile, " | ");
+  for (ref_idx = 0; ref_idx<encoder_info->frame_info.num_ref; ref_idx++) {
+    int r0 = encoder_info->frame_info.ref_array[ref_idx+0];
+    int r1 = encoder_info->frame_info.ref_array[ref_idx+1];
+    int r2 = encoder_info->frame_info.ref_array[ref_idx+2];
+    r0 == -1 ? fprintf(out->logfile, "I(%d,%d)", job->ref_frame_num[r1] + out->frame_num_offset, job->ref_frame_num[r2] + out->frame_num_offset)
+      : fprintf(out->logfile, "%3d", job->ref_frame_num[r0] + out->frame_num_offset);
   }
-  reconfile = NULL;
-  y4m_output = 0;
-  if (params->reconfilestr) {
-    char *p;
-    if (!(reconfile = fopen(params->reconfilestr,"wb")))
-    {
-      fatalerror("Could not open recon-file for reading.");
+  fprintf(out->logfile,"\n");
+  fflush(out->logfile);
+
+  /* Write compressed bits for this frame to file */
+  if (get_bit_pos(out->stream) > 0){
+    append_stream(out->stream, &job->stream);
+    flush_all_bits(out->stream, out->strfile);
+  }
+  else{
+    flush_all_bits(&job->stream, out->strfile);
+  }
+
+  if (out->reconfile){
+    /* Write output frame */
+    rec_buffer_idx = (out->last_frame_output+1) % MAX_REORDER_BUFFER;
+    if (out->rec_available[rec_buffer_idx]) {
+      out->last_frame_output++;
+      if (out->y4m_output)
+      {
+        fprintf(out->reconfile, "FRAME\x0a");
+      }
+      write_yuv_frame(&out->rec[rec_buffer_idx],width,height,out->reconfile);
+      out->rec_available[rec_buffer_idx]=0;
     }
-    p = strrchr(params->reconfilestr,'.');
-    y4m_output = p != NULL && strcmp(p,".y4m") == 0;
   }
-  
-  fseek(infile, 0, SEEK_END);
-  input_file_size = ftell(infile);
-  fseek(infile, 0, SEEK_SET);
 
+  frame_pool_release(pool);
+  return 1;
+}
 
-  if (y4m_output) {
-    fprintf(reconfile,
-     "YUV4MPEG2 W%d H%d F%d:1 Ip A0:0 C420jpeg XYSCSS=420JPEG\x0a",
-     params->width, params->height, (int)params->frame_rate);
-  }
+typedef struct
+{
+  frame_pool_t *pool;
+  enc_output_t *out;
+} output_worker_t;
 
-  accsnr.y = 0;
-  accsnr.u = 0;
-  accsnr.v = 0;
-  acc_num_bits = 0;
+/* Output stage of the encoder pipeline. Computes PSNR and writes the bitstream
+   and reconstructed frames while the encoder moves on to the next frames. */
+static void *output_worker(void *arg)
+{
+  output_worker_t *ow = (output_worker_t*)arg;
+  while (retire_frame(ow->pool, ow->out, 1));
+  return NULL;
+}
 
-  height = params->height;
-  width = params->width;
-  ysize = height * width;
-  csize = ysize / 4;
-  frame_size = ysize + 2*csize;
+/* Encode the frames params->skip to params->skip+params->num_frames-1 of the
+   input file as a sequence of its own, starting with an intra frame */
+static void encode_segment(segment_t *seg)
+{
+  enc_params *params = &seg->params;
+  enc_output_t *out = &seg->out;
+  FILE *infile = seg->infile;
+  uint32_t input_file_size = seg->input_file_size;
+  yuv_frame_t ref[MAX_REF_FRAMES];
+  yuv_frame_t rec[MAX_REORDER_BUFFER];
+  int num_encoded_frames;
+  int sub_gop=1;
+  int rec_buffer_idx;
+  int frame_num,frame_num0,k,r;
+  int frame_offset;
+  int width = params->width;
+  int height = params->height;
+  int frame_size = width*height + 2*(width*height/4);
+  int min_interp_depth;
+  int last_intra_frame_num = 0;
+  encoder_info_t encoder_info;
+  frame_pool_t pool;
+  frame_job_t *job;
+  frame_reader_t reader;
+  output_worker_t ow;
+  thor_thread_t output_thread;
+  // Keep track of last P frame for using the right references for the tail of a sequence in re-ordered modes
+  int last_PorI_frame;
 
   /* Create frames*/
-  create_yuv_frame(&orig,width,height,0,0,0,0);
   for (r=0;r<MAX_REORDER_BUFFER;r++){
     create_yuv_frame(&rec[r],width,height,0,0,0,0);
   }
   for (r=0;r<MAX_REF_FRAMES;r++){ //TODO: Use Long-term frame instead of a large sliding window
     create_yuv_frame(&ref[r],width,height,PADDING_Y,PADDING_Y,PADDING_Y/2,PADDING_Y/2);
+    /* Empty slots precede the first intra frame and are never used as references */
+    ref[r].frame_num = -1;
   }
-  if (params->interp_ref) {
-    for (r=0;r<MAX_SKIP_FRAMES;r++){
-      encoder_info.interp_frames[r] = malloc(sizeof(yuv_frame_t));
-      create_yuv_frame(encoder_info.interp_frames[r],width,height,PADDING_Y,PADDING_Y,PADDING_Y/2,PADDING_Y/2);
-    }
-  }
-
-  /* Initialize main bit stream */
-  stream_t stream;
-  stream.bitstream = (uint8_t *)malloc(MAX_BUFFER_SIZE * sizeof(uint8_t));
-  stream.bitbuf = 0;
-  stream.bitrest = 32;
-  stream.bytepos = 0;
-  stream.bytesize = MAX_BUFFER_SIZE;
 
-  /* Configure encoder */
+  /* Configure encoder. Frames are encoded using private copies of encoder_info
+     with their own orig, stream and deblock_data, see frame_pool.c */
+  memset(&encoder_info, 0, sizeof(encoder_info));
   encoder_info.params = params;
-  encoder_info.orig = &orig;
   for (r=0;r<MAX_REF_FRAMES;r++){
     encoder_info.ref[r] = &ref[r];
   }
-  encoder_info.stream = &stream;
   encoder_info.width = width;
   encoder_info.height = height;
-
-  encoder_info.deblock_data = (deblock_data_t *)malloc((height/MIN_PB_SIZE) * (width/MIN_PB_SIZE) * sizeof(deblock_data_t));
-
-
-  /* Write sequence header */ //TODO: Separate function for sequence header
-  start_bits = get_bit_pos(&stream);
-  putbits(16,width,&stream);
-  putbits(16,height,&stream);
-  putbits(1,params->enable_pb_split,&stream);
-  putbits(1,params->enable_tb_split,&stream);
-  putbits(2,params->max_num_ref-1,&stream); //TODO: Support more than 4 reference frames
-  putbits(1,params->interp_ref,&stream);// Use an interpolated reference frame
-  putbits(3,params->max_delta_qp,&stream);
-  putbits(1,params->deblocking,&stream);
-  putbits(1,params->clpf,&stream);
-  putbits(1,params->use_block_contexts,&stream);
-  putbits(1,params->enable_bipred,&stream);
-
-  end_bits = get_bit_pos(&stream);
-  num_bits = end_bits-start_bits;
-  acc_num_bits += num_bits;
-  printf("SH:  %4d bits\n",num_bits);
+  get_tile(&encoder_info.tile, width, height, 1, 1, 0, 0);
+
+  frame_pool_init(&pool, &encoder_info, ref, params->frame_threads);
+
+  out->params = params;
+  out->rec = rec;
+  memset(out->rec_available, 0, sizeof(out->rec_available));
+  out->last_frame_output = -1;
+
+  /* With async_io the input is read ahead and the output is written by
+     separate threads, see frame_reader.c and output_worker() */
+  frame_reader_init(&reader, infile, params, params->skip, min(params->skip+params->num_frames, input_file_size/frame_size), params->async_io);
+  if (params->async_io){
+    ow.pool = &pool;
+    ow.out = out;
+    thor_thread_create(&output_thread, output_worker, &ow);
+  }
 
   /* Start encoding sequence */
-  num_encoded_frames = 0;
+  num_encoded_frames = seg->frame_count;
   sub_gop = max(1,params->num_reorder_pics+1);
 
   min_interp_depth = log2i(params->num_reorder_pics+1)-2;
@@ -229,6 +287,10 @@ int main(int argc, char **argv)
       // If there is an initial I frame and reordering need to jump to the next P frame
       if (frame_num<params->skip) continue;
 
+      /* Retire frames in coding order until a job is available for this frame */
+      while ((job = frame_pool_next_job(&pool, params->async_io)) == NULL)
+        retire_frame(&pool, out, 1);
+
       encoder_info.frame_info.frame_num = frame_num - params->skip;
       rec_buffer_idx = encoder_info.frame_info.frame_num%MAX_REORDER_BUFFER;
       encoder_info.rec = &rec[rec_buffer_idx];
@@ -323,11 +385,10 @@ int main(int argc, char **argv)
                 // Interpolate these two reference frames to make a new frame
                 encoder_info.frame_info.ref_array[0]=-1;
                 // Add this interpolated frame to the reference buffer and use it as the first reference
-                yuv_frame_t* ref1=encoder_info.ref[encoder_info.frame_info.ref_array[1]];
-                yuv_frame_t* ref2=encoder_info.ref[encoder_info.frame_info.ref_array[2]];
-                interpolate_frames(encoder_info.interp_frames[0], ref1, ref2, 2, 1);
-                pad_yuv_frame(encoder_info.interp_frames[0]);
-                encoder_info.interp_frames[0]->frame_num = encoder_info.frame_info.frame_num;
+                job->interp_src[0]=encoder_info.ref[encoder_info.frame_info.ref_array[1]];
+                job->interp_src[1]=encoder_info.ref[encoder_info.frame_info.ref_array[2]];
+                job->interp_ratio = 2;
+                job->interp_pos = 1;
                 /* use most recent frames for the last ref(s)*/
                 for (r=3;r<encoder_info.frame_info.num_ref;r++){
                   encoder_info.frame_info.ref_array[r] = r-3;
@@ -380,11 +441,10 @@ int main(int argc, char **argv)
                 // Interpolate these two reference frames to make a new frame
                 encoder_info.frame_info.ref_array[0]=-1;
                 // Add this interpolated frame to the reference buffer and use it as the first reference
-                yuv_frame_t* ref1=encoder_info.ref[encoder_info.frame_info.ref_array[1]];
-                yuv_frame_t* ref2=encoder_info.ref[encoder_info.frame_info.ref_array[2]];
-                interpolate_frames(encoder_info.interp_frames[0], ref1, ref2, sub_gop-phase,phase!=0 ? 1 : sub_gop-phase-1);
-                pad_yuv_frame(encoder_info.interp_frames[0]);
-                encoder_info.interp_frames[0]->frame_num = encoder_info.frame_info.frame_num;
+                job->interp_src[0]=encoder_info.ref[encoder_info.frame_info.ref_array[1]];
+                job->interp_src[1]=encoder_info.ref[encoder_info.frame_info.ref_array[2]];
+                job->interp_ratio = sub_gop-phase;
+                job->interp_pos = phase!=0 ? 1 : sub_gop-phase-1;
 
                 /* Use the prior P frame as the 4th ref */
                 if (encoder_info.frame_info.num_ref>2) {
@@ -507,73 +567,16 @@ int main(int argc, char **argv)
 #endif
 
       /* Read input frame */
-      fseek(infile, frame_num*(frame_size+params->frame_headerlen)+params->file_headerlen+params->frame_headerlen, SEEK_SET);
-      read_yuv_frame(&orig,width,height,infile);
-      orig.frame_num = encoder_info.frame_info.frame_num;
+      frame_reader_get(&reader, &job->orig, frame_num);
+      job->orig.frame_num = encoder_info.frame_info.frame_num;
 
       /* Encode frame */
-      start_bits = get_bit_pos(&stream);
-      encode_frame(&encoder_info);
-      rec_available[rec_buffer_idx]=1;
-      end_bits =  get_bit_pos(&stream);
-      num_bits = end_bits-start_bits;
+      frame_pool_submit(&pool, job, &encoder_info);
       num_encoded_frames++;
 
-      /* Compute SNR */
-      if (params->snrcalc){
-        snr_yuv(&psnr,&orig,&rec[rec_buffer_idx],height,width);
-      }
-      else{
-        psnr.y =  psnr.u = psnr.v = 0.0;
-      }
-      accsnr.y += psnr.y;
-      accsnr.u += psnr.u;
-      accsnr.v += psnr.v;
-
-      acc_num_bits += num_bits;
-
-      if (encoder_info.frame_info.frame_type==I_FRAME)
-        fprintf(stdout,"%4d I %4d %10d %10.4f %8.4f %8.4f ",frame_num,encoder_info.frame_info.qp,num_bits,psnr.y,psnr.u,psnr.v);
-      else if (encoder_info.frame_info.frame_type==P_FRAME)
-        fprintf(stdout,"%4d P %4d %10d %10.4f %8.4f %8.4f ",frame_num,encoder_info.frame_info.qp,num_bits,psnr.y,psnr.u,psnr.v);
-      else 
-        fprintf(stdout,"%4d B %4d %10d %10.4f %8.4f %8.4f ",frame_num,encoder_info.frame_info.qp,num_bits,psnr.y,psnr.u,psnr.v);
-
-      int ref_idx;
-      for (ref_idx=0; ref_idx<encoder_info.frame_info.num_ref; ref_idx++){
-        encoder_info.frame_info.ref_array[ref_idx]==-1 ? fprintf(stdout,"I(%d,%d) ",encoder_info.frame_info.ref_array[ref_idx+1],encoder_info.frame_info.ref_array[ref_idx+2])
-          : fprintf(stdout,"%3d",encoder_info.frame_info.ref_array[ref_idx]);
-      }
-
-      for (ref_idx = encoder_info.frame_info.num_ref; ref_idx < encoder_info.params->max_num_ref; ref_idx++) {
-        fprintf(stdout, "   ");
-      }
-      fprintf(stdout, " | ");
-      for (ref_idx = 0; ref_idx<encoder_info.frame_info.num_ref; ref_idx++) {
-        int r0 = encoder_info.frame_info.ref_array[ref_idx+0];
-        int r1 = encoder_info.frame_info.ref_array[ref_idx+1];
-        int r2 = encoder_info.frame_info.ref_array[ref_idx+2];
-        r0 == -1 ? fprintf(stdout, "I(%d,%d)", encoder_info.ref[r1 + 1]->frame_num, encoder_info.ref[r2 + 1]->frame_num) : fprintf(stdout, "%3d", encoder_info.ref[r0 + 1]->frame_num);
-      }
-      fprintf(stdout,"\n");
-      fflush(stdout);
-
-      /* Write compressed bits for this frame to file */
-      flush_all_bits(&stream, strfile);
-
-      if (reconfile){
-        /* Write output frame */
-        rec_buffer_idx = (last_frame_output+1) % MAX_REORDER_BUFFER;
-        if (rec_available[rec_buffer_idx]) {
-          last_frame_output++;
-          if (y4m_output)
-          {
-            fprintf(reconfile, "FRAME\x0a");
-          }
-          write_yuv_frame(&rec[rec_buffer_idx],width,height,reconfile);
-          rec_available[rec_buffer_idx]=0;
-        }
-      }
+      /* Write out frames that are done */
+      if (!params->async_io)
+        while (retire_frame(&pool, out, 0));
 
       // Keep track of when the last anchor frame was in the sliding window
       last_PorI_frame = (encoder_info.frame_info.frame_type != B_FRAME ? 0 : last_PorI_frame+1);
@@ -589,29 +592,382 @@ int main(int argc, char **argv)
       params->num_reorder_pics = 0;
     };
   }
+  frame_pool_flush(&pool);
+  if (params->async_io)
+    thor_thread_join(output_thread);
+  else
+    while (retire_frame(&pool, out, 1));
+  frame_pool_close(&pool);
+  frame_reader_close(&reader);
+
   // Write out the tail
   int i;
-  if (reconfile) {
+  if (out->reconfile) {
     for (i=1; i<=MAX_REORDER_BUFFER; ++i) {
-      rec_buffer_idx=(last_frame_output+i) % MAX_REORDER_BUFFER;
-      if (rec_available[rec_buffer_idx]) {
-        write_yuv_frame(&rec[rec_buffer_idx],width,height,reconfile);
-        rec_available[rec_buffer_idx]=0;
+      rec_buffer_idx=(out->last_frame_output+i) % MAX_REORDER_BUFFER;
+      if (out->rec_available[rec_buffer_idx]) {
+        write_yuv_frame(&rec[rec_buffer_idx],width,height,out->reconfile);
+        out->rec_available[rec_buffer_idx]=0;
       }
       else
         break;
     }
   }
 
+  seg->num_encoded_frames = num_encoded_frames - seg->frame_count;
 
-  bit_rate_in_kbps = 0.001*params->frame_rate*(double)acc_num_bits/num_encoded_frames;
+  for (r=0;r<MAX_REORDER_BUFFER;r++){
+    close_yuv_frame(&rec[r]);
+  }
+  for (r=0;r<MAX_REF_FRAMES;r++){
+    close_yuv_frame(&ref[r]);
+  }
+}
+
+/* GOP-segment parallel encoding. Without frame reordering no frame refers to a
+   frame before the last intra frame, so the input is split into segments of
+   intra_period frames which are encoded concurrently as separate sequences.
+   The output of each segment is written to temporary files and stitched to
+   the output in order. Each segment is coded as it would be in a single
+   sequence, except that its frame numbers start from zero and are rebased
+   when the segment is stitched. */
+typedef struct
+{
+  enc_output_t *out;
+  uint32_t input_file_size;
+  int num_frames;
+  segment_t *segs;
+  int num_segs;
+  int next_seg;          //Next segment to be encoded
+  int num_stitched;      //Number of segments written to the output
+  int max_ahead;         //Maximum number of segments encoded ahead of the output
+  int *done;
+  thor_mutex_t mutex;
+  thor_cond_t cond;
+} segment_pool_t;
+
+static void init_segment(segment_pool_t *sp, int n)
+{
+  segment_t *seg = &sp->segs[n];
+  enc_params *params = sp->out->params;
+
+  seg->params = *params;
+  seg->params.skip = params->skip + n*params->intra_period;
+  seg->params.num_frames = min(params->intra_period, sp->num_frames - n*params->intra_period);
+  seg->frame_count = n*params->intra_period;
+  seg->input_file_size = sp->input_file_size;
+  init_stream(&seg->stream, 0);
+
+  seg->out = *sp->out;
+  /* The sequence header is written with the first frame of the first segment */
+  if (n > 0)
+    seg->out.stream = &seg->stream;
+  seg->out.frame_num_offset = seg->frame_count;
+  seg->out.acc_num_bits = 0;
+  seg->out.accsnr.y = 0;
+  seg->out.accsnr.u = 0;
+  seg->out.accsnr.v = 0;
+  if (!(seg->infile = fopen(params->infilestr,"rb")))
+    fatalerror("Could not open in-file for reading.");
+  seg->out.strfile = tmpfile();
+  seg->out.logfile = tmpfile();
+  if (seg->out.strfile == NULL || seg->out.logfile == NULL)
+    fatalerror("Could not create temporary file.");
+  if (seg->out.reconfile && !(seg->out.reconfile = tmpfile()))
+    fatalerror("Could not create temporary file.");
+}
+
+static void *segment_worker(void *arg)
+{
+  segment_pool_t *sp = (segment_pool_t*)arg;
+
+  thor_mutex_lock(&sp->mutex);
+  while (sp->next_seg < sp->num_segs){
+    int n = sp->next_seg;
+    if (n >= sp->num_stitched + sp->max_ahead){
+      thor_cond_wait(&sp->cond, &sp->mutex);
+      continue;
+    }
+    sp->next_seg++;
+    thor_mutex_unlock(&sp->mutex);
+
+    init_segment(sp, n);
+    encode_segment(&sp->segs[n]);
+    free_stream(&sp->segs[n].stream);
+    fclose(sp->segs[n].infile);
+
+    thor_mutex_lock(&sp->mutex);
+    sp->done[n] = 1;
+    thor_cond_broadcast(&sp->cond);
+  }
+  thor_mutex_unlock(&sp->mutex);
+  return NULL;
+}
+
+static unsigned int get_buf_bits(const uint8_t *buf, int pos, int n)
+{
+  unsigned int val = 0;
+  for (int i=pos;i<pos+n;i++)
+    val = (val << 1) | ((buf[i>>3] >> (7-(i&7))) & 1);
+  return val;
+}
+
+static void set_buf_bits(uint8_t *buf, int pos, int n, unsigned int val)
+{
+  for (int i=pos+n-1;i>=pos;i--){
+    buf[i>>3] = (buf[i>>3] & ~(0x80>>(i&7))) | ((val & 1) << (7-(i&7)));
+    val >>= 1;
+  }
+}
+
+/* Add offset to the 16 bit frame number in the frame header, see encode_frame() */
+static void rebase_frame_num(uint8_t *buf, int offset)
+{
+  int pos = 1+8+4;
+  if (get_buf_bits(buf, 0, 1))
+    pos += 2 + 6*(get_buf_bits(buf, pos, 2)+1);
+  set_buf_bits(buf, pos, 16, (get_buf_bits(buf, pos, 16) + offset) & 0xffff);
+}
+
+static void copy_file(FILE *dst, FILE *src)
+{
+  char buf[4096];
+  size_t n;
+  rewind(src);
+  while ((n = fread(buf, 1, sizeof(buf), src)) > 0){
+    if (fwrite(buf, 1, n, dst) != n)
+      fatalerror("Problem writing to file.");
+  }
+}
+
+static void stitch_segment(enc_output_t *out, segment_t *seg)
+{
+  uint8_t frame_bytes_buf[4];
+  uint32_t buf_size = MAX_BUFFER_SIZE;
+  uint8_t *buf = (uint8_t*)malloc(buf_size);
+  if (buf == NULL)
+    fatalerror("Memory allocation failed.");
+
+  /* Copy the length-prefixed frames, rebasing the frame numbers */
+  rewind(seg->out.strfile);
+  while (fread(frame_bytes_buf, sizeof(frame_bytes_buf), 1, seg->out.strfile) == 1){
+    uint32_t frame_bytes = frame_bytes_buf[0] << 24 | frame_bytes_buf[1] << 16 | frame_bytes_buf[2] << 8 | frame_bytes_buf[3];
+    if (frame_bytes > buf_size){
+      free(buf);
+      buf_size = frame_bytes;
+      buf = (uint8_t*)malloc(buf_size);
+      if (buf == NULL)
+        fatalerror("Memory allocation failed.");
+    }
+    if (fread(buf, 1, frame_bytes, seg->out.strfile) != frame_bytes)
+      fatalerror("Problem reading segment bitstream.");
+    if (seg->out.frame_num_offset)
+      rebase_frame_num(buf, seg->out.frame_num_offset);
+    if (fwrite(frame_bytes_buf, sizeof(frame_bytes_buf), 1, out->strfile) != 1 ||
+        fwrite(buf, 1, frame_bytes, out->strfile) != frame_bytes)
+      fatalerror("Problem writing bitstream to file.");
+  }
+  free(buf);
+  fclose(seg->out.strfile);
+
+  if (seg->out.reconfile){
+    copy_file(out->reconfile, seg->out.reconfile);
+    fclose(seg->out.reconfile);
+  }
+  copy_file(out->logfile, seg->out.logfile);
+  fclose(seg->out.logfile);
+  fflush(out->logfile);
+
+  out->acc_num_bits += seg->out.acc_num_bits;
+  out->accsnr.y += seg->out.accsnr.y;
+  out->accsnr.u += seg->out.accsnr.u;
+  out->accsnr.v += seg->out.accsnr.v;
+}
+
+/* Encode the sequence in segments of intra_period frames. Returns the number
+   of frames encoded. */
+static int encode_segments(enc_output_t *out, uint32_t input_file_size)
+{
+  enc_params *params = out->params;
+  int frame_size = params->width*params->height + 2*(params->width*params->height/4);
+  int num_frames = min((int)params->num_frames, (int)(input_file_size/frame_size) - params->skip);
+  int num_threads = params->segment_threads;
+  int num_encoded_frames = 0;
+  thor_thread_t threads[MAX_THREADS];
+  segment_pool_t sp;
+  int n,t;
+
+  sp.out = out;
+  sp.input_file_size = input_file_size;
+  sp.num_frames = num_frames;
+  sp.num_segs = max(0, (num_frames + params->intra_period - 1)/params->intra_period);
+  sp.next_seg = 0;
+  sp.num_stitched = 0;
+  sp.max_ahead = 2*num_threads;
+  sp.segs = (segment_t*)malloc(max(1,sp.num_segs) * sizeof(segment_t));
+  sp.done = (int*)calloc(max(1,sp.num_segs), sizeof(int));
+  if (sp.segs == NULL || sp.done == NULL)
+    fatalerror("Memory allocation failed.");
+
+  thor_mutex_init(&sp.mutex);
+  thor_cond_init(&sp.cond);
+  num_threads = min(num_threads, max(1,sp.num_segs));
+  for (t=0;t<num_threads;t++)
+    thor_thread_create(&threads[t], segment_worker, &sp);
+
+  for (n=0;n<sp.num_segs;n++){
+    thor_mutex_lock(&sp.mutex);
+    while (!sp.done[n])
+      thor_cond_wait(&sp.cond, &sp.mutex);
+    thor_mutex_unlock(&sp.mutex);
+
+    stitch_segment(out, &sp.segs[n]);
+    num_encoded_frames += sp.segs[n].num_encoded_frames;
+
+    thor_mutex_lock(&sp.mutex);
+    sp.num_stitched++;
+    thor_cond_broadcast(&sp.cond);
+    thor_mutex_unlock(&sp.mutex);
+  }
+
+  for (t=0;t<num_threads;t++)
+    thor_thread_join(threads[t]);
+  thor_cond_destroy(&sp.cond);
+  thor_mutex_destroy(&sp.mutex);
+  free(sp.done);
+  free(sp.segs);
+  return num_encoded_frames;
+}
+
+int main(int argc, char **argv)
+{
+  FILE *infile, *strfile, *reconfile;
+
+  uint32_t input_file_size; //TODO: Support file size values larger than 32 bits 
+  int num_encoded_frames,num_bits,start_bits,end_bits;
+  int width,height;
+  double bit_rate_in_kbps;
+  enc_params *params;
+  enc_output_t out;
+  int y4m_output;
+
+  /* Read commands from command line and from configuration file(s) */
+  if (argc < 3)
+  {
+    fprintf(stdout,"usage: %s <parameters>\n",argv[0]);
+    fatalerror("");
+  }
+  params = parse_config_params(argc, argv);
+  if (params == NULL)
+  {
+    fatalerror("Error while reading encoder paramaters.");
+  }
+  init_use_simd(params->simd);
+  init_enc_kernels();
+  init_vlc_tables();
+  check_parameters(params);
+
+  /* Open files */
+  if (!(infile = fopen(params->infilestr,"rb")))
+  {
+    fatalerror("Could not open in-file for reading.");
+  }
+  if (!(strfile = fopen(params->outfilestr,"wb")))
+  {
+    fatalerror("Could not open out-file for writing.");
+  }
+  reconfile = NULL;
+  y4m_output = 0;
+  if (params->reconfilestr) {
+    char *p;
+    if (!(reconfile = fopen(params->reconfilestr,"wb")))
+    {
+      fatalerror("Could not open recon-file for reading.");
+    }
+    p = strrchr(params->reconfilestr,'.');
+    y4m_output = p != NULL && strcmp(p,".y4m") == 0;
+  }
+  
+  fseek(infile, 0, SEEK_END);
+  input_file_size = ftell(infile);
+  fseek(infile, 0, SEEK_SET);
+
+
+  if (y4m_output) {
+    fprintf(reconfile,
+     "YUV4MPEG2 W%d H%d F%d:1 Ip A0:0 C420jpeg XYSCSS=420JPEG\x0a",
+     params->width, params->height, (int)params->frame_rate);
+  }
+
+  height = params->height;
+  width = params->width;
+
+  /* Initialize main bit stream */
+  stream_t stream;
+  init_stream(&stream, MAX_BUFFER_SIZE);
+
+  out.params = params;
+  out.strfile = strfile;
+  out.reconfile = reconfile;
+  out.logfile = stdout;
+  out.y4m_output = y4m_output;
+  out.stream = &stream;
+  out.frame_num_offset = 0;
+  out.acc_num_bits = 0;
+  out.accsnr.y = 0;
+  out.accsnr.u = 0;
+  out.accsnr.v = 0;
+
+
+  /* Write sequence header */ //TODO: Separate function for sequence header
+  start_bits = get_bit_pos(&stream);
+  putbits(16,width,&stream);
+  putbits(16,height,&stream);
+  putbits(1,params->enable_pb_split,&stream);
+  putbits(1,params->enable_tb_split,&stream);
+  putbits(2,params->max_num_ref-1,&stream); //TODO: Support more than 4 reference frames
+  putbits(1,params->interp_ref,&stream);// Use an interpolated reference frame
+  putbits(3,params->max_delta_qp,&stream);
+  putbits(1,params->deblocking,&stream);
+  putbits(1,params->clpf,&stream);
+  putbits(1,params->use_block_contexts,&stream);
+  putbits(1,params->enable_bipred,&stream);
+  putbits(1,params->tile_cols*params->tile_rows > 1,&stream);
+  if (params->tile_cols*params->tile_rows > 1){
+    putbits(8,params->tile_cols-1,&stream);
+    putbits(8,params->tile_rows-1,&stream);
+    /* Tile substreams are byte aligned relative to the start of the sequence */
+    putbits(stream.bitrest%8,0,&stream);
+  }
+
+  end_bits = get_bit_pos(&stream);
+  num_bits = end_bits-start_bits;
+  out.acc_num_bits += num_bits;
+  printf("SH:  %4d bits\n",num_bits);
+
+  if (params->segment_threads > 1){
+    num_encoded_frames = encode_segments(&out, input_file_size);
+  }
+  else{
+    segment_t seg;
+    seg.params = *params;
+    seg.frame_count = 0;
+    seg.infile = infile;
+    seg.input_file_size = input_file_size;
+    seg.out = out;
+    encode_segment(&seg);
+    out = seg.out;
+    num_encoded_frames = seg.num_encoded_frames;
+  }
+
+  bit_rate_in_kbps = 0.001*params->frame_rate*(double)out.acc_num_bits/num_encoded_frames;
 
   /* Finised encoding sequence */
   fprintf(stdout,"------------------- Average data for all frames ------------------------------\n");
   fprintf(stdout,"kbps            : %12.3f\n",bit_rate_in_kbps);
-  fprintf(stdout,"PSNR Y          : %12.3f\n",accsnr.y/num_encoded_frames);
-  fprintf(stdout,"PSNR U          : %12.3f\n",accsnr.u/num_encoded_frames);
-  fprintf(stdout,"PSNR V          : %12.3f\n",accsnr.v/num_encoded_frames);
+  fprintf(stdout,"PSNR Y          : %12.3f\n",out.accsnr.y/num_encoded_frames);
+  fprintf(stdout,"PSNR U          : %12.3f\n",out.accsnr.u/num_encoded_frames);
+  fprintf(stdout,"PSNR V          : %12.3f\n",out.accsnr.v/num_encoded_frames);
   fprintf(stdout,"------------------------------------------------------------------------------\n");
 
   /* Append one line of statistics to a file */
@@ -627,34 +983,20 @@ int main(int argc, char **argv)
       fprintf(cumu_fp, "%4d %12.3f %6.3f %6.3f %6.3f\n",
           params->num_frames,
           bit_rate_in_kbps,
-          accsnr.y/(double)num_encoded_frames,
-          accsnr.u/(double)num_encoded_frames,
-          accsnr.v/(double)num_encoded_frames);
+          out.accsnr.y/(double)num_encoded_frames,
+          out.accsnr.u/(double)num_encoded_frames,
+          out.accsnr.v/(double)num_encoded_frames);
       fclose(cumu_fp);
     }
   }
 
-  close_yuv_frame(&orig);
-  for (int i=0; i<MAX_REORDER_BUFFER; ++i) {
-    close_yuv_frame(&rec[i]);
-  }
-  for (r=0;r<MAX_REF_FRAMES;r++){
-    close_yuv_frame(&ref[r]);
-  }
-  if (params->interp_ref) {
-    for (r=0;r<MAX_SKIP_FRAMES;r++){
-      close_yuv_frame(encoder_info.interp_frames[r]);
-      free(encoder_info.interp_frames[r]);
-    }
-  }
   fclose(infile);
   fclose(strfile);
   if (reconfile)
   {
     fclose(reconfile);
   }
-  free(stream.bitstream);
-  free(encoder_info.deblock_data);
+  free_stream(&stream);
   delete_config_params(params);
   return 0;
 }    
@@ -30,6 +30,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdio.h>
 #include "putbits.h"
 #include "types.h"
+#include "row_filter.h"
 
 typedef struct
 {
@@ -85,6 +86,18 @@ typedef struct
   int snrcalc;
   int use_block_contexts;
   int enable_bipred;
+  int threads;
+  int frame_threads;
+  int tile_cols;
+  int tile_rows;
+  int segment_threads;
+  int qp_threads;
+  int me_analysis;
+  int async_io;
+  int filter_thread;
+  int simd;
+  int satd;
+  int intra_rdo_modes;
 } enc_params;
 
 typedef struct
@@ -137,6 +150,8 @@ typedef struct
   int b_level;
 } frame_info_t;
 
+typedef struct qp_search_t qp_search_t;
+
 typedef struct 
 {
   block_info_t *block_info;
@@ -148,6 +163,11 @@ typedef struct
   yuv_frame_t *interp_frames[MAX_SKIP_FRAMES];
   stream_t *stream;
   deblock_data_t *deblock_data;
+  tile_t tile;
+  qp_search_t *qp_search; //Scratch contexts for the delta QP search
+  mv_t *mv_field[MAX_REF_FRAMES]; //Motion vectors per 8x8 block from the motion pre-analysis
+  yuv_frame_t *ref_out; //Reference buffer slot that receives the padded reconstruction, or NULL
+  row_filter_t *row_filter; //Loop filtering of finished superblock rows, or NULL
   int width;
   int height;
   int depth;
@@ -0,0 +1,151 @@
+/*
+Copyright (c) 2015, Cisco Systems
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "global.h"
+#include "me_analysis.h"
+#include "encode_block.h"
+#include "thread.h"
+
+/* Motion pre-analysis. Before the superblocks of an inter frame are encoded, a
+   best motion vector is found for every 8x8 block of the frame and every
+   reference. The search of a row only depends on the blocks to its left, so
+   all rows of all references are searched in parallel. Mode decision then
+   uses the field as motion vector candidates instead of a wide search around
+   the predictor. */
+typedef struct
+{
+  encoder_info_t *encoder_info;
+  int num_rows;
+  int num_jobs;
+  int next_job;          //Next (reference, row) pair to be searched
+  thor_mutex_t mutex;
+} me_analysis_t;
+
+static void analyse_row(encoder_info_t *encoder_info, int ref_idx, int row)
+{
+  frame_info_t *frame_info = &encoder_info->frame_info;
+  int width = encoder_info->width;
+  int height = encoder_info->height;
+  int num_cols = width/ME_CELL_SIZE;
+  int r = frame_info->ref_array[ref_idx];
+  yuv_frame_t *ref = r>=0 ? encoder_info->ref[r] : encoder_info->interp_frames[0];
+  yuv_frame_t *orig = encoder_info->orig;
+  int sign = ref->frame_num >= encoder_info->rec->frame_num;
+  double lambda = sqrt(frame_info->lambda);
+  mv_t *field = encoder_info->mv_field[ref_idx] + row*num_cols;
+  uint8_t org_block[ME_CELL_SIZE*ME_CELL_SIZE];
+  mv_t mvcand[2];
+  mv_t mvp = {0,0};
+  int ypos = row*ME_CELL_SIZE;
+  int i;
+
+  /* The field is a pre-analysis, so always search with a telescope around the predictor */
+  enc_params params = *encoder_info->params;
+  params.encoder_speed = 0;
+  params.me_analysis = 0;
+
+  for (int col=0;col<num_cols;col++){
+    int xpos = col*ME_CELL_SIZE;
+    int num_cand = 1;
+    for (i=0;i<ME_CELL_SIZE;i++)
+      memcpy(org_block + i*ME_CELL_SIZE, orig->y + (ypos+i)*orig->stride_y + xpos, ME_CELL_SIZE);
+    mvcand[0].x = mvcand[0].y = 0;
+    if (col > 0){
+      mvcand[1].x = (mvp.x + 2) >> 2;
+      mvcand[1].y = (mvp.y + 2) >> 2;
+      num_cand += mvcand[1].x || mvcand[1].y;
+    }
+    motion_estimate(org_block, ref->y + ypos*ref->stride_y + xpos, ME_CELL_SIZE, ref->stride_y, ME_CELL_SIZE, ME_CELL_SIZE,
+                    &field[col], &mvp, &mvp, lambda, &params, sign, width, height, xpos, ypos, mvcand, &num_cand, 0);
+    mvp = field[col];
+  }
+}
+
+static void *me_analysis_worker(void *arg)
+{
+  me_analysis_t *ma = (me_analysis_t*)arg;
+
+  while (1){
+    thor_mutex_lock(&ma->mutex);
+    int job = ma->next_job++;
+    thor_mutex_unlock(&ma->mutex);
+    if (job >= ma->num_jobs)
+      break;
+    analyse_row(ma->encoder_info, job/ma->num_rows, job%ma->num_rows);
+  }
+  return NULL;
+}
+
+void analyse_motion_field(encoder_info_t *encoder_info)
+{
+  int num_ref = encoder_info->frame_info.num_ref;
+  int size = (encoder_info->height/ME_CELL_SIZE) * (encoder_info->width/ME_CELL_SIZE);
+  thor_thread_t threads[MAX_THREADS];
+  me_analysis_t ma;
+  int t;
+
+  for (int ref_idx=0;ref_idx<num_ref;ref_idx++){
+    encoder_info->mv_field[ref_idx] = (mv_t*)malloc(size * sizeof(mv_t));
+    if (encoder_info->mv_field[ref_idx] == NULL)
+      fatalerror("Memory allocation failed.");
+  }
+
+  ma.encoder_info = encoder_info;
+  ma.num_rows = encoder_info->height/ME_CELL_SIZE;
+  ma.num_jobs = num_ref*ma.num_rows;
+  ma.next_job = 0;
+  thor_mutex_init(&ma.mutex);
+
+  int num_threads = min(encoder_info->params->threads, ma.num_jobs);
+  if (num_threads > 1){
+    for (t=0;t<num_threads;t++)
+      thor_thread_create(&threads[t], me_analysis_worker, &ma);
+    for (t=0;t<num_threads;t++)
+      thor_thread_join(threads[t]);
+  }
+  else{
+    me_analysis_worker(&ma);
+  }
+
+  thor_mutex_destroy(&ma.mutex);
+}
+
+void close_motion_field(encoder_info_t *encoder_info)
+{
+  for (int ref_idx=0;ref_idx<MAX_REF_FRAMES;ref_idx++){
+    free(encoder_info->mv_field[ref_idx]);
+    encoder_info->mv_field[ref_idx] = NULL;
+  }
+}
+
+mv_t get_field_mv(encoder_info_t *encoder_info, int ref_idx, int ypos, int xpos)
+{
+  return encoder_info->mv_field[ref_idx][(ypos/ME_CELL_SIZE)*(encoder_info->width/ME_CELL_SIZE) + xpos/ME_CELL_SIZE];
+}
@@ -41,95 +41,134 @@ static unsigned int mask[33] = {
     0x0fffffff,0x1fffffff,0x3fffffff,0x7fffffff,
     0xffffffff};
 
-static void flush_bytebuf(stream_t *str, FILE *outfile)
+#define STREAM_HEADER_BYTES 4   //Room for the frame length in front of the bitstream
+
+static void grow_stream(stream_t *str, uint32_t bytesize)
+{
+  uint8_t *base = str->bitstream ? str->bitstream - STREAM_HEADER_BYTES : NULL;
+  base = (uint8_t *)realloc(base, STREAM_HEADER_BYTES + bytesize);
+  if (base == NULL)
+    fatalerror("Memory allocation failed.");
+  str->bitstream = base + STREAM_HEADER_BYTES;
+  str->bytesize = bytesize;
+}
+
+void init_stream(stream_t *str, uint32_t bytesize)
+{
+  str->bitstream = NULL;
+  grow_stream(str, max(bytesize, 8));
+  str->estimate = 0;
+  reset_stream(str);
+}
+
+void init_estimate_stream(stream_t *str)
+{
+  str->bitstream = NULL;
+  str->bytesize = 0;
+  str->estimate = 1;
+  reset_stream(str);
+}
+
+void reset_stream(stream_t *str)
 {
-  if (outfile)
-  {
-    if (fwrite(str->bitstream,sizeof(unsigned char),str->bytepos,outfile) != str->bytepos)
-    {
-      fatalerror("Problem writing bitstream to file.");
-    }
-  }
   str->bytepos = 0;
+  str->bitbuf = 0;
+  str->bitrest = 64;
+  str->bitcount = 0;
 }
 
+void free_stream(stream_t *str)
+{
+  if (str->bitstream)
+    free(str->bitstream - STREAM_HEADER_BYTES);
+  str->bitstream = NULL;
+  str->bytesize = 0;
+}
 
+/* Write the frame length followed by all bits of the stream, padded to a
+   byte boundary, and empty the stream */
 void flush_all_bits(stream_t *str, FILE *outfile)
 {
   uint32_t frame_bytes;
   int i;
-  int bytes = 4 - str->bitrest/8;
-  frame_bytes = str->bytepos + bytes;
-  if (outfile)
-  {
-    uint8_t frame_bytes_buf[4];
-    for (i = 0; i < 4; i++)
-    {
-      frame_bytes_buf[i] = (uint8_t)(frame_bytes >> (24 - i*8));
-    }
-    if (fwrite(frame_bytes_buf, sizeof(frame_bytes_buf), 1, outfile) != 1)
-    {
-      fatalerror("Problem writing bitstream to file.");
-    }
-  }
+  int bytes = 8 - str->bitrest/8;
 
-  if ((str->bytepos+bytes) > str->bytesize)
-  {
-    flush_bytebuf(str,outfile);
-  }
+  if (str->bytepos + 8 > str->bytesize)
+    grow_stream(str, str->bytepos + 8);
   for (i = 0; i < bytes; i++)
   {
-    str->bitstream[str->bytepos++] = (str->bitbuf >> (24-i*8)) & 0xff;
+    str->bitstream[str->bytepos++] = (uint8_t)(str->bitbuf >> (56-i*8));
   }
-  str->bitbuf = 0;
-  str->bitrest = 32;
+  frame_bytes = str->bytepos;
 
   if (outfile)
   {
-    if (fwrite(str->bitstream,sizeof(unsigned char),str->bytepos,outfile) != str->bytepos)
+    uint8_t *frame = str->bitstream - STREAM_HEADER_BYTES;
+    for (i = 0; i < 4; i++)
+    {
+      frame[i] = (uint8_t)(frame_bytes >> (24 - i*8));
+    }
+    if (fwrite(frame,sizeof(unsigned char),STREAM_HEADER_BYTES+frame_bytes,outfile) != STREAM_HEADER_BYTES+frame_bytes)
     {
       fatalerror("Problem writing bitstream to file.");
     }
   }
-  str->bytepos = 0;
-}    
-                    
+  reset_stream(str);
+}
 
 void flush_bitbuf(stream_t *str)
 {
-  if ((str->bytepos+4) > str->bytesize)
+  uint8_t *p;
+  if (str->bytepos + 8 > str->bytesize)
   {
-    fatalerror("Run out of bits in stream buffer.");
+    grow_stream(str, max(2*str->bytesize, str->bytepos + 8));
   }
-  str->bitstream[str->bytepos++] = (str->bitbuf >> 24) & 0xff;
-  str->bitstream[str->bytepos++] = (str->bitbuf >> 16) & 0xff;
-  str->bitstream[str->bytepos++] = (str->bitbuf >> 8) & 0xff;
-  str->bitstream[str->bytepos++] = str->bitbuf & 0xff;
+  p = &str->bitstream[str->bytepos];
+  p[0] = (uint8_t)(str->bitbuf >> 56);
+  p[1] = (uint8_t)(str->bitbuf >> 48);
+  p[2] = (uint8_t)(str->bitbuf >> 40);
+  p[3] = (uint8_t)(str->bitbuf >> 32);
+  p[4] = (uint8_t)(str->bitbuf >> 24);
+  p[5] = (uint8_t)(str->bitbuf >> 16);
+  p[6] = (uint8_t)(str->bitbuf >> 8);
+  p[7] = (uint8_t)str->bitbuf;
+  str->bytepos += 8;
   str->bitbuf = 0;
-  str->bitrest = 32;
+  str->bitrest = 64;
 }
 
 void putbits(unsigned int n, unsigned int val, stream_t *str)
 {
+  uint64_t bits = val & mask[n];
   unsigned int rest;
 
-  if (n <= str->bitrest)
+  if (str->estimate)
+  {
+    str->bitcount += n;
+    return;
+  }
+  if (n == 0)
+    return;
+  if (n < str->bitrest)
   {
-    str->bitbuf |= ((val & mask[n]) << (str->bitrest-n));
+    str->bitbuf |= bits << (str->bitrest-n);
     str->bitrest -= n;
   }
   else
   {
     rest = n-str->bitrest;
-    str->bitbuf |= (val >> rest) & mask[n-rest];
+    str->bitbuf |= bits >> rest;
     flush_bitbuf(str);
-    str->bitbuf |= (val & mask[rest]) << (32-rest);
-    str->bitrest -= rest;
+    if (rest)
+    {
+      str->bitbuf = bits << (64-rest);
+      str->bitrest -= rest;
+    }
   }
 }
 
 int get_bit_pos(stream_t *str){
-  int bitpos = 8*str->bytepos + (32 - str->bitrest);
+  int bitpos = 8*str->bytepos + (64 - str->bitrest) + str->bitcount;
   return bitpos; 
 }
 
@@ -137,17 +176,53 @@ void write_stream_pos(stream_t *stream, stream_pos_t *stream_pos){
   stream->bitrest = stream_pos->bitrest;
   stream->bytepos = stream_pos->bytepos;
   stream->bitbuf = stream_pos->bitbuf;
+  stream->bitcount = stream_pos->bitcount;
 }
 
 void read_stream_pos(stream_pos_t *stream_pos, stream_t *stream){
   stream_pos->bitrest = stream->bitrest;
   stream_pos->bytepos = stream->bytepos;
   stream_pos->bitbuf = stream->bitbuf;
+  stream_pos->bitcount = stream->bitcount;
 }
 
 void copy_stream(stream_t *str1, stream_t *str2){
+  if (str2->bytepos > str1->bytesize)
+    grow_stream(str1, str2->bytepos);
   str1->bitrest = str2->bitrest;
   str1->bytepos = str2->bytepos;
   str1->bitbuf = str2->bitbuf;
+  str1->bitcount = str2->bitcount;
   memcpy(&(str1->bitstream[0]),&(str2->bitstream[0]),str2->bytepos*sizeof(uint8_t));
 }
+
+void append_stream(stream_t *dst, stream_t *src){
+  /* Append all bits written to src, including those still in bitbuf, to dst */
+  uint32_t i;
+  int rest = 64 - src->bitrest;
+  int shift = 64;
+  if (dst->bitrest%8 == 0){
+    /* Byte aligned: move the whole bytes of dst out of bitbuf and copy those of src */
+    uint32_t pending = (64 - dst->bitrest)/8;
+    uint32_t size = dst->bytepos + pending + src->bytepos + 8;
+    if (size > dst->bytesize)
+      grow_stream(dst, max(2*dst->bytesize, size));
+    for (i = 0; i < pending; i++)
+      dst->bitstream[dst->bytepos++] = (uint8_t)(dst->bitbuf >> (56-8*i));
+    dst->bitbuf = 0;
+    dst->bitrest = 64;
+    if (src->bytepos)
+      memcpy(&dst->bitstream[dst->bytepos], src->bitstream, src->bytepos);
+    dst->bytepos += src->bytepos;
+  }
+  else{
+    for (i = 0; i < src->bytepos; i++)
+      putbits(8, src->bitstream[i], dst);
+  }
+  while (rest > 0){
+    int n = min(rest, 8);
+    shift -= n;
+    putbits(n, (src->bitbuf >> shift) & mask[n], dst);
+    rest -= n;
+  }
+}
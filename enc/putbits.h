@@ -32,22 +32,34 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdio.h>
 #include <stdint.h>
 
+/* Bits are collected MSB-first in a 64-bit accumulator and written to the
+   bitstream eight bytes at a time. The bitstream grows as needed and is
+   preceded by room for the length prefix written by flush_all_bits.
+   An estimate stream has no bitstream and only counts the bits put to it,
+   which is what rate-distortion decisions need. */
 typedef struct
 {
-  uint32_t bytesize;     //Buffer size - typically maximum compressed frame size
+  uint32_t bytesize;     //Allocated size of bitstream
   uint32_t bytepos;      //Byte position in bitstream
-  uint8_t *bitstream;   //Compressed bit stream
-  uint32_t bitbuf;       //Recent bits not written the bitstream yet
+  uint8_t *bitstream;    //Compressed bit stream
+  uint64_t bitbuf;       //Recent bits not written the bitstream yet
   uint32_t bitrest;      //Empty bits in bitbuf
+  uint32_t bitcount;     //Bits put to an estimate stream
+  int estimate;          //Count bits without writing them
 } stream_t;
 
 typedef struct
 {
   uint32_t bytepos;      //Byte position in bitstream
-  uint32_t bitbuf;       //Recent bits not written the bitstream yet
+  uint64_t bitbuf;       //Recent bits not written the bitstream yet
   uint32_t bitrest;      //Empty bits in bitbuf
+  uint32_t bitcount;     //Bits put to an estimate stream
 } stream_pos_t;
 
+void init_stream(stream_t *str, uint32_t bytesize);
+void init_estimate_stream(stream_t *str);
+void reset_stream(stream_t *str);
+void free_stream(stream_t *str);
 void flush_all_bits(stream_t *str, FILE *outfile);
 void putbits(unsigned int n,unsigned int val,stream_t *str);
 void flush_bitbuf(stream_t *str);
@@ -57,5 +69,6 @@ unsigned int leading_zeros(unsigned int code);
 void write_stream_pos(stream_t *stream, stream_pos_t *stream_pos);
 void read_stream_pos(stream_pos_t *stream_pos, stream_t *stream);
 void copy_stream(stream_t *str1, stream_t *str2);
+void append_stream(stream_t *dst, stream_t *src);
 
 #endif
@@ -31,7 +31,21 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "putvlc.h"
 #include "simd.h"
 
-int put_vlc(unsigned int n,unsigned int cn,stream_t *str)
+/* Code and length of the most frequent code numbers of each VLC table,
+   filled in by init_vlc_tables(). A zero length marks an invalid code
+   number, which is left to vlc_code() to report. */
+#define VLC_TABLES 14
+#define VLC_TABLE_SIZE 64
+
+typedef struct
+{
+  uint16_t code;
+  uint16_t len;
+} vlc_entry_t;
+
+static vlc_entry_t vlc_table[VLC_TABLES][VLC_TABLE_SIZE];
+
+static unsigned int vlc_code(unsigned int n,unsigned int cn,unsigned int *codep)
 {
   unsigned int len,tmp;
   unsigned int code;
@@ -126,104 +140,44 @@ int put_vlc(unsigned int n,unsigned int cn,stream_t *str)
   default:
     fatalerror("No such VLC table, only 0-13 allowed.");
   }
+  *codep = code;
+  return len;
+}
+
+void init_vlc_tables(void)
+{
+  unsigned int n,cn,code;
+
+  for (n=0;n<VLC_TABLES;n++){
+    for (cn=0;cn<VLC_TABLE_SIZE;cn++){
+      vlc_table[n][cn].len = 0;
+      if (n == 8 && cn > 2)
+        continue;
+      vlc_table[n][cn].len = vlc_code(n,cn,&code);
+      vlc_table[n][cn].code = code;
+    }
+  }
+}
+
+int put_vlc(unsigned int n,unsigned int cn,stream_t *str)
+{
+  unsigned int len,code;
+
+  if (n < VLC_TABLES && cn < VLC_TABLE_SIZE && vlc_table[n][cn].len){
+    code = vlc_table[n][cn].code;
+    len = vlc_table[n][cn].len;
+  }
+  else
+    len = vlc_code(n,cn,&code);
   putbits(len,code,str);
   return len;
 }
 
 int quote_vlc(unsigned int n,unsigned int cn)
 {
-    unsigned int len,tmp;
-    unsigned int code;
-
-    switch (n) {
-    case 0:
-    case 1:
-    case 2:
-    case 3:
-    case 4:
-    case 5:
-      if ((int)cn < (6 * (1 << n)))
-      {
-        tmp = 1<<n;
-        code = tmp+(cn & (tmp-1));
-        len = 1+n+(cn>>n);
-      }
-      else
-      {
-        code = cn - (6 * (1 << n)) + (1 << n);
-        len = (6-n)+1+2*log2i(code);
-      }
-      break;
-    case 6:
-    case 7:
-      tmp = 1<<(n-4);
-      code = tmp+cn%tmp;
-      len = 1+(n-4)+(cn>>(n-4));
-      break;
-    case 8:
-      if (cn == 0)
-      {
-        code = 1;
-        len = 1;
-      }
-      else if (cn == 1)
-      {
-        code = 1;
-        len = 2;
-      }
-      else if (cn == 2)
-      {
-        code = 0;
-        len = 2;
-      }
-      else fatalerror("Code number too large for VLC8.");
-      break;
-    case 9:
-      if (cn == 0)
-      {
-        code = 4;
-        len = 3;
-      }
-      else if (cn == 1)
-      {
-        code = 10;
-        len = 4;
-      }
-      else if (cn == 2)
-      {
-        code = 11;
-        len = 4;
-      }
-      else if (cn < 11)
-      {
-        code = cn+21;
-        len = 5;
-      }
-      else
-      {
-        tmp = 1<<4;
-        code = tmp+(cn+5)%tmp;
-        len = 5+((cn+5)>>4);
-      }
-      break;
-    case 10:
-      code = cn+1;
-      len = 1+2*log2i(code);
-      break;
-    case 11:
-      len = cn < 2 ? cn + 1 : cn/2 + 3;
-      code = cn < 2 ? 1 : 2 + (cn&1);
-      break;
-    case 12:
-      len = min(4,cn+1);
-      code = cn==4 ? 0 : 1;
-      break;
-    case 13:
-      len = min(6,cn+1);
-      code = cn==6 ? 0 : 1;
-      break;
-    default:
-      fatalerror("No such VLC table, only 0-10 allowed.");
-    }
-    return len;
+  unsigned int code;
+
+  if (n < VLC_TABLES && cn < VLC_TABLE_SIZE && vlc_table[n][cn].len)
+    return vlc_table[n][cn].len;
+  return vlc_code(n,cn,&code);
 }
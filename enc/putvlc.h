@@ -31,6 +31,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "putbits.h"
 #include "mainenc.h"
 
+void init_vlc_tables(void);
 int put_vlc(unsigned int n,unsigned int cn,stream_t *str);
 int quote_vlc(unsigned int n,unsigned int cn);
 
@@ -336,6 +336,18 @@ enc_params *parse_config_params(int argc, char **argv)
   add_param_to_list(&list, "-snrcalc",               "1", ARG_INTEGER,  &params->snrcalc);
   add_param_to_list(&list, "-use_block_contexts",    "0", ARG_INTEGER,  &params->use_block_contexts);
   add_param_to_list(&list, "-enable_bipred",         "0", ARG_INTEGER,  &params->enable_bipred);
+  add_param_to_list(&list, "-threads",               "1", ARG_INTEGER,  &params->threads);
+  add_param_to_list(&list, "-frame_threads",         "1", ARG_INTEGER,  &params->frame_threads);
+  add_param_to_list(&list, "-tile_cols",             "1", ARG_INTEGER,  &params->tile_cols);
+  add_param_to_list(&list, "-tile_rows",             "1", ARG_INTEGER,  &params->tile_rows);
+  add_param_to_list(&list, "-segment_threads",       "1", ARG_INTEGER,  &params->segment_threads);
+  add_param_to_list(&list, "-qp_threads",            "1", ARG_INTEGER,  &params->qp_threads);
+  add_param_to_list(&list, "-me_analysis",           "0", ARG_INTEGER,  &params->me_analysis);
+  add_param_to_list(&list, "-async_io",              "1", ARG_INTEGER,  &params->async_io);
+  add_param_to_list(&list, "-filter_thread",         "1", ARG_INTEGER,  &params->filter_thread);
+  add_param_to_list(&list, "-simd",                 "-1", ARG_INTEGER,  &params->simd);
+  add_param_to_list(&list, "-satd",                  "0", ARG_INTEGER,  &params->satd);
+  add_param_to_list(&list, "-intra_rdo_modes",       "0", ARG_INTEGER,  &params->intra_rdo_modes);
 
   /* Generate "argv" and "argc" for default parameters */
   default_argc = 1;
@@ -476,4 +488,34 @@ void check_parameters(enc_params *params)
   if (params->sync && params->encoder_speed<2) {
     fatalerror("Sync requires encoder_speed=2\n");
   }
+
+  if (params->threads < 1 || params->threads > MAX_THREADS) {
+    fatalerror("Number of threads out of range.\n");
+  }
+
+  if (params->frame_threads < 1 || params->frame_threads > MAX_FRAME_JOBS) {
+    fatalerror("Number of frame threads out of range.\n");
+  }
+
+  if (params->tile_cols < 1 || params->tile_cols > MAX_TILES ||
+      params->tile_cols > (int)(params->width + MAX_BLOCK_SIZE - 1)/MAX_BLOCK_SIZE) {
+    fatalerror("Number of tile columns out of range.\n");
+  }
+
+  if (params->tile_rows < 1 || params->tile_rows > MAX_TILES ||
+      params->tile_rows > (int)(params->height + MAX_BLOCK_SIZE - 1)/MAX_BLOCK_SIZE) {
+    fatalerror("Number of tile rows out of range.\n");
+  }
+
+  if (params->segment_threads < 1 || params->segment_threads > MAX_THREADS) {
+    fatalerror("Number of segment threads out of range.\n");
+  }
+
+  if (params->segment_threads > 1 && (params->intra_period <= 0 || params->num_reorder_pics > 0)) {
+    fatalerror("Segment threads require intra_period>0 and num_reorder_pics=0.\n");
+  }
+
+  if (params->qp_threads < 1 || params->qp_threads > MAX_THREADS) {
+    fatalerror("Number of QP threads out of range.\n");
+  }
 }
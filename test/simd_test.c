@@ -0,0 +1,225 @@
+/*
+Copyright (c) 2015, Cisco Systems
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* -*- mode: c; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2; -*- */
+
+/* Check the SIMD kernels against the plain C versions on random input,
+   at every SIMD level the host supports.  Run with "make test". */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "simd.h"
+#include "global.h"
+#include "common_kernels.h"
+#include "enc_kernels.h"
+
+#define ITERATIONS 200
+
+static const char *level_names[] = { "none", "base", "sse4", "avx2" };
+static int failures = 0;
+
+/* Fixed seed, so that a failure can be reproduced */
+static uint32_t rnd_state = 1;
+
+static uint32_t rnd(void)
+{
+  rnd_state = rnd_state * 1103515245 + 12345;
+  return rnd_state >> 8;
+}
+
+static int rnd_range(int lo, int hi)
+{
+  return lo + (int)(rnd() % (uint32_t)(hi - lo + 1));
+}
+
+static void fill_u8(uint8_t *p, int n)
+{
+  /* Mix noise with flat areas, which exercise the rounding and edges */
+  int flat = rnd() & 1;
+  int base = rnd_range(0, 255);
+  for (int i = 0; i < n; i++) {
+    int v = flat ? base + rnd_range(-2, 2) : rnd_range(0, 255);
+    p[i] = clip255(v);
+  }
+}
+
+static void report(const char *kernel, int errors)
+{
+  printf("%-5s %-28s %s", level_names[simd_level], kernel, errors ? "FAILED" : "ok");
+  if (errors)
+    printf(" (%d mismatches)", errors);
+  printf("\n");
+  failures += errors;
+}
+
+static void test_sad_ssd(void)
+{
+  const int stride = 128;
+  uint8_t *a = thor_alloc(stride*64, 16);
+  uint8_t *b = thor_alloc(stride*64 + 16, 16);
+  int sad_errors = 0, ssd_errors = 0;
+
+  for (int i = 0; i < ITERATIONS; i++) {
+    fill_u8(a, stride*64);
+    fill_u8(b, stride*64 + 16);
+    for (int size = 32; size <= 64; size *= 2) {
+      uint8_t *r = b + rnd_range(0, 15);
+      sad_errors += sad_calc_non_simd(a, r, stride, stride, size, size) !=
+        enc_kernels->sad_calc(a, r, stride, stride, size, size);
+      ssd_errors += ssd_calc_non_simd(a, r, stride, stride, size, size) !=
+        enc_kernels->ssd_calc(a, r, stride, stride, size, size);
+    }
+  }
+  report("sad_calc 32x32, 64x64", sad_errors);
+  report("ssd_calc 32x32, 64x64", ssd_errors);
+  thor_free(a);
+  thor_free(b);
+}
+
+static void test_inter_prediction_luma(void)
+{
+  const int stride = 128;
+  uint8_t *ref = thor_alloc(stride*96, 16);
+  uint8_t *p0 = thor_alloc(MAX_BLOCK_SIZE*MAX_BLOCK_SIZE, 16);
+  uint8_t *p1 = thor_alloc(MAX_BLOCK_SIZE*MAX_BLOCK_SIZE, 16);
+  int errors = 0;
+
+  for (int i = 0; i < ITERATIONS; i++) {
+    fill_u8(ref, stride*96);
+    for (int size = 8; size <= MAX_BLOCK_SIZE; size *= 2) {
+      for (int frac = 1; frac < 16; frac++) {
+        int xoff = frac & 3;
+        int yoff = frac >> 2;
+        int bipred = rnd() & 1;
+        /* Leave room for the filter taps on every side */
+        const uint8_t *ip = ref + rnd_range(8, 16)*stride + rnd_range(8, 16);
+        memset(p0, 0, MAX_BLOCK_SIZE*MAX_BLOCK_SIZE);
+        memset(p1, 0, MAX_BLOCK_SIZE*MAX_BLOCK_SIZE);
+        get_inter_prediction_luma_non_simd(size, size, xoff, yoff, p0, MAX_BLOCK_SIZE, ip, stride, bipred);
+        common_kernels->get_inter_prediction_luma(size, size, xoff, yoff, p1, MAX_BLOCK_SIZE, ip, stride, bipred);
+        errors += !!memcmp(p0, p1, MAX_BLOCK_SIZE*MAX_BLOCK_SIZE);
+      }
+    }
+  }
+  report("get_inter_prediction_luma", errors);
+  thor_free(ref);
+  thor_free(p0);
+  thor_free(p1);
+}
+
+static void test_transform(void)
+{
+  int16_t *block = thor_alloc(MAX_TR_SIZE*MAX_TR_SIZE*2, 16);
+  int16_t *c0 = thor_alloc(MAX_TR_SIZE*MAX_TR_SIZE*2, 16);
+  int16_t *c1 = thor_alloc(MAX_TR_SIZE*MAX_TR_SIZE*2, 16);
+  int fwd_errors = 0, inv_errors = 0;
+
+  for (int i = 0; i < ITERATIONS; i++) {
+    for (int size = 4; size <= MAX_TR_SIZE; size *= 2) {
+      /* Only the top left MAX_QUANT_SIZE square of coefficients is kept */
+      int qsize = min(size, MAX_QUANT_SIZE);
+      int range = rnd_range(1, 255);
+      for (int fast = 0; fast < 2; fast++) {
+        for (int k = 0; k < size*size; k++)
+          block[k] = rnd_range(-range, range);
+        transform_non_simd(block, c0, size, fast);
+        common_kernels->transform(block, c1, size, fast);
+        for (int y = 0; y < qsize; y++)
+          fwd_errors += !!memcmp(c0 + y*size, c1 + y*size, qsize*2);
+      }
+
+      /* The inverse transform of size 64 is done as 32 and upsampled */
+      if (size < MAX_TR_SIZE) {
+        /* Sometimes only the top left 4x4, which has its own kernels */
+        int nz = rnd() & 1 ? 4 : qsize;
+        range = rnd_range(1, 4095);
+        memset(block, 0, size*size*2);
+        for (int y = 0; y < nz; y++)
+          for (int x = 0; x < nz; x++)
+            block[y*size + x] = rnd_range(-range, range);
+        inverse_transform_non_simd(block, c0, size);
+        common_kernels->inverse_transform(block, c1, size);
+        inv_errors += !!memcmp(c0, c1, size*size*2);
+      }
+    }
+  }
+  report("transform", fwd_errors);
+  report("inverse_transform", inv_errors);
+  thor_free(block);
+  thor_free(c0);
+  thor_free(c1);
+}
+
+static void test_clpf_block8(void)
+{
+  const int width = 2*MAX_BLOCK_SIZE;
+  const int height = 2*MAX_BLOCK_SIZE;
+  uint8_t *src = thor_alloc(width*height, 16);
+  uint8_t *d0 = thor_alloc(MAX_BLOCK_SIZE*MAX_BLOCK_SIZE, 16);
+  uint8_t *d1 = thor_alloc(MAX_BLOCK_SIZE*MAX_BLOCK_SIZE, 16);
+  int errors = 0;
+
+  for (int i = 0; i < ITERATIONS/10; i++) {
+    fill_u8(src, width*height);
+    for (int y0 = 0; y0 < height; y0 += MAX_BLOCK_SIZE) {
+      for (int x0 = 0; x0 < width; x0 += MAX_BLOCK_SIZE) {
+        memset(d0, 0, MAX_BLOCK_SIZE*MAX_BLOCK_SIZE);
+        memset(d1, 0, MAX_BLOCK_SIZE*MAX_BLOCK_SIZE);
+        for (int y = y0; y < y0 + MAX_BLOCK_SIZE; y += 8) {
+          for (int x = x0; x < x0 + MAX_BLOCK_SIZE; x += 8) {
+            clpf_block(src, d0, width, MAX_BLOCK_SIZE, x, y, 8, width, height);
+            common_kernels->clpf_block(src, d1, width, MAX_BLOCK_SIZE, x, y, 8, width, height);
+          }
+        }
+        errors += !!memcmp(d0, d1, MAX_BLOCK_SIZE*MAX_BLOCK_SIZE);
+      }
+    }
+  }
+  report("clpf_block 8x8", errors);
+  thor_free(src);
+  thor_free(d0);
+  thor_free(d1);
+}
+
+int main(void)
+{
+  for (int level = SIMD_BASE; level <= SIMD_AVX2; level++) {
+    init_use_simd(level);
+    if (simd_level != level)
+      break;
+    init_enc_kernels();
+
+    test_sad_ssd();
+    test_inter_prediction_luma();
+    test_transform();
+    test_clpf_block8();
+  }
+
+  if (failures)
+    printf("%d mismatches\n", failures);
+  return failures != 0;
+}